@@ -0,0 +1,305 @@
+/**
+ * SPDX-License-Identifier: Apache-2.0
+ * Copyright (c) Bao Project and Contributors. All rights reserved.
+ */
+
+#include <irqbench.h>
+
+#define UART_DR   (0x00)
+#define UART_FR   (0x18)
+#define UART_IMSC (0x38)
+#define UART_TXFF (1UL << 5)
+#define UART_TXIM (1UL << 5)
+
+#define PSCI_CPU_ON_SMC64 (0xc4000003UL)
+
+#define IRQ_ID_SGI    (0)
+#define IRQ_ID_VTIMER (27)
+#define IRQ_ID_UART   (33)
+/* Not assigned to any device, so the vGIC handles them in software only */
+#define IRQ_ID_BURST  (64)
+#define IRQ_ID_SPURIOUS (1023)
+
+#define GICD_CTLR       (0x0000)
+#define GICD_ISENABLER  (0x0100)
+#define GICD_ISPENDR    (0x0200)
+#define GICD_IPRIORITYR (0x0400)
+#define GICD_ITARGETSR  (0x0800)
+#define GICD_SGIR       (0x0f00)
+#define GICD_IROUTER    (0x6000)
+#define GICC_CTLR       (0x0000)
+#define GICC_PMR        (0x0004)
+#define GICC_IAR        (0x000c)
+#define GICC_EOIR       (0x0010)
+#define GICR_STRIDE     (0x20000)
+#define GICR_SGI_BASE   (0x10000)
+#define GICR_ISENABLER0 (0x0100)
+#define GICR_IPRIORITYR (0x0400)
+
+/* Interrupts are only signaled with a priority higher than the priority mask's 0xff */
+#define IRQ_PRIO (0xa0)
+
+#define CNTV_CTL_ENABLE (1UL << 0)
+
+#define PTE_BLOCK     (0x1UL)
+#define PTE_ATTR(i)   ((uint64_t)(i) << 2)
+#define PTE_SH_IS     (0x3UL << 8)
+#define PTE_AF        (1UL << 10)
+#define PTE_PXN       (1UL << 53)
+#define PTE_UXN       (1UL << 54)
+#define L1_BLOCK_SIZE (1UL << 30)
+
+/* Attribute 0 is normal write-back memory, attribute 1 is device memory */
+#define MAIR_VAL (0x00ffUL)
+/* 39-bit input and 40-bit output addresses, 4K granule, write-back inner shareable walks */
+#define TCR_VAL                                                                       \
+    ((25UL << 0) | (1UL << 8) | (1UL << 10) | (3UL << 12) | (1UL << 23) | (2UL << 32))
+#define SCTLR_M (1UL << 0)
+#define SCTLR_C (1UL << 2)
+#define SCTLR_I (1UL << 12)
+
+static uint64_t l1_table[512] __attribute__((aligned(4096)));
+
+static inline void reg_write(uintptr_t addr, uint32_t val)
+{
+    *(volatile uint32_t*)addr = val;
+}
+
+static inline uint32_t reg_read(uintptr_t addr)
+{
+    return *(volatile uint32_t*)addr;
+}
+
+/* Route the SPI to cpu 0 with the default priority and enable it */
+static void gic_spi_enable(uint32_t id)
+{
+#ifdef IRQBENCH_GICV2
+    *(volatile uint8_t*)(IRQBENCH_GICD_BASE + GICD_ITARGETSR + id) = 0x1;
+#else
+    *(volatile uint64_t*)(IRQBENCH_GICD_BASE + GICD_IROUTER + (id * 8)) = 0;
+#endif
+    *(volatile uint8_t*)(IRQBENCH_GICD_BASE + GICD_IPRIORITYR + id) = IRQ_PRIO;
+    reg_write(IRQBENCH_GICD_BASE + GICD_ISENABLER + ((id / 32) * 4), 1U << (id % 32));
+}
+
+/**
+ * Identity map the first GiB as device memory, for the uart and the gic, and the rest as normal
+ * cacheable memory, so that the guest's own code does not weigh on the measured latencies.
+ */
+void arch_init(void)
+{
+    l1_table[0] = PTE_BLOCK | PTE_ATTR(1) | PTE_AF | PTE_PXN | PTE_UXN;
+    for (size_t i = 1; i < 4; i++) {
+        l1_table[i] = (i * L1_BLOCK_SIZE) | PTE_BLOCK | PTE_ATTR(0) | PTE_SH_IS | PTE_AF;
+    }
+
+#ifdef IRQBENCH_GICV2
+    reg_write(IRQBENCH_GICD_BASE + GICD_CTLR, 0x1);
+#else
+    /* Affinity routing and group 1 enable */
+    reg_write(IRQBENCH_GICD_BASE + GICD_CTLR, (1U << 4) | (1U << 1));
+#endif
+    gic_spi_enable(IRQ_ID_UART);
+    for (size_t i = 0; i < IRQBENCH_BURST_MAX; i++) {
+        gic_spi_enable(IRQ_ID_BURST + i);
+    }
+}
+
+void arch_cpu_init(size_t cpu_id)
+{
+    uint64_t sctlr;
+
+    asm volatile("msr mair_el1, %0\n\t"
+                 "msr tcr_el1, %1\n\t"
+                 "msr ttbr0_el1, %2\n\t"
+                 "dsb ish\n\t"
+                 "tlbi vmalle1\n\t"
+                 "dsb ish\n\t"
+                 "isb\n\t" ::"r"(MAIR_VAL),
+                 "r"(TCR_VAL), "r"(l1_table)
+                 : "memory");
+
+    asm volatile("mrs %0, sctlr_el1" : "=r"(sctlr));
+    sctlr |= SCTLR_M | SCTLR_C | SCTLR_I;
+    asm volatile("msr sctlr_el1, %0\n\t"
+                 "isb\n\t" ::"r"(sctlr)
+                 : "memory");
+
+#ifdef IRQBENCH_GICV2
+    *(volatile uint8_t*)(IRQBENCH_GICD_BASE + GICD_IPRIORITYR + IRQ_ID_SGI) = IRQ_PRIO;
+    *(volatile uint8_t*)(IRQBENCH_GICD_BASE + GICD_IPRIORITYR + IRQ_ID_VTIMER) = IRQ_PRIO;
+    reg_write(IRQBENCH_GICD_BASE + GICD_ISENABLER, (1U << IRQ_ID_SGI) | (1U << IRQ_ID_VTIMER));
+    reg_write(IRQBENCH_GICC_BASE + GICC_PMR, 0xff);
+    reg_write(IRQBENCH_GICC_BASE + GICC_CTLR, 0x1);
+#else
+    uintptr_t sgi_base = IRQBENCH_GICR_BASE + (cpu_id * GICR_STRIDE) + GICR_SGI_BASE;
+    *(volatile uint8_t*)(sgi_base + GICR_IPRIORITYR + IRQ_ID_SGI) = IRQ_PRIO;
+    *(volatile uint8_t*)(sgi_base + GICR_IPRIORITYR + IRQ_ID_VTIMER) = IRQ_PRIO;
+    reg_write(sgi_base + GICR_ISENABLER0, (1U << IRQ_ID_SGI) | (1U << IRQ_ID_VTIMER));
+    asm volatile("msr icc_sre_el1, %0\n\t"
+                 "isb\n\t"
+                 "msr icc_pmr_el1, %1\n\t"
+                 "msr icc_igrpen1_el1, %2\n\t"
+                 "isb\n\t" ::"r"(0x7UL),
+                 "r"(0xffUL), "r"(0x1UL));
+#endif
+}
+
+size_t arch_cpu_id(void)
+{
+    uint64_t mpidr;
+    asm volatile("mrs %0, mpidr_el1" : "=r"(mpidr));
+    return mpidr & 0xff;
+}
+
+extern uint8_t _start[];
+
+void arch_cpu_on(size_t cpu_id)
+{
+    register unsigned long x0 asm("x0") = PSCI_CPU_ON_SMC64;
+    register unsigned long x1 asm("x1") = cpu_id;
+    register unsigned long x2 asm("x2") = (unsigned long)_start;
+    register unsigned long x3 asm("x3") = 0;
+
+    asm volatile("hvc #0" : "+r"(x0) : "r"(x1), "r"(x2), "r"(x3) : "memory");
+}
+
+void arch_irq_enable(void)
+{
+    asm volatile("msr daifclr, #2" ::: "memory");
+}
+
+void arch_irq_disable(void)
+{
+    asm volatile("msr daifset, #2" ::: "memory");
+}
+
+uint64_t arch_timer_read(void)
+{
+    uint64_t cnt;
+    asm volatile("isb\n\t"
+                 "mrs %0, cntvct_el0"
+                 : "=r"(cnt));
+    return cnt;
+}
+
+uint64_t arch_timer_freq(void)
+{
+    uint64_t freq;
+    asm volatile("mrs %0, cntfrq_el0" : "=r"(freq));
+    return freq;
+}
+
+void arch_timer_arm(uint64_t deadline)
+{
+    asm volatile("msr cntv_cval_el0, %0\n\t"
+                 "msr cntv_ctl_el0, %1\n\t"
+                 "isb\n\t" ::"r"(deadline),
+                 "r"(CNTV_CTL_ENABLE));
+}
+
+void arch_timer_disarm(void)
+{
+    asm volatile("msr cntv_ctl_el0, %0\n\t"
+                 "isb\n\t" ::"r"(0UL));
+}
+
+void arch_ipi_send(size_t cpu_id)
+{
+    asm volatile("dsb ish" ::: "memory");
+#ifdef IRQBENCH_GICV2
+    reg_write(IRQBENCH_GICD_BASE + GICD_SGIR, (1U << (16 + cpu_id)) | IRQ_ID_SGI);
+#else
+    uint64_t sgi1r = (1UL << cpu_id) | ((uint64_t)IRQ_ID_SGI << 24);
+    asm volatile("msr icc_sgi1r_el1, %0\n\t"
+                 "isb\n\t" ::"r"(sgi1r));
+#endif
+}
+
+/**
+ * The uart's transmit interrupt stays asserted while its fifo is empty, so it fires as soon as it
+ * is unmasked.
+ */
+void arch_dev_irq_trigger(void)
+{
+    reg_write(IRQBENCH_UART_BASE + UART_IMSC, UART_TXIM);
+}
+
+void arch_dev_irq_mask(void)
+{
+    reg_write(IRQBENCH_UART_BASE + UART_IMSC, 0);
+}
+
+size_t arch_burst_trigger(size_t num)
+{
+    uint32_t pend[(IRQBENCH_BURST_MAX / 32) + 2] = { 0 };
+
+    if (num > IRQBENCH_BURST_MAX) {
+        num = IRQBENCH_BURST_MAX;
+    }
+
+    for (size_t i = 0; i < num; i++) {
+        pend[(IRQ_ID_BURST + i) / 32 - (IRQ_ID_BURST / 32)] |= 1U << ((IRQ_ID_BURST + i) % 32);
+    }
+
+    for (size_t r = 0; r < (sizeof(pend) / sizeof(pend[0])); r++) {
+        if (pend[r] != 0) {
+            reg_write(IRQBENCH_GICD_BASE + GICD_ISPENDR + (((IRQ_ID_BURST / 32) + r) * 4), pend[r]);
+        }
+    }
+
+    return num;
+}
+
+static inline uint32_t gic_ack(void)
+{
+#ifdef IRQBENCH_GICV2
+    return reg_read(IRQBENCH_GICC_BASE + GICC_IAR);
+#else
+    uint64_t iar;
+    asm volatile("mrs %0, icc_iar1_el1" : "=r"(iar));
+    return (uint32_t)iar;
+#endif
+}
+
+static inline void gic_eoi(uint32_t iar)
+{
+#ifdef IRQBENCH_GICV2
+    reg_write(IRQBENCH_GICC_BASE + GICC_EOIR, iar);
+#else
+    asm volatile("msr icc_eoir1_el1, %0\n\t"
+                 "isb\n\t" ::"r"((uint64_t)iar));
+#endif
+}
+
+void arch_irq_handler(void)
+{
+    uint64_t now = arch_timer_read();
+    uint32_t iar = gic_ack();
+    uint32_t id = iar & 0x3ff;
+
+    if (id == IRQ_ID_SPURIOUS) {
+        return;
+    }
+
+    if (id == IRQ_ID_VTIMER) {
+        irqbench_handle(IRQ_TIMER, now);
+    } else if (id == IRQ_ID_UART) {
+        irqbench_handle(IRQ_DEVICE, now);
+    } else if (id == IRQ_ID_SGI) {
+        irqbench_handle(IRQ_IPI, now);
+    } else if ((id >= IRQ_ID_BURST) && (id < (IRQ_ID_BURST + IRQBENCH_BURST_MAX))) {
+        irqbench_handle(IRQ_BURST, now);
+    }
+
+    gic_eoi(iar);
+}
+
+void arch_putc(char c)
+{
+    if (c == '\n') {
+        arch_putc('\r');
+    }
+    while (reg_read(IRQBENCH_UART_BASE + UART_FR) & UART_TXFF) { }
+    reg_write(IRQBENCH_UART_BASE + UART_DR, (uint32_t)c);
+}
@@ -0,0 +1,241 @@
+/**
+ * SPDX-License-Identifier: Apache-2.0
+ * Copyright (c) Bao Project and Contributors. All rights reserved.
+ */
+
+#include <irqbench.h>
+
+#define UART_THR  (0x0)
+#define UART_IER  (0x1)
+#define UART_LSR  (0x5)
+#define UART_THRE (1U << 5)
+#define UART_ETBEI (1U << 1)
+
+#define IRQ_ID_UART (10)
+
+#define SBI_EXTID_TIME (0x54494D45UL)
+#define SBI_EXTID_IPI  (0x735049UL)
+#define SBI_EXTID_HSM  (0x48534DUL)
+
+#define SCAUSE_INT_BIT (1UL << 63)
+#define SCAUSE_SSI     (1)
+#define SCAUSE_STI     (5)
+#define SCAUSE_SEI     (9)
+#define SIE_SSIE       (1UL << SCAUSE_SSI)
+#define SIE_STIE       (1UL << SCAUSE_STI)
+#define SIE_SEIE       (1UL << SCAUSE_SEI)
+#define SSTATUS_SIE    (1UL << 1)
+
+#ifdef IRQBENCH_APLIC
+#define APLIC_DOMAINCFG      (0x0000)
+#define APLIC_DOMAINCFG_IE   (1U << 8)
+#define APLIC_SOURCECFG(id)  (0x0004 + (((id)-1) * 4))
+#define APLIC_SM_LEVEL_HIGH  (6)
+#define APLIC_SETIENUM       (0x1edc)
+#define APLIC_TARGET(id)     (0x3004 + (((id)-1) * 4))
+#define APLIC_TARGET_HART_OFF (18)
+#define APLIC_IDC(hart)      (0x4000 + ((hart) * 32))
+#define APLIC_IDC_IDELIVERY  (0x00)
+#define APLIC_IDC_ITHRESHOLD (0x08)
+#define APLIC_IDC_CLAIMI     (0x1c)
+#define APLIC_CLAIMI_ID_OFF  (16)
+#else
+#define PLIC_PRIO(id)        ((id) * 4)
+#define PLIC_ENBL(cntxt)     (0x2000 + ((cntxt) * 0x80))
+#define PLIC_THRESHOLD(cntxt) (0x200000 + ((cntxt) * 0x1000))
+#define PLIC_CLAIM(cntxt)    (PLIC_THRESHOLD(cntxt) + 4)
+/* Supervisor context of a hart */
+#define PLIC_CNTXT(hart)     (((hart) * 2) + 1)
+#endif
+
+#ifndef IRQBENCH_TIMER_FREQ
+#define IRQBENCH_TIMER_FREQ (10000000UL)
+#endif
+
+static inline void reg_write(uintptr_t addr, uint32_t val)
+{
+    *(volatile uint32_t*)addr = val;
+}
+
+static inline uint32_t reg_read(uintptr_t addr)
+{
+    return *(volatile uint32_t*)addr;
+}
+
+static long sbi_ecall(unsigned long ext, unsigned long fid, unsigned long arg0,
+    unsigned long arg1, unsigned long arg2)
+{
+    register unsigned long a0 asm("a0") = arg0;
+    register unsigned long a1 asm("a1") = arg1;
+    register unsigned long a2 asm("a2") = arg2;
+    register unsigned long a6 asm("a6") = fid;
+    register unsigned long a7 asm("a7") = ext;
+
+    asm volatile("ecall" : "+r"(a0), "+r"(a1) : "r"(a2), "r"(a6), "r"(a7) : "memory");
+
+    return (long)a0;
+}
+
+/**
+ * The guest runs with address translation disabled, all its memory accesses being cacheable as
+ * defined by the platform's physical memory attributes. Only the uart interrupt is used, routed
+ * to hart 0.
+ */
+void arch_init(void)
+{
+#ifdef IRQBENCH_APLIC
+    reg_write(IRQBENCH_IRQC_BASE + APLIC_SOURCECFG(IRQ_ID_UART), APLIC_SM_LEVEL_HIGH);
+    reg_write(IRQBENCH_IRQC_BASE + APLIC_TARGET(IRQ_ID_UART), (0U << APLIC_TARGET_HART_OFF) | 1);
+    reg_write(IRQBENCH_IRQC_BASE + APLIC_SETIENUM, IRQ_ID_UART);
+    reg_write(IRQBENCH_IRQC_BASE + APLIC_DOMAINCFG, APLIC_DOMAINCFG_IE);
+#else
+    reg_write(IRQBENCH_IRQC_BASE + PLIC_PRIO(IRQ_ID_UART), 1);
+    reg_write(IRQBENCH_IRQC_BASE + PLIC_ENBL(PLIC_CNTXT(0)) + ((IRQ_ID_UART / 32) * 4),
+        1U << (IRQ_ID_UART % 32));
+#endif
+}
+
+void arch_cpu_init(size_t cpu_id)
+{
+#ifdef IRQBENCH_APLIC
+    reg_write(IRQBENCH_IRQC_BASE + APLIC_IDC(cpu_id) + APLIC_IDC_ITHRESHOLD, 0);
+    reg_write(IRQBENCH_IRQC_BASE + APLIC_IDC(cpu_id) + APLIC_IDC_IDELIVERY, 1);
+#else
+    reg_write(IRQBENCH_IRQC_BASE + PLIC_THRESHOLD(PLIC_CNTXT(cpu_id)), 0);
+#endif
+    asm volatile("csrs sie, %0" ::"r"(SIE_SSIE | SIE_STIE | SIE_SEIE));
+}
+
+size_t arch_cpu_id(void)
+{
+    size_t hart_id;
+    asm volatile("mv %0, tp" : "=r"(hart_id));
+    return hart_id;
+}
+
+extern uint8_t _start[];
+
+void arch_cpu_on(size_t cpu_id)
+{
+    sbi_ecall(SBI_EXTID_HSM, 0, cpu_id, (unsigned long)_start, 0);
+}
+
+void arch_irq_enable(void)
+{
+    asm volatile("csrs sstatus, %0" ::"r"(SSTATUS_SIE) : "memory");
+}
+
+void arch_irq_disable(void)
+{
+    asm volatile("csrc sstatus, %0" ::"r"(SSTATUS_SIE) : "memory");
+}
+
+uint64_t arch_timer_read(void)
+{
+    uint64_t time;
+    asm volatile("rdtime %0" : "=r"(time));
+    return time;
+}
+
+uint64_t arch_timer_freq(void)
+{
+    return IRQBENCH_TIMER_FREQ;
+}
+
+void arch_timer_arm(uint64_t deadline)
+{
+    sbi_ecall(SBI_EXTID_TIME, 0, deadline, 0, 0);
+}
+
+void arch_timer_disarm(void)
+{
+    sbi_ecall(SBI_EXTID_TIME, 0, ~0UL, 0, 0);
+}
+
+void arch_ipi_send(size_t cpu_id)
+{
+    asm volatile("fence rw, rw" ::: "memory");
+    sbi_ecall(SBI_EXTID_IPI, 0, 1UL << cpu_id, 0, 0);
+}
+
+/**
+ * The uart's transmitter holding register empty interrupt is raised as soon as it is enabled
+ * while the uart is idle.
+ */
+void arch_dev_irq_trigger(void)
+{
+    *(volatile uint8_t*)(IRQBENCH_UART_BASE + UART_IER) = UART_ETBEI;
+}
+
+void arch_dev_irq_mask(void)
+{
+    *(volatile uint8_t*)(IRQBENCH_UART_BASE + UART_IER) = 0;
+}
+
+/**
+ * Neither the PLIC nor the APLIC in direct mode let the guest set an interrupt pending, and there
+ * are no list registers to spill anyway.
+ */
+size_t arch_burst_trigger(size_t num)
+{
+    return 0;
+}
+
+static void irqc_handle(uint64_t now)
+{
+    uint32_t id;
+
+#ifdef IRQBENCH_APLIC
+    uintptr_t claimi = IRQBENCH_IRQC_BASE + APLIC_IDC(arch_cpu_id()) + APLIC_IDC_CLAIMI;
+    while ((id = (reg_read(claimi) >> APLIC_CLAIMI_ID_OFF)) != 0) {
+        if (id == IRQ_ID_UART) {
+            irqbench_handle(IRQ_DEVICE, now);
+        }
+    }
+#else
+    uintptr_t claim = IRQBENCH_IRQC_BASE + PLIC_CLAIM(PLIC_CNTXT(arch_cpu_id()));
+    while ((id = reg_read(claim)) != 0) {
+        if (id == IRQ_ID_UART) {
+            irqbench_handle(IRQ_DEVICE, now);
+        }
+        reg_write(claim, id);
+    }
+#endif
+}
+
+void arch_irq_handler(void)
+{
+    uint64_t now = arch_timer_read();
+    unsigned long scause;
+
+    asm volatile("csrr %0, scause" : "=r"(scause));
+    if (!(scause & SCAUSE_INT_BIT)) {
+        while (true) { }
+    }
+
+    switch (scause & ~SCAUSE_INT_BIT) {
+        case SCAUSE_STI:
+            irqbench_handle(IRQ_TIMER, now);
+            break;
+        case SCAUSE_SSI:
+            asm volatile("csrc sip, %0" ::"r"(SIE_SSIE));
+            irqbench_handle(IRQ_IPI, now);
+            break;
+        case SCAUSE_SEI:
+            irqc_handle(now);
+            break;
+        default:
+            break;
+    }
+}
+
+void arch_putc(char c)
+{
+    volatile uint8_t* uart = (volatile uint8_t*)IRQBENCH_UART_BASE;
+
+    if (c == '\n') {
+        arch_putc('\r');
+    }
+    while (!(uart[UART_LSR] & UART_THRE)) { }
+    uart[UART_THR] = (uint8_t)c;
+}
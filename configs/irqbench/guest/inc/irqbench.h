@@ -0,0 +1,50 @@
+/**
+ * SPDX-License-Identifier: Apache-2.0
+ * Copyright (c) Bao Project and Contributors. All rights reserved.
+ */
+
+#ifndef __IRQBENCH_H__
+#define __IRQBENCH_H__
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#define IRQBENCH_CPUS      (2)
+#define IRQBENCH_BURST_MAX (32)
+
+/* Interrupt sources, as seen by the guest's handler */
+enum irqbench_irq {
+    /* The cpu's timer deadline expired */
+    IRQ_TIMER,
+    /* The uart's transmit interrupt, a hardware interrupt passed through to the VM */
+    IRQ_DEVICE,
+    /* An IPI sent by the other cpu */
+    IRQ_IPI,
+    /* One of the software triggered interrupts of the burst test */
+    IRQ_BURST,
+};
+
+/* Called by the architecture's interrupt handler, with the time read on entry */
+void irqbench_handle(enum irqbench_irq irq, uint64_t now);
+
+/* Implemented for each architecture */
+
+void arch_init(void);
+void arch_cpu_init(size_t cpu_id);
+size_t arch_cpu_id(void);
+void arch_cpu_on(size_t cpu_id);
+void arch_irq_enable(void);
+void arch_irq_disable(void);
+uint64_t arch_timer_read(void);
+uint64_t arch_timer_freq(void);
+void arch_timer_arm(uint64_t deadline);
+void arch_timer_disarm(void);
+void arch_ipi_send(size_t cpu_id);
+void arch_dev_irq_trigger(void);
+void arch_dev_irq_mask(void);
+/* Set num interrupts pending at once, returns how many were, 0 if not supported */
+size_t arch_burst_trigger(size_t num);
+void arch_putc(char c);
+
+#endif /* __IRQBENCH_H__ */
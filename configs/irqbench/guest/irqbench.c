@@ -0,0 +1,251 @@
+/**
+ * SPDX-License-Identifier: Apache-2.0
+ * Copyright (c) Bao Project and Contributors. All rights reserved.
+ */
+
+/**
+ * Virtual interrupt latency benchmark. A VM with two vcpus runs this guest. Cpu 0 triggers each
+ * kind of interrupt IRQBENCH_SAMPLES times, one every IRQBENCH_PERIOD_US, and timestamps its
+ * handler against the trigger. Cpu 1 only answers the IPIs of cpu 0. Once done, cpu 0 prints a
+ * summary and a histogram of the latencies of each test:
+ *
+ *  - timer: from the timer deadline to the handler;
+ *  - device: from unmasking the uart's transmit interrupt, which is already asserted, to the
+ *    handler. This is the path of a hardware interrupt through the hypervisor;
+ *  - ipi: round trip of an IPI to cpu 1 and its answer back;
+ *  - burst: from unmasking interrupts at the cpu with IRQBENCH_BURST interrupts pending to the
+ *    handler of the last one. With more pending interrupts than list registers, this measures
+ *    the spilling and refilling of the vGIC's list registers.
+ */
+
+#include <irqbench.h>
+
+#ifndef IRQBENCH_SAMPLES
+#define IRQBENCH_SAMPLES (10000)
+#endif
+
+#ifndef IRQBENCH_PERIOD_US
+#define IRQBENCH_PERIOD_US (1000)
+#endif
+
+#ifndef IRQBENCH_BURST
+#define IRQBENCH_BURST (16)
+#endif
+
+/* Bucket i counts the latencies in [2^(i + 6), 2^(i + 7)) ns, the first and last are open */
+#define HIST_BUCKETS (16)
+#define HIST_SHIFT   (6)
+
+enum irqbench_test { TEST_TIMER, TEST_DEVICE, TEST_IPI, TEST_BURST, TEST_NUM };
+
+static const char* const test_names[] = { "timer", "device", "ipi", "burst" };
+
+struct hist {
+    uint64_t samples;
+    uint64_t total;
+    uint64_t min;
+    uint64_t max;
+    uint64_t buckets[HIST_BUCKETS];
+};
+
+static struct hist hists[TEST_NUM];
+static uint64_t freq;
+static volatile uint64_t trigger_ts;
+static volatile uint64_t handler_ts;
+static volatile bool fired;
+static volatile size_t burst_left;
+static volatile bool cpu1_ready;
+
+static void print_str(const char* str)
+{
+    while (*str != '\0') {
+        arch_putc(*str++);
+    }
+}
+
+static void print_u64(uint64_t val)
+{
+    char buf[21];
+    size_t i = sizeof(buf) - 1;
+
+    buf[i] = '\0';
+    do {
+        buf[--i] = (char)('0' + (val % 10));
+        val /= 10;
+    } while (val != 0);
+
+    print_str(&buf[i]);
+}
+
+static uint64_t ticks_to_ns(uint64_t ticks)
+{
+    return ((ticks / freq) * 1000000000ULL) + (((ticks % freq) * 1000000000ULL) / freq);
+}
+
+static void record(enum irqbench_test test, uint64_t ticks)
+{
+    struct hist* hist = &hists[test];
+    uint64_t ns = ticks_to_ns(ticks);
+    size_t bucket = 0;
+
+    while ((bucket < (HIST_BUCKETS - 1)) && (ns >= (1ULL << (bucket + HIST_SHIFT + 1)))) {
+        bucket++;
+    }
+
+    hist->buckets[bucket]++;
+    hist->total += ns;
+    if ((hist->samples == 0) || (ns < hist->min)) {
+        hist->min = ns;
+    }
+    if (ns > hist->max) {
+        hist->max = ns;
+    }
+    hist->samples++;
+}
+
+void irqbench_handle(enum irqbench_irq irq, uint64_t now)
+{
+    if (arch_cpu_id() != 0) {
+        if (irq == IRQ_IPI) {
+            arch_ipi_send(0);
+        }
+        return;
+    }
+
+    switch (irq) {
+        case IRQ_TIMER:
+            arch_timer_disarm();
+            break;
+        case IRQ_DEVICE:
+            arch_dev_irq_mask();
+            break;
+        case IRQ_BURST:
+            if (--burst_left != 0) {
+                return;
+            }
+            break;
+        default:
+            break;
+    }
+
+    handler_ts = now;
+    fired = true;
+}
+
+static void wait_until(uint64_t deadline)
+{
+    while (arch_timer_read() < deadline) { }
+}
+
+static void wait_fired(void)
+{
+    while (!fired) { }
+    fired = false;
+}
+
+static void run(enum irqbench_test test)
+{
+    uint64_t period = (freq * IRQBENCH_PERIOD_US) / 1000000;
+    uint64_t next = arch_timer_read() + period;
+
+    for (size_t i = 0; i < IRQBENCH_SAMPLES; i++) {
+        switch (test) {
+            case TEST_TIMER:
+                trigger_ts = next;
+                arch_timer_arm(next);
+                break;
+            case TEST_DEVICE:
+                wait_until(next);
+                trigger_ts = arch_timer_read();
+                arch_dev_irq_trigger();
+                break;
+            case TEST_IPI:
+                wait_until(next);
+                trigger_ts = arch_timer_read();
+                arch_ipi_send(1);
+                break;
+            default:
+                wait_until(next);
+                arch_irq_disable();
+                burst_left = arch_burst_trigger(IRQBENCH_BURST);
+                if (burst_left == 0) {
+                    arch_irq_enable();
+                    return;
+                }
+                trigger_ts = arch_timer_read();
+                arch_irq_enable();
+                break;
+        }
+
+        wait_fired();
+        record(test, handler_ts - trigger_ts);
+        next += period;
+    }
+}
+
+static void report(void)
+{
+    print_str("irqbench,test,samples,min_ns,avg_ns,max_ns\n");
+    for (size_t t = 0; t < TEST_NUM; t++) {
+        struct hist* hist = &hists[t];
+        print_str("irqbench,");
+        print_str(test_names[t]);
+        print_str(",");
+        print_u64(hist->samples);
+        print_str(",");
+        print_u64(hist->min);
+        print_str(",");
+        print_u64((hist->samples != 0) ? (hist->total / hist->samples) : 0);
+        print_str(",");
+        print_u64(hist->max);
+        print_str("\n");
+    }
+
+    print_str("irqbench_hist,test,from_ns,to_ns,count\n");
+    for (size_t t = 0; t < TEST_NUM; t++) {
+        for (size_t b = 0; (hists[t].samples != 0) && (b < HIST_BUCKETS); b++) {
+            print_str("irqbench_hist,");
+            print_str(test_names[t]);
+            print_str(",");
+            print_u64((b == 0) ? 0 : (1ULL << (b + HIST_SHIFT)));
+            print_str(",");
+            if (b == (HIST_BUCKETS - 1)) {
+                print_str("inf");
+            } else {
+                print_u64(1ULL << (b + HIST_SHIFT + 1));
+            }
+            print_str(",");
+            print_u64(hists[t].buckets[b]);
+            print_str("\n");
+        }
+    }
+    print_str("irqbench,done\n");
+}
+
+void main(void)
+{
+    size_t cpu_id = arch_cpu_id();
+
+    if (cpu_id == 0) {
+        arch_init();
+    }
+    arch_cpu_init(cpu_id);
+    arch_irq_enable();
+
+    if (cpu_id != 0) {
+        cpu1_ready = true;
+        while (true) { }
+    }
+
+    freq = arch_timer_freq();
+    print_str("irqbench: starting\n");
+
+    arch_cpu_on(1);
+    while (!cpu1_ready) { }
+
+    for (size_t t = 0; t < TEST_NUM; t++) {
+        run(t);
+    }
+
+    report();
+}
@@ -0,0 +1,81 @@
+/**
+ * SPDX-License-Identifier: Apache-2.0
+ * Copyright (c) Bao Project and Contributors. All rights reserved.
+ */
+
+/**
+ * Virtual interrupt latency benchmark: a single VM with two vcpus running the irqbench guest found
+ * in configs/irqbench/guest, which owns the uart and its interrupt, used as the hardware interrupt
+ * source, and the virtual timer interrupt.
+ *
+ * Build with CONFIG=irqbench/qemu-aarch64-virt after building the guest with ARCH=aarch64 and the
+ * same GIC_VERSION as the hypervisor, e.g. for GICv2:
+ *
+ *   make -C configs/irqbench/guest ARCH=aarch64 GIC_VERSION=GICV2
+ *   make PLATFORM=qemu-aarch64-virt CONFIG=irqbench/qemu-aarch64-virt GIC_VERSION=GICV2
+ *
+ * and run qemu with the matching gic-version. The guest prints its results as csv lines prefixed
+ * by irqbench and irqbench_hist.
+ */
+
+#include <config.h>
+
+#ifndef IRQBENCH_IMAGE
+#define IRQBENCH_IMAGE "configs/irqbench/guest/build/aarch64/irqbench.bin"
+#endif
+
+#define IRQBENCH_MEM_BASE (0x40000000)
+#define IRQBENCH_MEM_SIZE (0x1000000)
+
+VM_IMAGE(irqbench, IRQBENCH_IMAGE);
+
+struct config config = {
+
+    CONFIG_HEADER
+
+    .vmlist_size = 1,
+    .vmlist = {
+        {
+            .image = VM_IMAGE_BUILTIN(irqbench, IRQBENCH_MEM_BASE),
+            .entry = IRQBENCH_MEM_BASE,
+            .cpu_affinity = 0x3,
+
+            .platform = {
+                .cpu_num = 2,
+
+                .region_num = 1,
+                .regions = (struct vm_mem_region[]) {
+                    {
+                        .base = IRQBENCH_MEM_BASE,
+                        .size = IRQBENCH_MEM_SIZE,
+                    },
+                },
+
+                .dev_num = 2,
+                .devs = (struct vm_dev_region[]) {
+                    {
+                        /* PL011 */
+                        .pa = 0x9000000,
+                        .va = 0x9000000,
+                        .size = 0x10000,
+                        .interrupt_num = 1,
+                        .interrupts = (irqid_t[]) {33},
+                    },
+                    {
+                        /* Virtual timer */
+                        .interrupt_num = 1,
+                        .interrupts = (irqid_t[]) {27},
+                    },
+                },
+
+                .arch = {
+                    .gic = {
+                        .gicd_addr = 0x08000000,
+                        .gicc_addr = 0x08010000,
+                        .gicr_addr = 0x080A0000,
+                    },
+                },
+            },
+        },
+    },
+};
@@ -0,0 +1,76 @@
+/**
+ * SPDX-License-Identifier: Apache-2.0
+ * Copyright (c) Bao Project and Contributors. All rights reserved.
+ */
+
+/**
+ * Virtual interrupt latency benchmark: a single VM with two vcpus running the irqbench guest found
+ * in configs/irqbench/guest, which owns the uart and its interrupt, used as the hardware interrupt
+ * source.
+ *
+ * Build with CONFIG=irqbench/qemu-riscv64-virt after building the guest with ARCH=riscv64 and the
+ * same IRQC as the hypervisor, e.g. for the AIA:
+ *
+ *   make -C configs/irqbench/guest ARCH=riscv64 IRQC=APLIC
+ *   make PLATFORM=qemu-riscv64-virt CONFIG=irqbench/qemu-riscv64-virt IRQC=APLIC
+ *
+ * and run qemu with aia=aplic. The guest prints its results as csv lines prefixed by irqbench and
+ * irqbench_hist.
+ */
+
+#include <config.h>
+
+#ifndef IRQBENCH_IMAGE
+#define IRQBENCH_IMAGE "configs/irqbench/guest/build/riscv64/irqbench.bin"
+#endif
+
+#define IRQBENCH_MEM_BASE (0x80000000)
+#define IRQBENCH_MEM_SIZE (0x1000000)
+
+VM_IMAGE(irqbench, IRQBENCH_IMAGE);
+
+struct config config = {
+
+    CONFIG_HEADER
+
+    .vmlist_size = 1,
+    .vmlist = {
+        {
+            .image = VM_IMAGE_BUILTIN(irqbench, IRQBENCH_MEM_BASE),
+            .entry = IRQBENCH_MEM_BASE,
+            .cpu_affinity = 0x3,
+
+            .platform = {
+                .cpu_num = 2,
+
+                .region_num = 1,
+                .regions = (struct vm_mem_region[]) {
+                    {
+                        .base = IRQBENCH_MEM_BASE,
+                        .size = IRQBENCH_MEM_SIZE,
+                    },
+                },
+
+                .dev_num = 1,
+                .devs = (struct vm_dev_region[]) {
+                    {
+                        /* NS16550 */
+                        .pa = 0x10000000,
+                        .va = 0x10000000,
+                        .size = 0x1000,
+                        .interrupt_num = 1,
+                        .interrupts = (irqid_t[]) {10},
+                    },
+                },
+
+                .arch = {
+#if (IRQC == PLIC)
+                    .irqc.plic.base = 0xc000000,
+#else
+                    .irqc.aia.aplic.base = 0xd000000,
+#endif
+                },
+            },
+        },
+    },
+};
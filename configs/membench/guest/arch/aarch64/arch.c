@@ -0,0 +1,100 @@
+/**
+ * SPDX-License-Identifier: Apache-2.0
+ * Copyright (c) Bao Project and Contributors. All rights reserved.
+ */
+
+#include <membench.h>
+
+#define UART_DR    (0x00)
+#define UART_FR    (0x18)
+#define UART_TXFF  (1UL << 5)
+
+#define SMCC64_FID_VND_HYP_SRVC (0xc6000000UL)
+
+#define PTE_BLOCK    (0x1UL)
+#define PTE_ATTR(i)  ((uint64_t)(i) << 2)
+#define PTE_SH_IS    (0x3UL << 8)
+#define PTE_AF       (1UL << 10)
+#define PTE_PXN      (1UL << 53)
+#define PTE_UXN      (1UL << 54)
+#define L1_BLOCK_SIZE (1UL << 30)
+
+/* Attribute 0 is normal write-back memory, attribute 1 is device memory */
+#define MAIR_VAL     (0x00ffUL)
+/* 39-bit input and 40-bit output addresses, 4K granule, write-back inner shareable walks */
+#define TCR_VAL      ((25UL << 0) | (1UL << 8) | (1UL << 10) | (3UL << 12) | (1UL << 23) | \
+                      (2UL << 32))
+#define SCTLR_M      (1UL << 0)
+#define SCTLR_C      (1UL << 2)
+#define SCTLR_I      (1UL << 12)
+
+static uint64_t l1_table[512] __attribute__((aligned(4096)));
+
+/**
+ * Without the MMU enabled all data accesses are to device memory and bypass the caches, which
+ * would make the benchmark meaningless. Identity map the first GiB as device memory, for the uart
+ * and the gic, and the rest as normal cacheable memory.
+ */
+void arch_init(void)
+{
+    uint64_t sctlr;
+
+    l1_table[0] = PTE_BLOCK | PTE_ATTR(1) | PTE_AF | PTE_PXN | PTE_UXN;
+    for (size_t i = 1; i < 4; i++) {
+        l1_table[i] = (i * L1_BLOCK_SIZE) | PTE_BLOCK | PTE_ATTR(0) | PTE_SH_IS | PTE_AF;
+    }
+
+    asm volatile("msr mair_el1, %0\n\t"
+                 "msr tcr_el1, %1\n\t"
+                 "msr ttbr0_el1, %2\n\t"
+                 "dsb ish\n\t"
+                 "tlbi vmalle1\n\t"
+                 "dsb ish\n\t"
+                 "isb\n\t" ::"r"(MAIR_VAL),
+                 "r"(TCR_VAL), "r"(l1_table)
+                 : "memory");
+
+    asm volatile("mrs %0, sctlr_el1" : "=r"(sctlr));
+    sctlr |= SCTLR_M | SCTLR_C | SCTLR_I;
+    asm volatile("msr sctlr_el1, %0\n\t"
+                 "isb\n\t" ::"r"(sctlr)
+                 : "memory");
+}
+
+uint64_t arch_timer_read(void)
+{
+    uint64_t cnt;
+    asm volatile("isb\n\t"
+                 "mrs %0, cntvct_el0"
+                 : "=r"(cnt));
+    return cnt;
+}
+
+uint64_t arch_timer_freq(void)
+{
+    uint64_t freq;
+    asm volatile("mrs %0, cntfrq_el0" : "=r"(freq));
+    return freq;
+}
+
+long arch_hypercall(unsigned long id, unsigned long arg0, unsigned long arg1)
+{
+    register unsigned long x0 asm("x0") = SMCC64_FID_VND_HYP_SRVC | id;
+    register unsigned long x1 asm("x1") = arg0;
+    register unsigned long x2 asm("x2") = arg1;
+
+    asm volatile("hvc #0" : "+r"(x0) : "r"(x1), "r"(x2) : "x3", "memory");
+
+    return (long)x0;
+}
+
+void arch_putc(char c)
+{
+    volatile uint32_t* uart = (volatile uint32_t*)MEMBENCH_UART_BASE;
+
+    if (c == '\n') {
+        arch_putc('\r');
+    }
+    while (uart[UART_FR / 4] & UART_TXFF) { }
+    uart[UART_DR / 4] = (uint32_t)c;
+}
@@ -0,0 +1,57 @@
+/**
+ * SPDX-License-Identifier: Apache-2.0
+ * Copyright (c) Bao Project and Contributors. All rights reserved.
+ */
+
+#include <membench.h>
+
+#define UART_THR  (0x0)
+#define UART_LSR  (0x5)
+#define UART_THRE (1U << 5)
+
+#define SBI_EXTID_BAO (0x08000ba0UL)
+
+#ifndef MEMBENCH_TIMER_FREQ
+#define MEMBENCH_TIMER_FREQ (10000000UL)
+#endif
+
+/**
+ * The guest runs with address translation disabled, all its memory accesses being cacheable as
+ * defined by the platform's physical memory attributes.
+ */
+void arch_init(void) { }
+
+uint64_t arch_timer_read(void)
+{
+    uint64_t time;
+    asm volatile("rdtime %0" : "=r"(time));
+    return time;
+}
+
+uint64_t arch_timer_freq(void)
+{
+    return MEMBENCH_TIMER_FREQ;
+}
+
+long arch_hypercall(unsigned long id, unsigned long arg0, unsigned long arg1)
+{
+    register unsigned long a0 asm("a0") = arg0;
+    register unsigned long a1 asm("a1") = arg1;
+    register unsigned long a6 asm("a6") = id;
+    register unsigned long a7 asm("a7") = SBI_EXTID_BAO;
+
+    asm volatile("ecall" : "+r"(a0), "+r"(a1) : "r"(a6), "r"(a7) : "memory");
+
+    return (long)a0;
+}
+
+void arch_putc(char c)
+{
+    volatile uint8_t* uart = (volatile uint8_t*)MEMBENCH_UART_BASE;
+
+    if (c == '\n') {
+        arch_putc('\r');
+    }
+    while (!(uart[UART_LSR] & UART_THRE)) { }
+    uart[UART_THR] = (uint8_t)c;
+}
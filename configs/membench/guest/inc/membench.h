@@ -0,0 +1,69 @@
+/**
+ * SPDX-License-Identifier: Apache-2.0
+ * Copyright (c) Bao Project and Contributors. All rights reserved.
+ */
+
+#ifndef __MEMBENCH_H__
+#define __MEMBENCH_H__
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#define MEMBENCH_MAGIC       (0x6d656d62UL)
+#define MEMBENCH_MAX_CPUS    (8)
+#define MEMBENCH_MAX_RESULTS (64)
+
+enum membench_kernel { KERNEL_READ, KERNEL_WRITE, KERNEL_CHASE, KERNEL_NUM };
+
+enum membench_phase {
+    /* Only the measuring cpu is running */
+    PHASE_SOLO,
+    /* All other cpus are writing to their own buffers while the measuring cpu runs */
+    PHASE_CONTENDED,
+    /* Bandwidth achieved by a cpu interfering with the measuring one */
+    PHASE_INTERFERER,
+};
+
+struct membench_result {
+    uint32_t kernel;
+    uint32_t phase;
+    uint64_t wss;
+    uint64_t ticks;
+    /* Bytes moved by the bandwidth kernels, loads done by the pointer chase */
+    uint64_t ops;
+};
+
+/**
+ * Layout of the shared memory region, the same in all VMs. Each cpu only writes its own slot,
+ * which the reporting cpu reads once the slot is marked done.
+ */
+struct membench_shmem {
+    volatile uint32_t magic;
+    volatile uint32_t barrier_count;
+    volatile uint32_t barrier_sense;
+    volatile uint32_t stop;
+    struct {
+        volatile uint32_t done;
+        uint32_t result_num;
+        struct membench_result results[MEMBENCH_MAX_RESULTS];
+    } __attribute__((aligned(64))) cpu[MEMBENCH_MAX_CPUS];
+};
+
+/* Implemented for each architecture */
+
+void arch_init(void);
+uint64_t arch_timer_read(void);
+uint64_t arch_timer_freq(void);
+long arch_hypercall(unsigned long id, unsigned long arg0, unsigned long arg1);
+void arch_putc(char c);
+
+/* Hypercall ids, as defined by the hypervisor */
+#define HC_REQUEST_MEM_ACCESS (2)
+#define HC_REVOKE_MEM_ACCESS  (3)
+#define HC_GET_CPU_ID         (4)
+
+/* Bit of HC_REQUEST_MEM_ACCESS's answer set if the memory token was granted */
+#define MEM_ACCESS_ACK (1UL << 0)
+
+#endif /* __MEMBENCH_H__ */
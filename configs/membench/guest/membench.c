@@ -0,0 +1,349 @@
+/**
+ * SPDX-License-Identifier: Apache-2.0
+ * Copyright (c) Bao Project and Contributors. All rights reserved.
+ */
+
+/**
+ * Memory interference benchmark. Each VM runs a copy of this guest on a single cpu. For every
+ * kernel and working set size, the cpu with id 0 runs the kernel first alone and then while all
+ * other cpus write to their own buffers as fast as they can. Every cpu stores its results in its
+ * slot of the shared memory region and cpu 0 prints them all once done.
+ */
+
+#include <membench.h>
+
+#ifndef MEMBENCH_CPUS
+#define MEMBENCH_CPUS (4)
+#endif
+
+#ifndef MEMBENCH_ARBITRATE
+#define MEMBENCH_ARBITRATE (0)
+#endif
+
+#ifndef MEMBENCH_WCET_US
+#define MEMBENCH_WCET_US (1000000)
+#endif
+
+#define LINE_SIZE    (64)
+#define MAX_WSS      (16UL * 1024 * 1024)
+#define TARGET_BYTES (64UL * 1024 * 1024)
+#define CHASE_LOADS  (1UL * 1024 * 1024)
+#define CHUNK_SIZE   (64UL * 1024)
+
+#if (MEMBENCH_CPUS > MEMBENCH_MAX_CPUS)
+#error "too many cpus for the shared memory layout"
+#endif
+
+struct line {
+    struct line* next;
+    uint64_t pad[(LINE_SIZE / sizeof(uint64_t)) - 1];
+};
+
+static struct membench_shmem* const shmem = (struct membench_shmem*)MEMBENCH_SHMEM_BASE;
+
+static const size_t wss_list[] = { 16 * 1024, 256 * 1024, 2 * 1024 * 1024, MAX_WSS };
+static const char* const kernel_names[] = { "read", "write", "chase" };
+static const char* const phase_names[] = { "solo", "contended", "interferer" };
+
+extern uint8_t _buffer_start[];
+
+static size_t cpu_id;
+static uint32_t barrier_sense;
+static volatile uint64_t sink;
+
+static void print_str(const char* str)
+{
+    while (*str != '\0') {
+        arch_putc(*str++);
+    }
+}
+
+static void print_u64(uint64_t val)
+{
+    char buf[21];
+    size_t i = sizeof(buf) - 1;
+
+    buf[i] = '\0';
+    do {
+        buf[--i] = (char)('0' + (val % 10));
+        val /= 10;
+    } while (val != 0);
+
+    print_str(&buf[i]);
+}
+
+/* Print a value given in tenths with one decimal place */
+static void print_dec1(uint64_t val10)
+{
+    print_u64(val10 / 10);
+    arch_putc('.');
+    arch_putc((char)('0' + (val10 % 10)));
+}
+
+static void barrier(void)
+{
+    barrier_sense = !barrier_sense;
+
+    if (__atomic_add_fetch(&shmem->barrier_count, 1, __ATOMIC_ACQ_REL) == MEMBENCH_CPUS) {
+        __atomic_store_n(&shmem->barrier_count, 0, __ATOMIC_RELAXED);
+        __atomic_store_n(&shmem->barrier_sense, barrier_sense, __ATOMIC_RELEASE);
+    } else {
+        while (__atomic_load_n(&shmem->barrier_sense, __ATOMIC_ACQUIRE) != barrier_sense) { }
+    }
+}
+
+/**
+ * With arbitration enabled, a cpu holds the hypervisor's memory token while running a kernel. The
+ * guest does not handle the pause and resume notifications, so it just polls until it gets the
+ * token. Only the answer's ack bit tells whether it did, as dp_wcet also returns the time left to
+ * wait in the others. The declared wcet must cover the kernel's run, which dp_wcet makes the cpu
+ * wait out before its next request.
+ */
+static void arbitrate_begin(void)
+{
+    if (MEMBENCH_ARBITRATE) {
+        unsigned long wcet = (MEMBENCH_WCET_US * arch_timer_freq()) / 1000000;
+        while (!(arch_hypercall(HC_REQUEST_MEM_ACCESS, cpu_id, wcet) & MEM_ACCESS_ACK)) { }
+    }
+}
+
+static void arbitrate_end(void)
+{
+    if (MEMBENCH_ARBITRATE) {
+        arch_hypercall(HC_REVOKE_MEM_ACCESS, 0, 0);
+    }
+}
+
+static uint64_t kernel_read(const uint64_t* buf, size_t wss)
+{
+    uint64_t sum = 0;
+
+    for (size_t pass = 0; pass < (TARGET_BYTES / wss); pass++) {
+        for (size_t i = 0; i < (wss / sizeof(uint64_t)); i++) {
+            sum += buf[i];
+        }
+    }
+    sink = sum;
+
+    return (TARGET_BYTES / wss) * wss;
+}
+
+static uint64_t kernel_write(uint64_t* buf, size_t wss)
+{
+    for (size_t pass = 0; pass < (TARGET_BYTES / wss); pass++) {
+        for (size_t i = 0; i < (wss / sizeof(uint64_t)); i++) {
+            buf[i] = pass + i;
+        }
+    }
+
+    return (TARGET_BYTES / wss) * wss;
+}
+
+/**
+ * Link all the lines in the working set in a single random cycle, so that each load depends on
+ * the previous one and hardware prefetchers can not guess the next.
+ */
+static struct line* chase_build(struct line* lines, size_t wss)
+{
+    size_t n = wss / LINE_SIZE;
+    size_t* perm = (size_t*)&_buffer_start[MAX_WSS];
+    uint64_t rnd = 0x9e3779b97f4a7c15ULL ^ cpu_id;
+
+    for (size_t i = 0; i < n; i++) {
+        perm[i] = i;
+    }
+
+    for (size_t i = n - 1; i > 0; i--) {
+        rnd ^= rnd << 13;
+        rnd ^= rnd >> 7;
+        rnd ^= rnd << 17;
+        size_t j = rnd % (i + 1);
+        size_t tmp = perm[i];
+        perm[i] = perm[j];
+        perm[j] = tmp;
+    }
+
+    for (size_t i = 0; i < n; i++) {
+        lines[perm[i]].next = &lines[perm[(i + 1) % n]];
+    }
+
+    return &lines[perm[0]];
+}
+
+static uint64_t kernel_chase(struct line* head)
+{
+    struct line* p = head;
+
+    for (size_t i = 0; i < CHASE_LOADS; i++) {
+        p = p->next;
+    }
+    sink = (uint64_t)p;
+
+    return CHASE_LOADS;
+}
+
+static void record(enum membench_kernel kernel, enum membench_phase phase, size_t wss,
+    uint64_t ticks, uint64_t ops)
+{
+    uint32_t n = shmem->cpu[cpu_id].result_num;
+
+    if (n < MEMBENCH_MAX_RESULTS) {
+        shmem->cpu[cpu_id].results[n] = (struct membench_result){
+            .kernel = kernel,
+            .phase = phase,
+            .wss = wss,
+            .ticks = ticks,
+            .ops = ops,
+        };
+        shmem->cpu[cpu_id].result_num = n + 1;
+    }
+}
+
+static void run(enum membench_kernel kernel, enum membench_phase phase, size_t wss)
+{
+    struct line* head = NULL;
+    uint64_t ops = 0;
+
+    if (kernel == KERNEL_CHASE) {
+        head = chase_build((struct line*)_buffer_start, wss);
+    }
+
+    arbitrate_begin();
+    uint64_t start = arch_timer_read();
+    switch (kernel) {
+        case KERNEL_READ:
+            ops = kernel_read((uint64_t*)_buffer_start, wss);
+            break;
+        case KERNEL_WRITE:
+            ops = kernel_write((uint64_t*)_buffer_start, wss);
+            break;
+        default:
+            ops = kernel_chase(head);
+            break;
+    }
+    uint64_t end = arch_timer_read();
+    arbitrate_end();
+
+    record(kernel, phase, wss, end - start, ops);
+}
+
+/**
+ * Write over the largest working set, a chunk at a time, until the measuring cpu is done.
+ */
+static void interfere(enum membench_kernel kernel, size_t wss)
+{
+    uint64_t* buf = (uint64_t*)_buffer_start;
+    uint64_t bytes = 0;
+    size_t offset = 0;
+
+    uint64_t start = arch_timer_read();
+    while (!__atomic_load_n(&shmem->stop, __ATOMIC_ACQUIRE)) {
+        arbitrate_begin();
+        for (size_t i = 0; i < (CHUNK_SIZE / sizeof(uint64_t)); i++) {
+            buf[(offset / sizeof(uint64_t)) + i] = bytes + i;
+        }
+        arbitrate_end();
+        bytes += CHUNK_SIZE;
+        offset = (offset + CHUNK_SIZE) % MAX_WSS;
+    }
+    uint64_t end = arch_timer_read();
+
+    record(kernel, PHASE_INTERFERER, wss, end - start, bytes);
+}
+
+static uint64_t ticks_to_ns10(uint64_t ticks, uint64_t freq)
+{
+    return ((ticks / freq) * 10000000000ULL) + (((ticks % freq) * 10000000000ULL) / freq);
+}
+
+static void report(void)
+{
+    uint64_t freq = arch_timer_freq();
+
+    for (size_t cpu = 0; cpu < MEMBENCH_CPUS; cpu++) {
+        while (!__atomic_load_n(&shmem->cpu[cpu].done, __ATOMIC_ACQUIRE)) { }
+    }
+
+    print_str("membench,cpu,kernel,phase,wss,ticks,ops,metric,unit\n");
+    for (size_t cpu = 0; cpu < MEMBENCH_CPUS; cpu++) {
+        for (size_t i = 0; i < shmem->cpu[cpu].result_num; i++) {
+            struct membench_result* res = &shmem->cpu[cpu].results[i];
+            bool bandwidth = (res->kernel != KERNEL_CHASE) || (res->phase == PHASE_INTERFERER);
+
+            print_str("membench,");
+            print_u64(cpu);
+            print_str(",");
+            print_str(kernel_names[res->kernel]);
+            print_str(",");
+            print_str(phase_names[res->phase]);
+            print_str(",");
+            print_u64(res->wss);
+            print_str(",");
+            print_u64(res->ticks);
+            print_str(",");
+            print_u64(res->ops);
+            print_str(",");
+            if (res->ticks == 0) {
+                print_str("0,");
+            } else if (bandwidth) {
+                print_dec1(((res->ops * 10 / 1024) * freq / res->ticks) / 1024);
+                print_str(",MiB/s");
+            } else {
+                print_dec1(ticks_to_ns10(res->ticks, freq) / res->ops);
+                print_str(",ns");
+            }
+            print_str("\n");
+        }
+    }
+    print_str("membench,done\n");
+}
+
+void main(void)
+{
+    arch_init();
+
+    cpu_id = (size_t)arch_hypercall(HC_GET_CPU_ID, 0, 0);
+    if (cpu_id >= MEMBENCH_CPUS) {
+        return;
+    }
+
+    if (cpu_id == 0) {
+        uint8_t* shmem_bytes = (uint8_t*)shmem;
+        for (size_t i = 0; i < sizeof(*shmem); i++) {
+            shmem_bytes[i] = 0;
+        }
+        __atomic_store_n(&shmem->magic, MEMBENCH_MAGIC, __ATOMIC_RELEASE);
+    } else {
+        while (__atomic_load_n(&shmem->magic, __ATOMIC_ACQUIRE) != MEMBENCH_MAGIC) { }
+    }
+
+    barrier();
+
+    for (size_t k = 0; k < KERNEL_NUM; k++) {
+        for (size_t w = 0; w < (sizeof(wss_list) / sizeof(wss_list[0])); w++) {
+            barrier();
+            if (cpu_id == 0) {
+                run(k, PHASE_SOLO, wss_list[w]);
+            }
+
+            barrier();
+            if (cpu_id == 0) {
+                run(k, PHASE_CONTENDED, wss_list[w]);
+                __atomic_store_n(&shmem->stop, 1, __ATOMIC_RELEASE);
+            } else {
+                interfere(k, wss_list[w]);
+            }
+
+            barrier();
+            if (cpu_id == 0) {
+                __atomic_store_n(&shmem->stop, 0, __ATOMIC_RELEASE);
+            }
+        }
+    }
+
+    __atomic_store_n(&shmem->cpu[cpu_id].done, 1, __ATOMIC_RELEASE);
+
+    if (cpu_id == 0) {
+        report();
+    }
+}
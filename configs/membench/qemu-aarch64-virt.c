@@ -0,0 +1,101 @@
+/**
+ * SPDX-License-Identifier: Apache-2.0
+ * Copyright (c) Bao Project and Contributors. All rights reserved.
+ */
+
+/**
+ * Memory interference benchmark: one VM on each of the platform's cpus, all running the membench
+ * guest found in configs/membench/guest and sharing a memory region through which they synchronize
+ * and return their results. VM 0 owns the uart and prints the report.
+ *
+ * Build with CONFIG=membench/qemu-aarch64-virt after building the guest with ARCH=aarch64. The colors of
+ * each VM can be swept without editing this file by defining MEMBENCH_COLORS_VM<n>, e.g.
+ * CPPFLAGS=-DMEMBENCH_COLORS_VM0=0xf, see configs/membench/sweep.sh.
+ */
+
+#include <config.h>
+
+#ifndef MEMBENCH_IMAGE
+#define MEMBENCH_IMAGE "configs/membench/guest/build/aarch64/membench.bin"
+#endif
+
+#ifndef MEMBENCH_COLORS_VM0
+#define MEMBENCH_COLORS_VM0 (0)
+#endif
+#ifndef MEMBENCH_COLORS_VM1
+#define MEMBENCH_COLORS_VM1 (0)
+#endif
+#ifndef MEMBENCH_COLORS_VM2
+#define MEMBENCH_COLORS_VM2 (0)
+#endif
+#ifndef MEMBENCH_COLORS_VM3
+#define MEMBENCH_COLORS_VM3 (0)
+#endif
+
+#define MEMBENCH_MEM_BASE   (0x40000000)
+#define MEMBENCH_MEM_SIZE   (0x2000000)
+#define MEMBENCH_SHMEM_BASE (0x70000000)
+#define MEMBENCH_SHMEM_SIZE (0x10000)
+
+VM_IMAGE(membench, MEMBENCH_IMAGE);
+
+static struct vm_dev_region uart_dev[] = {
+    {
+        /* PL011 */
+        .pa = 0x9000000,
+        .va = 0x9000000,
+        .size = 0x10000,
+    },
+};
+
+#define MEMBENCH_VM(vm_id, vm_colors, vm_dev_num, vm_devs)                  \
+    {                                                                       \
+        .image = VM_IMAGE_BUILTIN(membench, MEMBENCH_MEM_BASE),             \
+        .entry = MEMBENCH_MEM_BASE,                                         \
+        .cpu_affinity = (1UL << (vm_id)),                                   \
+        .colors = (vm_colors),                                              \
+        .platform = {                                                       \
+            .cpu_num = 1,                                                   \
+            .region_num = 1,                                                \
+            .regions = (struct vm_mem_region[]) {                           \
+                {                                                           \
+                    .base = MEMBENCH_MEM_BASE,                              \
+                    .size = MEMBENCH_MEM_SIZE,                              \
+                },                                                          \
+            },                                                              \
+            .ipc_num = 1,                                                   \
+            .ipcs = (struct ipc[]) {                                        \
+                {                                                           \
+                    .base = MEMBENCH_SHMEM_BASE,                            \
+                    .size = MEMBENCH_SHMEM_SIZE,                            \
+                    .shmem_id = 0,                                          \
+                },                                                          \
+            },                                                              \
+            .dev_num = (vm_dev_num),                                        \
+            .devs = (vm_devs),                                              \
+            .arch = {                                                       \
+                .gic = {                                                    \
+                    .gicd_addr = 0x08000000,                                \
+                    .gicr_addr = 0x080A0000,                                \
+                },                                                          \
+            },                                                              \
+        },                                                                  \
+    }
+
+struct config config = {
+
+    CONFIG_HEADER
+
+    .shmemlist_size = 1,
+    .shmemlist = (struct shmem[]) {
+        [0] = { .size = MEMBENCH_SHMEM_SIZE, },
+    },
+
+    .vmlist_size = 4,
+    .vmlist = {
+        MEMBENCH_VM(0, MEMBENCH_COLORS_VM0, 1, uart_dev),
+        MEMBENCH_VM(1, MEMBENCH_COLORS_VM1, 0, NULL),
+        MEMBENCH_VM(2, MEMBENCH_COLORS_VM2, 0, NULL),
+        MEMBENCH_VM(3, MEMBENCH_COLORS_VM3, 0, NULL),
+    },
+};
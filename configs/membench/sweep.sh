@@ -0,0 +1,66 @@
+#!/bin/sh
+## SPDX-License-Identifier: Apache-2.0
+## Copyright (c) Bao Project and Contributors. All rights reserved.
+
+# Runs the membench configuration for each combination of VM colors and memory
+# arbitration policy, and gathers all results in a single csv report.
+#
+# Must be run from the root of the repository. MEMBENCH_RUN is the command that
+# boots the hypervisor image given as its first argument on the target (e.g.
+# qemu with the firmware needed for the platform) and prints the console to its
+# standard output. It is killed after MEMBENCH_TIMEOUT seconds.
+#
+#   PLATFORM=qemu-aarch64-virt MEMBENCH_RUN="./run-qemu.sh" \
+#       configs/membench/sweep.sh > report.csv
+#
+# MEMBENCH_COLORS is a space separated list of color assignments, each a colon
+# separated list of the colormaps of VMs 0 to 3. MEMBENCH_POLICIES lists the
+# arbitration policies: none (the guests do not arbitrate), fp_classic and
+# dp_wcet (the guests hold the hypervisor's memory token while running a
+# kernel, with the respective scheduler).
+
+set -e
+
+: "${PLATFORM:?PLATFORM not set}"
+: "${MEMBENCH_RUN:?MEMBENCH_RUN not set}"
+MEMBENCH_TIMEOUT=${MEMBENCH_TIMEOUT:-600}
+MEMBENCH_COLORS=${MEMBENCH_COLORS:-"0:0:0:0 0x000f:0x00f0:0x0f00:0xf000"}
+MEMBENCH_POLICIES=${MEMBENCH_POLICIES:-"none fp_classic dp_wcet"}
+
+case $PLATFORM in
+    qemu-aarch64-virt) guest_arch=aarch64 ;;
+    qemu-riscv64-virt) guest_arch=riscv64 ;;
+    *) echo "no membench configuration for $PLATFORM" >&2; exit 1 ;;
+esac
+
+echo "colors,policy,cpu,kernel,phase,wss,ticks,ops,metric,unit"
+
+for policy in $MEMBENCH_POLICIES; do
+    case $policy in
+        none) arbitrate=n; wait=n ;;
+        fp_classic) arbitrate=y; wait=n ;;
+        dp_wcet) arbitrate=y; wait=y ;;
+        *) echo "unknown policy $policy" >&2; exit 1 ;;
+    esac
+
+    make -s -C configs/membench/guest clean >&2
+    make -s -C configs/membench/guest ARCH=$guest_arch MEMBENCH_ARBITRATE=$arbitrate >&2
+
+    for colors in $MEMBENCH_COLORS; do
+        flags=""
+        vm=0
+        for clr in $(echo "$colors" | tr ':' ' '); do
+            flags="$flags -DMEMBENCH_COLORS_VM$vm=$clr"
+            vm=$((vm + 1))
+        done
+
+        # The colors only change the configuration's preprocessor flags, which
+        # the build does not track
+        make -s PLATFORM=$PLATFORM CONFIG=membench/$PLATFORM clean >&2
+        make -s PLATFORM=$PLATFORM CONFIG=membench/$PLATFORM MEMORY_REQUEST_WAIT=$wait \
+            CPPFLAGS="$flags" >&2
+
+        timeout "$MEMBENCH_TIMEOUT" $MEMBENCH_RUN bin/$PLATFORM/membench/$PLATFORM/bao.bin |
+            tr -d '\r' | grep '^membench,[0-9]' | sed "s/^membench,/$colors,$policy,/" || true
+    done
+done
@@ -1,4 +1,12 @@
 # Dynamic Priority, set CPU to lower prio when its tasks go faster than their WCET
 ifeq ($(MEMORY_REQUEST_WAIT),y)
 build_macros+=-DMEMORY_REQUEST_WAIT
-endif
\ No newline at end of file
+endif
+
+# Multiplex the vcpus of several VMs on the same physical cpus (Armv8-A AArch64 only)
+ifeq ($(VCPU_SCHED),y)
+ifneq ($(ARCH)-$(ARCH_PROFILE)-$(ARCH_SUB),armv8-armv8-a-aarch64)
+$(error VCPU_SCHED is only supported on Armv8-A AArch64 platforms)
+endif
+build_macros+=-DVCPU_SCHED
+endif
@@ -0,0 +1,138 @@
+/**
+ * SPDX-License-Identifier: Apache-2.0
+ * Copyright (c) Bao Project and Contributors. All rights reserved
+ */
+
+/**
+ * Reports how the memory of each VM in the configuration is spread across the DRAM banks described
+ * by the platform. Regions placed at a fixed physical address are counted page by page. For
+ * regions allocated by the hypervisor the exact pages are only known at runtime, so the report
+ * shows the number of pages of the platform's memory each VM's colors can be allocated from.
+ *
+ * Usage: bank_report [cache colors] [cache color size]
+ *
+ * The number of cache colors and their size (in pages) default to the ones derived from the
+ * platform's cache description. If the platform does not describe its caches, they are probed at
+ * runtime and must be given here for the report to take cache colors into account.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <config.h>
+#include <cache.h>
+#include <dram.h>
+#include <console.h>
+
+/**
+ * The color and bank geometry are computed by the hypervisor's cache.c and dram.c, built along
+ * with this tool, from the platform's description rather than from probing the caches.
+ */
+void cache_arch_enumerate(struct cache* dscrp) {
+    *dscrp = platform.cache;
+}
+
+void console_printk(const char* fmt, ...) {
+    va_list args;
+    va_start(args, fmt);
+    vfprintf(stderr, fmt, args);
+    va_end(args);
+}
+
+static void count_pages(paddr_t base, size_t size, colormap_t colors, size_t* banks) {
+    for (paddr_t pa = ALIGN(base, PAGE_SIZE); pa < (base + size); pa += PAGE_SIZE) {
+        if (pa_in_clrs(pa, colors)) {
+            banks[dram_bank(pa)]++;
+        }
+    }
+}
+
+static void print_banks(const char* name, size_t* banks) {
+    printf("%-24s", name);
+    for (size_t b = 0; b < BANK_NUM; b++) {
+        printf(" %8ld", banks[b]);
+    }
+    printf("\n");
+}
+
+int main(int argc, char** argv) {
+    size_t used[CONFIG_VM_NUM] = { 0 };
+    char name[32];
+
+    cache_enumerate();
+    if (argc > 1) {
+        COLOR_NUM = strtoul(argv[1], NULL, 0);
+        COLOR_SIZE = (argc > 2) ? strtoul(argv[2], NULL, 0) : 1;
+    }
+    dram_init();
+
+    if (BANK_NUM == 1) {
+        printf("Platform does not describe its dram banks\n");
+        return 0;
+    }
+
+    printf("%ld cache colors of %ld pages, %ld banks\n\n", COLOR_NUM, COLOR_SIZE, BANK_NUM);
+
+    printf("%-24s", "pages per bank");
+    for (size_t b = 0; b < BANK_NUM; b++) {
+        printf(" %8ld", b);
+    }
+    printf("\n");
+
+    for (size_t i = 0; i < config.vmlist_size; i++) {
+        struct vm_config* vm_config = &config.vmlist[i];
+        size_t fixed[BANK_NUM];
+        size_t avail[BANK_NUM];
+        bool has_fixed = false;
+        bool has_alloc = false;
+
+        for (size_t b = 0; b < BANK_NUM; b++) {
+            fixed[b] = 0;
+            avail[b] = 0;
+        }
+
+        for (size_t j = 0; j < vm_config->platform.region_num; j++) {
+            struct vm_mem_region* reg = &vm_config->platform.regions[j];
+            if (reg->place_phys) {
+                count_pages(reg->phys, reg->size, reg->colors, fixed);
+                has_fixed = true;
+            } else {
+                has_alloc = true;
+            }
+        }
+
+        if (has_alloc) {
+            for (size_t j = 0; j < platform.region_num; j++) {
+                count_pages(platform.regions[j].base, platform.regions[j].size, vm_config->colors,
+                    avail);
+            }
+        }
+
+        for (size_t b = 0; b < BANK_NUM; b++) {
+            if ((fixed[b] != 0) || (avail[b] != 0)) {
+                used[i] |= 1UL << b;
+            }
+        }
+
+        if (has_fixed) {
+            snprintf(name, sizeof(name), "vm %ld fixed", i);
+            print_banks(name, fixed);
+        }
+        if (has_alloc) {
+            snprintf(name, sizeof(name), "vm %ld allocatable", i);
+            print_banks(name, avail);
+        }
+    }
+
+    printf("\n");
+    for (size_t i = 0; i < config.vmlist_size; i++) {
+        for (size_t j = i + 1; j < config.vmlist_size; j++) {
+            size_t shared = used[i] & used[j];
+            if (shared != 0) {
+                printf("vm %ld and vm %ld share banks 0x%lx\n", i, j, shared);
+            }
+        }
+    }
+
+    return 0;
+}
@@ -111,6 +111,8 @@ SYSREG_GEN_ACCESSORS(icc_bpr1_el1, 0, c12, c12, 3);
 SYSREG_GEN_ACCESSORS(icc_ctlr_el1, 0, c12, c12, 4);
 SYSREG_GEN_ACCESSORS(icc_igrpen1_el1, 0, c12, c12, 7);
 SYSREG_GEN_ACCESSORS(ich_hcr_el2, 4, c12, c11, 0);
+SYSREG_GEN_ACCESSORS(ich_vmcr_el2, 4, c12, c11, 7);
+SYSREG_GEN_ACCESSORS(ich_ap1r0_el2, 4, c12, c9, 0);
 SYSREG_GEN_ACCESSORS_64(icc_sgi1r_el1, 0, c12);
 
 SYSREG_GEN_ACCESSORS(vsctlr_el2, 4, c2, c0, 0);
@@ -153,6 +155,11 @@ static inline void arm_at_s12e1w(vaddr_t vaddr)
     asm volatile("mcr p15, 0, %0, c7, c8, 5" ::"r"(vaddr)); // ats12nsopw
 }
 
+static inline void arm_tlbi_alle2()
+{
+    asm volatile("mcr p15, 4, r0, c8, c7, 0");
+}
+
 static inline void arm_tlbi_alle2is()
 {
     asm volatile("mcr p15, 4, r0, c8, c7, 0");
@@ -163,6 +170,11 @@ static inline void arm_tlbi_vmalls12e1is()
     asm volatile("mcr p15, 0, r0, c8, c7, 0");
 }
 
+static inline void arm_tlbi_vmalle1is()
+{
+    asm volatile("mcr p15, 0, r0, c8, c3, 0"); // tlbiallis
+}
+
 static inline void arm_tlbi_vae2is(vaddr_t vaddr)
 {
     asm volatile("mcr p15, 4, %0, c8, c7, 1" ::"r"(vaddr));
@@ -26,6 +26,8 @@
 #define icc_ctlr_el1    S3_0_C12_C12_4
 #define icc_igrpen1_el1 S3_0_C12_C12_7
 #define ich_hcr_el2     S3_4_C12_C11_0
+#define ich_vmcr_el2    S3_4_C12_C11_7
+#define ich_ap1r0_el2   S3_4_C12_C9_0
 #define icc_sgi1r_el1   S3_0_C12_C11_5
 #define ich_lr0_el2     S3_4_C12_C12_0
 #define ich_lr1_el2     S3_4_C12_C12_1
@@ -69,6 +71,7 @@ SYSREG_GEN_ACCESSORS(csselr_el1);
 SYSREG_GEN_ACCESSORS(ccsidr_el1);
 SYSREG_GEN_ACCESSORS(ccsidr2_el1);
 SYSREG_GEN_ACCESSORS(ctr_el0);
+SYSREG_GEN_ACCESSORS(dczid_el0);
 SYSREG_GEN_ACCESSORS(mpidr_el1);
 SYSREG_GEN_ACCESSORS(vmpidr_el2);
 SYSREG_GEN_ACCESSORS(cntvoff_el2);
@@ -77,6 +80,33 @@ SYSREG_GEN_ACCESSORS(cntkctl_el1);
 SYSREG_GEN_ACCESSORS(cntfrq_el0);
 SYSREG_GEN_ACCESSORS(pmcr_el0);
 SYSREG_GEN_ACCESSORS(par_el1);
+SYSREG_GEN_ACCESSORS(cpacr_el1);
+SYSREG_GEN_ACCESSORS(ttbr0_el1);
+SYSREG_GEN_ACCESSORS(ttbr1_el1);
+SYSREG_GEN_ACCESSORS(tcr_el1);
+SYSREG_GEN_ACCESSORS(esr_el1);
+SYSREG_GEN_ACCESSORS(afsr0_el1);
+SYSREG_GEN_ACCESSORS(afsr1_el1);
+SYSREG_GEN_ACCESSORS(far_el1);
+SYSREG_GEN_ACCESSORS(mair_el1);
+SYSREG_GEN_ACCESSORS(amair_el1);
+SYSREG_GEN_ACCESSORS(vbar_el1);
+SYSREG_GEN_ACCESSORS(contextidr_el1);
+SYSREG_GEN_ACCESSORS(tpidr_el0);
+SYSREG_GEN_ACCESSORS(tpidrro_el0);
+SYSREG_GEN_ACCESSORS(tpidr_el1);
+SYSREG_GEN_ACCESSORS(sp_el0);
+SYSREG_GEN_ACCESSORS(sp_el1);
+SYSREG_GEN_ACCESSORS(elr_el1);
+SYSREG_GEN_ACCESSORS(spsr_el1);
+SYSREG_GEN_ACCESSORS(mdscr_el1);
+SYSREG_GEN_ACCESSORS(cntv_ctl_el0);
+SYSREG_GEN_ACCESSORS(cntv_cval_el0);
+SYSREG_GEN_ACCESSORS(cntpct_el0);
+SYSREG_GEN_ACCESSORS(cntp_ctl_el0);
+SYSREG_GEN_ACCESSORS(cntp_cval_el0);
+SYSREG_GEN_ACCESSORS(cnthp_ctl_el2);
+SYSREG_GEN_ACCESSORS(cnthp_cval_el2);
 SYSREG_GEN_ACCESSORS(tcr_el2);
 SYSREG_GEN_ACCESSORS(ttbr0_el2);
 SYSREG_GEN_ACCESSORS(mair_el2);
@@ -105,6 +135,8 @@ SYSREG_GEN_ACCESSORS(icc_bpr1_el1);
 SYSREG_GEN_ACCESSORS(icc_ctlr_el1);
 SYSREG_GEN_ACCESSORS(icc_igrpen1_el1);
 SYSREG_GEN_ACCESSORS(ich_hcr_el2);
+SYSREG_GEN_ACCESSORS(ich_vmcr_el2);
+SYSREG_GEN_ACCESSORS(ich_ap1r0_el2);
 SYSREG_GEN_ACCESSORS(icc_sgi1r_el1);
 SYSREG_GEN_ACCESSORS(ich_lr0_el2);
 SYSREG_GEN_ACCESSORS(ich_lr1_el2);
@@ -128,6 +160,11 @@ static inline void arm_dc_civac(vaddr_t cache_addr)
     asm volatile("dc civac, %0\n\t" ::"r"(cache_addr));
 }
 
+static inline void arm_dc_zva(vaddr_t addr)
+{
+    asm volatile("dc zva, %0\n\t" ::"r"(addr) : "memory");
+}
+
 static inline void arm_at_s1e2w(vaddr_t vaddr)
 {
     asm volatile("at s1e2w, %0" ::"r"(vaddr));
@@ -138,6 +175,11 @@ static inline void arm_at_s12e1w(vaddr_t vaddr)
     asm volatile("at s12e1w, %0" ::"r"(vaddr));
 }
 
+static inline void arm_tlbi_alle2()
+{
+    asm volatile("tlbi alle2");
+}
+
 static inline void arm_tlbi_alle2is()
 {
     asm volatile("tlbi alle2is");
@@ -148,6 +190,11 @@ static inline void arm_tlbi_vmalls12e1is()
     asm volatile("tlbi vmalls12e1is");
 }
 
+static inline void arm_tlbi_vmalle1is()
+{
+    asm volatile("tlbi vmalle1is");
+}
+
 static inline void arm_tlbi_vae2is(vaddr_t vaddr)
 {
     asm volatile("tlbi vae2is, %0" ::"r"(vaddr >> 12));
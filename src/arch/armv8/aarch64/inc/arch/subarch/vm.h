@@ -14,4 +14,40 @@ struct arch_regs {
     uint64_t spsr_el2;
 } __attribute__((aligned(16))); // makes size always aligned to 16 to respect stack alignment
 
+#ifdef VCPU_SCHED
+/* The guest's EL1 state, saved while a vcpu of another VM runs on the cpu */
+struct vcpu_subarch_ctx {
+    uint64_t sctlr_el1;
+    uint64_t cpacr_el1;
+    uint64_t ttbr0_el1;
+    uint64_t ttbr1_el1;
+    uint64_t tcr_el1;
+    uint64_t esr_el1;
+    uint64_t afsr0_el1;
+    uint64_t afsr1_el1;
+    uint64_t far_el1;
+    uint64_t mair_el1;
+    uint64_t amair_el1;
+    uint64_t vbar_el1;
+    uint64_t contextidr_el1;
+    uint64_t tpidr_el0;
+    uint64_t tpidrro_el0;
+    uint64_t tpidr_el1;
+    uint64_t sp_el0;
+    uint64_t sp_el1;
+    uint64_t elr_el1;
+    uint64_t spsr_el1;
+    uint64_t par_el1;
+    uint64_t cntkctl_el1;
+    uint64_t csselr_el1;
+    uint64_t mdscr_el1;
+    uint64_t cntv_ctl_el0;
+    uint64_t cntv_cval_el0;
+    uint64_t cntvoff_el2;
+    uint64_t cntp_ctl_el0;
+    uint64_t cntp_cval_el0;
+    uint64_t vttbr_el2;
+};
+#endif
+
 #endif                          /* VM_SUBARCH_H */
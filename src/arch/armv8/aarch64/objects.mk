@@ -5,3 +5,8 @@ cpu-objs-y+=$(ARCH_SUB)/boot.o
 cpu-objs-y+=$(ARCH_SUB)/exceptions.o
 cpu-objs-y+=$(ARCH_SUB)/vm.o
 cpu-objs-y+=$(ARCH_SUB)/aborts.o
+cpu-objs-y+=$(ARCH_SUB)/string.o
+
+ifeq ($(VCPU_SCHED),y)
+cpu-objs-y+=$(ARCH_SUB)/fpu.o
+endif
@@ -0,0 +1,147 @@
+/**
+ * SPDX-License-Identifier: Apache-2.0
+ * Copyright (c) Bao Project and Contributors. All rights reserved.
+ */
+
+#include <string.h>
+#include <arch/sysregs.h>
+
+/**
+ * AArch64 versions of the generic string.c memcpy and memset. The hypervisor is built with
+ * -mgeneral-regs-only and does not save the guests' FP/SIMD registers, so wide accesses are done
+ * through LDP/STP pairs of general purpose registers instead of NEON registers.
+ */
+
+#define WORD_SIZE  (sizeof(unsigned long))
+#define BLOCK_SIZE (8 * WORD_SIZE)
+
+static inline void memcpy_block(uint8_t* dst, const uint8_t* src)
+{
+    unsigned long t0, t1, t2, t3, t4, t5, t6, t7;
+
+    asm volatile("ldp %0, %1, [%8]\n\t"
+                 "ldp %2, %3, [%8, #16]\n\t"
+                 "ldp %4, %5, [%8, #32]\n\t"
+                 "ldp %6, %7, [%8, #48]\n\t"
+                 "stp %0, %1, [%9]\n\t"
+                 "stp %2, %3, [%9, #16]\n\t"
+                 "stp %4, %5, [%9, #32]\n\t"
+                 "stp %6, %7, [%9, #48]\n\t"
+                 : "=&r"(t0), "=&r"(t1), "=&r"(t2), "=&r"(t3), "=&r"(t4), "=&r"(t5), "=&r"(t6),
+                 "=&r"(t7)
+                 : "r"(src), "r"(dst)
+                 : "memory");
+}
+
+static inline void memset_block(uint8_t* dst, unsigned long pattern)
+{
+    asm volatile("stp %0, %0, [%1]\n\t"
+                 "stp %0, %0, [%1, #16]\n\t"
+                 "stp %0, %0, [%1, #32]\n\t"
+                 "stp %0, %0, [%1, #48]\n\t"
+                 :
+                 : "r"(pattern), "r"(dst)
+                 : "memory");
+}
+
+/**
+ * Returns the size of the block zeroed by DC ZVA, or 0 if its use is prohibited.
+ */
+static inline size_t memset_zva_size()
+{
+    unsigned long dczid = sysreg_dczid_el0_read();
+
+    if (dczid & DCZID_DZP_BIT) {
+        return 0;
+    }
+
+    return 4UL << bit64_extract(dczid, DCZID_BS_OFF, DCZID_BS_LEN);
+}
+
+void* memcpy(void* dst, const void* src, size_t count)
+{
+    uint8_t* dst_tmp = dst;
+    const uint8_t* src_tmp = src;
+
+    /**
+     * Only use wide accesses if both source and destination can be aligned at the same time, as
+     * the rest of the hypervisor is built assuming strict alignment.
+     */
+    if ((((uintptr_t)dst_tmp ^ (uintptr_t)src_tmp) & (WORD_SIZE - 1)) == 0) {
+        while (((uintptr_t)dst_tmp & (WORD_SIZE - 1)) && (count > 0)) {
+            *dst_tmp++ = *src_tmp++;
+            count--;
+        }
+
+        while (count >= BLOCK_SIZE) {
+            memcpy_block(dst_tmp, src_tmp);
+            dst_tmp += BLOCK_SIZE;
+            src_tmp += BLOCK_SIZE;
+            count -= BLOCK_SIZE;
+        }
+
+        while (count >= WORD_SIZE) {
+            *(unsigned long*)dst_tmp = *(const unsigned long*)src_tmp;
+            dst_tmp += WORD_SIZE;
+            src_tmp += WORD_SIZE;
+            count -= WORD_SIZE;
+        }
+    }
+
+    while (count > 0) {
+        *dst_tmp++ = *src_tmp++;
+        count--;
+    }
+
+    return dst;
+}
+
+void* memset(void* dest, int c, size_t count)
+{
+    uint8_t* d = dest;
+    unsigned long pattern = (uint8_t)c * 0x0101010101010101UL;
+
+    while (((uintptr_t)d & (WORD_SIZE - 1)) && (count > 0)) {
+        *d++ = (uint8_t)c;
+        count--;
+    }
+
+    /**
+     * Zero whole blocks with DC ZVA when the cpu allows it and the range is large enough to make
+     * the alignment preamble worth it.
+     */
+    if (c == 0) {
+        size_t zva_size = memset_zva_size();
+        if ((zva_size != 0) && (count >= 2 * zva_size)) {
+            while ((uintptr_t)d & (zva_size - 1)) {
+                *(unsigned long*)d = 0;
+                d += WORD_SIZE;
+                count -= WORD_SIZE;
+            }
+            while (count >= zva_size) {
+                arm_dc_zva((vaddr_t)d);
+                d += zva_size;
+                count -= zva_size;
+            }
+        }
+    }
+
+    while (count >= BLOCK_SIZE) {
+        memset_block(d, pattern);
+        d += BLOCK_SIZE;
+        count -= BLOCK_SIZE;
+    }
+
+    while (count >= WORD_SIZE) {
+        *(unsigned long*)d = pattern;
+        d += WORD_SIZE;
+        count -= WORD_SIZE;
+    }
+
+    while (count > 0) {
+        *d++ = (uint8_t)c;
+        count--;
+    }
+
+    return dest;
+}
@@ -17,6 +17,12 @@ typedef void (*abort_handler_t)(unsigned long, unsigned long, unsigned long, uns
 // TODO Make it look better!
 void aborts_instruction_lower(unsigned long iss, unsigned long far, unsigned long il, unsigned long ec)
 {
+    unsigned long FSC =
+        bit64_extract(iss, ESR_ISS_DA_DSFC_OFF, ESR_ISS_DA_DSFC_LEN) & ESR_ISS_DA_DSFC_CODE;
+    if (FSC == ESR_ISS_DA_DSFC_TRNSLT && vm_mem_fault_recover(cpu()->vcpu->vm, far)) {
+        return;
+    }
+
     INFO("Instruction Abort Exception");
     unsigned int SET = bit64_extract(iss, ESR_ISS_DA_SET_OFF, ESR_ISS_DA_SET_LEN);
     unsigned char FnV = bit64_extract(iss, ESR_ISS_DA_FnV_OFF, ESR_ISS_DA_FnV_LEN);
@@ -84,12 +90,20 @@ void aborts_instruction_lower(unsigned long iss, unsigned long far, unsigned lon
 
 void aborts_data_lower(unsigned long iss, unsigned long far, unsigned long il, unsigned long ec)
 {
+    unsigned long DSFC = bit64_extract(iss, ESR_ISS_DA_DSFC_OFF, ESR_ISS_DA_DSFC_LEN) & (0xf << 2);
+
+    /**
+     * Pages left unmapped by the hypervisor while recoloring them are recovered before anything
+     * else as the faulting access, of any kind, only has to be retried.
+     */
+    if (DSFC == ESR_ISS_DA_DSFC_TRNSLT && vm_mem_fault_recover(cpu()->vcpu->vm, far)) {
+        return;
+    }
+
     if (!(iss & ESR_ISS_DA_ISV_BIT) || (iss & ESR_ISS_DA_FnV_BIT)) {
         ERROR("no information to handle data abort (0x%x)", far);
     }
 
-    unsigned long DSFC = bit64_extract(iss, ESR_ISS_DA_DSFC_OFF, ESR_ISS_DA_DSFC_LEN) & (0xf << 2);
-
     if (DSFC != ESR_ISS_DA_DSFC_TRNSLT && DSFC != ESR_ISS_DA_DSFC_PERMIS) {
         ERROR("data abort is not translation fault - cant deal with it");
     }
@@ -230,6 +244,10 @@ abort_handler_t abort_handlers[64] = {
     [ESR_EC_RG_64] = sysreg_handler,
     [ESR_EC_HVC32] = hvc_handler,
     [ESR_EC_HVC64] = hvc_handler,
+    [ESR_EC_WFIE] = wfx_handler,
+#ifdef VCPU_SCHED
+    [ESR_EC_FP] = fpu_handler,
+#endif
 };
 
 void aborts_sync_handler()
@@ -18,3 +18,21 @@ arch-cppflags+=-DGIC_VERSION=$(GIC_VERSION)
 arch-cflags+=-mgeneral-regs-only
 arch-asflags+=
 arch-ldflags+=
+
+# Print vgic spilled lock hold and hardware interrupt injection times (AArch64 only)
+ifeq ($(VGIC_STATS),y)
+arch-cppflags+=-DVGIC_STATS
+endif
+
+# Print each vcpu's halt polling, sleep residency and wake-up latency statistics
+ifeq ($(WFX_STATS),y)
+arch-cppflags+=-DWFX_STATS
+endif
+
+# Inject the VMs' SGIs directly through a GICv4.1 ITS, when the platform describes one
+ifeq ($(GICV4),y)
+ifneq ($(GIC_VERSION),GICV3)
+$(error GICV4 requires GIC_VERSION=GICV3)
+endif
+arch-cppflags+=-DGICV4
+endif
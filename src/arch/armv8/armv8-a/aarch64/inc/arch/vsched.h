@@ -0,0 +1,29 @@
+/**
+ * SPDX-License-Identifier: Apache-2.0
+ * Copyright (c) Bao Project and Contributors. All rights reserved.
+ */
+
+#ifndef __ARCH_VSCHED_H__
+#define __ARCH_VSCHED_H__
+
+#include <bao.h>
+
+struct fpu_state {
+    uint64_t q[32][2];
+    uint64_t fpsr;
+    uint64_t fpcr;
+} __attribute__((aligned(16)));
+
+/**
+ * Per vcpu state kept by the scheduler. The FP/SIMD registers are only switched on a vcpu's first
+ * use of them after another vcpu's, at which point the owner's VM may no longer be mapped, so they
+ * can not be saved in its struct vcpu.
+ */
+struct vsched_vcpu_arch {
+    struct fpu_state fpu;
+};
+
+void fpu_save_state(struct fpu_state* state);
+void fpu_restore_state(struct fpu_state* state);
+
+#endif /* __ARCH_VSCHED_H__ */
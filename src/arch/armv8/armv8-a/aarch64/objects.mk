@@ -4,3 +4,7 @@
 cpu-objs-y+=$(ARCH_PROFILE)/$(ARCH_SUB)/boot.o
 cpu-objs-y+=$(ARCH_PROFILE)/$(ARCH_SUB)/relocate.o
 cpu-objs-y+=$(ARCH_PROFILE)/$(ARCH_SUB)/vmm.o
+
+ifeq ($(VCPU_SCHED),y)
+cpu-objs-y+=$(ARCH_PROFILE)/$(ARCH_SUB)/vsched.o
+endif
@@ -0,0 +1,276 @@
+/**
+ * SPDX-License-Identifier: Apache-2.0
+ * Copyright (c) Bao Project and Contributors. All rights reserved.
+ */
+
+#include <vsched.h>
+
+#include <cpu.h>
+#include <vm.h>
+#include <vmm.h>
+#include <platform.h>
+#include <interrupts.h>
+#include <arch/sysregs.h>
+#include <arch/gic.h>
+#include <arch/vgic.h>
+#include <arch/fences.h>
+
+/* The EL2 physical timer paces the scheduler, the guests keep the virtual timer */
+#define VSCHED_TIMER_IRQ (26)
+
+#define CNT_CTL_ENABLE_BIT  (1UL << 0)
+#define CNT_CTL_IMASK_BIT   (1UL << 1)
+#define CNT_CTL_ISTATUS_BIT (1UL << 2)
+
+extern uint8_t _vm_beg;
+
+/* The vcpu whose FP/SIMD state is loaded on each cpu */
+static struct vsched_vcpu* vsched_fpu_owner[PLAT_CPU_NUM];
+
+static void vsched_timer_handler(irqid_t int_id)
+{
+    sysreg_cnthp_ctl_el2_write(0);
+    vsched_resched();
+}
+
+void vsched_arch_init(void)
+{
+    sysreg_cnthp_ctl_el2_write(0);
+
+    /* No vcpu owns the FP/SIMD registers yet, the first one to use them takes them */
+    vsched_fpu_owner[cpu()->id] = NULL;
+    sysreg_cptr_el2_write(sysreg_cptr_el2_read() | CPTR_TFP_BIT);
+    ISB();
+
+    if (cpu_is_master()) {
+        if (!interrupts_reserve(VSCHED_TIMER_IRQ, vsched_timer_handler)) {
+            ERROR("Failed to reserve the scheduler timer interrupt");
+        }
+    }
+
+    interrupts_cpu_enable(VSCHED_TIMER_IRQ, true);
+}
+
+uint64_t vsched_arch_time(void)
+{
+    ISB();
+    return sysreg_cntpct_el0_read();
+}
+
+uint64_t vsched_arch_freq(void)
+{
+    return sysreg_cntfrq_el0_read();
+}
+
+void vsched_arch_timer_set(uint64_t deadline)
+{
+    if (deadline == UINT64_MAX) {
+        sysreg_cnthp_ctl_el2_write(0);
+    } else {
+        sysreg_cnthp_cval_el2_write(deadline);
+        sysreg_cnthp_ctl_el2_write(CNT_CTL_ENABLE_BIT);
+    }
+    ISB();
+}
+
+void vsched_arch_wfi_trap(bool trap)
+{
+    if (trap) {
+        sysreg_hcr_el2_write(sysreg_hcr_el2_read() | HCR_TWI_BIT);
+    } else {
+        sysreg_hcr_el2_write(sysreg_hcr_el2_read() & ~HCR_TWI_BIT);
+    }
+    ISB();
+}
+
+void vsched_arch_handle_irqs(void)
+{
+    while (gic_handle()) { }
+}
+
+/**
+ * Directly injected interrupts hold list registers and GICv4.1 vSGIs the redistributor's resident
+ * vPE, both of which would have to be moved on each switch.
+ */
+bool vsched_arch_vcpu_shareable(struct vcpu* vcpu)
+{
+    return !vcpu->vm->arch.vgicd.direct_irqs && !vcpu->vm->arch.vgicd.direct_sgis;
+}
+
+/**
+ * The VM section is mapped by a single root page table entry, pointing to the tables of the VM
+ * whose vcpu is the cpu's current one. As other VMs' structures are at the same addresses, the
+ * hypervisor's translations must be invalidated on every switch.
+ */
+void vsched_arch_vm_install(struct vm_install_info* install_info)
+{
+    if (install_info != NULL) {
+        vmm_vm_install(install_info);
+    } else {
+        pte_t* pte = pt_get_pte(&cpu()->as.pt, 0, (vaddr_t)&_vm_beg);
+        *pte = 0;
+    }
+
+    DSB(ish);
+    arm_tlbi_alle2();
+    DSB(ish);
+    ISB();
+}
+
+/**
+ * Saves the state of a vcpu being switched out, except for the FP/SIMD registers, which are only
+ * saved once another vcpu uses them.
+ */
+void vsched_arch_vcpu_save(struct vsched_vcpu* vsv)
+{
+    struct vcpu* vcpu = vsv->vcpu;
+    struct vcpu_subarch_ctx* ctx = &vcpu->arch.ctx;
+
+    ctx->sctlr_el1 = sysreg_sctlr_el1_read();
+    ctx->cpacr_el1 = sysreg_cpacr_el1_read();
+    ctx->ttbr0_el1 = sysreg_ttbr0_el1_read();
+    ctx->ttbr1_el1 = sysreg_ttbr1_el1_read();
+    ctx->tcr_el1 = sysreg_tcr_el1_read();
+    ctx->esr_el1 = sysreg_esr_el1_read();
+    ctx->afsr0_el1 = sysreg_afsr0_el1_read();
+    ctx->afsr1_el1 = sysreg_afsr1_el1_read();
+    ctx->far_el1 = sysreg_far_el1_read();
+    ctx->mair_el1 = sysreg_mair_el1_read();
+    ctx->amair_el1 = sysreg_amair_el1_read();
+    ctx->vbar_el1 = sysreg_vbar_el1_read();
+    ctx->contextidr_el1 = sysreg_contextidr_el1_read();
+    ctx->tpidr_el0 = sysreg_tpidr_el0_read();
+    ctx->tpidrro_el0 = sysreg_tpidrro_el0_read();
+    ctx->tpidr_el1 = sysreg_tpidr_el1_read();
+    ctx->sp_el0 = sysreg_sp_el0_read();
+    ctx->sp_el1 = sysreg_sp_el1_read();
+    ctx->elr_el1 = sysreg_elr_el1_read();
+    ctx->spsr_el1 = sysreg_spsr_el1_read();
+    ctx->par_el1 = sysreg_par_el1_read();
+    ctx->cntkctl_el1 = sysreg_cntkctl_el1_read();
+    ctx->csselr_el1 = sysreg_csselr_el1_read();
+    ctx->mdscr_el1 = sysreg_mdscr_el1_read();
+
+    /* A stopped timer does not assert its interrupt on behalf of the next vcpu */
+    ctx->cntv_ctl_el0 = sysreg_cntv_ctl_el0_read();
+    ctx->cntv_cval_el0 = sysreg_cntv_cval_el0_read();
+    ctx->cntvoff_el2 = sysreg_cntvoff_el2_read();
+    sysreg_cntv_ctl_el0_write(0);
+    ctx->cntp_ctl_el0 = sysreg_cntp_ctl_el0_read();
+    ctx->cntp_cval_el0 = sysreg_cntp_cval_el0_read();
+    sysreg_cntp_ctl_el0_write(0);
+
+    ctx->vttbr_el2 = sysreg_vttbr_el2_read();
+
+    vgic_cpu_save(vcpu);
+}
+
+void vsched_arch_vcpu_restore(struct vsched_vcpu* vsv)
+{
+    struct vcpu* vcpu = vsv->vcpu;
+    struct vcpu_subarch_ctx* ctx = &vcpu->arch.ctx;
+
+    sysreg_vttbr_el2_write(ctx->vttbr_el2);
+    sysreg_vmpidr_el2_write(vcpu->arch.vmpidr);
+
+    sysreg_sctlr_el1_write(ctx->sctlr_el1);
+    sysreg_cpacr_el1_write(ctx->cpacr_el1);
+    sysreg_ttbr0_el1_write(ctx->ttbr0_el1);
+    sysreg_ttbr1_el1_write(ctx->ttbr1_el1);
+    sysreg_tcr_el1_write(ctx->tcr_el1);
+    sysreg_esr_el1_write(ctx->esr_el1);
+    sysreg_afsr0_el1_write(ctx->afsr0_el1);
+    sysreg_afsr1_el1_write(ctx->afsr1_el1);
+    sysreg_far_el1_write(ctx->far_el1);
+    sysreg_mair_el1_write(ctx->mair_el1);
+    sysreg_amair_el1_write(ctx->amair_el1);
+    sysreg_vbar_el1_write(ctx->vbar_el1);
+    sysreg_contextidr_el1_write(ctx->contextidr_el1);
+    sysreg_tpidr_el0_write(ctx->tpidr_el0);
+    sysreg_tpidrro_el0_write(ctx->tpidrro_el0);
+    sysreg_tpidr_el1_write(ctx->tpidr_el1);
+    sysreg_sp_el0_write(ctx->sp_el0);
+    sysreg_sp_el1_write(ctx->sp_el1);
+    sysreg_elr_el1_write(ctx->elr_el1);
+    sysreg_spsr_el1_write(ctx->spsr_el1);
+    sysreg_par_el1_write(ctx->par_el1);
+    sysreg_cntkctl_el1_write(ctx->cntkctl_el1);
+    sysreg_csselr_el1_write(ctx->csselr_el1);
+    sysreg_mdscr_el1_write(ctx->mdscr_el1);
+
+    sysreg_cntvoff_el2_write(ctx->cntvoff_el2);
+    sysreg_cntv_cval_el0_write(ctx->cntv_cval_el0);
+    sysreg_cntv_ctl_el0_write(ctx->cntv_ctl_el0);
+    sysreg_cntp_cval_el0_write(ctx->cntp_cval_el0);
+    sysreg_cntp_ctl_el0_write(ctx->cntp_ctl_el0);
+
+    vgic_cpu_restore(vcpu);
+
+    /* The vcpu's first FP/SIMD access traps if the registers hold another vcpu's state */
+    if (vsched_fpu_owner[cpu()->id] == vsv) {
+        sysreg_cptr_el2_write(sysreg_cptr_el2_read() & ~CPTR_TFP_BIT);
+    } else {
+        sysreg_cptr_el2_write(sysreg_cptr_el2_read() | CPTR_TFP_BIT);
+    }
+
+    ISB();
+}
+
+/**
+ * First FP/SIMD access of the current vcpu since it was switched in, with the registers holding
+ * the state of another vcpu. The access is retried once the state is switched.
+ */
+void fpu_handler(unsigned long iss, unsigned long far, unsigned long il, unsigned long ec)
+{
+    struct vsched_vcpu* vsv = vsched_current();
+    struct vsched_vcpu** owner = &vsched_fpu_owner[cpu()->id];
+    struct vsched_stats* stats = vsched_stats();
+
+    sysreg_cptr_el2_write(sysreg_cptr_el2_read() & ~CPTR_TFP_BIT);
+    ISB();
+
+    stats->fpu_traps++;
+    if (*owner != vsv) {
+        if (*owner != NULL) {
+            fpu_save_state(&(*owner)->arch.fpu);
+        }
+        fpu_restore_state(&vsv->arch.fpu);
+        *owner = vsv;
+        stats->fpu_switches++;
+    }
+}
+
+/**
+ * Trapped WFI on a cpu shared by several vcpus. The vcpu waits until an interrupt is injected,
+ * which wakes it up, or one of its timers fires, for which it is woken up at the earliest timer
+ * deadline as the timers are stopped while the vcpu is switched out.
+ */
+void vsched_arch_wfi(struct vcpu* vcpu)
+{
+    unsigned long cntv_ctl = sysreg_cntv_ctl_el0_read();
+    unsigned long cntp_ctl = sysreg_cntp_ctl_el0_read();
+    uint64_t wakeup = 0;
+
+    if (vgic_cpu_pending(vcpu)) {
+        return;
+    }
+
+    if ((cntv_ctl & CNT_CTL_ENABLE_BIT) && !(cntv_ctl & CNT_CTL_IMASK_BIT)) {
+        if (cntv_ctl & CNT_CTL_ISTATUS_BIT) {
+            return;
+        }
+        wakeup = sysreg_cntv_cval_el0_read() + sysreg_cntvoff_el2_read();
+    }
+
+    if ((cntp_ctl & CNT_CTL_ENABLE_BIT) && !(cntp_ctl & CNT_CTL_IMASK_BIT)) {
+        if (cntp_ctl & CNT_CTL_ISTATUS_BIT) {
+            return;
+        }
+        uint64_t cntp_cval = sysreg_cntp_cval_el0_read();
+        if ((wakeup == 0) || (cntp_cval < wakeup)) {
+            wakeup = cntp_cval;
+        }
+    }
+
+    vsched_block(wakeup);
+}
@@ -7,6 +7,7 @@
 #include <platform.h>
 #include <arch/psci.h>
 #include <arch/sysregs.h>
+#include <vsched.h>
 
 void cpu_arch_profile_init(cpuid_t cpuid, paddr_t load_addr)
 {
@@ -29,6 +30,17 @@ void cpu_arch_profile_init(cpuid_t cpuid, paddr_t load_addr)
 
 void cpu_arch_profile_idle()
 {
+#ifdef VCPU_SCHED
+    /**
+     * The scheduler's timer must keep running on cpus shared by several vcpus, and the switched
+     * out vcpus' state must not be lost, so these are never powered down.
+     */
+    if (vsched_shared()) {
+        asm volatile("wfi");
+        return;
+    }
+#endif
+
     int64_t err = psci_power_down(PSCI_WAKEUP_IDLE);
     if (err) {
         switch (err) {
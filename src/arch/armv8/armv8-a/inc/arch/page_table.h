@@ -126,6 +126,9 @@
 
 #define PTE_VM_DEV_FLAGS (PTE_MEMATTR_DEV_GRE | PTE_SH_NS | PTE_S2AP_RW | PTE_AF)
 
+#define PTE_VM_RO_FLAGS \
+    (PTE_MEMATTR_NRML_OWBC | PTE_MEMATTR_NRML_IWBC | PTE_SH_NS | PTE_S2AP_RO | PTE_AF)
+
 #ifndef __ASSEMBLER__
 
     typedef uint64_t pte_t;
@@ -140,6 +143,7 @@ struct page_table;
 struct page_table_arch {
     pte_t rec_mask;
     size_t rec_ind;
+    paddr_t root_pa;
 };
 
 void pt_set_recursive(struct page_table* pt, size_t index);
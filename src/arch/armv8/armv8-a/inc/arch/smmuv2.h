@@ -36,6 +36,13 @@
 #define SMMUV2_IDR2_IAS_OFF             (0)
 #define SMMUV2_IDR2_IAS_LEN             (4)
 
+#define SMMUV2_TLBGSTATUS_GSACTIVE      (0x1 << 0)
+#define SMMUV2_TLBSTATUS_SACTIVE        (0x1 << 0)
+
+/* All global faults, and the stream id of the last one in GFSYNR1 */
+#define SMMUV2_GFSR_FAULTS              (0x1FF | (0x1U << 31))
+#define SMMUV2_GFSYNR1_SID_MSK          BIT32_MASK(0, 16)
+
 #define SMMUV2_IDR7_MAJOR_OFF           (4)
 #define SMMUV2_IDR7_MAJOR_LEN           (4)
 
@@ -284,7 +291,14 @@ struct smmu_glbl_rs1_hw {
 
 #define SMMUV2_SCTLR_CLEAR(sctlr)  (sctlr & (0xF << 28 | 0x1 << 20 | 0xF << 9 | 0x1 << 11))
 
-#define SMMUV2_SCTLR_DEFAULT       (SMMUV2_SCTLR_CFCFG | SMMUV2_SCTLR_M)
+#define SMMUV2_SCTLR_DEFAULT \
+    (SMMUV2_SCTLR_CFCFG | SMMUV2_SCTLR_CFIE | SMMUV2_SCTLR_CFRE | SMMUV2_SCTLR_M)
+
+/* All context faults, the stream id of the last one being in the bank's CBFRSYNRA */
+#define SMMUV2_FSR_FAULTS          (0x1FE | (0x1U << 31))
+#define SMMUV2_FSR_SS              (0x1 << 30)
+#define SMMUV2_CBFRSYNRA_SID_MSK   BIT32_MASK(0, 16)
+#define SMMUV2_RESUME_TERMINATE    (0x1)
 
 #define SMMUV2_TCR_T0SZ_MSK        (0x1F)
 #define SMMUV2_TCR_T0SZ(SZ)        ((SZ) & SMMUV2_TCR_T0SZ_MSK)
@@ -383,5 +397,6 @@ streamid_t smmu_sme_get_id(size_t sme);
 streamid_t smmu_sme_get_mask(size_t sme);
 bool smmu_sme_is_group(size_t sme);
 bool smmu_compatible_sme_exists(streamid_t mask, streamid_t id, size_t ctx, bool group);
+void smmu_inv_ipa(asid_t vm_id, paddr_t ipa, size_t size);
 
 #endif
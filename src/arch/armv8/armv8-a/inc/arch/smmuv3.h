@@ -0,0 +1,150 @@
+/**
+ * SPDX-License-Identifier: Apache-2.0
+ * Copyright (c) Bao Project and Contributors. All rights reserved.
+ */
+
+#ifndef __ARCH_SMMUV3_H__
+#define __ARCH_SMMUV3_H__
+
+#include <bao.h>
+
+#define SMMUV3_IDR0_S2P_BIT             (0x1UL << 0)
+#define SMMUV3_IDR0_TTF_AA64_BIT        (0x1UL << 3)
+#define SMMUV3_IDR0_COHACC_BIT          (0x1UL << 4)
+#define SMMUV3_IDR0_ST_LEVEL_OFF        (27)
+#define SMMUV3_IDR0_ST_LEVEL_LEN        (2)
+#define SMMUV3_IDR0_ST_LEVEL_2LVL       (0x1)
+
+#define SMMUV3_IDR1_SIDSIZE_OFF         (0)
+#define SMMUV3_IDR1_SIDSIZE_LEN         (6)
+#define SMMUV3_IDR1_CMDQS_OFF           (21)
+#define SMMUV3_IDR1_CMDQS_LEN           (5)
+#define SMMUV3_IDR1_QUEUES_PRESET_BIT   (0x1UL << 29)
+#define SMMUV3_IDR1_TABLES_PRESET_BIT   (0x1UL << 30)
+
+#define SMMUV3_IDR3_RIL_BIT             (0x1UL << 10)
+
+#define SMMUV3_IDR5_OAS_OFF             (0)
+#define SMMUV3_IDR5_OAS_LEN             (3)
+#define SMMUV3_IDR5_GRAN4K_BIT          (0x1UL << 4)
+
+#define SMMUV3_AIDR_MAJOR_OFF           (4)
+#define SMMUV3_AIDR_MAJOR_LEN           (4)
+
+#define SMMUV3_CR0_SMMUEN_BIT           (0x1UL << 0)
+#define SMMUV3_CR0_CMDQEN_BIT           (0x1UL << 3)
+
+#define SMMUV3_CR1_QUEUE_IC_WB          (0x1UL << 0)
+#define SMMUV3_CR1_QUEUE_OC_WB          (0x1UL << 2)
+#define SMMUV3_CR1_QUEUE_SH_IS          (0x3UL << 4)
+#define SMMUV3_CR1_TABLE_IC_WB          (0x1UL << 6)
+#define SMMUV3_CR1_TABLE_OC_WB          (0x1UL << 8)
+#define SMMUV3_CR1_TABLE_SH_IS          (0x3UL << 10)
+
+#define SMMUV3_CR2_RECINVSID_BIT        (0x1UL << 1)
+#define SMMUV3_CR2_PTM_BIT              (0x1UL << 2)
+
+#define SMMUV3_GERROR_CMDQ_ERR_BIT      (0x1UL << 0)
+
+#define SMMUV3_STRTAB_BASE_RA_BIT       (0x1ULL << 62)
+#define SMMUV3_STRTAB_BASE_ADDR_MSK     BIT64_MASK(6, 46)
+#define SMMUV3_STRTAB_BASE_CFG_LOG2SIZE_OFF (0)
+#define SMMUV3_STRTAB_BASE_CFG_SPLIT_OFF    (6)
+#define SMMUV3_STRTAB_BASE_CFG_FMT_2LVL     (0x1UL << 16)
+
+#define SMMUV3_CMDQ_BASE_RA_BIT         (0x1ULL << 62)
+#define SMMUV3_CMDQ_BASE_ADDR_MSK       BIT64_MASK(5, 47)
+#define SMMUV3_CMDQ_CONS_ERR_OFF        (24)
+#define SMMUV3_CMDQ_CONS_ERR_LEN        (7)
+
+/* Stream table entries, in double words */
+#define SMMUV3_STE_SIZE                 (64)
+#define SMMUV3_STE_DWORDS               (SMMUV3_STE_SIZE / sizeof(uint64_t))
+#define SMMUV3_STE_0_V_BIT              (0x1ULL << 0)
+#define SMMUV3_STE_0_CONFIG_OFF         (1)
+#define SMMUV3_STE_0_CONFIG_LEN         (3)
+#define SMMUV3_STE_0_CONFIG_ABORT       (0x0ULL << SMMUV3_STE_0_CONFIG_OFF)
+#define SMMUV3_STE_0_CONFIG_S2_TRANS    (0x6ULL << SMMUV3_STE_0_CONFIG_OFF)
+#define SMMUV3_STE_1_SHCFG_INCOMING     (0x1ULL << 44)
+#define SMMUV3_STE_2_S2VMID_OFF         (0)
+#define SMMUV3_STE_2_S2VMID_LEN         (16)
+/* S2VTCR holds the same fields as VTCR_EL2's 19 lowest bits */
+#define SMMUV3_STE_2_S2VTCR_OFF         (32)
+#define SMMUV3_STE_2_S2VTCR_LEN         (19)
+#define SMMUV3_STE_2_S2AA64_BIT         (0x1ULL << 51)
+#define SMMUV3_STE_3_S2TTB_MSK          BIT64_MASK(4, 48)
+
+/* Level 1 stream table descriptors, each pointing to a table of 2^SMMUV3_STRTAB_SPLIT STEs */
+#define SMMUV3_STRTAB_SPLIT             (6)
+#define SMMUV3_L1STD_SPAN               (SMMUV3_STRTAB_SPLIT + 1)
+#define SMMUV3_L1STD_L2PTR_MSK          BIT64_MASK(6, 46)
+
+/* Streams with ids up to this size are described by a linear stream table */
+#define SMMUV3_STRTAB_LINEAR_SIDSIZE    (8)
+
+#define SMMUV3_CMDQ_LOG2SIZE_MAX        (8)
+
+/* VMIDs are as wide as in VTTBR_EL2 */
+#define SMMUV3_VMID_NUM                 (256)
+
+#define SMMUV3_CMD_CFGI_STE             (0x03)
+#define SMMUV3_CMD_CFGI_ALL             (0x04)
+#define SMMUV3_CMD_TLBI_S12_VMALL       (0x28)
+#define SMMUV3_CMD_TLBI_S2_IPA          (0x2a)
+#define SMMUV3_CMD_TLBI_NSNH_ALL        (0x30)
+#define SMMUV3_CMD_SYNC                 (0x46)
+
+#define SMMUV3_CMD_0_SID_OFF            (32)
+#define SMMUV3_CMD_0_VMID_OFF           (32)
+#define SMMUV3_CMD_0_NUM_OFF            (12)
+#define SMMUV3_CMD_0_SCALE_OFF          (20)
+#define SMMUV3_CMD_1_TG_4K              (0x1ULL << 10)
+#define SMMUV3_CMD_1_ADDR_MSK           BIT64_MASK(12, 40)
+#define SMMUV3_CMD_1_RANGE_ALL          (31)
+
+struct smmuv3_hw {
+    uint32_t IDR0;
+    uint32_t IDR1;
+    uint32_t IDR2;
+    uint32_t IDR3;
+    uint32_t IDR4;
+    uint32_t IDR5;
+    uint32_t IIDR;
+    uint32_t AIDR;
+    uint32_t CR0;
+    uint32_t CR0ACK;
+    uint32_t CR1;
+    uint32_t CR2;
+    uint8_t pad1[0x40 - 0x30];
+    uint32_t STATUSR;
+    uint32_t GBPA;
+    uint32_t AGBPA;
+    uint8_t pad2[0x50 - 0x4c];
+    uint32_t IRQ_CTRL;
+    uint32_t IRQ_CTRLACK;
+    uint8_t pad3[0x60 - 0x58];
+    uint32_t GERROR;
+    uint32_t GERRORN;
+    uint64_t GERROR_IRQ_CFG0;
+    uint32_t GERROR_IRQ_CFG1;
+    uint32_t GERROR_IRQ_CFG2;
+    uint8_t pad4[0x80 - 0x78];
+    uint64_t STRTAB_BASE;
+    uint32_t STRTAB_BASE_CFG;
+    uint8_t pad5[0x90 - 0x8c];
+    uint64_t CMDQ_BASE;
+    uint32_t CMDQ_PROD;
+    uint32_t CMDQ_CONS;
+    uint64_t EVENTQ_BASE;
+    uint8_t pad6[0x1000 - 0xa8];
+} __attribute__((__packed__, __aligned__(PAGE_SIZE)));
+
+typedef deviceid_t streamid_t;
+
+void smmu_init();
+
+bool smmu_write_ste(streamid_t mask, streamid_t id, asid_t vm_id, paddr_t root_pt);
+void smmu_inv_ipa(asid_t vm_id, paddr_t ipa, size_t size);
+void smmu_inv_vmid(asid_t vm_id);
+
+#endif
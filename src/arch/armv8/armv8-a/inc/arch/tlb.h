@@ -38,11 +38,19 @@ static inline void tlb_vm_inv_va(asid_t vmid, vaddr_t va)
         ISB();
     }
 
+    DSB(ishst);
     arm_tlbi_ipas2e1is(va);
+    /**
+     * Invalidating by IPA only affects stage 2 entries. Entries combining both stages of
+     * translation can only be invalidated for the whole VMID.
+     */
+    DSB(ish);
+    arm_tlbi_vmalle1is();
+    DSB(ish);
 
     if (switch_vmid) {
-        DSB(ish);
-        sysreg_vttbr_el2_write(((uint64_t)vmid << VTTBR_VMID_OFF) & VTTBR_VMID_MSK);
+        sysreg_vttbr_el2_write(vttbr);
+        ISB();
     }
 }
 
@@ -58,11 +66,13 @@ static inline void tlb_vm_inv_all(asid_t vmid)
         ISB();
     }
 
+    DSB(ishst);
     arm_tlbi_vmalls12e1is();
+    DSB(ish);
 
     if (switch_vmid) {
-        DSB(ish);
-        sysreg_vttbr_el2_write(((uint64_t)vmid << VTTBR_VMID_OFF) & VTTBR_VMID_MSK);
+        sysreg_vttbr_el2_write(vttbr);
+        ISB();
     }
 }
 
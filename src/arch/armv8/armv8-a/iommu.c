@@ -19,6 +19,22 @@ bool iommu_arch_init()
     return false;
 }
 
+#if (SMMU_VERSION == SMMUV3)
+
+/**
+ * The smmuv3 has no context banks, each of the VM's streams points to its stage 2 page table
+ * directly.
+ */
+static bool iommu_vm_arch_add(struct vm* vm, streamid_t mask, streamid_t id)
+{
+    paddr_t rootpt;
+    mem_translate(&cpu()->as, (vaddr_t)vm->as.pt.root, &rootpt);
+
+    return smmu_write_ste(mask | vm->io.prot.mmu.global_mask, id, vm->id, rootpt);
+}
+
+#else
+
 static ssize_t iommu_vm_arch_init_ctx(struct vm* vm)
 {
     ssize_t ctx_id = vm->io.prot.mmu.ctx_id;
@@ -64,6 +80,8 @@ static bool iommu_vm_arch_add(struct vm* vm, streamid_t mask, streamid_t id)
     return true;
 }
 
+#endif
+
 inline bool iommu_arch_vm_add_device(struct vm* vm, streamid_t id)
 {
     return iommu_vm_arch_add(vm, 0, id);
@@ -73,7 +91,9 @@ bool iommu_arch_vm_init(struct vm* vm, const struct vm_config* config)
 {
     vm->io.prot.mmu.global_mask =
         config->platform.arch.smmu.global_mask | platform.arch.smmu.global_mask;
+#if (SMMU_VERSION != SMMUV3)
     vm->io.prot.mmu.ctx_id = -1;
+#endif
 
     /* This section relates only to arm's iommu so we parse it here. */
     for (size_t i = 0; i < config->platform.arch.smmu.group_num; i++) {
@@ -86,3 +106,8 @@ bool iommu_arch_vm_init(struct vm* vm, const struct vm_config* config)
 
     return true;
 }
+
+void iommu_arch_inv_range(asid_t vm_id, vaddr_t va, size_t size)
+{
+    smmu_inv_ipa(vm_id, va, size);
+}
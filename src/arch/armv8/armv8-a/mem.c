@@ -24,6 +24,28 @@ void as_arch_init(struct addr_space* as)
     pt_set_recursive(&as->pt, index);
 }
 
+/**
+ * VM page tables are accessed through the PT_VM_REC_IND recursive entry of the current cpu's root
+ * page table, which as_arch_init only sets up on the cpu creating the address space. Before
+ * operating on a VM address space from any cpu, make sure this entry points to its root table.
+ */
+void as_arch_pt_attach(struct addr_space* as)
+{
+    if (as->type != AS_VM) {
+        return;
+    }
+
+    pte_t* pte = cpu()->as.pt.root + PT_VM_REC_IND;
+    if (!pte_valid(pte) || (pte_addr(pte) != as->pt.arch.root_pa)) {
+        pte_set(pte, as->pt.arch.root_pa, PTE_TABLE, PTE_HYP_FLAGS);
+        /* The root page table is private to this cpu, so a local invalidation suffices */
+        DSB(ishst);
+        arm_tlbi_alle2();
+        DSB(ish);
+        ISB();
+    }
+}
+
 bool mem_translate(struct addr_space* as, vaddr_t va, paddr_t* pa)
 {
     uint64_t par = 0, par_saved = 0;
@@ -7,7 +7,14 @@ cpu-objs-y+=$(ARCH_PROFILE)/mem.o
 cpu-objs-y+=$(ARCH_PROFILE)/vm.o
 cpu-objs-y+=$(ARCH_PROFILE)/vmm.o
 cpu-objs-y+=$(ARCH_PROFILE)/psci.o
-cpu-objs-y+=$(ARCH_PROFILE)/smmuv2.o
 cpu-objs-y+=$(ARCH_PROFILE)/iommu.o
 cpu-objs-y+=$(ARCH_PROFILE)/cpu.o
 cpu-objs-y+=$(ARCH_PROFILE)/smc.o
+
+ifeq ($(SMMU_VERSION), SMMUV2)
+	cpu-objs-y+=$(ARCH_PROFILE)/smmuv2.o
+else ifeq ($(SMMU_VERSION), SMMUV3)
+	cpu-objs-y+=$(ARCH_PROFILE)/smmuv3.o
+else
+$(error Invalid SMMU version $(SMMU_VERSION))
+endif
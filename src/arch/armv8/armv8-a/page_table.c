@@ -59,6 +59,7 @@ void pt_set_recursive(struct page_table* pt, size_t index)
     mem_translate(&cpu()->as, (vaddr_t)pt->root, &pa);
     pte_t* pte = cpu()->as.pt.root + index;
     pte_set(pte, pa, PTE_TABLE, PTE_HYP_FLAGS);
+    pt->arch.root_pa = pa;
     pt->arch.rec_ind = index;
     pt->arch.rec_mask = 0;
     size_t cpu_rec_ind = cpu()->as.pt.arch.rec_ind;
@@ -8,3 +8,7 @@ arch-ldflags+=
 
 arch_mem_prot:=mmu
 PAGE_SIZE:=0x1000
+
+# Platforms with an SMMUv3 must set SMMU_VERSION:=SMMUV3
+SMMU_VERSION?=SMMUV2
+arch-cppflags+=-DSMMU_VERSION=$(SMMU_VERSION)
@@ -8,13 +8,19 @@
 #include <bitmap.h>
 #include <bit.h>
 #include <arch/sysregs.h>
+#include <arch/fences.h>
 #include <platform.h>
 #include <cpu.h>
 #include <mem.h>
+#include <io.h>
+#include <interrupts.h>
 
 #define SME_MAX_NUM 128
 #define CTX_MAX_NUM 128
 
+/* Larger ranges are invalidated for the whole VMID */
+#define SMMUV2_TLBI_PAGES_MAX (32)
+
 struct smmu_hw {
     volatile struct smmu_glbl_rs0_hw* glbl_rs0;
     volatile struct smmu_glbl_rs1_hw* glbl_rs1;
@@ -116,6 +122,40 @@ static void smmu_check_features()
     }
 }
 
+/**
+ * Global faults, e.g., of streams matching no entry, and the context faults of all banks are
+ * signaled by the smmu's fault interrupt. Faults are only recorded here, and the transactions
+ * stalled by a context fault terminated.
+ */
+static void smmu_fault_handler(irqid_t int_id)
+{
+    uint32_t gfsr = smmu.hw.glbl_rs0->GFSR;
+    if (gfsr & SMMUV2_GFSR_FAULTS) {
+        io_fault_record(smmu.hw.glbl_rs0->GFSYNR1 & SMMUV2_GFSYNR1_SID_MSK, gfsr,
+            smmu.hw.glbl_rs0->GFAR);
+        smmu.hw.glbl_rs0->GFSR = gfsr;
+    }
+
+    for (size_t ctx_id = 0; ctx_id < smmu.ctx_num; ctx_id++) {
+        if (!bitmap_get(smmu.ctxbank_bitmap, ctx_id)) {
+            continue;
+        }
+
+        uint32_t fsr = smmu.hw.cntxt[ctx_id].FSR;
+        if (!(fsr & SMMUV2_FSR_FAULTS)) {
+            continue;
+        }
+
+        /* Stage 2 only banks report the faulting IPA in FAR */
+        io_fault_record(smmu.hw.glbl_rs1->CBFRSYNRA[ctx_id] & SMMUV2_CBFRSYNRA_SID_MSK, fsr,
+            smmu.hw.cntxt[ctx_id].FAR);
+        smmu.hw.cntxt[ctx_id].FSR = fsr;
+        if (fsr & SMMUV2_FSR_SS) {
+            smmu.hw.cntxt[ctx_id].RESUME = SMMUV2_RESUME_TERMINATE;
+        }
+    }
+}
+
 void smmu_init()
 {
     /*
@@ -175,6 +215,14 @@ void smmu_init()
     cr0 = SMMUV2_CR0_CLEAR(cr0);
     cr0 |= SMMUV2_CR0_USFCFG | SMMUV2_CR0_SMCFCFG;
     cr0 &= ~SMMUV2_CR0_CLIENTPD;
+
+    if (platform.arch.smmu.interrupt_id != 0) {
+        if (!interrupts_reserve(platform.arch.smmu.interrupt_id, smmu_fault_handler)) {
+            ERROR("Failed to reserve the smmu fault interrupt");
+        }
+        interrupts_cpu_enable(platform.arch.smmu.interrupt_id, true);
+        cr0 |= SMMUV2_CR0_GFRE | SMMUV2_CR0_GFIE;
+    }
     smmu.hw.glbl_rs0->CR0 = cr0;
 }
 
@@ -344,3 +392,37 @@ void smmu_write_s2c(size_t sme, size_t ctx_id)
     }
     spin_unlock(&smmu.sme_lock);
 }
+
+/**
+ * Invalidates the translations of a VM's IPA range cached by the context banks translating its
+ * streams. The invalidations of each bank, or of the whole VMID for larger ranges, complete with
+ * a single sync.
+ */
+void smmu_inv_ipa(asid_t vm_id, paddr_t ipa, size_t size)
+{
+    size_t num_pages = NUM_PAGES(size);
+
+    /* The page table updates must be visible to the smmu's walks. */
+    DSB(st);
+
+    spin_lock(&smmu.ctx_lock);
+    for (size_t ctx_id = 0; ctx_id < smmu.ctx_num; ctx_id++) {
+        if (!bitmap_get(smmu.ctxbank_bitmap, ctx_id) ||
+            (SMMUV2_CBAR_VMID(smmu.hw.glbl_rs1->CBAR[ctx_id]) != SMMUV2_CBAR_VMID(vm_id))) {
+            continue;
+        }
+
+        if (num_pages > SMMUV2_TLBI_PAGES_MAX) {
+            smmu.hw.glbl_rs0->TLBIVMID = SMMUV2_CBAR_VMID(vm_id);
+            smmu.hw.glbl_rs0->TLBGSYNC = 0;
+            while (smmu.hw.glbl_rs0->TLBGSTATUS & SMMUV2_TLBGSTATUS_GSACTIVE) { }
+        } else {
+            for (size_t i = 0; i < num_pages; i++) {
+                smmu.hw.cntxt[ctx_id].TLBIIPAS2 = (ipa + (i * PAGE_SIZE)) >> 12;
+            }
+            smmu.hw.cntxt[ctx_id].TLBSYNC = 0;
+            while (smmu.hw.cntxt[ctx_id].TLBSTATUS & SMMUV2_TLBSTATUS_SACTIVE) { }
+        }
+    }
+    spin_unlock(&smmu.ctx_lock);
+}
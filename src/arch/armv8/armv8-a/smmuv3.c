@@ -0,0 +1,438 @@
+/**
+ * SPDX-License-Identifier: Apache-2.0
+ * Copyright (c) Bao Project and Contributors. All rights reserved.
+ */
+
+#include <arch/smmuv3.h>
+#include <arch/spinlock.h>
+#include <arch/sysregs.h>
+#include <arch/fences.h>
+#include <bit.h>
+#include <bitmap.h>
+#include <string.h>
+#include <platform.h>
+#include <cpu.h>
+#include <mem.h>
+
+/* Stream ids are limited to this size, which bounds the stream table's memory footprint */
+#define SMMUV3_SIDSIZE_MAX    (16)
+
+/* Commands written to the queue before it is handed over to the smmu */
+#define SMMUV3_CMD_BATCH_MAX  (16)
+
+#define SMMUV3_TLBI_RANGE_NUM (31)
+
+/* Without range invalidation, larger ranges are invalidated for the whole VMID */
+#define SMMUV3_TLBI_PAGES_MAX (32)
+
+struct smmu_cmd {
+    uint64_t dw[2];
+};
+
+struct smmu_cmd_batch {
+    size_t num;
+    struct smmu_cmd cmds[SMMUV3_CMD_BATCH_MAX];
+};
+
+struct smmu_priv {
+    volatile struct smmuv3_hw* hw;
+
+    bool range_inv;
+    size_t sid_size;
+    /* Stage 2 translation parameters, shared with the VMs' page tables */
+    uint64_t vtcr;
+
+    /* Either the STEs of a linear stream table or the level 1 descriptors of a 2-level one */
+    spinlock_t strtab_lock;
+    bool strtab_2lvl;
+    uint64_t* strtab;
+    uint64_t** l2_strtabs;
+    /* VMs with at least one stream, whose translations the smmu may have cached */
+    BITMAP_ALLOC(vmid_bitmap, SMMUV3_VMID_NUM);
+
+    spinlock_t cmdq_lock;
+    struct smmu_cmd* cmdq;
+    size_t cmdq_log2size;
+    uint32_t cmdq_prod;
+};
+
+struct smmu_priv smmu;
+
+static void smmu_check_features()
+{
+    unsigned version = bit32_extract(smmu.hw->AIDR, SMMUV3_AIDR_MAJOR_OFF, SMMUV3_AIDR_MAJOR_LEN);
+    if (version != 0) {
+        ERROR("smmu unsupported version: %d", version + 3);
+    }
+
+    if (!(smmu.hw->IDR0 & SMMUV3_IDR0_S2P_BIT)) {
+        ERROR("smmuv3 does not support 2nd stage translation");
+    }
+
+    if (!(smmu.hw->IDR0 & SMMUV3_IDR0_TTF_AA64_BIT)) {
+        ERROR("smmuv3 does not support aarch64 translation tables");
+    }
+
+    if (!(smmu.hw->IDR5 & SMMUV3_IDR5_GRAN4K_BIT)) {
+        ERROR("smmuv3 does not support 4kb page granule");
+    }
+
+    if (smmu.hw->IDR1 & (SMMUV3_IDR1_TABLES_PRESET_BIT | SMMUV3_IDR1_QUEUES_PRESET_BIT)) {
+        ERROR("smmuv3 with fixed table and queue addresses not supported");
+    }
+
+    /**
+     * The VMs' page tables, shared with the smmu, are written through the cache without cleaning
+     * them to the point of coherency, so the smmu's table walks must snoop it.
+     */
+    if (!(smmu.hw->IDR0 & SMMUV3_IDR0_COHACC_BIT)) {
+        ERROR("smmuv3 does not support coherent accesses");
+    }
+
+    size_t pasize = bit32_extract(smmu.hw->IDR5, SMMUV3_IDR5_OAS_OFF, SMMUV3_IDR5_OAS_LEN);
+    if (pasize < parange) {
+        ERROR("smmuv3 does not support the full available pa range");
+    }
+}
+
+static void* smmu_alloc_table(size_t size, paddr_t* pa)
+{
+    size_t num_pages = NUM_PAGES(size);
+    void* table = mem_alloc_page(num_pages, SEC_HYP_GLOBAL, true);
+
+    if (table == NULL) {
+        ERROR("smmuv3 could not allocate %d pages", num_pages);
+    }
+    memset(table, 0, num_pages * PAGE_SIZE);
+    mem_translate(&cpu()->as, (vaddr_t)table, pa);
+
+    return table;
+}
+
+/**
+ * Command queue. The producer index and wrap bit are only kept in the smmu's register once a
+ * batch of commands is written to the queue, as the smmu may start consuming them right away.
+ */
+
+static inline uint32_t smmu_cmdq_idx(uint32_t ptr)
+{
+    return ptr & BIT32_MASK(0, smmu.cmdq_log2size);
+}
+
+static inline uint32_t smmu_cmdq_wrap(uint32_t ptr)
+{
+    return ptr & (1U << smmu.cmdq_log2size);
+}
+
+static uint32_t smmu_cmdq_cons()
+{
+    uint32_t cons = smmu.hw->CMDQ_CONS;
+
+    if ((smmu.hw->GERROR ^ smmu.hw->GERRORN) & SMMUV3_GERROR_CMDQ_ERR_BIT) {
+        ERROR("smmuv3 command queue error %d",
+            bit32_extract(cons, SMMUV3_CMDQ_CONS_ERR_OFF, SMMUV3_CMDQ_CONS_ERR_LEN));
+    }
+
+    return cons & BIT32_MASK(0, smmu.cmdq_log2size + 1);
+}
+
+static inline bool smmu_cmdq_full(uint32_t cons)
+{
+    return (smmu_cmdq_idx(smmu.cmdq_prod) == smmu_cmdq_idx(cons)) &&
+        (smmu_cmdq_wrap(smmu.cmdq_prod) != smmu_cmdq_wrap(cons));
+}
+
+static void smmu_cmdq_publish()
+{
+    DSB(st);
+    smmu.hw->CMDQ_PROD = smmu.cmdq_prod;
+}
+
+static void smmu_cmdq_write(const struct smmu_cmd* cmds, size_t num)
+{
+    for (size_t i = 0; i < num; i++) {
+        if (smmu_cmdq_full(smmu_cmdq_cons())) {
+            smmu_cmdq_publish();
+            while (smmu_cmdq_full(smmu_cmdq_cons())) { }
+        }
+
+        struct smmu_cmd* entry = &smmu.cmdq[smmu_cmdq_idx(smmu.cmdq_prod)];
+        *entry = cmds[i];
+        smmu.cmdq_prod = (smmu.cmdq_prod + 1) & BIT32_MASK(0, smmu.cmdq_log2size + 1);
+    }
+}
+
+/**
+ * Hands a batch of commands over to the smmu. If sync is set, a single CMD_SYNC follows them and
+ * the batch only returns once the smmu has consumed it, i.e., once all of them have completed.
+ */
+static void smmu_cmdq_submit(struct smmu_cmd_batch* batch, bool sync)
+{
+    spin_lock(&smmu.cmdq_lock);
+    smmu_cmdq_write(batch->cmds, batch->num);
+    if (sync) {
+        struct smmu_cmd cmd = { .dw = { SMMUV3_CMD_SYNC, 0 } };
+        smmu_cmdq_write(&cmd, 1);
+    }
+    smmu_cmdq_publish();
+    if (sync) {
+        while (smmu_cmdq_cons() != smmu.cmdq_prod) { }
+    }
+    spin_unlock(&smmu.cmdq_lock);
+
+    batch->num = 0;
+}
+
+static void smmu_batch_add(struct smmu_cmd_batch* batch, uint64_t dw0, uint64_t dw1)
+{
+    if (batch->num == SMMUV3_CMD_BATCH_MAX) {
+        smmu_cmdq_submit(batch, false);
+    }
+
+    batch->cmds[batch->num].dw[0] = dw0;
+    batch->cmds[batch->num].dw[1] = dw1;
+    batch->num++;
+}
+
+static void smmu_cmdq_init()
+{
+    paddr_t pa;
+    size_t log2size =
+        bit32_extract(smmu.hw->IDR1, SMMUV3_IDR1_CMDQS_OFF, SMMUV3_IDR1_CMDQS_LEN);
+
+    smmu.cmdq_log2size = (log2size < SMMUV3_CMDQ_LOG2SIZE_MAX) ? log2size : SMMUV3_CMDQ_LOG2SIZE_MAX;
+    smmu.cmdq = smmu_alloc_table(sizeof(struct smmu_cmd) << smmu.cmdq_log2size, &pa);
+    smmu.cmdq_prod = 0;
+    smmu.cmdq_lock = SPINLOCK_INITVAL;
+
+    smmu.hw->CMDQ_BASE = SMMUV3_CMDQ_BASE_RA_BIT | (pa & SMMUV3_CMDQ_BASE_ADDR_MSK) |
+        smmu.cmdq_log2size;
+    smmu.hw->CMDQ_PROD = 0;
+    smmu.hw->CMDQ_CONS = 0;
+}
+
+/**
+ * Stream table. Streams not assigned to any VM have their transactions aborted, either by an
+ * abort STE or, in 2-level tables, by an invalid level 1 descriptor.
+ */
+
+static void smmu_strtab_abort(uint64_t* stes, size_t num)
+{
+    for (size_t i = 0; i < num; i++) {
+        stes[i * SMMUV3_STE_DWORDS] = SMMUV3_STE_0_V_BIT | SMMUV3_STE_0_CONFIG_ABORT;
+    }
+}
+
+static void smmu_strtab_init()
+{
+    paddr_t pa;
+    uint32_t cfg = smmu.sid_size << SMMUV3_STRTAB_BASE_CFG_LOG2SIZE_OFF;
+    size_t st_level =
+        bit32_extract(smmu.hw->IDR0, SMMUV3_IDR0_ST_LEVEL_OFF, SMMUV3_IDR0_ST_LEVEL_LEN);
+
+    smmu.strtab_lock = SPINLOCK_INITVAL;
+    bitmap_clear_consecutive(smmu.vmid_bitmap, 0, SMMUV3_VMID_NUM);
+    smmu.strtab_2lvl =
+        (st_level == SMMUV3_IDR0_ST_LEVEL_2LVL) && (smmu.sid_size > SMMUV3_STRTAB_LINEAR_SIDSIZE);
+
+    if (smmu.strtab_2lvl) {
+        size_t l1_num = 1UL << (smmu.sid_size - SMMUV3_STRTAB_SPLIT);
+        size_t l2_ptrs_size = l1_num * sizeof(uint64_t*);
+
+        smmu.strtab = smmu_alloc_table(l1_num * sizeof(uint64_t), &pa);
+        smmu.l2_strtabs = mem_alloc_page(NUM_PAGES(l2_ptrs_size), SEC_HYP_GLOBAL, false);
+        if (smmu.l2_strtabs == NULL) {
+            ERROR("smmuv3 could not allocate stream table");
+        }
+        memset(smmu.l2_strtabs, 0, l2_ptrs_size);
+
+        cfg |= SMMUV3_STRTAB_BASE_CFG_FMT_2LVL;
+        cfg |= SMMUV3_STRTAB_SPLIT << SMMUV3_STRTAB_BASE_CFG_SPLIT_OFF;
+    } else {
+        size_t ste_num = 1UL << smmu.sid_size;
+        smmu.strtab = smmu_alloc_table(ste_num * SMMUV3_STE_SIZE, &pa);
+        smmu_strtab_abort(smmu.strtab, ste_num);
+    }
+
+    smmu.hw->STRTAB_BASE = SMMUV3_STRTAB_BASE_RA_BIT | (pa & SMMUV3_STRTAB_BASE_ADDR_MSK);
+    smmu.hw->STRTAB_BASE_CFG = cfg;
+}
+
+static uint64_t* smmu_strtab_get_ste(streamid_t sid)
+{
+    if (!smmu.strtab_2lvl) {
+        return &smmu.strtab[sid * SMMUV3_STE_DWORDS];
+    }
+
+    size_t l1_idx = sid >> SMMUV3_STRTAB_SPLIT;
+    uint64_t* l2_strtab = smmu.l2_strtabs[l1_idx];
+
+    if (l2_strtab == NULL) {
+        paddr_t pa;
+        size_t ste_num = 1UL << SMMUV3_STRTAB_SPLIT;
+
+        l2_strtab = smmu_alloc_table(ste_num * SMMUV3_STE_SIZE, &pa);
+        smmu_strtab_abort(l2_strtab, ste_num);
+        smmu.l2_strtabs[l1_idx] = l2_strtab;
+
+        smmu.strtab[l1_idx] = (pa & SMMUV3_L1STD_L2PTR_MSK) | SMMUV3_L1STD_SPAN;
+    }
+
+    return &l2_strtab[(sid & BIT32_MASK(0, SMMUV3_STRTAB_SPLIT)) * SMMUV3_STE_DWORDS];
+}
+
+void smmu_init()
+{
+    vaddr_t smmu_regs = mem_alloc_map_dev(&cpu()->as, SEC_HYP_GLOBAL, INVALID_VA,
+        platform.arch.smmu.base, NUM_PAGES(sizeof(struct smmuv3_hw)));
+
+    smmu.hw = (struct smmuv3_hw*)smmu_regs;
+
+    smmu_check_features();
+
+    size_t sid_size = bit32_extract(smmu.hw->IDR1, SMMUV3_IDR1_SIDSIZE_OFF, SMMUV3_IDR1_SIDSIZE_LEN);
+    smmu.sid_size = (sid_size < SMMUV3_SIDSIZE_MAX) ? sid_size : SMMUV3_SIDSIZE_MAX;
+    smmu.range_inv = (smmu.hw->IDR3 & SMMUV3_IDR3_RIL_BIT) != 0;
+
+    /**
+     * This must match the VTCR configuration set up in vmm_arch_init, which precedes the iommu's,
+     * as the streams share the VMs' page tables.
+     */
+    smmu.vtcr = sysreg_vtcr_el2_read();
+
+    /* Disable the smmu, in case it was left enabled, before setting up its tables and queues. */
+    smmu.hw->CR0 = 0;
+    while (smmu.hw->CR0ACK != 0) { }
+
+    /* Clear random reset state. */
+    smmu.hw->GERRORN = smmu.hw->GERROR;
+
+    smmu_strtab_init();
+    smmu_cmdq_init();
+
+    smmu.hw->CR1 = SMMUV3_CR1_TABLE_IC_WB | SMMUV3_CR1_TABLE_OC_WB | SMMUV3_CR1_TABLE_SH_IS |
+        SMMUV3_CR1_QUEUE_IC_WB | SMMUV3_CR1_QUEUE_OC_WB | SMMUV3_CR1_QUEUE_SH_IS;
+    smmu.hw->CR2 = SMMUV3_CR2_RECINVSID_BIT;
+
+    smmu.hw->CR0 = SMMUV3_CR0_CMDQEN_BIT;
+    while (smmu.hw->CR0ACK != SMMUV3_CR0_CMDQEN_BIT) { }
+
+    /* Nothing cached from before the reset may survive it. */
+    struct smmu_cmd_batch batch = { .num = 0 };
+    smmu_batch_add(&batch, SMMUV3_CMD_CFGI_ALL, SMMUV3_CMD_1_RANGE_ALL);
+    smmu_batch_add(&batch, SMMUV3_CMD_TLBI_NSNH_ALL, 0);
+    smmu_cmdq_submit(&batch, true);
+
+    /* Enable IOMMU. */
+    smmu.hw->CR0 = SMMUV3_CR0_CMDQEN_BIT | SMMUV3_CR0_SMMUEN_BIT;
+    while (smmu.hw->CR0ACK != (SMMUV3_CR0_CMDQEN_BIT | SMMUV3_CR0_SMMUEN_BIT)) { }
+}
+
+/**
+ * There are no stream match entries, so every stream id matching id on the bits not set in mask
+ * gets its own STE. These translate the streams' addresses through the VM's stage 2 page table
+ * alone, as in smmuv2's context banks. Stage 1 is bypassed, so there are no context descriptors.
+ * All the STEs of the group are invalidated in a single batch.
+ */
+bool smmu_write_ste(streamid_t mask, streamid_t id, asid_t vm_id, paddr_t root_pt)
+{
+    streamid_t sid_mask = BIT32_MASK(0, smmu.sid_size);
+    struct smmu_cmd_batch batch = { .num = 0 };
+    uint64_t ste[SMMUV3_STE_DWORDS] = { 0 };
+
+    if ((id & ~mask & ~sid_mask) != 0) {
+        INFO("smmuv3 stream id %d out of range", id);
+        return false;
+    }
+    mask &= sid_mask;
+
+    ste[0] = SMMUV3_STE_0_V_BIT | SMMUV3_STE_0_CONFIG_S2_TRANS;
+    ste[1] = SMMUV3_STE_1_SHCFG_INCOMING;
+    ste[2] = (vm_id & BIT64_MASK(0, SMMUV3_STE_2_S2VMID_LEN)) << SMMUV3_STE_2_S2VMID_OFF;
+    ste[2] |= (smmu.vtcr & BIT64_MASK(0, SMMUV3_STE_2_S2VTCR_LEN)) << SMMUV3_STE_2_S2VTCR_OFF;
+    ste[2] |= SMMUV3_STE_2_S2AA64_BIT;
+    ste[3] = root_pt & SMMUV3_STE_3_S2TTB_MSK;
+
+    spin_lock(&smmu.strtab_lock);
+    bitmap_set(smmu.vmid_bitmap, vm_id % SMMUV3_VMID_NUM);
+    streamid_t sub = 0;
+    do {
+        streamid_t sid = (id & ~mask) | sub;
+        uint64_t* entry = smmu_strtab_get_ste(sid);
+        uint64_t config = entry[0] & BIT64_MASK(SMMUV3_STE_0_CONFIG_OFF, SMMUV3_STE_0_CONFIG_LEN);
+
+        if (config == SMMUV3_STE_0_CONFIG_S2_TRANS) {
+            if (entry[2] != ste[2] || entry[3] != ste[3]) {
+                ERROR("smmuv3 stream %d conflict", sid);
+            }
+        } else {
+            /* The entry only becomes a translating one once all its other fields are written */
+            for (size_t i = 1; i < SMMUV3_STE_DWORDS; i++) {
+                entry[i] = ste[i];
+            }
+            DMB(st);
+            entry[0] = ste[0];
+
+            smmu_batch_add(&batch, SMMUV3_CMD_CFGI_STE | ((uint64_t)sid << SMMUV3_CMD_0_SID_OFF),
+                0);
+        }
+
+        /* Next combination of the mask bits */
+        sub = (sub - mask) & mask;
+    } while (sub != 0);
+    spin_unlock(&smmu.strtab_lock);
+
+    smmu_cmdq_submit(&batch, true);
+
+    return true;
+}
+
+/**
+ * Invalidates the stage 2 translations of a VM's IPA range. With range invalidation, each
+ * command covers up to SMMUV3_TLBI_RANGE_NUM times a power of two pages, otherwise each covers a
+ * single page, up to SMMUV3_TLBI_PAGES_MAX. All of them complete with a single CMD_SYNC.
+ */
+void smmu_inv_ipa(asid_t vm_id, paddr_t ipa, size_t size)
+{
+    struct smmu_cmd_batch batch = { .num = 0 };
+    uint64_t vmid = (uint64_t)vm_id << SMMUV3_CMD_0_VMID_OFF;
+    size_t num_pages = NUM_PAGES(size);
+
+    if ((smmu.hw == NULL) || !bitmap_get(smmu.vmid_bitmap, vm_id % SMMUV3_VMID_NUM)) {
+        return;
+    }
+
+    if (!smmu.range_inv && (num_pages > SMMUV3_TLBI_PAGES_MAX)) {
+        smmu_inv_vmid(vm_id);
+        return;
+    }
+
+    while (num_pages > 0) {
+        uint64_t dw0 = SMMUV3_CMD_TLBI_S2_IPA | vmid;
+        uint64_t dw1 = ipa & SMMUV3_CMD_1_ADDR_MSK;
+        size_t pages = 1;
+
+        if (smmu.range_inv) {
+            size_t scale = (size_t)bit_ffs(num_pages);
+            size_t num = (num_pages >> scale) & SMMUV3_TLBI_RANGE_NUM;
+            dw0 |= ((num - 1) << SMMUV3_CMD_0_NUM_OFF) | (scale << SMMUV3_CMD_0_SCALE_OFF);
+            dw1 |= SMMUV3_CMD_1_TG_4K;
+            pages = num << scale;
+        }
+
+        smmu_batch_add(&batch, dw0, dw1);
+        ipa += pages * PAGE_SIZE;
+        num_pages -= pages;
+    }
+
+    smmu_cmdq_submit(&batch, true);
+}
+
+void smmu_inv_vmid(asid_t vm_id)
+{
+    struct smmu_cmd_batch batch = { .num = 0 };
+
+    smmu_batch_add(&batch, SMMUV3_CMD_TLBI_S12_VMALL | ((uint64_t)vm_id << SMMUV3_CMD_0_VMID_OFF),
+        0);
+    smmu_cmdq_submit(&batch, true);
+}
@@ -25,16 +25,16 @@ struct cpu_arch_profile {
             perms_t el1;
         } perms[MPU_ARCH_MAX_NUM_ENTRIES];
         /**
-         * We maintain an ordered list of the regions currently in the mpu to simplify the merging
-         * algorithm when mapping an overllaping region.
+         * We maintain the regions currently in the mpu sorted by base address to simplify the
+         * merging algorithm when mapping an overllaping region. As they never overlap, they are
+         * also sorted by limit, so the first region that may overlap a new one is binary searched.
+         * A copy of each entry's region avoids reading it back from the mpu on every search.
          */
         struct {
-            struct list list;
-            struct mpu_node {
-                node_t node;
-                mpid_t mpid;
-            } node[MPU_ARCH_MAX_NUM_ENTRIES];
+            size_t num;
+            mpid_t mpid[MPU_ARCH_MAX_NUM_ENTRIES];
         } order;
+        struct mp_region regions[MPU_ARCH_MAX_NUM_ENTRIES];
     } mpu;
 };
 
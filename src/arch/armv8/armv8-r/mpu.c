@@ -13,7 +13,7 @@ static inline const size_t mpu_num_entries()
     return (size_t)MPUIR_REGION(sysreg_mpuir_el2_read());
 }
 
-static void mpu_entry_get_region(mpid_t mpid, struct mp_region* mpe)
+static void mpu_entry_read_region(mpid_t mpid, struct mp_region* mpe)
 {
     sysreg_prselr_el2_write(mpid);
     ISB();
@@ -26,20 +26,53 @@ static void mpu_entry_get_region(mpid_t mpid, struct mp_region* mpe)
     mpe->as_sec = SEC_UNKNOWN;
 }
 
-static int mpu_node_cmp(node_t* _n1, node_t* _n2)
+static inline void mpu_entry_get_region(mpid_t mpid, struct mp_region* mpe)
 {
-    struct mpu_node* n1 = (struct mpu_node*)_n1;
-    struct mpu_node* n2 = (struct mpu_node*)_n2;
-    struct mp_region r1;
-    struct mp_region r2;
-    mpu_entry_get_region(n1->mpid, &r1);
-    mpu_entry_get_region(n2->mpid, &r2);
-    if (r1.base > r2.base) {
-        return 1;
-    } else if (r1.base < r2.base) {
-        return -1;
-    } else {
-        return 0;
+    *mpe = cpu()->arch.profile.mpu.regions[mpid];
+}
+
+/* Position in the mpu order of the first region whose limit is above addr */
+static size_t mpu_order_search(vaddr_t addr)
+{
+    size_t low = 0;
+    size_t high = cpu()->arch.profile.mpu.order.num;
+
+    while (low < high) {
+        size_t mid = low + ((high - low) / 2);
+        struct mp_region* reg =
+            &cpu()->arch.profile.mpu.regions[cpu()->arch.profile.mpu.order.mpid[mid]];
+        if ((reg->base + reg->size) <= addr) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+
+    return low;
+}
+
+static void mpu_order_insert(mpid_t mpid)
+{
+    size_t pos = mpu_order_search(cpu()->arch.profile.mpu.regions[mpid].base);
+    mpid_t* order = cpu()->arch.profile.mpu.order.mpid;
+
+    for (size_t i = cpu()->arch.profile.mpu.order.num; i > pos; i--) {
+        order[i] = order[i - 1];
+    }
+    order[pos] = mpid;
+    cpu()->arch.profile.mpu.order.num++;
+}
+
+static void mpu_order_remove(mpid_t mpid)
+{
+    size_t pos = mpu_order_search(cpu()->arch.profile.mpu.regions[mpid].base);
+    mpid_t* order = cpu()->arch.profile.mpu.order.mpid;
+
+    if ((pos < cpu()->arch.profile.mpu.order.num) && (order[pos] == mpid)) {
+        cpu()->arch.profile.mpu.order.num--;
+        for (size_t i = pos; i < cpu()->arch.profile.mpu.order.num; i++) {
+            order[i] = order[i + 1];
+        }
     }
 }
 
@@ -52,25 +85,32 @@ static void mpu_entry_set(mpid_t mpid, struct mp_region* mpr)
     sysreg_prbar_el2_write((mpr->base & PRBAR_BASE_MSK) | mpr->mem_flags.prbar);
     sysreg_prlar_el2_write((lim & PRLAR_LIMIT_MSK) | mpr->mem_flags.prlar);
 
-    list_insert_ordered(&cpu()->arch.profile.mpu.order.list,
-        (node_t*)&cpu()->arch.profile.mpu.order.node[mpid], mpu_node_cmp);
+    struct mp_region* reg = &cpu()->arch.profile.mpu.regions[mpid];
+    reg->base = mpr->base;
+    reg->size = mpr->size;
+    reg->mem_flags.prbar = PRBAR_FLAGS(mpr->mem_flags.prbar);
+    reg->mem_flags.prlar = PRLAR_FLAGS(mpr->mem_flags.prlar);
+    reg->as_sec = SEC_UNKNOWN;
+
+    mpu_order_insert(mpid);
 }
 
 static void mpu_entry_modify(mpid_t mpid, struct mp_region* mpr)
 {
-    list_rm(&cpu()->arch.profile.mpu.order.list, (node_t*)&cpu()->arch.profile.mpu.order.node[mpid]);
+    mpu_order_remove(mpid);
 
     mpu_entry_set(mpid, mpr);
 }
 
 static bool mpu_entry_clear(mpid_t mpid)
 {
-    list_rm(&cpu()->arch.profile.mpu.order.list, (node_t*)&cpu()->arch.profile.mpu.order.node[mpid]);
+    mpu_order_remove(mpid);
 
     sysreg_prselr_el2_write(mpid);
     ISB();
     sysreg_prlar_el2_write(0);
     sysreg_prbar_el2_write(0);
+    cpu()->arch.profile.mpu.regions[mpid] = (struct mp_region){ 0 };
     return true;
 }
 
@@ -156,13 +196,10 @@ static inline mem_attrs_t mpu_entry_attrs(struct mp_region* mpr)
 
 static mpid_t mpu_entry_allocate()
 {
-    mpid_t reg_num = INVALID_MPID;
-    for (mpid_t i = 0; i < mpu_num_entries(); i++) {
-        if (bitmap_get(cpu()->arch.profile.mpu.bitmap, i) == 0) {
-            bitmap_set(cpu()->arch.profile.mpu.bitmap, i);
-            reg_num = i;
-            break;
-        }
+    mpid_t reg_num =
+        bitmap_find_nth(cpu()->arch.profile.mpu.bitmap, mpu_num_entries(), 1, 0, false);
+    if (reg_num != INVALID_MPID) {
+        bitmap_set(cpu()->arch.profile.mpu.bitmap, reg_num);
     }
     return reg_num;
 }
@@ -232,9 +269,16 @@ bool mpu_map(priv_t priv, struct mp_region* mpr)
         bottom_mpid = INVALID_MPID;
         top_mpid = INVALID_MPID;
 
-        struct list* mpu_order_list = &cpu()->arch.profile.mpu.order.list;
-        list_foreach ((*mpu_order_list), struct mpu_node, entry) {
-            mpid_t mpid = entry->mpid;
+        // Regions below the first one ending past the new region's base can't overlap it, the
+        // last of them being the one right before it.
+        mpid_t* mpu_order = cpu()->arch.profile.mpu.order.mpid;
+        size_t pos = mpu_order_search(new_reg->base);
+        if (pos > 0) {
+            prev = mpu_order[pos - 1];
+        }
+
+        for (size_t i = pos; i < cpu()->arch.profile.mpu.order.num; i++) {
+            mpid_t mpid = mpu_order[i];
             struct mp_region overlapped_reg;
 
             mpu_entry_get_region(mpid, &overlapped_reg);
@@ -472,20 +516,20 @@ bool mpu_unmap(priv_t priv, struct mp_region* mpr)
         mpid_t mpid = INVALID_MPID;
         struct mp_region reg;
 
-        struct list* mpu_order_list = &cpu()->arch.profile.mpu.order.list;
-        list_foreach ((*mpu_order_list), struct mpu_node, entry) {
-            mpu_entry_get_region(entry->mpid, &reg);
+        mpid_t* mpu_order = cpu()->arch.profile.mpu.order.mpid;
+        for (size_t i = mpu_order_search(mpr->base); i < cpu()->arch.profile.mpu.order.num; i++) {
+            mpu_entry_get_region(mpu_order[i], &reg);
 
             if ((mpr->base + mpr->size) < reg.base) {
                 break;
             }
 
-            if (!mpu_entry_has_priv(entry->mpid, priv)) {
+            if (!mpu_entry_has_priv(mpu_order[i], priv)) {
                 continue;
             }
 
             if (mem_regions_overlap(&reg, mpr)) {
-                mpid = entry->mpid;
+                mpid = mpu_order[i];
                 break;
             }
         }
@@ -544,11 +588,9 @@ bool mpu_unmap(priv_t priv, struct mp_region* mpr)
 void mpu_init()
 {
     bitmap_clear_consecutive(cpu()->arch.profile.mpu.bitmap, 0, mpu_num_entries());
-    list_init(&cpu()->arch.profile.mpu.order.list);
+    cpu()->arch.profile.mpu.order.num = 0;
 
     for (mpid_t mpid = 0; mpid < mpu_num_entries(); mpid++) {
-        cpu()->arch.profile.mpu.order.node[mpid].mpid = mpid;
-
         if (mpu_entry_valid(mpid)) {
             bitmap_set(cpu()->arch.profile.mpu.bitmap, mpid);
             bitmap_set(cpu()->arch.profile.mpu.locked, mpid);
@@ -560,8 +602,8 @@ void mpu_init()
             cpu()->arch.profile.mpu.perms[mpid].el1 = PERM_NONE;
             cpu()->arch.profile.mpu.perms[mpid].el2 = PERM_RWX;
 
-            list_insert_ordered(&cpu()->arch.profile.mpu.order.list,
-                (node_t*)&cpu()->arch.profile.mpu.order.node[mpid], mpu_node_cmp);
+            mpu_entry_read_region(mpid, &cpu()->arch.profile.mpu.regions[mpid]);
+            mpu_order_insert(mpid);
         }
     }
 }
@@ -98,9 +98,10 @@ void cache_arch_enumerate(struct cache* dscrp)
 
 void cache_flush_range(vaddr_t base, size_t size)
 {
-    vaddr_t cache_addr = base;
     uint64_t ctr = sysreg_ctr_el0_read();
-    size_t min_line_size = 1UL << bit64_extract(ctr, CTR_DMINLINE_OFF, CTR_DMINLINE_LEN);
+    /* DminLine is the log2 of the number of words in the smallest data cache line */
+    size_t min_line_size = 4UL << bit64_extract(ctr, CTR_DMINLINE_OFF, CTR_DMINLINE_LEN);
+    vaddr_t cache_addr = base & ~(min_line_size - 1);
 
     while (cache_addr < (base + size)) {
         arm_dc_civac(cache_addr);
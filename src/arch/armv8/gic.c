@@ -9,10 +9,12 @@
 #include <arch/gicv2.h>
 #elif (GIC_VERSION == GICV3)
 #include <arch/gicv3.h>
+#include <arch/its.h>
 #else
 #error "unknown GIV version " GIC_VERSION
 #endif
 
+#include <arch/vgic.h>
 #include <interrupts.h>
 #include <cpu.h>
 #include <spinlock.h>
@@ -82,6 +84,9 @@ void gic_init()
         gic_map_mmio();
         gicd_init();
         NUM_LRS = gich_num_lrs();
+#ifdef GICV4
+        its_init();
+#endif
     }
 
     cpu_sync_and_clear_msgs(&cpu_glb_sync);
@@ -89,18 +94,24 @@ void gic_init()
     gic_cpu_init();
 }
 
-void gic_handle()
+bool gic_handle()
 {
     uint32_t ack = gicc_iar();
     irqid_t id = bit32_extract(ack, GICC_IAR_ID_OFF, GICC_IAR_ID_LEN);
 
     if (id < GIC_FIRST_SPECIAL_INTID) {
-        enum irq_res res = interrupts_handle(id);
+        enum irq_res res = FORWARD_TO_VM;
+        if (!vgic_inject_direct(cpu()->vcpu, id)) {
+            res = interrupts_handle(id);
+        }
         gicc_eoir(ack);
         if (res == HANDLED_BY_HYP) {
             gicc_dir(ack);
         }
+        return true;
     }
+
+    return false;
 }
 
 uint8_t gicd_get_prio(irqid_t int_id)
@@ -170,14 +181,16 @@ bool gicd_get_act(irqid_t int_id)
     return (gicd->ISACTIVER[GIC_INT_REG(int_id)] & GIC_INT_MASK(int_id)) != 0;
 }
 
-void gicd_set_enable(irqid_t int_id, bool en)
+void gicd_set_enable_mask(size_t reg_ind, uint32_t mask, bool en)
 {
-    size_t reg_ind = GIC_INT_REG(int_id);
-    uint32_t bit = GIC_INT_MASK(int_id);
-
     if (en) {
-        gicd->ISENABLER[reg_ind] = bit;
+        gicd->ISENABLER[reg_ind] = mask;
     } else {
-        gicd->ICENABLER[reg_ind] = bit;
+        gicd->ICENABLER[reg_ind] = mask;
     }
 }
+
+void gicd_set_enable(irqid_t int_id, bool en)
+{
+    gicd_set_enable_mask(GIC_INT_REG(int_id), GIC_INT_MASK(int_id), en);
+}
@@ -5,6 +5,7 @@
 
 #include <arch/gic.h>
 #include <arch/gicv3.h>
+#include <arch/its.h>
 
 #include <cpu.h>
 #include <mem.h>
@@ -91,6 +92,7 @@ void gicc_restore_state(struct gicc_state* state)
 void gic_cpu_init()
 {
     gicr_init();
+    its_cpu_init();
     gicc_init();
 }
 
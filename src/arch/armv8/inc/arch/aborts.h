@@ -8,4 +8,9 @@
 
 #include <bao.h>
 
+void wfx_handler(unsigned long iss, unsigned long far, unsigned long il, unsigned long ec);
+#ifdef VCPU_SCHED
+void fpu_handler(unsigned long iss, unsigned long far, unsigned long il, unsigned long ec);
+#endif
+
 #endif /* __ABORTS_H__ */
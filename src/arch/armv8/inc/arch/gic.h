@@ -196,6 +196,19 @@ struct gicr_hw {
     uint32_t IGRPMODR0;
     uint8_t pad16[0x0e00 - 0xd04];
     uint32_t NSACR;
+
+#ifdef GICV4
+    /* VLPI_base frame */
+    uint8_t vlpi_base[0] __attribute__((aligned(0x10000)));
+    uint8_t pad17[0x0070 - 0x0000];
+    uint64_t VPROPBASER;
+    uint64_t VPENDBASER;
+    uint64_t VSGIR;
+    uint32_t VSGIPENDR;
+
+    /* reserved frame */
+    uint8_t reserved[0x10000] __attribute__((aligned(0x10000)));
+#endif
 } __attribute__((__packed__, aligned(0x10000)));
 
 /* CPU Interface Control Register, GICC_CTLR */
@@ -397,6 +410,7 @@ extern size_t NUM_LRS;
 void gic_init();
 void gic_cpu_init();
 void gic_send_sgi(cpuid_t cpu_target, irqid_t sgi_num);
+bool gic_handle();
 
 void gicc_save_state(struct gicc_state* state);
 void gicc_restore_state(struct gicc_state* state);
@@ -411,6 +425,7 @@ bool gic_get_pend(irqid_t int_id);
 bool gic_get_act(irqid_t int_id);
 
 void gicd_set_enable(irqid_t int_id, bool en);
+void gicd_set_enable_mask(size_t reg_ind, uint32_t mask, bool en);
 void gicd_set_pend(irqid_t int_id, bool pend);
 void gicd_set_prio(irqid_t int_id, uint8_t prio);
 void gicd_set_icfgr(irqid_t int_id, uint8_t cfg);
@@ -36,6 +36,26 @@ static inline void gich_set_hcr(uint32_t hcr)
     gich->HCR = hcr;
 }
 
+static inline uint32_t gich_get_vmcr()
+{
+    return gich->VMCR;
+}
+
+static inline void gich_set_vmcr(uint32_t vmcr)
+{
+    gich->VMCR = vmcr;
+}
+
+static inline uint32_t gich_get_apr()
+{
+    return gich->APR;
+}
+
+static inline void gich_set_apr(uint32_t apr)
+{
+    gich->APR = apr;
+}
+
 static inline uint32_t gich_get_misr()
 {
     return gich->MISR;
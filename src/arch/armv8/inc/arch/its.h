@@ -0,0 +1,124 @@
+/**
+ * SPDX-License-Identifier: Apache-2.0
+ * Copyright (c) Bao Project and Contributors. All rights reserved.
+ */
+
+#ifndef __ITS_H__
+#define __ITS_H__
+
+#include <bao.h>
+#include <bit.h>
+
+#define GITS_CTLR_EN_BIT        (1UL << 0)
+#define GITS_CTLR_QUIESCENT_BIT (1UL << 31)
+
+#define GITS_TYPER_VIRTUAL_BIT (1ULL << 1)
+#define GITS_TYPER_PTA_BIT     (1ULL << 19)
+#define GITS_TYPER_VMAPP_BIT   (1ULL << 40)
+#define GITS_TYPER_SVPET_OFF   (41)
+#define GITS_TYPER_SVPET_LEN   (2)
+
+#define GITS_CBASER_VALID_BIT (1ULL << 63)
+#define GITS_CBASER_ADDR_MSK  BIT64_MASK(12, 40)
+#define GITS_CBASER_SIZE_MSK  BIT64_MASK(0, 8)
+
+#define GITS_CREADR_STALLED_BIT (1ULL << 0)
+#define GITS_CREADR_OFF_MSK     BIT64_MASK(5, 15)
+
+#define GITS_BASER_NUM       (8)
+#define GITS_BASER_VALID_BIT (1ULL << 63)
+#define GITS_BASER_TYPE_OFF  (56)
+#define GITS_BASER_TYPE_LEN  (3)
+#define GITS_BASER_TYPE_VPE  (2)
+#define GITS_BASER_ESZ_OFF   (48)
+#define GITS_BASER_ESZ_LEN   (5)
+#define GITS_BASER_ADDR_MSK  BIT64_MASK(12, 36)
+#define GITS_BASER_SIZE_MSK  BIT64_MASK(0, 8)
+
+/**
+ * The tables shared with the ITS and the redistributors are accessed by the GIC as normal
+ * non-cacheable memory, and every write the hypervisor does to them is followed by a cache clean.
+ * The InnerCache field is at [61:59] in the ITS's base registers but at [9:7] in the
+ * redistributors', where the ITS's bits 7:0 are the table size.
+ */
+#define GITS_TBL_INNER_NC (1ULL << 59)
+#define GICR_TBL_INNER_NC (1ULL << 7)
+
+#define GICR_TYPER_VLPIS_BIT  (1ULL << 1)
+#define GICR_TYPER_RVPEID_BIT (1ULL << 7)
+#define GICR_TYPER_PRCNUM_LEN (16)
+
+#define GICR_CTLR_ENABLE_LPIS_BIT (1UL << 0)
+
+#define GICR_PROPBASER_ADDR_MSK BIT64_MASK(12, 40)
+#define GICR_PENDBASER_ADDR_MSK BIT64_MASK(16, 36)
+#define GICR_PENDBASER_PTZ_BIT  (1ULL << 62)
+
+#define GICR_VPROPBASER_VALID_BIT (1ULL << 63)
+#define GICR_VPROPBASER_ADDR_MSK  BIT64_MASK(12, 40)
+#define GICR_VPROPBASER_SIZE_MSK  BIT64_MASK(0, 7)
+
+#define GICR_VPENDBASER_VALID_BIT   (1ULL << 63)
+#define GICR_VPENDBASER_DIRTY_BIT   (1ULL << 60)
+#define GICR_VPENDBASER_VGRP0EN_BIT (1ULL << 59)
+#define GICR_VPENDBASER_VGRP1EN_BIT (1ULL << 58)
+#define GICR_VPENDBASER_VPEID_MSK   BIT64_MASK(0, 16)
+
+/* Number of LPI interrupt id bits of the physical and virtual LPI tables */
+#define ITS_LPI_ID_BITS (14)
+#define ITS_NO_DOORBELL (1023)
+
+struct gits_hw {
+    /* ITS_base control frame */
+    uint32_t CTLR;
+    uint32_t IIDR;
+    uint64_t TYPER;
+    uint32_t MPAMIDR;
+    uint32_t PARTIDR;
+    uint32_t MPIDR;
+    uint8_t pad0[0x0080 - 0x001c];
+    uint64_t CBASER;
+    uint64_t CWRITER;
+    uint64_t CREADR;
+    uint8_t pad1[0x0100 - 0x0098];
+    uint64_t BASER[GITS_BASER_NUM];
+    uint8_t pad2[0xFFD0 - 0x0140];
+    uint32_t ID[(0x10000 - 0xFFD0) / sizeof(uint32_t)];
+
+    /* translation_base frame */
+    uint8_t translation_base[0] __attribute__((aligned(0x10000)));
+    uint8_t pad3[0x0040 - 0x0000];
+    uint32_t TRANSLATER;
+
+    /* vSGI_base frame */
+    uint8_t vsgi_base[0] __attribute__((aligned(0x10000)));
+    uint8_t pad4[0x0020 - 0x0000];
+    uint64_t SGIR;
+} __attribute__((__packed__, aligned(0x10000)));
+
+#ifdef GICV4
+
+void its_init();
+void its_cpu_init();
+bool its_vsgi_supported();
+void its_vsgi_config(cpuid_t vpeid, irqid_t sgi, uint8_t prio, bool enable);
+void its_vsgi_send(cpuid_t vpeid, irqid_t sgi);
+
+#else
+
+static inline void its_init() { }
+
+static inline void its_cpu_init() { }
+
+static inline bool its_vsgi_supported()
+{
+    return false;
+}
+
+static inline void its_vsgi_config(cpuid_t vpeid, irqid_t sgi, uint8_t prio, bool enable) { }
+
+static inline void its_vsgi_send(cpuid_t vpeid, irqid_t sgi) { }
+
+#endif
+
+#endif /* __ITS_H__ */
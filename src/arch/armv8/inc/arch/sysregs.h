@@ -256,6 +256,12 @@
 #define CTR_CEG_LEN                4
 #define CTR_RES1                   (1UL << 31)
 
+/* DCZID_EL0 - Data Cache Zero ID Register */
+
+#define DCZID_BS_OFF               0
+#define DCZID_BS_LEN               4
+#define DCZID_DZP_BIT              (1UL << 4)
+
 /* CSSELR_EL1 - Cache Size Selection Register */
 
 #define CSSELR_IND_BIT             0
@@ -330,6 +336,10 @@
 #define HCR_APK_BIT                (1ULL << 40)
 #define HCR_API_BIT                (1ULL << 41)
 
+/* CPTR_EL2, Architectural Feature Trap Register (EL2) */
+
+#define CPTR_TFP_BIT               (1UL << 10)
+
 /* ESR_ELx, Exception Syndrome Register (ELx) */
 
 #define ESR_ISS_OFF                (0)
@@ -343,6 +353,7 @@
 #define ESR_EC_WFIE                (0x01)
 #define ESR_EC_RG_32               (0x03)
 #define ESR_EC_RG_64               (0x04)
+#define ESR_EC_FP                  (0x07)
 #define ESR_EC_SVC32               (0x11)
 #define ESR_EC_HVC32               (0x12)
 #define ESR_EC_SMC32               (0x13)
@@ -403,6 +414,9 @@
 #define ESR_ISS_SYSREG_REG2_OFF    (10)
 #define ESR_ISS_SYSREG_REG2_LEN    (5)
 
+/* Set for a trapped WFE, clear for a WFI */
+#define ESR_ISS_WFx_TI_BIT         (0x1)
+
 #define OP0_MRS_CP15               ((0x3) << 20)
 
 #define UNDEFINED_REG_ADDR         (0xFFFFFFFFUL)
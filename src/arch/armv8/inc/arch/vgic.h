@@ -9,31 +9,32 @@
 #include <bao.h>
 #include <arch/gic.h>
 #include <list.h>
+#include <bitmap.h>
 
 struct vm;
 struct vcpu;
 struct vgic_dscrp;
 
 /**
- * TODO: optimize the vgic_int struct's size
+ * Interrupt state used when injecting and routing, kept small so that neighbouring interrupts
+ * share cache lines. On GICv3 the phys fields hold physical cpu ids, or VGIC_PHYS_ROUTE_INV if
+ * the guest routed the interrupt to a non-existent vcpu.
  */
 struct vgic_int {
     node_t node;
     struct vcpu* owner;
-#if (GIC_VERSION != GICV2)
-    unsigned long route;
-    union {
-        vcpuid_t redist;
-        unsigned long route;
-    } phys;
-#endif
     spinlock_t lock;
-    irqid_t id;
+    uint16_t id;
     uint8_t state;
     uint8_t prio;
-    uint8_t cfg;
     uint8_t lr;
-#if (GIC_VERSION == GICV2)
+    uint8_t spilled_lvl;
+#if (GIC_VERSION != GICV2)
+    union {
+        uint8_t redist;
+        uint8_t route;
+    } phys;
+#else
     union {
         uint8_t targets;
         struct {
@@ -42,15 +43,47 @@ struct vgic_int {
         } sgi;
     };
 #endif
-    bool hw;
-    bool in_lr;
-    bool enabled;
+    bool hw : 1;
+    bool in_lr : 1;
+    bool enabled : 1;
+    bool direct : 1;
+#if (GIC_VERSION != GICV2)
+    bool broadcast : 1;
+#endif
+};
+
+#define VGIC_PHYS_ROUTE_INV (0xff)
+
+/**
+ * Guest written register values that are only needed to emulate reads of the distributor or to
+ * program the physical interrupt, kept apart from the struct vgic_int array.
+ */
+struct vgic_int_regs {
+#if (GIC_VERSION != GICV2)
+    unsigned long route;
+#endif
+    uint8_t cfg;
+};
+
+#define VGIC_SPILLED_LVLS (1UL << GICH_LR_PRIO_LEN)
+
+/**
+ * Interrupts that did not fit in the list registers, kept in a fifo per priority level. A bit set
+ * in lvls marks a non-empty fifo so that the highest priority spilled interrupt is found without
+ * walking all of them.
+ */
+struct vgic_spilled {
+    BITMAP_ALLOC(lvls, VGIC_SPILLED_LVLS);
+    struct list fifo[VGIC_SPILLED_LVLS];
 };
 
 struct vgicd {
     struct vgic_int* interrupts;
+    struct vgic_int_regs* int_regs;
     spinlock_t lock;
     size_t int_num;
+    bool direct_irqs;
+    bool direct_sgis;
     uint32_t CTLR;
     uint32_t TYPER;
     uint32_t IIDR;
@@ -63,12 +96,28 @@ struct vgicr {
     uint32_t IIDR;
 };
 
+#ifdef VCPU_SCHED
+/* Virtual cpu interface state of a vcpu switched out of its physical cpu */
+struct vgic_cpu_ctx {
+    uint32_t hcr;
+    uint32_t vmcr;
+    uint32_t apr;
+    uint64_t lrs[GIC_NUM_LIST_REGS];
+    BITMAP_ALLOC(priv_act, GIC_CPU_PRIV);
+};
+#endif
+
 struct vgic_priv {
 #if (GIC_VERSION != GICV2)
     struct vgicr vgicr;
 #endif
     irqid_t curr_lrs[GIC_NUM_LIST_REGS];
+    uint64_t direct_lrs;
     struct vgic_int interrupts[GIC_CPU_PRIV];
+    struct vgic_int_regs int_regs[GIC_CPU_PRIV];
+#ifdef VCPU_SCHED
+    struct vgic_cpu_ctx ctx;
+#endif
 };
 
 void vgic_init(struct vm* vm, const struct vgic_dscrp* vgic_dscrp);
@@ -76,6 +125,13 @@ void vgic_cpu_init(struct vcpu* vcpu);
 void vgic_set_hw(struct vm* vm, irqid_t id);
 void vgic_inject(struct vcpu* vcpu, irqid_t id, vcpuid_t source);
 void vgic_inject_hw(struct vcpu* vcpu, irqid_t id);
+bool vgic_inject_direct(struct vcpu* vcpu, irqid_t id);
+void vgic_spilled_init(struct vgic_spilled* spilled);
+#ifdef VCPU_SCHED
+void vgic_cpu_save(struct vcpu* vcpu);
+void vgic_cpu_restore(struct vcpu* vcpu);
+#endif
+bool vgic_cpu_pending(struct vcpu* vcpu);
 
 /* VGIC INTERNALS */
 
@@ -106,16 +162,19 @@ struct vgic_reg_handler_info {
 };
 
 /* interface for version agnostic vgic */
+void vgicd_decode_init();
 bool vgicd_emul_handler(struct emul_access*);
 bool vgic_check_reg_alignment(struct emul_access* acc, struct vgic_reg_handler_info* handlers);
 bool vgic_add_lr(struct vcpu* vcpu, struct vgic_int* interrupt);
 bool vgic_remove_lr(struct vcpu* vcpu, struct vgic_int* interrupt);
 bool vgic_get_ownership(struct vcpu* vcpu, struct vgic_int* interrupt);
 void vgic_yield_ownership(struct vcpu* vcpu, struct vgic_int* interrupt);
+void vgic_direct_release(struct vcpu* vcpu, struct vgic_int* interrupt);
 void vgic_emul_generic_access(struct emul_access*, struct vgic_reg_handler_info*, bool, vcpuid_t);
 void vgic_send_sgi_msg(struct vcpu* vcpu, cpumap_t pcpu_mask, irqid_t int_id);
 size_t vgic_get_itln(const struct vgic_dscrp* vgic_dscrp);
 struct vgic_int* vgic_get_int(struct vcpu* vcpu, irqid_t int_id, vcpuid_t vgicr_id);
+struct vgic_int_regs* vgic_get_int_regs(struct vcpu* vcpu, struct vgic_int* interrupt);
 void vgic_int_set_field(struct vgic_reg_handler_info* handlers, struct vcpu* vcpu,
     struct vgic_int* interrupt, unsigned long data);
 void vgic_emul_razwi(struct emul_access* acc, struct vgic_reg_handler_info* handlers,
@@ -125,5 +184,6 @@ void vgic_emul_razwi(struct emul_access* acc, struct vgic_reg_handler_info* hand
 bool vgic_int_has_other_target(struct vcpu* vcpu, struct vgic_int* interrupt);
 uint8_t vgic_int_ptarget_mask(struct vcpu* vcpu, struct vgic_int* interrupt);
 void vgic_inject_sgi(struct vcpu* vcpu, struct vgic_int* interrupt, vcpuid_t source);
+void vgic_update_vsgi(struct vcpu* vcpu, struct vgic_int* interrupt);
 
 #endif /* __VGIC_H__ */
@@ -11,15 +11,14 @@
 
 static inline bool vgic_broadcast(struct vcpu* vcpu, struct vgic_int* interrupt)
 {
-    return (interrupt->route & GICD_IROUTER_IRM_BIT);
+    return interrupt->broadcast;
 }
 
 static inline bool vgic_int_vcpu_is_target(struct vcpu* vcpu, struct vgic_int* interrupt)
 {
     bool priv = gic_is_priv(interrupt->id);
     bool local = priv && (interrupt->phys.redist == vcpu->phys_id);
-    bool routed_here =
-        !priv && !(interrupt->phys.route ^ (sysreg_mpidr_el1_read() & MPIDR_AFF_MSK));
+    bool routed_here = !priv && (interrupt->phys.route == cpu()->id);
     bool any = !priv && vgic_broadcast(vcpu, interrupt);
     return local || routed_here || any;
 }
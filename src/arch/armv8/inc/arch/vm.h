@@ -11,7 +11,7 @@
 #include <arch/vgic.h>
 #include <arch/psci.h>
 #ifdef MEM_PROT_MMU
-#include <arch/smmuv2.h>
+#include <arch/smmu.h>
 #endif
 #include <list.h>
 
@@ -21,8 +21,34 @@ struct arch_vm_platform {
         paddr_t gicc_addr;
         paddr_t gicr_addr;
         size_t interrupt_num;
+        /**
+         * Inject the VM's hardware SPIs through list registers reserved for them on the cpu
+         * they are routed to, bypassing the interrupt's lock and list register allocation. Meant
+         * for VMs with dedicated devices, as each such interrupt holds a list register.
+         */
+        bool direct_irqs;
+        /**
+         * Deliver the SGIs the VM's vcpus send each other as GICv4.1 vSGIs, written straight to
+         * the target's redistributor through the ITS, instead of through an IPI to the target cpu
+         * and a list register. Needs a GICV4 build on a platform with an ITS, otherwise ignored.
+         * The guest can not read back the pending or active state of its SGIs.
+         */
+        bool direct_sgis;
     } gic;
 
+    /**
+     * Trap the guest's WFI and WFE instructions instead of letting it sleep natively on its
+     * cpu, so the hypervisor can serve the cpu messages sent to it in the meantime. A trapped WFI
+     * first polls for pending virtual interrupts and messages for an adaptive window of at most
+     * halt_poll_us, and only then puts the cpu to sleep. A trapped WFE only polls.
+     * WFI is not trapped for VMs with direct SGIs, as the vSGIs would not wake up a halted vcpu.
+     */
+    struct {
+        bool wfi;
+        bool wfe;
+        unsigned long halt_poll_us;
+    } wfx;
+
 #ifdef MEM_PROT_MMU
     struct {
         streamid_t global_mask;
@@ -38,7 +64,7 @@ struct arch_vm_platform {
 struct vm_arch {
     struct vgicd vgicd;
     vaddr_t vgicr_addr;
-    struct list vgic_spilled;
+    struct vgic_spilled vgic_spilled;
     spinlock_t vgic_spilled_lock;
     struct emul_mem vgicd_emul;
     struct emul_mem vgicr_emul;
@@ -46,11 +72,32 @@ struct vm_arch {
     struct emul_reg icc_sre_emul;
 };
 
+/* Halt polling state and statistics, all times in timer ticks */
+struct vcpu_wfx {
+    uint64_t poll;
+    uint64_t poll_max;
+    struct {
+        size_t halts;
+        /* Halts that ended while polling, and the ones that went to sleep */
+        size_t polled;
+        size_t slept;
+        uint64_t poll_time;
+        uint64_t sleep_time;
+        /* From the end of the sleep to the return to the guest */
+        uint64_t wakeup_max;
+        uint64_t wakeup_sum;
+    } stats;
+};
+
 struct vcpu_arch {
     unsigned long vmpidr;
     struct vgic_priv vgic_priv;
-    struct list vgic_spilled;
+    struct vgic_spilled vgic_spilled;
     struct psci_ctx psci_ctx;
+    struct vcpu_wfx wfx;
+#ifdef VCPU_SCHED
+    struct vcpu_subarch_ctx ctx;
+#endif
 };
 
 struct vcpu* vm_get_vcpu_by_mpidr(struct vm* vm, unsigned long mpidr);
@@ -59,6 +106,7 @@ void vcpu_arch_entry();
 bool vcpu_arch_profile_on(struct vcpu* vcpu);
 void vcpu_arch_profile_init(struct vcpu* vcpu, struct vm* vm);
 void vcpu_subarch_reset(struct vcpu* vcpu);
+void vcpu_wfx_init(struct vcpu* vcpu, struct vm* vm);
 
 static inline void vcpu_arch_inject_hw_irq(struct vcpu* vcpu, irqid_t id)
 {
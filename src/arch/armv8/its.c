@@ -0,0 +1,256 @@
+/**
+ * SPDX-License-Identifier: Apache-2.0
+ * Copyright (c) Bao Project and Contributors. All rights reserved.
+ */
+
+/**
+ * Minimal GICv4.1 ITS driver, used only to inject the VMs' SGIs directly through the
+ * redistributors. As vcpus are pinned to their physical cpus, each cpu hosts a single vPE, with
+ * the cpu's id as vPEID, mapped and made resident on that cpu's redistributor at init and never
+ * descheduled. No physical LPIs are used, so no devices or collections are ever mapped.
+ */
+
+#include <arch/its.h>
+#include <arch/gicv3.h>
+
+#include <cpu.h>
+#include <mem.h>
+#include <cache.h>
+#include <platform.h>
+#include <spinlock.h>
+#include <string.h>
+
+#define ITS_CMD_VMAPP (0x29)
+#define ITS_CMD_VSGI  (0x23)
+
+#define ITS_CMD_ID_MSK          BIT64_MASK(0, 8)
+#define ITS_CMD_VMAPP_ALLOC_BIT (1ULL << 8)
+#define ITS_CMD_VMAPP_PTZ_BIT   (1ULL << 9)
+#define ITS_CMD_VMAPP_V_BIT     (1ULL << 63)
+#define ITS_CMD_ADDR_MSK        BIT64_MASK(16, 36)
+#define ITS_CMD_VPEID_OFF       (32)
+#define ITS_CMD_VPEID_MSK       BIT64_MASK(ITS_CMD_VPEID_OFF, 16)
+#define ITS_CMD_VSGI_EN_BIT     (1ULL << 8)
+#define ITS_CMD_VSGI_GRP_BIT    (1ULL << 10)
+#define ITS_CMD_VSGI_PRIO_OFF   (20)
+#define ITS_CMD_VSGI_PRIO_LEN   (4)
+#define ITS_CMD_VSGI_SGI_OFF    (32)
+#define ITS_CMD_VSGI_SGI_LEN    (4)
+
+#define ITS_CMDQ_PAGES (1)
+#define ITS_CMDQ_NUM   ((ITS_CMDQ_PAGES * PAGE_SIZE) / sizeof(struct its_cmd))
+
+/* The pending tables must be 64KiB aligned */
+#define ITS_PEND_TBL_PAGES (NUM_PAGES(0x10000))
+#define ITS_PROP_TBL_PAGES (NUM_PAGES((1UL << ITS_LPI_ID_BITS) - 8192))
+
+struct its_cmd {
+    uint64_t dw[4];
+};
+
+volatile struct gits_hw* gits;
+
+static struct {
+    struct its_cmd* cmdq;
+    size_t cmdq_wr;
+    spinlock_t lock;
+    bool vsgi;
+    bool pta;
+    paddr_t prop_pa;
+    paddr_t pend_pa;
+    paddr_t vconf_pa;
+    paddr_t vpt_pa;
+    paddr_t vpe_tbl_pa;
+    size_t vpe_tbl_pages;
+} its = { .lock = SPINLOCK_INITVAL };
+
+static void* its_alloc_table(size_t num_pages, bool aligned, paddr_t* pa)
+{
+    void* table = mem_alloc_page(num_pages, SEC_HYP_GLOBAL, aligned);
+    if (table == NULL) {
+        ERROR("its: failed to allocate table");
+    }
+
+    memset(table, 0, num_pages * PAGE_SIZE);
+    cache_flush_range((vaddr_t)table, num_pages * PAGE_SIZE);
+    mem_translate(&cpu()->as, (vaddr_t)table, pa);
+
+    return table;
+}
+
+/**
+ * Commands are issued one at a time and waited for, which is enough for the few configuration
+ * commands sent after init.
+ */
+static void its_send_cmd(struct its_cmd* cmd)
+{
+    spin_lock(&its.lock);
+
+    size_t next = (its.cmdq_wr + 1) % ITS_CMDQ_NUM;
+    its.cmdq[its.cmdq_wr] = *cmd;
+    cache_flush_range((vaddr_t)&its.cmdq[its.cmdq_wr], sizeof(struct its_cmd));
+    its.cmdq_wr = next;
+    gits->CWRITER = next * sizeof(struct its_cmd);
+
+    uint64_t creadr;
+    do {
+        creadr = gits->CREADR;
+        if (creadr & GITS_CREADR_STALLED_BIT) {
+            ERROR("its: command queue stalled");
+        }
+    } while ((creadr & GITS_CREADR_OFF_MSK) != (next * sizeof(struct its_cmd)));
+
+    spin_unlock(&its.lock);
+}
+
+static uint64_t its_rd_target(cpuid_t cpuid)
+{
+    if (its.pta) {
+        return (platform.arch.gic.gicr_addr + (cpuid * sizeof(struct gicr_hw))) &
+            ITS_CMD_ADDR_MSK;
+    } else {
+        uint64_t prcnum =
+            bit64_extract(gicr[cpuid].TYPER, GICR_TYPER_PRCNUM_OFF, GICR_TYPER_PRCNUM_LEN);
+        return (prcnum << 16) & ITS_CMD_ADDR_MSK;
+    }
+}
+
+static void its_vmapp(cpuid_t vpeid)
+{
+    struct its_cmd cmd = { 0 };
+    paddr_t vpt = its.vpt_pa + (vpeid * ITS_PEND_TBL_PAGES * PAGE_SIZE);
+
+    cmd.dw[0] = ITS_CMD_VMAPP | ITS_CMD_VMAPP_ALLOC_BIT | ITS_CMD_VMAPP_PTZ_BIT |
+        (its.vconf_pa & ITS_CMD_ADDR_MSK);
+    cmd.dw[1] = (((uint64_t)vpeid << ITS_CMD_VPEID_OFF) & ITS_CMD_VPEID_MSK) | ITS_NO_DOORBELL;
+    cmd.dw[2] = ITS_CMD_VMAPP_V_BIT | its_rd_target(vpeid);
+    cmd.dw[3] = (vpt & ITS_CMD_ADDR_MSK) | (ITS_LPI_ID_BITS - 1);
+
+    its_send_cmd(&cmd);
+}
+
+bool its_vsgi_supported()
+{
+    return its.vsgi;
+}
+
+void its_vsgi_config(cpuid_t vpeid, irqid_t sgi, uint8_t prio, bool enable)
+{
+    struct its_cmd cmd = { 0 };
+
+    cmd.dw[0] = ITS_CMD_VSGI | ITS_CMD_VSGI_GRP_BIT | (enable ? ITS_CMD_VSGI_EN_BIT : 0) |
+        bit64_insert(0, prio >> (8 - ITS_CMD_VSGI_PRIO_LEN), ITS_CMD_VSGI_PRIO_OFF,
+            ITS_CMD_VSGI_PRIO_LEN) |
+        bit64_insert(0, sgi, ITS_CMD_VSGI_SGI_OFF, ITS_CMD_VSGI_SGI_LEN);
+    cmd.dw[1] = ((uint64_t)vpeid << ITS_CMD_VPEID_OFF) & ITS_CMD_VPEID_MSK;
+
+    its_send_cmd(&cmd);
+}
+
+void its_vsgi_send(cpuid_t vpeid, irqid_t sgi)
+{
+    gits->SGIR = ((uint64_t)vpeid << 32) | (sgi & 0xf);
+}
+
+/**
+ * GICv4.1 requires the ITS and the redistributors sharing its CommonLPIAff to use the same vPE
+ * table, so the one programmed here is also the one each redistributor's VPROPBASER points to.
+ */
+static bool its_init_vpe_table()
+{
+    for (size_t i = 0; i < GITS_BASER_NUM; i++) {
+        uint64_t baser = gits->BASER[i];
+        if (bit64_extract(baser, GITS_BASER_TYPE_OFF, GITS_BASER_TYPE_LEN) !=
+            GITS_BASER_TYPE_VPE) {
+            continue;
+        }
+
+        size_t esz = bit64_extract(baser, GITS_BASER_ESZ_OFF, GITS_BASER_ESZ_LEN) + 1;
+        size_t pages = NUM_PAGES(esz * platform.cpu_num);
+        its_alloc_table(pages, false, &its.vpe_tbl_pa);
+
+        gits->BASER[i] = GITS_BASER_VALID_BIT |
+            ((uint64_t)GITS_BASER_TYPE_VPE << GITS_BASER_TYPE_OFF) | GITS_TBL_INNER_NC |
+            (its.vpe_tbl_pa & GITS_BASER_ADDR_MSK) | ((pages - 1) & GITS_BASER_SIZE_MSK);
+        its.vpe_tbl_pages = pages;
+
+        return (gits->BASER[i] & GITS_BASER_VALID_BIT) != 0;
+    }
+
+    return false;
+}
+
+void its_init()
+{
+    if (platform.arch.gic.gits_addr == 0) {
+        return;
+    }
+
+    gits = (void*)mem_alloc_map_dev(&cpu()->as, SEC_HYP_GLOBAL, INVALID_VA,
+        platform.arch.gic.gits_addr, NUM_PAGES(sizeof(struct gits_hw)));
+
+    uint64_t typer = gits->TYPER;
+    if (!(typer & GITS_TYPER_VIRTUAL_BIT) || !(typer & GITS_TYPER_VMAPP_BIT) ||
+        !(gicr[cpu()->id].TYPER & GICR_TYPER_VLPIS_BIT) ||
+        !(gicr[cpu()->id].TYPER & GICR_TYPER_RVPEID_BIT)) {
+        WARNING("its: no GICv4.1 support, guest SGIs will be emulated");
+        return;
+    }
+    its.pta = (typer & GITS_TYPER_PTA_BIT) != 0;
+
+    gits->CTLR &= ~GITS_CTLR_EN_BIT;
+    while (!(gits->CTLR & GITS_CTLR_QUIESCENT_BIT)) { }
+
+    paddr_t cmdq_pa;
+    its.cmdq = its_alloc_table(ITS_CMDQ_PAGES, false, &cmdq_pa);
+    gits->CBASER = GITS_CBASER_VALID_BIT | GITS_TBL_INNER_NC | (cmdq_pa & GITS_CBASER_ADDR_MSK) |
+        ((ITS_CMDQ_PAGES - 1) & GITS_CBASER_SIZE_MSK);
+    gits->CWRITER = 0;
+    its.cmdq_wr = 0;
+
+    if (!its_init_vpe_table()) {
+        WARNING("its: failed to set up the vPE table, guest SGIs will be emulated");
+        return;
+    }
+
+    /**
+     * The physical LPI tables are required for the redistributors to accept vPEs, but all LPIs
+     * are left disabled. The vLPI configuration table is shared by all vPEs, as no vLPIs exist.
+     */
+    its_alloc_table(ITS_PROP_TBL_PAGES, false, &its.prop_pa);
+    its_alloc_table(ITS_PEND_TBL_PAGES * platform.cpu_num, true, &its.pend_pa);
+    its_alloc_table(ITS_PROP_TBL_PAGES, false, &its.vconf_pa);
+    its_alloc_table(ITS_PEND_TBL_PAGES * platform.cpu_num, true, &its.vpt_pa);
+
+    gits->CTLR |= GITS_CTLR_EN_BIT;
+    its.vsgi = true;
+}
+
+/**
+ * Must run on each cpu after its redistributor is awake. Maps the cpu's vPE and makes it resident
+ * for good.
+ */
+void its_cpu_init()
+{
+    if (!its.vsgi) {
+        return;
+    }
+
+    volatile struct gicr_hw* rd = &gicr[cpu()->id];
+
+    rd->PROPBASER = GICR_TBL_INNER_NC | (its.prop_pa & GICR_PROPBASER_ADDR_MSK) |
+        (ITS_LPI_ID_BITS - 1);
+    rd->PENDBASER = GICR_TBL_INNER_NC | GICR_PENDBASER_PTZ_BIT |
+        ((its.pend_pa + (cpu()->id * ITS_PEND_TBL_PAGES * PAGE_SIZE)) & GICR_PENDBASER_ADDR_MSK);
+    rd->CTLR |= GICR_CTLR_ENABLE_LPIS_BIT;
+
+    rd->VPROPBASER = GICR_VPROPBASER_VALID_BIT | GICR_TBL_INNER_NC |
+        (its.vpe_tbl_pa & GICR_VPROPBASER_ADDR_MSK) |
+        ((its.vpe_tbl_pages - 1) & GICR_VPROPBASER_SIZE_MSK);
+
+    its_vmapp(cpu()->id);
+
+    rd->VPENDBASER = GICR_VPENDBASER_VALID_BIT | GICR_VPENDBASER_VGRP0EN_BIT |
+        GICR_VPENDBASER_VGRP1EN_BIT | (cpu()->id & GICR_VPENDBASER_VPEID_MSK);
+    while (rd->VPENDBASER & GICR_VPENDBASER_DIRTY_BIT) { }
+}
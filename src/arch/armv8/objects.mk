@@ -11,6 +11,7 @@ cpu-objs-y+=gic.o
 cpu-objs-y+=vgic.o
 cpu-objs-y+=vmm.o
 cpu-objs-y+=psci.o
+cpu-objs-y+=wfx.o
 
 ifeq ($(GIC_VERSION), GICV2)
 	cpu-objs-y+=vgicv2.o
@@ -18,6 +19,9 @@ ifeq ($(GIC_VERSION), GICV2)
 else ifeq ($(GIC_VERSION), GICV3)
 	cpu-objs-y+=vgicv3.o
 	cpu-objs-y+=gicv3.o
+ifeq ($(GICV4),y)
+	cpu-objs-y+=its.o
+endif
 else ifeq ($(GIC_VERSION),)
 $(error Platform must define GIC_VERSION)
 else
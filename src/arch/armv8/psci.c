@@ -11,8 +11,10 @@
 #include <mem.h>
 #include <cache.h>
 #include <config.h>
+#include <vsched.h>
 
 enum { PSCI_MSG_ON };
+extern volatile const size_t PSCI_CPUMSG_ID;
 
 /* --------------------------------
     SMC Trapping
@@ -36,6 +38,11 @@ void psci_wake_from_off()
 
 void psci_cpumsg_handler(uint32_t event, uint64_t data)
 {
+    struct cpu_msg msg = { (uint32_t)PSCI_CPUMSG_ID, event, data };
+    if (vsched_msg_defer((vmid_t)data, &msg)) {
+        return;
+    }
+
     switch (event) {
         case PSCI_MSG_ON:
             psci_wake_from_off();
@@ -124,7 +131,7 @@ int32_t psci_cpu_on_handler(unsigned long target_cpu, unsigned long entrypoint,
         if (pcpuid == INVALID_CPUID) {
             ret = PSCI_E_INVALID_PARAMS;
         } else {
-            struct cpu_msg msg = { PSCI_CPUMSG_ID, PSCI_MSG_ON };
+            struct cpu_msg msg = { PSCI_CPUMSG_ID, PSCI_MSG_ON, vm->id };
             cpu_send_msg(pcpuid, &msg);
             ret = PSCI_E_SUCCESS;
         }
@@ -21,6 +21,11 @@
 #include <interrupts.h>
 #include <vm.h>
 #include <platform.h>
+#include <vsched.h>
+
+#ifdef VGIC_STATS
+#include <generic_timer.h>
+#endif
 
 enum VGIC_EVENTS { VGIC_UPDATE_ENABLE, VGIC_ROUTE, VGIC_INJECT, VGIC_SET_REG };
 extern volatile const size_t VGIC_IPI_ID;
@@ -41,6 +46,59 @@ extern volatile const size_t VGIC_IPI_ID;
 #define VGIC_MSG_REG(DATA)     (((DATA) >> 8) & 0xff)
 #define VGIC_MSG_VAL(DATA)     ((DATA) & 0xff)
 
+#ifdef VGIC_STATS
+
+#define VGIC_STATS_PERIOD (4096)
+
+/**
+ * Durations in counter ticks, printed and reset every VGIC_STATS_PERIOD samples.
+ */
+struct vgic_stats {
+    uint64_t total;
+    uint64_t max;
+    size_t samples;
+};
+
+/* Time the spilled interrupts lock is held by each cpu when refilling its list registers */
+static struct vgic_stats vgic_spilled_lock_stats[PLAT_CPU_NUM];
+/* Time to inject each hardware interrupt through the direct and the regular path */
+static struct vgic_stats vgic_direct_stats[GIC_MAX_INTERUPTS];
+static struct vgic_stats vgic_forward_stats[GIC_MAX_INTERUPTS];
+
+static inline uint64_t vgic_stats_start(void)
+{
+    return generic_timer_read_counter();
+}
+
+static void vgic_stats_end(struct vgic_stats* stats, uint64_t start, const char* what,
+    unsigned long id)
+{
+    uint64_t duration = generic_timer_read_counter() - start;
+
+    stats->total += duration;
+    if (duration > stats->max) {
+        stats->max = duration;
+    }
+
+    if (++stats->samples >= VGIC_STATS_PERIOD) {
+        INFO("vgic: %s %d avg %llu max %llu ticks over %d samples", what, id,
+            stats->total / stats->samples, stats->max, stats->samples);
+        stats->total = 0;
+        stats->max = 0;
+        stats->samples = 0;
+    }
+}
+
+#define VGIC_STATS_START()              uint64_t vgic_stats_ts = vgic_stats_start()
+#define VGIC_STATS_END(STATS, WHAT, ID) vgic_stats_end(&(STATS)[ID], vgic_stats_ts, WHAT, ID)
+
+#else
+
+#define VGIC_STATS_START()
+#define VGIC_STATS_END(STATS, WHAT, ID)
+
+#endif
+
 void vgic_ipi_handler(uint32_t event, uint64_t data);
 CPU_MSG_HANDLER(vgic_ipi_handler, VGIC_IPI_ID);
 
@@ -56,6 +114,18 @@ inline struct vgic_int* vgic_get_int(struct vcpu* vcpu, irqid_t int_id, vcpuid_t
     return NULL;
 }
 
+struct vgic_int_regs* vgic_get_int_regs(struct vcpu* vcpu, struct vgic_int* interrupt)
+{
+    if (gic_is_priv(interrupt->id)) {
+        /* the interrupt might belong to another vcpu's redistributor */
+        struct vgic_priv* vgic_priv = (struct vgic_priv*)((uintptr_t)(interrupt - interrupt->id) -
+            offsetof(struct vgic_priv, interrupts));
+        return &vgic_priv->int_regs[interrupt->id];
+    } else {
+        return &vcpu->vm->arch.vgicd.int_regs[interrupt->id - GIC_CPU_PRIV];
+    }
+}
+
 static inline bool vgic_int_is_hw(struct vgic_int* interrupt)
 {
     return !(interrupt->id < GIC_MAX_SGIS) && interrupt->hw;
@@ -120,7 +190,7 @@ bool vgic_owns(struct vcpu* vcpu, struct vgic_int* interrupt)
 void vgic_yield_ownership(struct vcpu* vcpu, struct vgic_int* interrupt)
 {
     if ((GIC_VERSION == GICV2 && gic_is_priv(interrupt->id)) || !vgic_owns(vcpu, interrupt) ||
-        interrupt->in_lr || (vgic_get_state(interrupt) & ACT)) {
+        interrupt->in_lr || interrupt->direct || (vgic_get_state(interrupt) & ACT)) {
         return;
     }
 
@@ -281,16 +351,43 @@ bool vgic_remove_lr(struct vcpu* vcpu, struct vgic_int* interrupt)
     return ret;
 }
 
+void vgic_spilled_init(struct vgic_spilled* spilled)
+{
+    bitmap_clear_consecutive(spilled->lvls, 0, VGIC_SPILLED_LVLS);
+    for (size_t i = 0; i < VGIC_SPILLED_LVLS; i++) {
+        list_init(&spilled->fifo[i]);
+    }
+}
+
+/**
+ * The level an interrupt is queued at is saved as its priority might change while spilled.
+ */
+static void vgic_spilled_push(struct vgic_spilled* spilled, struct vgic_int* interrupt)
+{
+    interrupt->spilled_lvl = interrupt->prio >> (GIC_PRIO_BITS - GICH_LR_PRIO_LEN);
+    list_push(&spilled->fifo[interrupt->spilled_lvl], &interrupt->node);
+    bitmap_set(spilled->lvls, interrupt->spilled_lvl);
+}
+
+static void vgic_spilled_rm(struct vgic_spilled* spilled, struct vgic_int* interrupt)
+{
+    struct list* fifo = &spilled->fifo[interrupt->spilled_lvl];
+    list_rm(fifo, &interrupt->node);
+    if (list_empty(fifo)) {
+        bitmap_clear(spilled->lvls, interrupt->spilled_lvl);
+    }
+}
+
 void vgic_add_spilled(struct vcpu* vcpu, struct vgic_int* interrupt)
 {
     spin_lock(&vcpu->vm->arch.vgic_spilled_lock);
-    struct list* spilled_list = NULL;
+    struct vgic_spilled* spilled = NULL;
     if (gic_is_priv(interrupt->id)) {
-        spilled_list = &vcpu->arch.vgic_spilled;
+        spilled = &vcpu->arch.vgic_spilled;
     } else {
-        spilled_list = &vcpu->vm->arch.vgic_spilled;
+        spilled = &vcpu->vm->arch.vgic_spilled;
     }
-    list_push(spilled_list, (node_t*)interrupt);
+    vgic_spilled_push(spilled, interrupt);
     spin_unlock(&vcpu->vm->arch.vgic_spilled_lock);
     gich_set_hcr(gich_get_hcr() | GICH_HCR_NPIE_BIT);
 }
@@ -317,8 +414,14 @@ bool vgic_add_lr(struct vcpu* vcpu, struct vgic_int* interrupt)
         return ret;
     }
 
+    if (interrupt->direct) {
+        vgic_write_lr(vcpu, interrupt, interrupt->lr);
+        return true;
+    }
+
+    uint64_t direct_lrs = vcpu->arch.vgic_priv.direct_lrs;
     ssize_t lr_ind = -1;
-    uint64_t elrsr = gich_get_elrsr();
+    uint64_t elrsr = gich_get_elrsr() & ~direct_lrs;
     for (size_t i = 0; i < NUM_LRS; i++) {
         if (bit64_get(elrsr, i)) {
             lr_ind = i;
@@ -333,6 +436,10 @@ bool vgic_add_lr(struct vcpu* vcpu, struct vgic_int* interrupt)
         ssize_t pend_ind = -1, act_ind = -1;
 
         for (size_t i = 0; i < NUM_LRS; i++) {
+            if (bit64_get(direct_lrs, i)) {
+                continue;
+            }
+
             unsigned long lr = gich_read_lr(i);
             unsigned lr_id = GICH_LR_VID(lr);
             unsigned lr_prio = (lr & GICH_LR_PRIO_MSK) >> GICH_LR_PRIO_OFF;
@@ -584,26 +691,28 @@ unsigned long vgic_int_get_act(struct vcpu* vcpu, struct vgic_int* interrupt)
 
 bool vgic_int_set_cfg(struct vcpu* vcpu, struct vgic_int* interrupt, unsigned long cfg)
 {
-    uint8_t prev_cfg = interrupt->cfg;
-    interrupt->cfg = (uint8_t)cfg;
+    struct vgic_int_regs* regs = vgic_get_int_regs(vcpu, interrupt);
+    uint8_t prev_cfg = regs->cfg;
+    regs->cfg = (uint8_t)cfg;
     return prev_cfg != cfg;
 }
 
 unsigned long vgic_int_get_cfg(struct vcpu* vcpu, struct vgic_int* interrupt)
 {
-    return (unsigned long)interrupt->cfg;
+    return (unsigned long)vgic_get_int_regs(vcpu, interrupt)->cfg;
 }
 
 void vgic_int_set_cfg_hw(struct vcpu* vcpu, struct vgic_int* interrupt)
 {
+    uint8_t cfg = vgic_get_int_regs(vcpu, interrupt)->cfg;
 #if (GIC_VERSION != GICV2)
     if (gic_is_priv(interrupt->id)) {
-        gicr_set_icfgr(interrupt->id, interrupt->cfg, interrupt->phys.redist);
+        gicr_set_icfgr(interrupt->id, cfg, interrupt->phys.redist);
     } else {
-        gicd_set_icfgr(interrupt->id, interrupt->cfg);
+        gicd_set_icfgr(interrupt->id, cfg);
     }
 #else
-    gic_set_icfgr(interrupt->id, interrupt->cfg);
+    gic_set_icfgr(interrupt->id, cfg);
 #endif
 }
 
@@ -646,8 +755,11 @@ void vgic_int_set_field(struct vgic_reg_handler_info* handlers, struct vcpu* vcp
     spin_lock(&interrupt->lock);
     if (vgic_get_ownership(vcpu, interrupt)) {
         vgic_remove_lr(vcpu, interrupt);
-        if (handlers->update_field(vcpu, interrupt, data) && vgic_int_is_hw(interrupt)) {
-            handlers->update_hw(vcpu, interrupt);
+        if (handlers->update_field(vcpu, interrupt, data)) {
+            if (vgic_int_is_hw(interrupt)) {
+                handlers->update_hw(vcpu, interrupt);
+            }
+            vgic_update_vsgi(vcpu, interrupt);
         }
         vgic_route(vcpu, interrupt);
         vgic_yield_ownership(vcpu, interrupt);
@@ -662,6 +774,55 @@ void vgic_int_set_field(struct vgic_reg_handler_info* handlers, struct vcpu* vcp
     spin_unlock(&interrupt->lock);
 }
 
+/**
+ * An enable register write only acts on the interrupts whose bit is set, and usually most of those
+ * are already in the requested state. Only the ones that change are updated, and the physical
+ * enables of the hardware SPIs among them are set in a single distributor register write.
+ */
+static void vgic_emul_enable_batch(struct vgic_reg_handler_info* handlers, struct vcpu* vcpu,
+    irqid_t first_int, unsigned long val, cpuid_t vgicr_id)
+{
+    bool enable = (handlers->regid == VGIC_ISENABLER_ID);
+    uint32_t hw_mask = 0;
+    uint32_t bits = (uint32_t)val;
+
+    while (bits != 0) {
+        size_t i = (size_t)bit32_ffs(bits);
+        bits = bit32_clear(bits, i);
+
+        struct vgic_int* interrupt = vgic_get_int(vcpu, first_int + i, vgicr_id);
+        if (interrupt == NULL) {
+            break;
+        }
+
+        spin_lock(&interrupt->lock);
+        bool update = (interrupt->enabled != enable);
+        bool owned = update && vgic_get_ownership(vcpu, interrupt);
+        if (owned) {
+            vgic_remove_lr(vcpu, interrupt);
+            if (handlers->update_field(vcpu, interrupt, 1)) {
+                if (vgic_int_is_hw(interrupt) && !gic_is_priv(interrupt->id)) {
+                    hw_mask |= 1U << i;
+                } else if (vgic_int_is_hw(interrupt)) {
+                    handlers->update_hw(vcpu, interrupt);
+                }
+                vgic_update_vsgi(vcpu, interrupt);
+            }
+            vgic_route(vcpu, interrupt);
+            vgic_yield_ownership(vcpu, interrupt);
+        }
+        spin_unlock(&interrupt->lock);
+
+        if (update && !owned) {
+            vgic_int_set_field(handlers, vcpu, interrupt, 1);
+        }
+    }
+
+    if (hw_mask != 0) {
+        gicd_set_enable_mask(GIC_INT_REG(first_int), hw_mask, enable);
+    }
+}
+
 void vgic_emul_generic_access(struct emul_access* acc, struct vgic_reg_handler_info* handlers,
     bool gicr_access, cpuid_t vgicr_id)
 {
@@ -671,7 +832,10 @@ void vgic_emul_generic_access(struct emul_access* acc, struct vgic_reg_handler_i
     unsigned long mask = (1ull << field_width) - 1;
     bool valid_access = (GIC_VERSION == GICV2) || !(gicr_access ^ gic_is_priv(first_int));
 
-    if (valid_access) {
+    if (valid_access && acc->write &&
+        ((handlers->regid == VGIC_ISENABLER_ID) || (handlers->regid == VGIC_ICENABLER_ID))) {
+        vgic_emul_enable_batch(handlers, cpu()->vcpu, first_int, val, vgicr_id);
+    } else if (valid_access) {
         for (size_t i = 0; i < ((acc->width * 8) / field_width); i++) {
             struct vgic_int* interrupt = vgic_get_int(cpu()->vcpu, first_int + i, vgicr_id);
             if (interrupt == NULL) {
@@ -840,72 +1004,237 @@ bool vgic_check_reg_alignment(struct emul_access* acc, struct vgic_reg_handler_i
     }
 }
 
-bool vgicd_emul_handler(struct emul_access* acc)
+enum vgicd_reg_class {
+    VGICD_MISC_CLASS,
+    VGICD_ISENABLER_CLASS,
+    VGICD_ISPENDR_CLASS,
+    VGICD_ISACTIVER_CLASS,
+    VGICD_ICENABLER_CLASS,
+    VGICD_ICPENDR_CLASS,
+    VGICD_ICACTIVER_CLASS,
+    VGICD_ICFGR_CLASS,
+    VGICD_SGIR_CLASS,
+    VGICD_IPRIORITYR_CLASS,
+    VGICD_ITARGETSR_CLASS,
+    VGICD_IROUTER_CLASS,
+    VGICD_PIDR_CLASS,
+    VGICD_RAZWI_CLASS,
+    VGICD_REG_CLASS_NUM,
+};
+
+static struct vgic_reg_handler_info* const vgicd_class_info[VGICD_REG_CLASS_NUM] = {
+    [VGICD_MISC_CLASS] = &vgicd_misc_info,
+    [VGICD_ISENABLER_CLASS] = &isenabler_info,
+    [VGICD_ISPENDR_CLASS] = &ispendr_info,
+    [VGICD_ISACTIVER_CLASS] = &isactiver_info,
+    [VGICD_ICENABLER_CLASS] = &icenabler_info,
+    [VGICD_ICPENDR_CLASS] = &icpendr_info,
+    [VGICD_ICACTIVER_CLASS] = &iactiver_info,
+    [VGICD_ICFGR_CLASS] = &icfgr_info,
+    [VGICD_SGIR_CLASS] = &sgir_info,
+    [VGICD_IPRIORITYR_CLASS] = &ipriorityr_info,
+    [VGICD_ITARGETSR_CLASS] = &itargetr_info,
+    [VGICD_IROUTER_CLASS] = &irouter_info,
+    [VGICD_PIDR_CLASS] = &vgicd_pidr_info,
+    [VGICD_RAZWI_CLASS] = &razwi_info,
+};
+
+#ifdef VGIC_STATS
+/* Traps and time spent emulating each class of distributor register, per cpu */
+static struct vgic_stats vgicd_class_stats[VGICD_REG_CLASS_NUM][PLAT_CPU_NUM];
+static const char* const vgicd_class_names[VGICD_REG_CLASS_NUM] = {
+    [VGICD_MISC_CLASS] = "gicd misc on cpu",
+    [VGICD_ISENABLER_CLASS] = "gicd isenabler on cpu",
+    [VGICD_ISPENDR_CLASS] = "gicd ispendr on cpu",
+    [VGICD_ISACTIVER_CLASS] = "gicd isactiver on cpu",
+    [VGICD_ICENABLER_CLASS] = "gicd icenabler on cpu",
+    [VGICD_ICPENDR_CLASS] = "gicd icpendr on cpu",
+    [VGICD_ICACTIVER_CLASS] = "gicd icactiver on cpu",
+    [VGICD_ICFGR_CLASS] = "gicd icfgr on cpu",
+    [VGICD_SGIR_CLASS] = "gicd sgir on cpu",
+    [VGICD_IPRIORITYR_CLASS] = "gicd ipriorityr on cpu",
+    [VGICD_ITARGETSR_CLASS] = "gicd itargetsr on cpu",
+    [VGICD_IROUTER_CLASS] = "gicd irouter on cpu",
+    [VGICD_PIDR_CLASS] = "gicd pidr on cpu",
+    [VGICD_RAZWI_CLASS] = "gicd razwi on cpu",
+};
+#endif
+
+#define VGICD_REG_GROUP_NUM ((GICD_REG_MASK(~0UL) + 1) >> 7)
+#define VGICD_DECODE_SLOW   (0xff)
+
+/**
+ * Register class of each 128 byte group of the distributor, or VGICD_DECODE_SLOW for the groups
+ * holding more than one class, which are decoded on each access.
+ */
+static uint8_t vgicd_decode_table[VGICD_REG_GROUP_NUM];
+static spinlock_t vgicd_decode_lock = SPINLOCK_INITVAL;
+static bool vgicd_decode_ready = false;
+
+static enum vgicd_reg_class vgicd_decode(size_t acc_off)
 {
-    struct vgic_reg_handler_info* handler_info = NULL;
-    switch (GICD_REG_MASK(acc->addr) >> 7) {
+    switch (acc_off >> 7) {
         case GICD_REG_GROUP(CTLR):
-            handler_info = &vgicd_misc_info;
-            break;
+            return VGICD_MISC_CLASS;
         case GICD_REG_GROUP(ISENABLER):
-            handler_info = &isenabler_info;
-            break;
+            return VGICD_ISENABLER_CLASS;
         case GICD_REG_GROUP(ISPENDR):
-            handler_info = &ispendr_info;
-            break;
+            return VGICD_ISPENDR_CLASS;
         case GICD_REG_GROUP(ISACTIVER):
-            handler_info = &isactiver_info;
-            break;
+            return VGICD_ISACTIVER_CLASS;
         case GICD_REG_GROUP(ICENABLER):
-            handler_info = &icenabler_info;
-            break;
+            return VGICD_ICENABLER_CLASS;
         case GICD_REG_GROUP(ICPENDR):
-            handler_info = &icpendr_info;
-            break;
+            return VGICD_ICPENDR_CLASS;
         case GICD_REG_GROUP(ICACTIVER):
-            handler_info = &iactiver_info;
-            break;
+            return VGICD_ICACTIVER_CLASS;
         case GICD_REG_GROUP(ICFGR):
-            handler_info = &icfgr_info;
-            break;
+            return VGICD_ICFGR_CLASS;
         case GICD_REG_GROUP(SGIR):
-            handler_info = &sgir_info;
-            break;
-        default: {
-            size_t acc_off = GICD_REG_MASK(acc->addr);
+            return VGICD_SGIR_CLASS;
+        default:
             if (GICD_IS_REG(IPRIORITYR, acc_off)) {
-                handler_info = &ipriorityr_info;
+                return VGICD_IPRIORITYR_CLASS;
             } else if (GICD_IS_REG(ITARGETSR, acc_off)) {
-                handler_info = &itargetr_info;
+                return VGICD_ITARGETSR_CLASS;
             } else if (GICD_IS_REG(IROUTER, acc_off)) {
-                handler_info = &irouter_info;
+                return VGICD_IROUTER_CLASS;
             } else if (GICD_IS_REG(ID, acc_off)) {
-                handler_info = &vgicd_pidr_info;
+                return VGICD_PIDR_CLASS;
             } else {
-                handler_info = &razwi_info;
+                return VGICD_RAZWI_CLASS;
             }
+    }
+}
+
+/**
+ * The decode table is the same for all VMs, so it is filled by the first VM to be initialized.
+ */
+void vgicd_decode_init()
+{
+    spin_lock(&vgicd_decode_lock);
+
+    if (!vgicd_decode_ready) {
+        for (size_t group = 0; group < VGICD_REG_GROUP_NUM; group++) {
+            size_t group_off = group << 7;
+            uint8_t reg_class = (uint8_t)vgicd_decode(group_off);
+            for (size_t off = group_off; off < (group_off + 0x80); off += sizeof(uint32_t)) {
+                if (vgicd_decode(off) != reg_class) {
+                    reg_class = VGICD_DECODE_SLOW;
+                    break;
+                }
+            }
+            vgicd_decode_table[group] = reg_class;
         }
+        vgicd_decode_ready = true;
     }
 
-    if (vgic_check_reg_alignment(acc, handler_info)) {
-        spin_lock(&cpu()->vcpu->vm->arch.vgicd.lock);
-        handler_info->reg_access(acc, handler_info, false, cpu()->vcpu->id);
-        spin_unlock(&cpu()->vcpu->vm->arch.vgicd.lock);
-        return true;
-    } else {
+    spin_unlock(&vgicd_decode_lock);
+}
+
+bool vgicd_emul_handler(struct emul_access* acc)
+{
+    size_t acc_off = GICD_REG_MASK(acc->addr);
+    enum vgicd_reg_class reg_class = vgicd_decode_table[acc_off >> 7];
+    if (reg_class == VGICD_DECODE_SLOW) {
+        reg_class = vgicd_decode(acc_off);
+    }
+    struct vgic_reg_handler_info* handler_info = vgicd_class_info[reg_class];
+
+    if (!vgic_check_reg_alignment(acc, handler_info)) {
         return false;
     }
+
+    VGIC_STATS_START();
+    spin_lock(&cpu()->vcpu->vm->arch.vgicd.lock);
+    handler_info->reg_access(acc, handler_info, false, cpu()->vcpu->id);
+    spin_unlock(&cpu()->vcpu->vm->arch.vgicd.lock);
+    VGIC_STATS_END(vgicd_class_stats[reg_class], vgicd_class_names[reg_class], cpu()->id);
+
+    return true;
+}
+
+/**
+ * Reserve one of the upper half of the list registers for a hardware SPI of a VM with direct
+ * injection enabled, if the SPI is routed only to this vcpu, so that it can be injected by
+ * vgic_inject_direct. The interrupt stays owned by the vcpu until the guest routes it elsewhere.
+ */
+static void vgic_direct_reserve(struct vcpu* vcpu, struct vgic_int* interrupt)
+{
+    if (!vcpu->vm->arch.vgicd.direct_irqs || interrupt->direct || gic_is_priv(interrupt->id) ||
+        !vgic_int_is_hw(interrupt) || !vgic_int_vcpu_is_target(vcpu, interrupt) ||
+        vgic_int_has_other_target(vcpu, interrupt)) {
+        return;
+    }
+
+    size_t first = NUM_LRS / 2;
+    uint64_t free = BIT64_MASK(first, NUM_LRS - first) & ~vcpu->arch.vgic_priv.direct_lrs;
+    ssize_t lr_ind = bit64_ffs(free);
+    if (lr_ind < 0) {
+        return;
+    }
+
+    if (!bit64_get(gich_get_elrsr(), lr_ind)) {
+        vgic_spill_lr(vcpu, lr_ind);
+    }
+
+    vcpu->arch.vgic_priv.direct_lrs |= 1ULL << lr_ind;
+    interrupt->direct = true;
+    interrupt->lr = lr_ind;
+}
+
+/**
+ * Must be called by the interrupt's owner, holding its lock.
+ */
+void vgic_direct_release(struct vcpu* vcpu, struct vgic_int* interrupt)
+{
+    if (!interrupt->direct) {
+        return;
+    }
+
+    vgic_remove_lr(vcpu, interrupt);
+    vcpu->arch.vgic_priv.direct_lrs &= ~(1ULL << interrupt->lr);
+    interrupt->direct = false;
 }
 
 void vgic_inject_hw(struct vcpu* vcpu, irqid_t id)
 {
+    VGIC_STATS_START();
     struct vgic_int* interrupt = vgic_get_int(vcpu, id, vcpu->id);
     spin_lock(&interrupt->lock);
     interrupt->owner = vcpu;
     interrupt->state = PEND;
     interrupt->in_lr = false;
+    vgic_direct_reserve(vcpu, interrupt);
     vgic_add_lr(vcpu, interrupt);
     spin_unlock(&interrupt->lock);
+    VGIC_STATS_END(vgic_forward_stats, "irq forwarded", id);
+}
+
+/**
+ * Fast path for hardware interrupts with a reserved list register on the current vcpu. The
+ * interrupt's lock is not needed: all changes to it are made by its owner, which is this cpu, and
+ * the hypervisor does not take interrupts. The physical interrupt is deactivated by the guest's
+ * EOI through the list register's hardware bit, so no maintenance interrupt is involved.
+ */
+bool vgic_inject_direct(struct vcpu* vcpu, irqid_t id)
+{
+    VGIC_STATS_START();
+
+    if ((vcpu == NULL) || gic_is_priv(id) || (id >= vcpu->vm->arch.vgicd.int_num)) {
+        return false;
+    }
+
+    struct vgic_int* interrupt = &vcpu->vm->arch.vgicd.interrupts[id - GIC_CPU_PRIV];
+    if (!interrupt->direct || (interrupt->owner != vcpu) || !interrupt->enabled) {
+        return false;
+    }
+
+    interrupt->state = PEND;
+    vgic_write_lr(vcpu, interrupt, interrupt->lr);
+
+    VGIC_STATS_END(vgic_direct_stats, "irq direct", id);
+    return true;
 }
 
 void vgic_inject(struct vcpu* vcpu, irqid_t id, vcpuid_t source)
@@ -929,6 +1258,11 @@ void vgic_ipi_handler(uint32_t event, uint64_t data)
     irqid_t int_id = VGIC_MSG_INTID(data);
     uint64_t val = VGIC_MSG_VAL(data);
 
+    struct cpu_msg msg = { (uint32_t)VGIC_IPI_ID, event, data };
+    if (vsched_msg_defer(vm_id, &msg)) {
+        return;
+    }
+
     if (vm_id != cpu()->vcpu->vm->id) {
         ERROR("received vgic3 msg target to another vcpu");
         // TODO: need to fetch vcpu from other vm if the taget vm for this is not active
@@ -968,53 +1302,69 @@ void vgic_ipi_handler(uint32_t event, uint64_t data)
     }
 }
 
+static struct vgic_int* vgic_spilled_first(struct vgic_spilled* spilled, size_t lvl,
+    unsigned flags)
+{
+    list_foreach (spilled->fifo[lvl], struct vgic_int, irq) {
+        if (vgic_get_state(irq) & flags) {
+            return irq;
+        }
+    }
+    return NULL;
+}
+
 /**
- * Must be called holding the vgic_spilled_lock
+ * Must be called holding the vgic_spilled_lock. Both the vcpu's private and the vm's shared
+ * spilled interrupts are looked up starting from the highest priority non-empty level. Within a
+ * level, private interrupts come first and then the oldest spilled. Usually the first interrupt
+ * found is the one returned, but the ones that are in none of the given states are skipped.
  */
 static inline struct vgic_int* vgic_highest_prio_spilled(struct vcpu* vcpu, unsigned flags,
-    struct list** outlist)
+    struct vgic_spilled** outspilled)
 {
-    struct vgic_int* irq = NULL;
-    struct list* spilled_lists[] = {
+    struct vgic_spilled* spilled[] = {
         &vcpu->arch.vgic_spilled,
         &vcpu->vm->arch.vgic_spilled,
     };
-    size_t spilled_list_size = sizeof(spilled_lists) / sizeof(struct list*);
-    for (size_t i = 0; i < spilled_list_size; i++) {
-        struct list* list = spilled_lists[i];
-        list_foreach ((*list), struct vgic_int, temp_irq) {
-            if (!(vgic_get_state(temp_irq) & flags)) {
-                continue;
-            }
-            bool irq_is_null = irq == NULL;
-            uint8_t irq_prio = irq_is_null ? GIC_LOWEST_PRIO : irq->prio;
-            irqid_t irq_id = irq_is_null ? GIC_MAX_VALID_INTERRUPTS : irq->id;
-            bool is_higher_prio = (temp_irq->prio < irq_prio);
-            bool is_same_prio = temp_irq->prio == irq_prio;
-            bool is_lower_id = temp_irq->id < irq_id;
-            if (is_higher_prio || (is_same_prio && is_lower_id)) {
-                irq = temp_irq;
-                *outlist = list;
+    size_t spilled_size = sizeof(spilled) / sizeof(struct vgic_spilled*);
+
+    for (size_t i = 0; i < BITMAP_SIZE(VGIC_SPILLED_LVLS); i++) {
+        bitmap_granule_t lvls = 0;
+        for (size_t j = 0; j < spilled_size; j++) {
+            lvls |= spilled[j]->lvls[i];
+        }
+        while (lvls != 0) {
+            size_t lvl = (i * BITMAP_GRANULE_LEN) + (size_t)bit32_ffs(lvls);
+            for (size_t j = 0; j < spilled_size; j++) {
+                struct vgic_int* irq = vgic_spilled_first(spilled[j], lvl, flags);
+                if (irq != NULL) {
+                    *outspilled = spilled[j];
+                    return irq;
+                }
             }
+            lvls &= lvls - 1;
         }
     }
-    return irq;
+
+    return NULL;
 }
 
 static void vgic_refill_lrs(struct vcpu* vcpu, bool npie)
 {
-    uint64_t elrsr = gich_get_elrsr();
+    uint64_t direct_lrs = vcpu->arch.vgic_priv.direct_lrs;
+    uint64_t elrsr = gich_get_elrsr() & ~direct_lrs;
     ssize_t lr_ind = bit64_ffs(elrsr & BIT64_MASK(0, NUM_LRS));
     unsigned flags = npie ? PEND : ACT | PEND;
     spin_lock(&vcpu->vm->arch.vgic_spilled_lock);
+    VGIC_STATS_START();
     while (lr_ind >= 0) {
-        struct list* list = NULL;
-        struct vgic_int* irq = vgic_highest_prio_spilled(vcpu, flags, &list);
+        struct vgic_spilled* spilled = NULL;
+        struct vgic_int* irq = vgic_highest_prio_spilled(vcpu, flags, &spilled);
         if (irq != NULL) {
             spin_lock(&irq->lock);
             bool got_ownership = vgic_get_ownership(vcpu, irq);
             if (got_ownership) {
-                list_rm(list, &irq->node);
+                vgic_spilled_rm(spilled, irq);
                 vgic_write_lr(vcpu, irq, lr_ind);
             }
             spin_unlock(&irq->lock);
@@ -1027,31 +1377,43 @@ static void vgic_refill_lrs(struct vcpu* vcpu, bool npie)
             break;
         }
         flags = ACT | PEND;
-        elrsr = gich_get_elrsr();
+        elrsr = gich_get_elrsr() & ~direct_lrs;
         lr_ind = bit64_ffs(elrsr & BIT64_MASK(0, NUM_LRS));
     }
+    VGIC_STATS_END(vgic_spilled_lock_stats, "cpu spilled lock held", cpu()->id);
     spin_unlock(&vcpu->vm->arch.vgic_spilled_lock);
 }
 
 static void vgic_eoir_highest_spilled_active(struct vcpu* vcpu)
 {
-    struct list* list = NULL;
-    struct vgic_int* interrupt = vgic_highest_prio_spilled(vcpu, ACT, &list);
+    struct vgic_spilled* spilled = NULL;
 
-    if (interrupt != NULL) {
-        spin_lock(&interrupt->lock);
-        if (vgic_get_ownership(vcpu, interrupt)) {
-            interrupt->state &= ~ACT;
-            if (vgic_int_is_hw(interrupt)) {
-                gic_set_act(interrupt->id, false);
-            } else {
-                if (interrupt->state & PEND) {
-                    vgic_add_lr(vcpu, interrupt);
-                }
+    spin_lock(&vcpu->vm->arch.vgic_spilled_lock);
+    struct vgic_int* interrupt = vgic_highest_prio_spilled(vcpu, ACT, &spilled);
+    if (interrupt == NULL) {
+        spin_unlock(&vcpu->vm->arch.vgic_spilled_lock);
+        return;
+    }
+
+    spin_lock(&interrupt->lock);
+    bool got_ownership = vgic_get_ownership(vcpu, interrupt);
+    if (got_ownership) {
+        /* Once deactivated, it is either inactive or goes through vgic_add_lr again */
+        vgic_spilled_rm(spilled, interrupt);
+    }
+    spin_unlock(&vcpu->vm->arch.vgic_spilled_lock);
+
+    if (got_ownership) {
+        interrupt->state &= ~ACT;
+        if (vgic_int_is_hw(interrupt)) {
+            gic_set_act(interrupt->id, false);
+        } else {
+            if (interrupt->state & PEND) {
+                vgic_add_lr(vcpu, interrupt);
             }
         }
-        spin_unlock(&interrupt->lock);
     }
+    spin_unlock(&interrupt->lock);
 }
 
 void vgic_handle_trapped_eoir(struct vcpu* vcpu)
@@ -1152,3 +1514,72 @@ void vgic_set_hw(struct vm* vm, irqid_t id)
         }
     }
 }
+
+#ifdef VCPU_SCHED
+/**
+ * The list registers and the hardware private interrupts are those of the physical cpu, so when
+ * the vcpu is switched out for a vcpu of another VM they are saved and cleared, the interrupts
+ * left active by the guest staying so until it is switched back in.
+ */
+void vgic_cpu_save(struct vcpu* vcpu)
+{
+    struct vgic_cpu_ctx* ctx = &vcpu->arch.vgic_priv.ctx;
+
+    ctx->hcr = gich_get_hcr();
+    ctx->vmcr = gich_get_vmcr();
+    ctx->apr = gich_get_apr();
+    for (size_t i = 0; i < NUM_LRS; i++) {
+        ctx->lrs[i] = gich_read_lr(i);
+        gich_write_lr(i, 0);
+    }
+    gich_set_apr(0);
+    gich_set_vmcr(0);
+    gich_set_hcr(GICH_HCR_LRENPIE_BIT);
+
+    for (irqid_t id = GIC_MAX_SGIS; id < GIC_CPU_PRIV; id++) {
+        if (vcpu->arch.vgic_priv.interrupts[id].hw) {
+            if (gic_get_act(id)) {
+                bitmap_set(ctx->priv_act, id);
+            } else {
+                bitmap_clear(ctx->priv_act, id);
+            }
+            gic_set_enable(id, false);
+            gic_set_act(id, false);
+        }
+    }
+}
+
+void vgic_cpu_restore(struct vcpu* vcpu)
+{
+    struct vgic_cpu_ctx* ctx = &vcpu->arch.vgic_priv.ctx;
+
+    for (irqid_t id = GIC_MAX_SGIS; id < GIC_CPU_PRIV; id++) {
+        struct vgic_int* interrupt = &vcpu->arch.vgic_priv.interrupts[id];
+        if (interrupt->hw) {
+            gic_set_act(id, bitmap_get(ctx->priv_act, id));
+            vgic_int_enable_hw(vcpu, interrupt);
+        }
+    }
+
+    for (size_t i = 0; i < NUM_LRS; i++) {
+        gich_write_lr(i, ctx->lrs[i]);
+    }
+    gich_set_apr(ctx->apr);
+    gich_set_vmcr(ctx->vmcr);
+    gich_set_hcr(ctx->hcr);
+}
+#endif
+
+/* Whether an interrupt is pending for the running vcpu, which then must not wait for one */
+bool vgic_cpu_pending(struct vcpu* vcpu)
+{
+    for (size_t i = 0; i < NUM_LRS; i++) {
+        uint64_t lr = gich_read_lr(i);
+        if ((lr & GICH_LR_STATE_MSK) == GICH_LR_STATE_PND ||
+            (lr & GICH_LR_STATE_MSK) == GICH_LR_STATE_ACTPEND) {
+            return true;
+        }
+    }
+
+    return false;
+}
@@ -33,6 +33,9 @@ bool vgicd_set_trgt(struct vcpu* vcpu, struct vgic_int* interrupt, unsigned long
 
     uint8_t prev_targets = interrupt->targets;
     targets = vm_translate_to_pcpu_mask(vcpu->vm, targets, GIC_TARGET_BITS);
+    if (prev_targets != targets) {
+        vgic_direct_release(vcpu, interrupt);
+    }
     interrupt->targets = (uint8_t)targets;
     return prev_targets != targets;
 }
@@ -124,9 +127,12 @@ void vgic_inject_sgi(struct vcpu* vcpu, struct vgic_int* interrupt, vcpuid_t sou
     spin_unlock(&interrupt->lock);
 }
 
+void vgic_update_vsgi(struct vcpu* vcpu, struct vgic_int* interrupt) { }
+
 void vgic_init(struct vm* vm, const struct vgic_dscrp* vgic_dscrp)
 {
     vm->arch.vgicd.CTLR = 0;
+    vm->arch.vgicd.direct_irqs = vgic_dscrp->direct_irqs;
     size_t vtyper_itln = vgic_get_itln(vgic_dscrp);
     vm->arch.vgicd.int_num = 32 * (vtyper_itln + 1);
     vm->arch.vgicd.TYPER = ((vtyper_itln << GICD_TYPER_ITLN_OFF) & GICD_TYPER_ITLN_MSK) |
@@ -139,7 +145,9 @@ void vgic_init(struct vm* vm, const struct vgic_dscrp* vgic_dscrp)
 
     size_t vgic_int_size = vm->arch.vgicd.int_num * sizeof(struct vgic_int);
     vm->arch.vgicd.interrupts = mem_alloc_page(NUM_PAGES(vgic_int_size), SEC_HYP_VM, false);
-    if (vm->arch.vgicd.interrupts == NULL) {
+    size_t vgic_int_regs_size = vm->arch.vgicd.int_num * sizeof(struct vgic_int_regs);
+    vm->arch.vgicd.int_regs = mem_alloc_page(NUM_PAGES(vgic_int_regs_size), SEC_HYP_VM, false);
+    if ((vm->arch.vgicd.interrupts == NULL) || (vm->arch.vgicd.int_regs == NULL)) {
         ERROR("failed to alloc vgic");
     }
 
@@ -149,19 +157,21 @@ void vgic_init(struct vm* vm, const struct vgic_dscrp* vgic_dscrp)
         vm->arch.vgicd.interrupts[i].id = i + GIC_CPU_PRIV;
         vm->arch.vgicd.interrupts[i].state = INV;
         vm->arch.vgicd.interrupts[i].prio = GIC_LOWEST_PRIO;
-        vm->arch.vgicd.interrupts[i].cfg = 0;
         vm->arch.vgicd.interrupts[i].targets = 0;
         vm->arch.vgicd.interrupts[i].hw = false;
         vm->arch.vgicd.interrupts[i].in_lr = false;
         vm->arch.vgicd.interrupts[i].enabled = false;
+        vm->arch.vgicd.interrupts[i].direct = false;
+        vm->arch.vgicd.int_regs[i].cfg = 0;
     }
 
     vm->arch.vgicd_emul = (struct emul_mem){ .va_base = vgic_dscrp->gicd_addr,
         .size = ALIGN(sizeof(struct gicd_hw), PAGE_SIZE),
         .handler = vgicd_emul_handler };
     vm_emul_add_mem(vm, &vm->arch.vgicd_emul);
+    vgicd_decode_init();
 
-    list_init(&vm->arch.vgic_spilled);
+    vgic_spilled_init(&vm->arch.vgic_spilled);
     vm->arch.vgic_spilled_lock = SPINLOCK_INITVAL;
 }
 
@@ -173,17 +183,19 @@ void vgic_cpu_init(struct vcpu* vcpu)
         vcpu->arch.vgic_priv.interrupts[i].id = i;
         vcpu->arch.vgic_priv.interrupts[i].state = INV;
         vcpu->arch.vgic_priv.interrupts[i].prio = GIC_LOWEST_PRIO;
-        vcpu->arch.vgic_priv.interrupts[i].cfg = 0;
         vcpu->arch.vgic_priv.interrupts[i].sgi.act = 0;
         vcpu->arch.vgic_priv.interrupts[i].sgi.pend = 0;
         vcpu->arch.vgic_priv.interrupts[i].hw = false;
         vcpu->arch.vgic_priv.interrupts[i].in_lr = false;
         vcpu->arch.vgic_priv.interrupts[i].enabled = false;
+        vcpu->arch.vgic_priv.interrupts[i].direct = false;
+        vcpu->arch.vgic_priv.int_regs[i].cfg = 0;
     }
 
     for (size_t i = 0; i < GIC_MAX_SGIS; i++) {
         vcpu->arch.vgic_priv.interrupts[i].enabled = true;
     }
 
-    list_init(&vcpu->arch.vgic_spilled);
+    vcpu->arch.vgic_priv.direct_lrs = 0;
+    vgic_spilled_init(&vcpu->arch.vgic_spilled);
 }
@@ -12,20 +12,24 @@
 #include <interrupts.h>
 #include <vm.h>
 #include <platform.h>
+#include <arch/its.h>
 
 #define GICR_IS_REG(REG, offset)                    \
     (((offset) >= offsetof(struct gicr_hw, REG)) && \
         (offset) < (offsetof(struct gicr_hw, REG) + sizeof(gicr[0].REG)))
 #define GICR_REG_OFF(REG)   (offsetof(struct gicr_hw, REG) & 0x1ffff)
 #define GICR_REG_MASK(ADDR) ((ADDR) & 0x1ffff)
+
 #define GICD_REG_MASK(ADDR) ((ADDR) & (GIC_VERSION == GICV2 ? 0xfffUL : 0xffffUL))
 
+/* The guests always see GICv3 redistributors, without the GICv4 VLPI and reserved frames */
+#define VGICR_SIZE (0x20000)
+
 bool vgic_int_has_other_target(struct vcpu* vcpu, struct vgic_int* interrupt)
 {
     bool priv = gic_is_priv(interrupt->id);
-    bool routed_here =
-        !priv && !(interrupt->phys.route ^ (sysreg_mpidr_el1_read() & MPIDR_AFF_MSK));
-    bool route_valid = interrupt->phys.route != GICD_IROUTER_INV;
+    bool routed_here = !priv && (interrupt->phys.route == cpu()->id);
+    bool route_valid = interrupt->phys.route != VGIC_PHYS_ROUTE_INV;
     bool any = !priv && vgic_broadcast(vcpu, interrupt);
     return any || (!routed_here && route_valid);
 }
@@ -41,27 +45,32 @@ uint8_t vgic_int_ptarget_mask(struct vcpu* vcpu, struct vgic_int* interrupt)
 
 bool vgic_int_set_route(struct vcpu* vcpu, struct vgic_int* interrupt, unsigned long route)
 {
+    struct vgic_int_regs* regs = vgic_get_int_regs(vcpu, interrupt);
     unsigned long phys_route;
-    unsigned long prev_route = interrupt->route;
+    unsigned long prev_route = regs->route;
 
     if (gic_is_priv(interrupt->id)) {
         return false;
     }
 
     if (route & GICD_IROUTER_IRM_BIT) {
-        phys_route = cpu_id_to_mpidr(vcpu->phys_id);
+        phys_route = vcpu->phys_id;
     } else {
         struct vcpu* tvcpu = vm_get_vcpu_by_mpidr(vcpu->vm, route & MPIDR_AFF_MSK);
         if (tvcpu != NULL) {
-            phys_route = cpu_id_to_mpidr(tvcpu->phys_id) & MPIDR_AFF_MSK;
+            phys_route = tvcpu->phys_id;
         } else {
-            phys_route = GICD_IROUTER_INV;
+            phys_route = VGIC_PHYS_ROUTE_INV;
         }
     }
-    interrupt->phys.route = phys_route;
+    if ((interrupt->phys.route != phys_route) || (route & GICD_IROUTER_IRM_BIT)) {
+        vgic_direct_release(vcpu, interrupt);
+    }
+    interrupt->phys.route = (uint8_t)phys_route;
+    interrupt->broadcast = !!(route & GICD_IROUTER_IRM_BIT);
 
-    interrupt->route = route & GICD_IROUTER_RES0_MSK;
-    return prev_route != interrupt->route;
+    regs->route = route & GICD_IROUTER_RES0_MSK;
+    return prev_route != regs->route;
 }
 
 unsigned long vgic_int_get_route(struct vcpu* vcpu, struct vgic_int* interrupt)
@@ -69,12 +78,21 @@ unsigned long vgic_int_get_route(struct vcpu* vcpu, struct vgic_int* interrupt)
     if (gic_is_priv(interrupt->id)) {
         return 0;
     }
-    return interrupt->route;
+    return vgic_get_int_regs(vcpu, interrupt)->route;
 }
 
 void vgic_int_set_route_hw(struct vcpu* vcpu, struct vgic_int* interrupt)
 {
-    gicd_set_route(interrupt->id, interrupt->phys.route);
+    unsigned long route = GICD_IROUTER_INV;
+
+    if (interrupt->phys.route != VGIC_PHYS_ROUTE_INV) {
+        route = cpu_id_to_mpidr(interrupt->phys.route);
+        if (!interrupt->broadcast) {
+            route &= MPIDR_AFF_MSK;
+        }
+    }
+
+    gicd_set_route(interrupt->id, route);
 }
 
 void vgicr_emul_ctrl_access(struct emul_access* acc, struct vgic_reg_handler_info* handlers,
@@ -190,7 +208,7 @@ struct vgic_reg_handler_info vgicr_pidr_info = {
 
 static inline vcpuid_t vgicr_get_id(struct emul_access* acc)
 {
-    return (acc->addr - cpu()->vcpu->vm->arch.vgicr_addr) / sizeof(struct gicr_hw);
+    return (acc->addr - cpu()->vcpu->vm->arch.vgicr_addr) / VGICR_SIZE;
 }
 
 bool vgicr_emul_handler(struct emul_access* acc)
@@ -270,12 +288,40 @@ bool vgic_icc_sgir_handler(struct emul_access* acc)
             trgtlist = vm_translate_to_pcpu_mask(cpu()->vcpu->vm, ICC_SGIR_TRGLSTFLT(sgir),
                 cpu()->vcpu->vm->cpu_num);
         }
-        vgic_send_sgi_msg(cpu()->vcpu, trgtlist, int_id);
+        if (cpu()->vcpu->vm->arch.vgicd.direct_sgis) {
+            for (size_t i = 0; i < platform.cpu_num; i++) {
+                if (trgtlist & (1ull << i)) {
+                    its_vsgi_send(i, int_id);
+                }
+            }
+        } else {
+            vgic_send_sgi_msg(cpu()->vcpu, trgtlist, int_id);
+        }
     }
 
     return true;
 }
 
+/**
+ * With direct SGIs, the vcpu's SGI configuration lives in its vPE, so it is forwarded to the ITS
+ * whenever the guest changes it. A pending state set by the guest becomes a vSGI.
+ */
+void vgic_update_vsgi(struct vcpu* vcpu, struct vgic_int* interrupt)
+{
+    if (!vcpu->vm->arch.vgicd.direct_sgis || !gic_is_sgi(interrupt->id)) {
+        return;
+    }
+
+    /* the sgi might belong to another vcpu's redistributor, and so to that vcpu's vPE */
+    cpuid_t vpeid = interrupt->phys.redist;
+    its_vsgi_config(vpeid, interrupt->id, interrupt->prio, interrupt->enabled);
+
+    if (interrupt->state & PEND) {
+        interrupt->state &= ~PEND;
+        its_vsgi_send(vpeid, interrupt->id);
+    }
+}
+
 bool vgic_icc_sre_handler(struct emul_access* acc)
 {
     if (!acc->write) {
@@ -288,6 +334,11 @@ void vgic_init(struct vm* vm, const struct vgic_dscrp* vgic_dscrp)
 {
     vm->arch.vgicr_addr = vgic_dscrp->gicr_addr;
     vm->arch.vgicd.CTLR = 0;
+    vm->arch.vgicd.direct_irqs = vgic_dscrp->direct_irqs;
+    vm->arch.vgicd.direct_sgis = vgic_dscrp->direct_sgis && its_vsgi_supported();
+    if (vgic_dscrp->direct_sgis && !vm->arch.vgicd.direct_sgis) {
+        WARNING("vgic: direct sgis not supported, falling back to emulation");
+    }
     size_t vtyper_itln = vgic_get_itln(vgic_dscrp);
     vm->arch.vgicd.int_num = 32 * (vtyper_itln + 1);
     vm->arch.vgicd.TYPER = ((vtyper_itln << GICD_TYPER_ITLN_OFF) & GICD_TYPER_ITLN_MSK) |
@@ -297,7 +348,9 @@ void vgic_init(struct vm* vm, const struct vgic_dscrp* vgic_dscrp)
 
     size_t vgic_int_size = vm->arch.vgicd.int_num * sizeof(struct vgic_int);
     vm->arch.vgicd.interrupts = mem_alloc_page(NUM_PAGES(vgic_int_size), SEC_HYP_VM, false);
-    if (vm->arch.vgicd.interrupts == NULL) {
+    size_t vgic_int_regs_size = vm->arch.vgicd.int_num * sizeof(struct vgic_int_regs);
+    vm->arch.vgicd.int_regs = mem_alloc_page(NUM_PAGES(vgic_int_regs_size), SEC_HYP_VM, false);
+    if ((vm->arch.vgicd.interrupts == NULL) || (vm->arch.vgicd.int_regs == NULL)) {
         ERROR("failed to alloc vgic");
     }
 
@@ -307,18 +360,21 @@ void vgic_init(struct vm* vm, const struct vgic_dscrp* vgic_dscrp)
         vm->arch.vgicd.interrupts[i].id = i + GIC_CPU_PRIV;
         vm->arch.vgicd.interrupts[i].state = INV;
         vm->arch.vgicd.interrupts[i].prio = GIC_LOWEST_PRIO;
-        vm->arch.vgicd.interrupts[i].cfg = 0;
-        vm->arch.vgicd.interrupts[i].route = GICD_IROUTER_INV;
-        vm->arch.vgicd.interrupts[i].phys.route = GICD_IROUTER_INV;
+        vm->arch.vgicd.interrupts[i].phys.route = VGIC_PHYS_ROUTE_INV;
         vm->arch.vgicd.interrupts[i].hw = false;
         vm->arch.vgicd.interrupts[i].in_lr = false;
         vm->arch.vgicd.interrupts[i].enabled = false;
+        vm->arch.vgicd.interrupts[i].direct = false;
+        vm->arch.vgicd.interrupts[i].broadcast = false;
+        vm->arch.vgicd.int_regs[i].cfg = 0;
+        vm->arch.vgicd.int_regs[i].route = GICD_IROUTER_INV;
     }
 
     vm->arch.vgicd_emul = (struct emul_mem){ .va_base = vgic_dscrp->gicd_addr,
         .size = ALIGN(sizeof(struct gicd_hw), PAGE_SIZE),
         .handler = vgicd_emul_handler };
     vm_emul_add_mem(vm, &vm->arch.vgicd_emul);
+    vgicd_decode_init();
 
     for (vcpuid_t vcpuid = 0; vcpuid < vm->cpu_num; vcpuid++) {
         struct vcpu* vcpu = vm_get_vcpu(vm, vcpuid);
@@ -331,7 +387,7 @@ void vgic_init(struct vm* vm, const struct vgic_dscrp* vgic_dscrp)
     }
 
     vm->arch.vgicr_emul = (struct emul_mem){ .va_base = vgic_dscrp->gicr_addr,
-        .size = ALIGN(sizeof(struct gicr_hw), PAGE_SIZE) * vm->cpu_num,
+        .size = VGICR_SIZE * vm->cpu_num,
         .handler = vgicr_emul_handler };
     vm_emul_add_mem(vm, &vm->arch.vgicr_emul);
 
@@ -343,7 +399,7 @@ void vgic_init(struct vm* vm, const struct vgic_dscrp* vgic_dscrp)
         .handler = vgic_icc_sre_handler };
     vm_emul_add_reg(vm, &vm->arch.icc_sre_emul);
 
-    list_init(&vm->arch.vgic_spilled);
+    vgic_spilled_init(&vm->arch.vgic_spilled);
     vm->arch.vgic_spilled_lock = SPINLOCK_INITVAL;
 }
 
@@ -355,17 +411,20 @@ void vgic_cpu_init(struct vcpu* vcpu)
         vcpu->arch.vgic_priv.interrupts[i].id = i;
         vcpu->arch.vgic_priv.interrupts[i].state = INV;
         vcpu->arch.vgic_priv.interrupts[i].prio = GIC_LOWEST_PRIO;
-        vcpu->arch.vgic_priv.interrupts[i].cfg = 0;
-        vcpu->arch.vgic_priv.interrupts[i].route = GICD_IROUTER_INV;
-        vcpu->arch.vgic_priv.interrupts[i].phys.redist = vcpu->phys_id;
+        vcpu->arch.vgic_priv.interrupts[i].phys.redist = (uint8_t)vcpu->phys_id;
         vcpu->arch.vgic_priv.interrupts[i].hw = false;
         vcpu->arch.vgic_priv.interrupts[i].in_lr = false;
         vcpu->arch.vgic_priv.interrupts[i].enabled = false;
+        vcpu->arch.vgic_priv.interrupts[i].direct = false;
+        vcpu->arch.vgic_priv.interrupts[i].broadcast = false;
+        vcpu->arch.vgic_priv.int_regs[i].cfg = 0;
+        vcpu->arch.vgic_priv.int_regs[i].route = GICD_IROUTER_INV;
     }
 
     for (size_t i = 0; i < GIC_MAX_SGIS; i++) {
-        vcpu->arch.vgic_priv.interrupts[i].cfg = 0b10;
+        vcpu->arch.vgic_priv.int_regs[i].cfg = 0b10;
     }
 
-    list_init(&vcpu->arch.vgic_spilled);
+    vcpu->arch.vgic_priv.direct_lrs = 0;
+    vgic_spilled_init(&vcpu->arch.vgic_spilled);
 }
@@ -55,6 +55,8 @@ void vcpu_arch_init(struct vcpu* vcpu, struct vm* vm)
     vcpu_arch_profile_init(vcpu, vm);
 
     vgic_cpu_init(vcpu);
+
+    vcpu_wfx_init(vcpu, vm);
 }
 
 void vcpu_arch_reset(struct vcpu* vcpu, vaddr_t entry)
@@ -0,0 +1,189 @@
+/**
+ * SPDX-License-Identifier: Apache-2.0
+ * Copyright (c) Bao Project and Contributors. All rights reserved.
+ */
+
+#include <arch/aborts.h>
+#include <arch/sysregs.h>
+#include <arch/gic.h>
+#include <arch/vgic.h>
+#include <arch/its.h>
+#include <cpu.h>
+#include <vm.h>
+#include <config.h>
+#include <generic_timer.h>
+#include <vsched.h>
+
+/* First polling window after a halt that would have been cut short by polling */
+#define WFX_POLL_GROW_START_US (10)
+
+#ifdef WFX_STATS
+#define WFX_STATS_PERIOD (4096)
+#endif
+
+static inline uint64_t wfx_us_to_ticks(uint64_t us)
+{
+    return (us * generic_timer_get_freq()) / 1000000;
+}
+
+void vcpu_wfx_init(struct vcpu* vcpu, struct vm* vm)
+{
+    unsigned long hcr = sysreg_hcr_el2_read();
+
+    vcpu->arch.wfx.poll = 0;
+    vcpu->arch.wfx.poll_max = wfx_us_to_ticks(vm->config->platform.arch.wfx.halt_poll_us);
+
+    /*
+     * A trapped WFI only wakes up for the interrupts in the vcpu's list registers, so it would
+     * miss the vSGIs the GIC delivers straight to the vcpu. With direct SGIs, leave WFI native.
+     */
+    bool direct_sgis = vm->config->platform.arch.gic.direct_sgis && its_vsgi_supported();
+    if (vm->config->platform.arch.wfx.wfi && direct_sgis) {
+        if (vcpu->id == 0) {
+            WARNING("wfx: wfi trapping not supported with direct sgis, not trapping wfi");
+        }
+    } else if (vm->config->platform.arch.wfx.wfi) {
+        hcr |= HCR_TWI_BIT;
+    }
+    if (vm->config->platform.arch.wfx.wfe) {
+        hcr |= HCR_TWE_BIT;
+    }
+    sysreg_hcr_el2_write(hcr);
+}
+
+/* Serves the messages and physical interrupts for the cpu, which may make the vcpu runnable */
+static bool wfx_check(struct vcpu* vcpu)
+{
+    if (!list_empty(&cpu()->interface->event_list)) {
+        cpu_msg_handler();
+    }
+    while (gic_handle()) { }
+
+    return vgic_cpu_pending(vcpu);
+}
+
+/**
+ * Adapts the polling window to the last halt, as halt polling only pays off if the vcpu is woken
+ * up shortly after halting. A halt that ended within the maximum window, but after the current one
+ * expired, grows it. A longer one shrinks it, as the time spent polling was wasted.
+ */
+static void wfx_poll_adjust(struct vcpu_wfx* wfx, uint64_t halt_time, bool slept)
+{
+    if (!slept) {
+        return;
+    }
+
+    if (halt_time <= wfx->poll_max) {
+        uint64_t poll = (wfx->poll == 0) ? wfx_us_to_ticks(WFX_POLL_GROW_START_US) : wfx->poll * 2;
+        wfx->poll = (poll < wfx->poll_max) ? poll : wfx->poll_max;
+    } else {
+        wfx->poll /= 2;
+    }
+}
+
+#ifdef WFX_STATS
+static void wfx_stats_print(struct vcpu* vcpu)
+{
+    struct vcpu_wfx* wfx = &vcpu->arch.wfx;
+
+    if ((wfx->stats.halts % WFX_STATS_PERIOD) != 0) {
+        return;
+    }
+
+    INFO("wfx: vm %d vcpu %d halts %d polled %d slept %d poll %llu sleep %llu ticks", vcpu->vm->id,
+        vcpu->id, wfx->stats.halts, wfx->stats.polled, wfx->stats.slept, wfx->stats.poll_time,
+        wfx->stats.sleep_time);
+    if (wfx->stats.slept != 0) {
+        INFO("wfx: vm %d vcpu %d wake-up avg %llu max %llu ticks", vcpu->vm->id, vcpu->id,
+            wfx->stats.wakeup_sum / wfx->stats.slept, wfx->stats.wakeup_max);
+    }
+}
+#endif
+
+/**
+ * Trapped WFI. The cpu polls for a reason for the vcpu to wake up for the current polling window
+ * and then sleeps until one arrives. The hypervisor runs with interrupts masked, but a pending
+ * physical interrupt still ends the wait.
+ */
+static void wfx_halt(struct vcpu* vcpu)
+{
+    struct vcpu_wfx* wfx = &vcpu->arch.wfx;
+    uint64_t start = generic_timer_read_counter();
+    uint64_t now = start;
+    uint64_t poll_end = 0;
+
+    wfx->stats.halts++;
+
+    while (!wfx_check(vcpu)) {
+        now = generic_timer_read_counter();
+        if ((now - start) < wfx->poll) {
+            continue;
+        }
+
+        if (poll_end == 0) {
+            poll_end = now;
+        }
+        asm volatile("dsb sy\n\twfi" ::: "memory");
+        uint64_t sleep_end = generic_timer_read_counter();
+        wfx->stats.sleep_time += sleep_end - now;
+        now = sleep_end;
+    }
+
+    uint64_t end = generic_timer_read_counter();
+    bool slept = (poll_end != 0);
+    if (slept) {
+        uint64_t wakeup = end - now;
+        wfx->stats.slept++;
+        wfx->stats.poll_time += poll_end - start;
+        wfx->stats.wakeup_sum += wakeup;
+        if (wakeup > wfx->stats.wakeup_max) {
+            wfx->stats.wakeup_max = wakeup;
+        }
+    } else {
+        wfx->stats.polled++;
+        wfx->stats.poll_time += end - start;
+    }
+
+    wfx_poll_adjust(wfx, end - start, slept);
+
+#ifdef WFX_STATS
+    wfx_stats_print(vcpu);
+#endif
+}
+
+/**
+ * Trapped WFE. Events are not tracked, so the vcpu polls for at most the maximum window and then
+ * goes back to check whatever it was waiting on.
+ */
+static void wfx_yield(struct vcpu* vcpu)
+{
+    struct vcpu_wfx* wfx = &vcpu->arch.wfx;
+    uint64_t start = generic_timer_read_counter();
+
+    while (!wfx_check(vcpu) && ((generic_timer_read_counter() - start) < wfx->poll_max)) { }
+}
+
+void wfx_handler(unsigned long iss, unsigned long far, unsigned long il, unsigned long ec)
+{
+    struct vcpu* vcpu = cpu()->vcpu;
+    bool wfe = (iss & ESR_ISS_WFx_TI_BIT) != 0;
+
+    vcpu_writepc(vcpu, vcpu_readpc(vcpu) + (il ? 4 : 2));
+
+#ifdef VCPU_SCHED
+    if (vsched_shared()) {
+        if (!wfe) {
+            vsched_arch_wfi(vcpu);
+        }
+        return;
+    }
+#endif
+
+    if (wfe) {
+        if (vcpu->vm->config->platform.arch.wfx.wfe) {
+            wfx_yield(vcpu);
+        }
+    } else {
+        wfx_halt(vcpu);
+    }
+}
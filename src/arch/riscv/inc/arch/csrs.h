@@ -17,6 +17,12 @@
 #define CSR_VSTVAL        0x243
 #define CSR_VSIP          0x244
 #define CSR_VSATP         0x280
+/* Ssaia Extension */
+#define CSR_SISELECT      0x150
+#define CSR_SIREG         0x151
+#define CSR_STOPEI        0x15C
+#define CSR_STOPI         0xDB0
+
 /* Sstc Extension */
 #define CSR_VSTIMECMP     0x24D
 #define CSR_VSTIMECMPH    0x25D
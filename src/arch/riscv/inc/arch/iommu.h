@@ -9,6 +9,11 @@
 #include <bao.h>
 
 // VM-specific IOMMU data
-struct iommu_vm_arch { };
+struct iommu_vm_arch {
+    // MSI page table redirecting the VM's IMSIC pages to its guest interrupt files, 0 if none
+    paddr_t msi_pt;
+    uint64_t msi_addr_mask;
+    uint64_t msi_addr_pattern;
+};
 
 #endif /* __IOMMU_ARCH_H__ */
@@ -8,6 +8,12 @@
 
 #include <bao.h>
 
+/* Supported external interrupt controllers, selected through IRQC */
+#define PLIC  (1)
+#define APLIC (2)
+/* APLIC in MSI delivery mode with per-hart IMSICs */
+#define AIA   (3)
+
 // Arch-specific platform data
 struct arch_platform {
     union irqc_dscrp {
@@ -18,6 +24,10 @@ struct arch_platform {
             struct {
                 paddr_t base;
             } aplic;
+            struct {
+                paddr_t base;            // Base address of hart 0's supervisor-level file
+                size_t guest_index_bits; // Each hart's files span 2^guest_index_bits pages
+            } imsic;
         } aia;
     } irqc;
 
@@ -52,6 +52,13 @@ struct arch_vm_platform {
             struct {
                 paddr_t base;
             } aplic;
+            struct {
+                /**
+                 * Where the VM sees its IMSIC supervisor-level files, one page per vcpu. Only
+                 * used with IRQC=AIA, enables the vAPLIC MSI delivery mode.
+                 */
+                paddr_t base;
+            } imsic;
         } aia;
     } irqc;
 };
@@ -4,11 +4,16 @@
  */
 
 #include <arch/iommu.h>
+#include <io.h>
 #include <config.h>
 #include <interrupts.h>
 #include <string.h>
 #include <arch/spinlock.h>
+#include <arch/fences.h>
 #include <bitmap.h>
+#if (IRQC == AIA)
+#include <imsic.h>
+#endif
 
 // We initially use a 1-LVL DDT with DC in extended format
 // N entries = 4kiB / 64 B p/ entry = 64 Entries
@@ -18,6 +23,16 @@
 #define FQ_LOG2SZ_1                (5ULL)
 #define FQ_INDEX_MASK              BIT32_MASK(0, FQ_LOG2SZ_1 + 1)
 
+#define CQ_N_ENTRIES               (64)
+#define CQ_LOG2SZ_1                (5ULL)
+#define CQ_INDEX_MASK              BIT32_MASK(0, CQ_LOG2SZ_1 + 1)
+
+// Commands queued before the tail is handed over to the IOMMU
+#define CQ_BATCH_MAX               (16)
+
+// Larger ranges are invalidated for the whole GSCID
+#define IOTINVAL_PAGES_MAX         (32)
+
 #define RV_IOMMU_SUPPORTED_VERSION (0x10)
 
 // # Memory-mapped Register Interface
@@ -58,6 +73,12 @@
 #define RV_IOMMU_XQCSR_ON_BIT      (1ULL << 16)
 #define RV_IOMMU_XQCSR_BUSY_BIT    (1ULL << 17)
 
+// CQ CSR
+#define RV_IOMMU_CQCSR_CMD_TO_BIT  (1ULL << 9)
+#define RV_IOMMU_CQCSR_CMD_ILL_BIT (1ULL << 10)
+#define RV_IOMMU_CQCSR_ERR \
+    (RV_IOMMU_XQCSR_MF_BIT | RV_IOMMU_CQCSR_CMD_TO_BIT | RV_IOMMU_CQCSR_CMD_ILL_BIT)
+
 // FQ CSR
 #define RV_IOMMU_FQCSR_OF_BIT      (1ULL << 9)
 #define RV_IOMMU_FQCSR_DEFAULT \
@@ -158,10 +179,25 @@ struct riscv_iommu_regmap {
 #define RV_IOMMU_DC_MSIPTP_MODE_MASK \
     BIT64_MASK(RV_IOMMU_DC_MSIPTP_MODE_OFF, RV_IOMMU_DC_MSIPTP_MODE_LEN)
 
+#define RV_IOMMU_DC_MSIPTP_MODE_FLAT (1ULL << RV_IOMMU_DC_MSIPTP_MODE_OFF)
+
 #define RV_IOMMU_DC_MSIMASK_OFF  (0)
 #define RV_IOMMU_DC_MSIMASK_LEN  (52)
 #define RV_IOMMU_DC_MSIMASK_MASK BIT64_MASK(RV_IOMMU_DC_MSIMASK_OFF, RV_IOMMU_DC_MSIMASK_LEN)
 
+// # MSI Page Table Entry (basic-translate mode)
+#define RV_IOMMU_MSI_PTE_V_BIT   (1ULL << 0)
+#define RV_IOMMU_MSI_PTE_M_FLAT  (3ULL << 1)
+#define RV_IOMMU_MSI_PTE_PPN_OFF (10)
+#define RV_IOMMU_MSI_PTE_PPN_LEN (44)
+#define RV_IOMMU_MSI_PTE_PPN_MASK \
+    BIT64_MASK(RV_IOMMU_MSI_PTE_PPN_OFF, RV_IOMMU_MSI_PTE_PPN_LEN)
+
+struct msi_pte {
+    uint64_t pte;
+    uint64_t mrif_info;
+} __attribute__((__packed__));
+
 struct ddt_entry {
     uint64_t tc;
     uint64_t iohgatp;
@@ -190,12 +226,47 @@ struct fq_entry {
     uint64_t iotval2;
 } __attribute__((__packed__));
 
+// # Command Queue
+#define RV_IOMMU_CMD_OPCODE_OFF       (0)
+#define RV_IOMMU_CMD_FUNC3_OFF        (7)
+
+#define RV_IOMMU_CMD_IOTINVAL         (1ULL << RV_IOMMU_CMD_OPCODE_OFF)
+#define RV_IOMMU_CMD_IOTINVAL_GVMA    (1ULL << RV_IOMMU_CMD_FUNC3_OFF)
+#define RV_IOMMU_CMD_IOTINVAL_AV_BIT  (1ULL << 10)
+#define RV_IOMMU_CMD_IOTINVAL_GV_BIT  (1ULL << 33)
+#define RV_IOMMU_CMD_IOTINVAL_GSCID_OFF (44)
+#define RV_IOMMU_CMD_IOTINVAL_GSCID_LEN (16)
+#define RV_IOMMU_CMD_IOTINVAL_GSCID_MASK \
+    BIT64_MASK(RV_IOMMU_CMD_IOTINVAL_GSCID_OFF, RV_IOMMU_CMD_IOTINVAL_GSCID_LEN)
+#define RV_IOMMU_CMD_IOTINVAL_ADDR_OFF (10)
+
+#define RV_IOMMU_CMD_IOFENCE          (2ULL << RV_IOMMU_CMD_OPCODE_OFF)
+#define RV_IOMMU_CMD_IOFENCE_C        (0ULL << RV_IOMMU_CMD_FUNC3_OFF)
+
+#define RV_IOMMU_CMD_IODIR            (3ULL << RV_IOMMU_CMD_OPCODE_OFF)
+#define RV_IOMMU_CMD_IODIR_INVAL_DDT  (0ULL << RV_IOMMU_CMD_FUNC3_OFF)
+#define RV_IOMMU_CMD_IODIR_DV_BIT     (1ULL << 33)
+#define RV_IOMMU_CMD_IODIR_DID_OFF    (40)
+#define RV_IOMMU_CMD_IODIR_DID_LEN    (24)
+#define RV_IOMMU_CMD_IODIR_DID_MASK \
+    BIT64_MASK(RV_IOMMU_CMD_IODIR_DID_OFF, RV_IOMMU_CMD_IODIR_DID_LEN)
+
+struct cq_entry {
+    uint64_t dw0;
+    uint64_t dw1;
+} __attribute__((__packed__));
+
+struct cq_batch {
+    size_t num;
+    struct cq_entry cmds[CQ_BATCH_MAX];
+};
+
 // # Memory-mapped and in-memory structures
-//  TODO: Add CQ
 struct riscv_iommu_hw {
     volatile struct riscv_iommu_regmap* reg_ptr;
     volatile struct ddt_entry* ddt;
     volatile struct fq_entry* fq;
+    volatile struct cq_entry* cq;
 };
 
 struct riscv_iommu_priv {
@@ -203,6 +274,13 @@ struct riscv_iommu_priv {
 
     spinlock_t ddt_lock;
     BITMAP_ALLOC(ddt_bitmap, DDT_N_ENTRIES);
+
+    spinlock_t cq_lock;
+    uint32_t cqt;
+    // VMs with at least one device, whose translations the IOMMU may have cached
+    BITMAP_ALLOC(vm_bitmap, CONFIG_VM_NUM);
+
+    bool msi_flat;
 };
 
 struct riscv_iommu_priv rv_iommu;
@@ -228,6 +306,8 @@ static void rv_iommu_check_features(void)
     if (!(caps & RV_IOMMU_CAPS_MSI_FLAT_BIT)) {
         WARNING("RISC-V IOMMU HW does not support MSI Address Translation "
                 "(basic-translate mode)");
+    } else {
+        rv_iommu.msi_flat = true;
     }
 
     unsigned igs = bit64_extract(caps, RV_IOMMU_CAPS_IGS_OFF, RV_IOMMU_CAPS_IGS_LEN);
@@ -257,9 +337,9 @@ void rv_iommu_fq_irq_handler(irqid_t irq_id)
             // TODO: MF management
         }
 
+        // The IOMMU drops the records it has no room for, which are only known to be at least one
         if (fqcsr & RV_IOMMU_FQCSR_OF_BIT) {
-            WARNING("RV IOMMU: FQ Full!");
-            // TODO: OF Management
+            io_fault_lost(1);
         }
 
         // Clear fqcsr error bits
@@ -269,16 +349,17 @@ void rv_iommu_fq_irq_handler(irqid_t irq_id)
     // Clear ipsr.fip
     rv_iommu.hw.reg_ptr->ipsr = RV_IOMMU_IPSR_FIP_BIT;
 
-    // Check if new records are available. If yes, report all remaining faults.
+    // Check if new records are available. If yes, record all remaining faults. They are reported
+    // later on, rate limited, so that a faulting device does not keep the hart printing here.
     uint32_t fqh = rv_iommu.hw.reg_ptr->fqh;
     uint32_t fqt = rv_iommu.hw.reg_ptr->fqt;
 
     while (fqh != fqt) {
         struct fq_entry record = rv_iommu.hw.fq[fqh];
-        WARNING("RV IOMMU FQ: CAUSE: %d | DID: %d | iotval: %x | iotval2: %x",
+        io_fault_record(
+            (deviceid_t)bit64_extract(record.tags, RV_IOMMU_FQ_DID_OFF, RV_IOMMU_FQ_DID_LEN),
             bit64_extract(record.tags, RV_IOMMU_FQ_CAUSE_OFF, RV_IOMMU_FQ_CAUSE_LEN),
-            bit64_extract(record.tags, RV_IOMMU_FQ_DID_OFF, RV_IOMMU_FQ_DID_LEN), record.iotval,
-            record.iotval2);
+            record.iotval);
         fqh = (fqh + 1) & FQ_INDEX_MASK;
         // TODO: Translation faults management
     }
@@ -287,6 +368,103 @@ void rv_iommu_fq_irq_handler(irqid_t irq_id)
     rv_iommu.hw.reg_ptr->fqh = fqh;
 }
 
+/**
+ * Check the CQ for errors. Commands are only issued by the hypervisor, so any of them is fatal.
+ */
+static void rv_iommu_cq_check(void)
+{
+    uint32_t cqcsr = rv_iommu.hw.reg_ptr->cqcsr;
+
+    if (cqcsr & RV_IOMMU_CQCSR_ERR) {
+        ERROR("RV IOMMU: CQ error (cqcsr: %x, cqh: %d)", cqcsr, rv_iommu.hw.reg_ptr->cqh);
+    }
+}
+
+/**
+ * Write commands to the CQ, handing them over to the IOMMU only once the whole batch is written or
+ * the CQ is full. Must be called with the CQ lock held.
+ */
+static void rv_iommu_cq_write(const struct cq_entry* cmds, size_t num)
+{
+    for (size_t i = 0; i < num; i++) {
+        uint32_t next = (rv_iommu.cqt + 1) & CQ_INDEX_MASK;
+
+        if (next == rv_iommu.hw.reg_ptr->cqh) {
+            fence_sync();
+            rv_iommu.hw.reg_ptr->cqt = rv_iommu.cqt;
+            while (next == rv_iommu.hw.reg_ptr->cqh) {
+                rv_iommu_cq_check();
+            }
+        }
+
+        rv_iommu.hw.cq[rv_iommu.cqt] = cmds[i];
+        rv_iommu.cqt = next;
+    }
+}
+
+/**
+ * Submit a batch of commands followed by a single IOFENCE.C, and wait for the IOMMU to process it,
+ * which it only does after all the commands before it complete.
+ */
+static void rv_iommu_cq_submit(struct cq_batch* batch, bool fence)
+{
+    spin_lock(&rv_iommu.cq_lock);
+    rv_iommu_cq_write(batch->cmds, batch->num);
+    if (fence) {
+        struct cq_entry cmd = { .dw0 = RV_IOMMU_CMD_IOFENCE | RV_IOMMU_CMD_IOFENCE_C, .dw1 = 0 };
+        rv_iommu_cq_write(&cmd, 1);
+    }
+
+    fence_sync();
+    rv_iommu.hw.reg_ptr->cqt = rv_iommu.cqt;
+
+    if (fence) {
+        while (rv_iommu.hw.reg_ptr->cqh != rv_iommu.cqt) {
+            rv_iommu_cq_check();
+        }
+    }
+    spin_unlock(&rv_iommu.cq_lock);
+
+    batch->num = 0;
+}
+
+static void rv_iommu_cq_batch_add(struct cq_batch* batch, uint64_t dw0, uint64_t dw1)
+{
+    if (batch->num == CQ_BATCH_MAX) {
+        rv_iommu_cq_submit(batch, false);
+    }
+
+    batch->cmds[batch->num].dw0 = dw0;
+    batch->cmds[batch->num].dw1 = dw1;
+    batch->num++;
+}
+
+/**
+ * Init and enable RISC-V IOMMU CQ.
+ */
+static void rv_iommu_cq_init(void)
+{
+    // Allocate memory for CQ (aligned to 4kiB)
+    vaddr_t cq_vaddr = (vaddr_t)mem_alloc_page(NUM_PAGES(sizeof(struct cq_entry) * CQ_N_ENTRIES),
+        SEC_HYP_GLOBAL, true);
+    memset((void*)cq_vaddr, 0, sizeof(struct cq_entry) * CQ_N_ENTRIES);
+    rv_iommu.hw.cq = (struct cq_entry*)cq_vaddr;
+
+    rv_iommu.cq_lock = SPINLOCK_INITVAL;
+    rv_iommu.cqt = 0;
+    bitmap_clear_consecutive(rv_iommu.vm_bitmap, 0, CONFIG_VM_NUM);
+
+    // Configure cqb with queue size and base address. Clear cqt
+    paddr_t cq_paddr;
+    mem_translate(&cpu()->as, cq_vaddr, &cq_paddr);
+    rv_iommu.hw.reg_ptr->cqb = CQ_LOG2SZ_1 | ((cq_paddr >> 2) & RV_IOMMU_XQB_PPN_MASK);
+    rv_iommu.hw.reg_ptr->cqt = 0;
+
+    // Enable CQ (cqcsr). Completion is polled for, so its interrupt is left disabled
+    rv_iommu.hw.reg_ptr->cqcsr = RV_IOMMU_XQCSR_EN_BIT;
+    while (!(rv_iommu.hw.reg_ptr->cqcsr & RV_IOMMU_XQCSR_ON_BIT)) { }
+}
+
 /**
  * Init and enable RISC-V IOMMU.
  */
@@ -312,8 +490,7 @@ void rv_iommu_init(void)
     // Clear all IP flags (ipsr)
     rv_iommu.hw.reg_ptr->ipsr = RV_IOMMU_IPSR_CLEAR;
 
-    // TODO Allocate memory for CQ Configure cqb with queue size and base address. Clear cqt
-    // Allocate IRQ for CQ Enable CQ (cqcsr)
+    rv_iommu_cq_init();
 
     // Allocate memory for FQ (aligned to 4kiB)
     vaddr_t fq_vaddr = (vaddr_t)mem_alloc_page(NUM_PAGES(sizeof(struct fq_entry) * FQ_N_ENTRIES),
@@ -354,7 +531,7 @@ void rv_iommu_init(void)
     mem_translate(&cpu()->as, ddt_vaddr, &ddt_paddr);
     rv_iommu.hw.reg_ptr->ddtp =
         (unsigned long long)platform.arch.iommu.mode | ((ddt_paddr >> 2) & RV_IOMMU_DDTP_PPN_MASK);
-    // TODO: poll ddtp.busy
+    while (rv_iommu.hw.reg_ptr->ddtp & RV_IOMMU_DDTP_BUSY_BIT) { }
 }
 
 /**
@@ -383,7 +560,7 @@ bool rv_iommu_alloc_did(deviceid_t dev_id)
 
 /**
  * Program DDT entry with base address of the root PT, VMID and translation configuration. Enable
- * DC.
+ * DC, and invalidate any copy of it the IOMMU may have cached, so devices can be added at any time.
  *
  * @dev_id:     device_id to index DDT
  * @vm:         VM to which the device is being assigned
@@ -396,21 +573,78 @@ void rv_iommu_write_ddt(deviceid_t dev_id, struct vm* vm, paddr_t root_pt)
         ERROR("IOMMU DC %d is not allocated", dev_id);
     } else {
         // Configure DC
-        uint64_t tc = 0;
-        tc |= RV_IOMMU_DC_VALID_BIT;
-        rv_iommu.hw.ddt[dev_id].tc = tc;
-
         uint64_t iohgatp = 0;
         iohgatp |= ((root_pt >> 12) & RV_IOMMU_DC_IOHGATP_PPN_MASK);
         iohgatp |= ((vm->id << RV_IOMMU_DC_IOHGATP_GSCID_OFF) & RV_IOMMU_DC_IOHGATP_GSCID_MASK);
         iohgatp |= RV_IOMMU_IOHGATP_SV39X4;
         rv_iommu.hw.ddt[dev_id].iohgatp = iohgatp;
 
-        // TODO: Configure first-stage translation. Second-stage only by now Configure MSI
-        // translation
+        // Redirect MSIs to the VM's IMSIC pages to the guest interrupt files backing them
+        if (vm->io.prot.mmu.msi_pt != 0) {
+            rv_iommu.hw.ddt[dev_id].msi_addr_mask = vm->io.prot.mmu.msi_addr_mask;
+            rv_iommu.hw.ddt[dev_id].msi_addr_pattern = vm->io.prot.mmu.msi_addr_pattern;
+            rv_iommu.hw.ddt[dev_id].msiptp = RV_IOMMU_DC_MSIPTP_MODE_FLAT |
+                ((vm->io.prot.mmu.msi_pt >> 12) & RV_IOMMU_DC_MSIPTP_PPN_MASK);
+        }
+
+        // TODO: Configure first-stage translation. Second-stage only by now
+
+        // The DC only becomes valid once all its other fields are written
+        uint64_t tc = 0;
+        tc |= RV_IOMMU_DC_VALID_BIT;
+        fence_ord_write();
+        rv_iommu.hw.ddt[dev_id].tc = tc;
+
+        bitmap_set(rv_iommu.vm_bitmap, vm->id);
     }
     spin_unlock(&rv_iommu.ddt_lock);
+
+    struct cq_batch batch = { .num = 0 };
+    rv_iommu_cq_batch_add(&batch,
+        RV_IOMMU_CMD_IODIR | RV_IOMMU_CMD_IODIR_INVAL_DDT | RV_IOMMU_CMD_IODIR_DV_BIT |
+            (((uint64_t)dev_id << RV_IOMMU_CMD_IODIR_DID_OFF) & RV_IOMMU_CMD_IODIR_DID_MASK),
+        0);
+    rv_iommu_cq_submit(&batch, true);
+}
+
+#if (IRQC == AIA)
+/**
+ * Build the MSI page table of a VM. Its devices' MSIs to the page of the IMSIC file of vcpu N,
+ * i.e., imsic_base + N * PAGE_SIZE, are written to the guest interrupt file backing it. Delivery
+ * then needs no hypervisor intervention.
+ *
+ * @vm:         VM under consideration.
+ * @imsic_base: Where the VM sees its IMSIC files.
+ */
+static void rv_iommu_msi_pt_init(struct vm* vm, paddr_t imsic_base)
+{
+    size_t index_bits = 0;
+    while ((1UL << index_bits) < vm->cpu_num) {
+        index_bits++;
+    }
+
+    // MSI addresses are matched by their pattern outside of the interrupt file number bits
+    if ((imsic_base & ((PAGE_SIZE << index_bits) - 1)) != 0) {
+        WARNING("RV IOMMU: VM %d IMSIC base is not aligned to its size, MSIs not translated",
+            vm->id);
+        return;
+    }
+
+    size_t pt_size = sizeof(struct msi_pte) * (1UL << index_bits);
+    struct msi_pte* msi_pt = mem_alloc_page(NUM_PAGES(pt_size), SEC_HYP_GLOBAL, true);
+    memset(msi_pt, 0, NUM_PAGES(pt_size) * PAGE_SIZE);
+
+    for (vcpuid_t i = 0; i < vm->cpu_num; i++) {
+        paddr_t file = imsic_file_addr(vm_translate_to_pcpuid(vm, i), IMSIC_VM_GUEST_FILE);
+        msi_pt[i].pte = RV_IOMMU_MSI_PTE_V_BIT | RV_IOMMU_MSI_PTE_M_FLAT |
+            (((file >> 12) << RV_IOMMU_MSI_PTE_PPN_OFF) & RV_IOMMU_MSI_PTE_PPN_MASK);
+    }
+
+    mem_translate(&cpu()->as, (vaddr_t)msi_pt, &vm->io.prot.mmu.msi_pt);
+    vm->io.prot.mmu.msi_addr_mask = ((1ULL << index_bits) - 1) & RV_IOMMU_DC_MSIMASK_MASK;
+    vm->io.prot.mmu.msi_addr_pattern = (imsic_base >> 12) & RV_IOMMU_DC_MSIMASK_MASK;
 }
+#endif
 
 /**************** IOMMU IF functions ****************/
 
@@ -484,6 +718,50 @@ inline bool iommu_arch_vm_add_device(struct vm* vm, deviceid_t dev_id)
  */
 bool iommu_arch_vm_init(struct vm* vm, const struct vm_config* config)
 {
-    // For now there is no data to initialize
+    vm->io.prot.mmu.msi_pt = 0;
+
+#if (IRQC == AIA)
+    paddr_t imsic_base = config->platform.arch.irqc.aia.imsic.base;
+    if (imsic_base != 0 && rv_iommu.msi_flat) {
+        rv_iommu_msi_pt_init(vm, imsic_base);
+    }
+#endif
+
     return true;
 }
+
+/**
+ * Invalidate the IOTLB entries of a VM's guest physical address range, with an IOTINVAL.GVMA per
+ * page, or a single one for the whole GSCID if the range is large. All of them complete with a
+ * single IOFENCE.C.
+ *
+ * @vm_id:  VM whose address space changed (GSCID).
+ * @va:     Base guest physical address of the range.
+ * @size:   Size of the range.
+ */
+void iommu_arch_inv_range(asid_t vm_id, vaddr_t va, size_t size)
+{
+    struct cq_batch batch = { .num = 0 };
+    size_t num_pages = NUM_PAGES(size);
+    uint64_t cmd = RV_IOMMU_CMD_IOTINVAL | RV_IOMMU_CMD_IOTINVAL_GVMA |
+        RV_IOMMU_CMD_IOTINVAL_GV_BIT |
+        (((uint64_t)vm_id << RV_IOMMU_CMD_IOTINVAL_GSCID_OFF) & RV_IOMMU_CMD_IOTINVAL_GSCID_MASK);
+
+    // Skip VMs without devices, or all of them if there is no IOMMU
+    if (rv_iommu.hw.reg_ptr == NULL || vm_id >= CONFIG_VM_NUM ||
+        !bitmap_get(rv_iommu.vm_bitmap, vm_id)) {
+        return;
+    }
+
+    if (num_pages > IOTINVAL_PAGES_MAX) {
+        rv_iommu_cq_batch_add(&batch, cmd, 0);
+    } else {
+        for (size_t i = 0; i < num_pages; i++) {
+            vaddr_t addr = va + (i * PAGE_SIZE);
+            rv_iommu_cq_batch_add(&batch, cmd | RV_IOMMU_CMD_IOTINVAL_AV_BIT,
+                (addr >> 12) << RV_IOMMU_CMD_IOTINVAL_ADDR_OFF);
+        }
+    }
+
+    rv_iommu_cq_submit(&batch, true);
+}
@@ -34,14 +34,22 @@ void aplic_init(void)
     aplic_control = (void*)mem_alloc_map_dev(&cpu()->as, SEC_HYP_GLOBAL, INVALID_VA,
         platform.arch.irqc.aia.aplic.base, NUM_PAGES(sizeof(struct aplic_control_hw)));
 
+#if (IRQC != AIA)
     aplic_idc = (void*)mem_alloc_map_dev(&cpu()->as, SEC_HYP_GLOBAL, INVALID_VA,
         platform.arch.irqc.aia.aplic.base + HART_REG_OFF,
         NUM_PAGES(sizeof(struct aplic_idc_hw) * IRQC_HART_INST));
+#endif
 
     /** Ensure that instructions after fence have the APLIC fully mapped */
     fence_sync();
 
+#if (IRQC == AIA)
+    /** The domain has no IDCs, interrupts are forwarded as MSIs to the addresses M-mode set up in
+     *  the msiaddrcfg registers */
+    aplic_control->domaincfg = APLIC_DOMAINCFG_DM;
+#else
     aplic_control->domaincfg = 0;
+#endif
 
     /** Clear all pending and enabled bits*/
     for (size_t i = 0; i < APLIC_NUM_CLRIx_REGS; i++) {
@@ -155,6 +163,13 @@ void aplic_set_target_hart(irqid_t intp_id, cpuid_t hart)
     aplic_control->target[intp_id - 1] |= hart << APLIC_TARGET_HART_IDX_SHIFT;
 }
 
+void aplic_set_target_msi(irqid_t intp_id, cpuid_t hart, size_t guest, uint32_t eiid)
+{
+    aplic_control->target[intp_id - 1] = (hart << APLIC_TARGET_HART_IDX_SHIFT) |
+        ((guest & APLIC_TARGET_GUEST_INDEX_MASK) << APLIC_TARGET_GUEST_IDX_SHIFT) |
+        (eiid & APLIC_TARGET_EEID_MASK);
+}
+
 uint8_t aplic_get_target_prio(irqid_t intp_id)
 {
     return aplic_control->target[intp_id - 1] & APLIC_TARGET_IPRIO_MASK;
@@ -0,0 +1,81 @@
+/**
+ * SPDX-License-Identifier: Apache-2.0
+ * Copyright (c) Bao Project and Contributors. All rights reserved.
+ */
+
+#include <imsic.h>
+#include <cpu.h>
+#include <interrupts.h>
+#include <arch/csrs.h>
+
+/** IMSIC indirectly accessed registers */
+#define IMSIC_EIDELIVERY         (0x70)
+#define IMSIC_EITHRESHOLD        (0x72)
+#define IMSIC_EIE0               (0xC0)
+#define IMSIC_NUM_EIE_REGS       (64)
+/** Only even eie registers exist in RV64, each holding 64 identities */
+#define IMSIC_EIE_REG_STEP       ((REGLEN * 8) / 32)
+
+#define IMSIC_ENABLE_EIDELIVERY  (1)
+#define IMSIC_DISABLE_EIDELIVERY (0)
+#define IMSIC_EITHRESHOLD_EN_ALL (0)
+
+#define IMSIC_TOPEI_ID_OFF       (16)
+#define IMSIC_TOPEI_ID_LEN       (11)
+
+static inline void imsic_write_ireg(unsigned long reg, unsigned long val)
+{
+    CSRW(CSR_SISELECT, reg);
+    CSRW(CSR_SIREG, val);
+}
+
+/**
+ * @brief Reads and clears the highest priority pending and enabled identity.
+ *
+ * @return unsigned long the stopei value, 0 if there is none
+ */
+static inline unsigned long imsic_claim(void)
+{
+    unsigned long topei;
+    asm volatile("csrrw %0, " XSTR(CSR_STOPEI) ", zero" : "=r"(topei)::"memory");
+    return topei;
+}
+
+void imsic_cpu_init(void)
+{
+    imsic_write_ireg(IMSIC_EIDELIVERY, IMSIC_DISABLE_EIDELIVERY);
+    for (size_t i = 0; i < IMSIC_NUM_EIE_REGS; i += IMSIC_EIE_REG_STEP) {
+        imsic_write_ireg(IMSIC_EIE0 + i, ~0UL);
+    }
+    imsic_write_ireg(IMSIC_EITHRESHOLD, IMSIC_EITHRESHOLD_EN_ALL);
+    imsic_write_ireg(IMSIC_EIDELIVERY, IMSIC_ENABLE_EIDELIVERY);
+}
+
+size_t imsic_guest_file_num(void)
+{
+    /** hgeie is WARL, only the bits of the implemented guest files stick */
+    CSRW(CSR_HGEIE, ~0UL);
+    unsigned long hgeie = CSRR(CSR_HGEIE);
+    CSRW(CSR_HGEIE, 0);
+
+    return (size_t)bit_count(hgeie);
+}
+
+paddr_t imsic_file_addr(cpuid_t hart, size_t guest)
+{
+    size_t file = ((size_t)hart << platform.arch.irqc.aia.imsic.guest_index_bits) + guest;
+    return platform.arch.irqc.aia.imsic.base + (file * PAGE_SIZE);
+}
+
+void imsic_handle(void)
+{
+    unsigned long topei;
+
+    while ((topei = imsic_claim()) != 0) {
+        irqid_t intp_id = bit_extract(topei, IMSIC_TOPEI_ID_OFF, IMSIC_TOPEI_ID_LEN);
+        /** The hypervisor uses the APLIC source id as identity for the sources it handles */
+        if (intp_id < MAX_INTERRUPTS) {
+            interrupts_handle(intp_id);
+        }
+    }
+}
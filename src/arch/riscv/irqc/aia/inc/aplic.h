@@ -239,6 +239,16 @@ void aplic_set_target_prio(irqid_t intp_id, uint8_t prio);
  */
 void aplic_set_target_hart(irqid_t intp_id, cpuid_t hart);
 
+/**
+ * @brief Write the target of an interrupt when the domain is in MSI delivery mode
+ *
+ * @param intp_id interrupt ID
+ * @param hart hart index
+ * @param guest guest interrupt file of the hart, 0 for its supervisor-level file
+ * @param eiid external interrupt identity written to the interrupt file
+ */
+void aplic_set_target_msi(irqid_t intp_id, cpuid_t hart, size_t guest, uint32_t eiid);
+
 /**
  * @brief Return the priority of a given interrupt
  *
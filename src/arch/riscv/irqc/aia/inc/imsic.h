@@ -0,0 +1,55 @@
+/**
+ * SPDX-License-Identifier: Apache-2.0
+ * Copyright (c) Bao Project and Contributors. All rights reserved.
+ */
+
+#ifndef IMSIC_H
+#define IMSIC_H
+
+#include <bao.h>
+#include <platform.h>
+
+/**
+ * Guest interrupt file backing the VS-level file of the vcpu running on each hart. Bao runs a
+ * single vcpu per hart, so the first guest file of every hart is enough.
+ */
+#define IMSIC_VM_GUEST_FILE (1)
+
+/** Data structures for IMSIC devices */
+struct imsic_file_hw {
+    uint32_t seteipnum_le;
+    uint32_t seteipnum_be;
+    uint8_t reserved[0x1000 - 0x0008];
+} __attribute__((__packed__, aligned(PAGE_SIZE)));
+
+/**
+ * @brief Initialize the hart's supervisor-level interrupt file, enabling all identities.
+ *
+ * The APLIC only sends MSIs to the hypervisor for the sources targeting it, so identities do not
+ * need to be enabled one by one.
+ */
+void imsic_cpu_init(void);
+
+/**
+ * @brief Returns the number of guest interrupt files of the current hart (GEILEN).
+ *
+ * @return size_t number of guest interrupt files
+ */
+size_t imsic_guest_file_num(void);
+
+/**
+ * @brief Returns the physical address of an interrupt file of a given hart.
+ *
+ * @param hart hart index
+ * @param guest guest interrupt file, 0 for the supervisor-level file
+ * @return paddr_t the interrupt file address
+ */
+paddr_t imsic_file_addr(cpuid_t hart, size_t guest);
+
+/**
+ * @brief Handles all interrupts pending in the supervisor-level interrupt file.
+ *
+ */
+void imsic_handle(void);
+
+#endif // IMSIC_H
@@ -10,6 +10,7 @@
 #include <aplic.h>
 #include <cpu.h>
 #include <vaplic.h>
+#include <imsic.h>
 
 #define IRQC_MAX_INTERRUPTS  (APLIC_MAX_INTERRUPTS)
 
@@ -26,7 +27,11 @@ static inline void irqc_init()
 
 static inline void irqc_cpu_init()
 {
+#if (IRQC == AIA)
+    imsic_cpu_init();
+#else
     aplic_idc_init();
+#endif
 }
 
 static inline void irqc_config_irq(irqid_t int_id, bool en)
@@ -34,8 +39,12 @@ static inline void irqc_config_irq(irqid_t int_id, bool en)
     if (en) {
         aplic_set_sourcecfg(int_id, HYP_IRQ_SM_EDGE_RISE);
         aplic_set_enbl(int_id);
+#if (IRQC == AIA)
+        aplic_set_target_msi(int_id, cpu()->id, 0, int_id);
+#else
         aplic_set_target_hart(int_id, cpu()->id);
         aplic_set_target_prio(int_id, HYP_IRQ_PRIO);
+#endif
     } else {
         aplic_clr_enbl(int_id);
     }
@@ -43,7 +52,11 @@ static inline void irqc_config_irq(irqid_t int_id, bool en)
 
 static inline void irqc_handle()
 {
+#if (IRQC == AIA)
+    imsic_handle();
+#else
     aplic_handle();
+#endif
 }
 
 static inline bool irqc_get_pend(irqid_t int_id)
@@ -8,6 +8,7 @@
 
 #include <bao.h>
 #include <aplic.h>
+#include <imsic.h>
 #include <arch/spinlock.h>
 #include <bitmap.h>
 #include <emul.h>
@@ -26,6 +27,19 @@ struct vaplic {
     BITMAP_ALLOC(iforce, APLIC_DOMAIN_NUM_HARTS);
     uint32_t ithreshold[APLIC_DOMAIN_NUM_HARTS];
     uint32_t topi_claimi[APLIC_DOMAIN_NUM_HARTS];
+    /**
+     * Per IDC set of the interrupts targeting it which are pending and enabled, and the one with
+     * the highest priority among them. Kept up to date by every path changing an interrupt's
+     * pending, enable or target state so that topi updates do not scan all interrupts.
+     */
+    BITMAP_ALLOC_ARRAY(ready, APLIC_MAX_INTERRUPTS, APLIC_DOMAIN_NUM_HARTS);
+    irqid_t best[APLIC_DOMAIN_NUM_HARTS];
+    /**
+     * Whether the VM has IMSIC guest interrupt files, allowing the guest to select the MSI delivery
+     * mode, and where the hypervisor has each vcpu's file mapped.
+     */
+    bool msi;
+    volatile struct imsic_file_hw* imsic_file[APLIC_DOMAIN_NUM_HARTS];
     struct emul_mem aplic_domain_emul;
     struct emul_mem aplic_idc_emul;
 };
@@ -43,6 +43,18 @@ static inline cpuid_t vaplic_vcpuid_to_pcpuid(struct vcpu* vcpu, vcpuid_t vhart)
     return vm_translate_to_pcpuid(vcpu->vm, vhart);
 }
 
+/**
+ * @brief Returns if the guest selected the MSI delivery mode
+ *
+ * @param vaplic virtual aplic
+ * @return true if interrupts are delivered as MSIs to the vcpus' IMSIC files
+ * @return false if interrupts are delivered through the emulated IDCs
+ */
+static inline bool vaplic_msi_mode(struct vaplic* vaplic)
+{
+    return vaplic->msi && !!(vaplic->domaincfg & APLIC_DOMAINCFG_DM);
+}
+
 static uint32_t vaplic_get_domaincfg(struct vcpu* vcpu);
 static uint32_t vaplic_get_target(struct vcpu* vcpu, irqid_t intp_id);
 static uint32_t vaplic_get_idelivery(struct vcpu* vcpu, idcid_t idc_id);
@@ -141,6 +153,119 @@ static bool vaplic_get_active(struct vcpu* vcpu, irqid_t intp_id)
     return ret;
 }
 
+/**
+ * @brief Returns if an interrupt takes precedence over another one, i.e., has a lower priority
+ *        number or the same priority and a lower id.
+ *
+ * @param vaplic virtual aplic
+ * @param intp_id interrupt ID
+ * @param other interrupt ID to compare against, 0 if none
+ * @return true if intp_id takes precedence over other
+ * @return false if it does NOT
+ */
+static bool vaplic_prio_higher(struct vaplic* vaplic, irqid_t intp_id, irqid_t other)
+{
+    uint32_t prio = vaplic->target[intp_id] & APLIC_TARGET_IPRIO_MASK;
+    uint32_t other_prio = vaplic->target[other] & APLIC_TARGET_IPRIO_MASK;
+    return (other == 0) || (prio < other_prio) || (prio == other_prio && intp_id < other);
+}
+
+/**
+ * @brief Recomputes the highest priority ready interrupt of an idc from its ready set
+ *
+ * @param vaplic virtual aplic
+ * @param idc_id idc identifier
+ */
+static void vaplic_best_rescan(struct vaplic* vaplic, idcid_t idc_id)
+{
+    irqid_t best = 0;
+
+    for (size_t i = 0; i < BITMAP_SIZE(APLIC_MAX_INTERRUPTS); i++) {
+        bitmap_granule_t granule = vaplic->ready[idc_id][i];
+        while (granule != 0) {
+            size_t bit = (size_t)bit32_ffs(granule);
+            irqid_t intp_id = (irqid_t)((i * BITMAP_GRANULE_LEN) + bit);
+            if (vaplic_prio_higher(vaplic, intp_id, best)) {
+                best = intp_id;
+            }
+            granule = bit32_clear(granule, bit);
+        }
+    }
+
+    vaplic->best[idc_id] = best;
+}
+
+/**
+ * @brief Removes an interrupt from the ready set of the idc it currently targets
+ *
+ * @pre This function should only be called by a function that has taken the lock, before the
+ *      interrupt's target is changed.
+ *
+ * @param vaplic virtual aplic
+ * @param intp_id interrupt ID
+ */
+static void vaplic_ready_clear(struct vaplic* vaplic, irqid_t intp_id)
+{
+    idcid_t idc_id =
+        (vaplic->target[intp_id] >> APLIC_TARGET_HART_IDX_SHIFT) & APLIC_TARGET_HART_IDX_MASK;
+
+    if (!vaplic_intp_valid(intp_id) || idc_id >= APLIC_DOMAIN_NUM_HARTS) {
+        return;
+    }
+
+    bitmap_clear(vaplic->ready[idc_id], intp_id);
+    if (vaplic->best[idc_id] == intp_id) {
+        vaplic_best_rescan(vaplic, idc_id);
+    }
+}
+
+/**
+ * @brief Re-evaluates if an interrupt is ready on the idc it targets after a change to its
+ *        pending, enable or target state.
+ *
+ * @pre This function should only be called by a function that has taken the lock.
+ *
+ * @param vaplic virtual aplic
+ * @param intp_id interrupt ID
+ */
+static void vaplic_ready_update(struct vaplic* vaplic, irqid_t intp_id)
+{
+    idcid_t idc_id =
+        (vaplic->target[intp_id] >> APLIC_TARGET_HART_IDX_SHIFT) & APLIC_TARGET_HART_IDX_MASK;
+
+    if (!vaplic_intp_valid(intp_id) || idc_id >= APLIC_DOMAIN_NUM_HARTS) {
+        return;
+    }
+
+    if (GET_INTP_REG(vaplic->ip, intp_id) && GET_INTP_REG(vaplic->ie, intp_id)) {
+        bitmap_set(vaplic->ready[idc_id], intp_id);
+        if (vaplic->best[idc_id] == intp_id) {
+            /** Its priority might have decreased */
+            vaplic_best_rescan(vaplic, idc_id);
+        } else if (vaplic_prio_higher(vaplic, intp_id, vaplic->best[idc_id])) {
+            vaplic->best[idc_id] = intp_id;
+        }
+    } else {
+        vaplic_ready_clear(vaplic, intp_id);
+    }
+}
+
+/**
+ * @brief Same as vaplic_ready_update for the interrupts [32*reg:(32*reg)+31] set in mask
+ *
+ * @param vaplic virtual aplic
+ * @param reg register index
+ * @param mask interrupts whose state changed
+ */
+static void vaplic_ready_update_reg(struct vaplic* vaplic, size_t reg, uint32_t mask)
+{
+    while (mask != 0) {
+        size_t bit = (size_t)bit32_ffs(mask);
+        vaplic_ready_update(vaplic, (irqid_t)((reg * APLIC_NUM_INTP_PER_REG) + bit));
+        mask = bit32_clear(mask, bit);
+    }
+}
+
 /**
  * @brief Set a given interrupt as pending
  *
@@ -159,6 +284,7 @@ static bool vaplic_set_pend(struct vcpu* vcpu, irqid_t intp_id)
     if (vaplic_intp_valid(intp_id) && !vaplic_get_pend(vcpu, intp_id) &&
         vaplic_get_active(vcpu, intp_id)) {
         SET_INTP_REG(vaplic->ip, intp_id);
+        vaplic_ready_update(vaplic, intp_id);
         ret = true;
     }
     return ret;
@@ -177,24 +303,16 @@ static bool vaplic_update_topi(struct vcpu* vcpu)
     bool ret = false;
     uint32_t intp_prio = APLIC_MIN_PRIO;
     irqid_t intp_id = APLIC_MAX_INTERRUPTS;
-    uint32_t prio = 0;
     uint32_t idc_threshold = 0;
     bool domain_enbl = false;
     bool idc_enbl = false;
     bool idc_force = false;
     uint32_t update_topi = 0;
 
-    /** Find highest pending and enabled interrupt */
-    for (size_t i = 1; i < APLIC_MAX_INTERRUPTS; i++) {
-        if (vaplic_get_hart_index(vcpu, i) == vcpu->id) {
-            if (vaplic_get_pend(vcpu, i) && vaplic_get_enbl(vcpu, i)) {
-                prio = vaplic_get_target(vcpu, i) & APLIC_TARGET_IPRIO_MASK;
-                if (prio < intp_prio) {
-                    intp_prio = prio;
-                    intp_id = i;
-                }
-            }
-        }
+    /** The highest pending and enabled interrupt is kept in the idc's ready set */
+    if (vaplic->best[vcpu->id] != 0) {
+        intp_id = vaplic->best[vcpu->id];
+        intp_prio = vaplic_get_target(vcpu, intp_id) & APLIC_TARGET_IPRIO_MASK;
     }
 
     /** Can interrupt be delivered? */
@@ -214,6 +332,38 @@ static bool vaplic_update_topi(struct vcpu* vcpu)
     return ret;
 }
 
+/**
+ * @brief Forwards the pending and enabled interrupts targeting a hart as MSIs to its IMSIC file.
+ *
+ * As in a real APLIC in MSI delivery mode, the pending bit is cleared once the MSI is sent. Writing
+ * to the guest interrupt file does not need the target hart to be interrupted.
+ *
+ * @pre This function should only be called by a function that has taken the lock.
+ *
+ * @param vaplic virtual aplic
+ * @param vhart_index hart whose interrupts are forwarded
+ */
+static void vaplic_msi_forward(struct vaplic* vaplic, vcpuid_t vhart_index)
+{
+    if (!(vaplic->domaincfg & APLIC_DOMAINCFG_IE) || vhart_index >= vaplic->idc_num) {
+        return;
+    }
+
+    for (size_t i = 0; i < BITMAP_SIZE(APLIC_MAX_INTERRUPTS); i++) {
+        bitmap_granule_t granule = vaplic->ready[vhart_index][i];
+        while (granule != 0) {
+            size_t bit = (size_t)bit32_ffs(granule);
+            irqid_t intp_id = (irqid_t)((i * BITMAP_GRANULE_LEN) + bit);
+            CLR_INTP_REG(vaplic->ip, intp_id);
+            vaplic->imsic_file[vhart_index]->seteipnum_le =
+                vaplic->target[intp_id] & APLIC_TARGET_EEID_MASK;
+            granule = bit32_clear(granule, bit);
+        }
+        vaplic->ready[vhart_index][i] = 0;
+    }
+    vaplic->best[vhart_index] = 0;
+}
+
 enum { UPDATE_HART_LINE };
 static void vaplic_ipi_handler(uint32_t event, uint64_t data);
 CPU_MSG_HANDLER(vaplic_ipi_handler, VPLIC_IPI_ID);
@@ -228,6 +378,11 @@ static void vaplic_update_hart_line(struct vcpu* vcpu, vcpuid_t vhart_index)
 {
     cpuid_t pcpu_id = vaplic_vcpuid_to_pcpuid(vcpu, vhart_index);
 
+    if (vaplic_msi_mode(&vcpu->vm->arch.vaplic)) {
+        vaplic_msi_forward(&vcpu->vm->arch.vaplic, vhart_index);
+        return;
+    }
+
     /**
      *  If the current cpu is the targeting cpu, signal the intp to the hart. Else, send a mensage
      *  to the targeting cpu
@@ -280,6 +435,36 @@ static void vaplic_ipi_handler(uint32_t event, uint64_t data)
     }
 }
 
+/**
+ * @brief Programs the physical target of an interrupt assigned to the VM from its virtual one.
+ *
+ * @pre This function should only be called by a function that has taken the lock.
+ *
+ * @param vcpu virtual cpu
+ * @param intp_id physical interrupt ID
+ */
+static void vaplic_set_hw_target(struct vcpu* vcpu, irqid_t intp_id)
+{
+    struct vaplic* vaplic = &vcpu->vm->arch.vaplic;
+    cpuid_t pcpu_id = vaplic_vcpuid_to_pcpuid(vcpu, vaplic_get_hart_index(vcpu, intp_id));
+
+#if (IRQC == AIA)
+    if (vaplic_msi_mode(vaplic)) {
+        /** Straight into the target vcpu's guest interrupt file, without hypervisor intervention */
+        aplic_set_target_msi(intp_id, pcpu_id, IMSIC_VM_GUEST_FILE,
+            vaplic->target[intp_id] & APLIC_TARGET_EEID_MASK);
+    } else {
+        /** To the hypervisor, which injects it in the emulated IDC */
+        aplic_set_target_msi(intp_id, pcpu_id, 0, intp_id);
+    }
+#else
+    aplic_set_target_hart(intp_id, pcpu_id);
+    aplic_set_target_prio(intp_id, vaplic->target[intp_id] & APLIC_TARGET_IPRIO_MASK);
+    vaplic->target[intp_id] &= ~APLIC_TARGET_IPRIO_MASK;
+    vaplic->target[intp_id] |= aplic_get_target_prio(intp_id);
+#endif
+}
+
 /**
  * @brief Write to domaincfg register a new value.
  *
@@ -289,12 +474,22 @@ static void vaplic_ipi_handler(uint32_t event, uint64_t data)
 static void vaplic_set_domaincfg(struct vcpu* vcpu, uint32_t new_val)
 {
     struct vaplic* vaplic = &vcpu->vm->arch.vaplic;
+    uint32_t prev_dm = 0;
+
     spin_lock(&vaplic->lock);
     /** Update only the virtual domaincfg */
-    /** Only Interrupt Enable is configurable */
-    new_val &= APLIC_DOMAINCFG_IE;
-    new_val &= ~APLIC_DOMAINCFG_DM;
+    /** Only Interrupt Enable is configurable, and Delivery Mode if the VM has IMSIC files */
+    new_val &= APLIC_DOMAINCFG_IE | (vaplic->msi ? APLIC_DOMAINCFG_DM : 0);
+    prev_dm = vaplic->domaincfg & APLIC_DOMAINCFG_DM;
     vaplic->domaincfg = new_val | APLIC_DOMAINCFG_RO80;
+    if ((new_val & APLIC_DOMAINCFG_DM) != prev_dm) {
+        /** The physical targets of the VM's interrupts depend on the delivery mode */
+        for (irqid_t i = 1; i < APLIC_MAX_INTERRUPTS; i++) {
+            if (vaplic_get_hw(vcpu, i) && vaplic_get_active(vcpu, i)) {
+                vaplic_set_hw_target(vcpu, i);
+            }
+        }
+    }
     vaplic_update_hart(vcpu, UPDATE_ALL_HARTS);
     spin_unlock(&vaplic->lock);
 }
@@ -366,6 +561,7 @@ static void vaplic_set_sourcecfg(struct vcpu* vcpu, irqid_t intp_id, uint32_t ne
         vaplic->srccfg[intp_id] = new_val;
 
         if (new_val == APLIC_SOURCECFG_SM_INACTIVE) {
+            vaplic_ready_clear(vaplic, intp_id);
             CLR_INTP_REG(vaplic->active, intp_id);
             /** Zero pend, en and target registers if intp is now inactive */
             CLR_INTP_REG(vaplic->ip, intp_id);
@@ -415,6 +611,7 @@ static void vaplic_set_setip(struct vcpu* vcpu, size_t reg, uint32_t new_val)
         new_val &= vaplic->active[reg];
         update_intps = (~vaplic->ip[reg]) & new_val;
         vaplic->ip[reg] |= new_val;
+        vaplic_ready_update_reg(vaplic, reg, update_intps);
         for (size_t i = (reg * APLIC_NUM_INTP_PER_REG);
              i < (reg * APLIC_NUM_INTP_PER_REG) + APLIC_NUM_INTP_PER_REG; i++) {
             if (!!bit32_get(update_intps, i % 32)) {
@@ -453,16 +650,19 @@ static void vaplic_set_in_clrip(struct vcpu* vcpu, size_t reg, uint32_t new_val)
 {
     struct vaplic* vaplic = &vcpu->vm->arch.vaplic;
     uint32_t update_intps = 0;
+    uint32_t prev_ip = 0;
 
     spin_lock(&vaplic->lock);
     if (reg < APLIC_NUM_CLRIx_REGS) {
         new_val &= vaplic->active[reg];
         update_intps = vaplic->ip[reg];
+        prev_ip = vaplic->ip[reg];
         vaplic->ip[reg] &= ~(new_val);
         new_val &= vaplic->hw[reg];
         aplic_clr_pend_reg(reg, new_val);
         vaplic->ip[reg] |= aplic_get_pend_reg(reg);
         update_intps &= ~(vaplic->ip[reg]);
+        vaplic_ready_update_reg(vaplic, reg, prev_ip ^ vaplic->ip[reg]);
         for (size_t i = (reg * APLIC_NUM_INTP_PER_REG);
              i < (reg * APLIC_NUM_INTP_PER_REG) + APLIC_NUM_INTP_PER_REG; i++) {
             if (!!bit32_get(update_intps, i % 32)) {
@@ -509,6 +709,7 @@ static void vaplic_set_clripnum(struct vcpu* vcpu, uint32_t new_val)
         } else {
             CLR_INTP_REG(vaplic->ip, new_val);
         }
+        vaplic_ready_update(vaplic, new_val);
         vaplic_update_hart(vcpu, vaplic_get_hart_index(vcpu, new_val));
     }
     spin_unlock(&vaplic->lock);
@@ -549,6 +750,7 @@ static void vaplic_set_setie(struct vcpu* vcpu, size_t reg, uint32_t new_val)
         new_val &= vaplic->active[reg];
         update_intps = ~(vaplic->ie[reg]) & new_val;
         vaplic->ie[reg] |= new_val;
+        vaplic_ready_update_reg(vaplic, reg, update_intps);
         new_val &= vaplic->hw[reg];
         aplic_set_enbl_reg(reg, new_val);
         for (size_t i = (reg * APLIC_NUM_INTP_PER_REG);
@@ -577,6 +779,7 @@ static void vaplic_set_setienum(struct vcpu* vcpu, uint32_t new_val)
             aplic_set_enbl(new_val);
         }
         SET_INTP_REG(vaplic->ie, new_val);
+        vaplic_ready_update(vaplic, new_val);
         vaplic_update_hart(vcpu, vaplic_get_hart_index(vcpu, new_val));
     }
     spin_unlock(&vaplic->lock);
@@ -597,8 +800,9 @@ static void vaplic_set_clrie(struct vcpu* vcpu, size_t reg, uint32_t new_val)
     spin_lock(&vaplic->lock);
     if (reg < APLIC_NUM_SETIx_REGS) {
         new_val &= vaplic->active[reg];
-        update_intps = vaplic->ip[reg] & ~new_val;
+        update_intps = vaplic->ie[reg] & new_val;
         vaplic->ie[reg] &= ~(new_val);
+        vaplic_ready_update_reg(vaplic, reg, update_intps);
         new_val &= vaplic->hw[reg];
         aplic_clr_enbl_reg(reg, new_val);
         for (size_t i = (reg * APLIC_NUM_INTP_PER_REG);
@@ -627,6 +831,7 @@ static void vaplic_set_clrienum(struct vcpu* vcpu, uint32_t new_val)
             aplic_clr_enbl(new_val);
         }
         CLR_INTP_REG(vaplic->ie, new_val);
+        vaplic_ready_update(vaplic, new_val);
         vaplic_update_hart(vcpu, vaplic_get_hart_index(vcpu, new_val));
     }
     spin_unlock(&vaplic->lock);
@@ -649,25 +854,33 @@ static void vaplic_set_target(struct vcpu* vcpu, irqid_t intp_id, uint32_t new_v
 
     spin_lock(&vaplic->lock);
     if (pcpu_id == INVALID_CPUID) {
-        /** If the hart index is invalid, make it vcpu = 0 and read the new pcpu. Software should
-         *  not write anything other than legal values to such a field */
+        /** If the hart index is invalid, make it vcpu = 0. Software should not write anything
+         *  other than legal values to such a field */
         hart_index = 0;
-        pcpu_id = vm_translate_to_pcpuid(vcpu->vm, hart_index);
     }
 
-    new_val &= APLIC_TARGET_DIRECT_MASK;
-    if (priority == 0) {
-        new_val |= APLIC_TARGET_MAX_PRIO;
-        priority = APLIC_TARGET_MAX_PRIO;
+    if (vaplic_msi_mode(vaplic)) {
+        /** The guest index is read-only zero, the VM has no guest interrupt files of its own */
+        new_val = (hart_index << APLIC_TARGET_HART_IDX_SHIFT) | (new_val & APLIC_TARGET_EEID_MASK);
+    } else {
+        new_val &= APLIC_TARGET_DIRECT_MASK;
+        if (priority == 0) {
+            new_val |= APLIC_TARGET_MAX_PRIO;
+            priority = APLIC_TARGET_MAX_PRIO;
+        }
     }
     if (vaplic_get_active(vcpu, intp_id) && vaplic_get_target(vcpu, intp_id) != new_val) {
         prev_hart_index = vaplic_get_hart_index(vcpu, intp_id);
+        vaplic_ready_clear(vaplic, intp_id);
+        if (vaplic_msi_mode(vaplic)) {
+            vaplic->target[intp_id] = new_val;
+        } else {
+            vaplic->target[intp_id] = (hart_index << APLIC_TARGET_HART_IDX_SHIFT) | priority;
+        }
         if (vaplic_get_hw(vcpu, intp_id)) {
-            aplic_set_target_hart(intp_id, pcpu_id);
-            aplic_set_target_prio(intp_id, priority);
-            priority = aplic_get_target_prio(intp_id);
+            vaplic_set_hw_target(vcpu, intp_id);
         }
-        vaplic->target[intp_id] = (hart_index << APLIC_TARGET_HART_IDX_SHIFT) | priority;
+        vaplic_ready_update(vaplic, intp_id);
         if (prev_hart_index != hart_index) {
             vaplic_update_hart(vcpu, prev_hart_index);
         }
@@ -842,6 +1055,7 @@ static uint32_t vaplic_get_claimi(struct vcpu* vcpu, idcid_t idc_id)
     if (idc_id < vaplic->idc_num) {
         ret = vaplic->topi_claimi[idc_id];
         CLR_INTP_REG(vaplic->ip, (ret >> IDC_CLAIMI_INTP_ID_SHIFT));
+        vaplic_ready_update(vaplic, (irqid_t)(ret >> IDC_CLAIMI_INTP_ID_SHIFT));
         /** Spurious intp*/
         if (ret == 0) {
             bitmap_clear(vaplic->iforce, idc_id);
@@ -1278,6 +1492,34 @@ static bool vaplic_idc_emul_handler(struct emul_access* acc)
     return true;
 }
 
+#if (IRQC == AIA)
+/**
+ * @brief Maps each vcpu's guest interrupt file both where the VM expects its IMSIC files and in
+ *        the hypervisor, to forward the emulated interrupts.
+ *
+ * @param vm Virtual machine
+ * @param vm_irqc_dscrp virtual irqc platform configuration
+ */
+static void vaplic_imsic_init(struct vm* vm, const union vm_irqc_dscrp* vm_irqc_dscrp)
+{
+    struct vaplic* vaplic = &vm->arch.vaplic;
+
+    if (imsic_guest_file_num() < IMSIC_VM_GUEST_FILE) {
+        ERROR("VM %d configures an IMSIC but harts have no guest interrupt files", vm->id);
+    }
+
+    for (vcpuid_t i = 0; i < vm->cpu_num; i++) {
+        paddr_t file = imsic_file_addr(vm_translate_to_pcpuid(vm, i), IMSIC_VM_GUEST_FILE);
+        vaplic->imsic_file[i] =
+            (void*)mem_alloc_map_dev(&cpu()->as, SEC_HYP_GLOBAL, INVALID_VA, file, 1);
+        mem_alloc_map_dev(&vm->as, SEC_VM_ANY, vm_irqc_dscrp->aia.imsic.base + (i * PAGE_SIZE),
+            file, 1);
+    }
+
+    vaplic->msi = true;
+}
+#endif
+
 void vaplic_init(struct vm* vm, const union vm_irqc_dscrp* vm_irqc_dscrp)
 {
     if (cpu()->id == vm->master) {
@@ -1297,5 +1539,11 @@ void vaplic_init(struct vm* vm, const union vm_irqc_dscrp* vm_irqc_dscrp)
                 .handler = vaplic_idc_emul_handler };
 
         vm_emul_add_mem(vm, &vm->arch.vaplic.aplic_idc_emul);
+
+#if (IRQC == AIA)
+        if (vm_irqc_dscrp->aia.imsic.base != 0) {
+            vaplic_imsic_init(vm, vm_irqc_dscrp);
+        }
+#endif
     }
 }
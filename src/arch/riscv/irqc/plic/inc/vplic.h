@@ -21,6 +21,13 @@ struct vplic {
     uint32_t prio[PLIC_MAX_INTERRUPTS];
     BITMAP_ALLOC_ARRAY(enbl, PLIC_MAX_INTERRUPTS, PLIC_PLAT_CNTXT_NUM);
     uint32_t threshold[PLIC_PLAT_CNTXT_NUM];
+    /**
+     * Per context set of the interrupts which are pending, not active and enabled, and the one
+     * with the highest priority among them, updated as each of those states changes so that
+     * claims and hart line updates do not need to go through all interrupts.
+     */
+    BITMAP_ALLOC_ARRAY(ready, PLIC_MAX_INTERRUPTS, PLIC_PLAT_CNTXT_NUM);
+    irqid_t best[PLIC_PLAT_CNTXT_NUM];
     struct emul_mem plic_global_emul;
     struct emul_mem plic_threshold_emul;
 };
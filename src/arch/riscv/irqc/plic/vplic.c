@@ -42,16 +42,6 @@ static bool vplic_get_pend(struct vcpu* vcpu, irqid_t id)
     return ret;
 }
 
-static bool vplic_get_act(struct vcpu* vcpu, irqid_t id)
-{
-    bool ret = false;
-    struct vplic* vplic = &vcpu->vm->arch.vplic;
-    if (id < PLIC_MAX_INTERRUPTS) {
-        ret = bitmap_get(vplic->act, id);
-    }
-    return ret;
-}
-
 static bool vplic_get_enbl(struct vcpu* vcpu, int vcntxt, irqid_t id)
 {
     bool ret = false;
@@ -95,22 +85,88 @@ static uint32_t vplic_get_threshold(struct vcpu* vcpu, int vcntxt)
     return vplic->threshold[vcntxt];
 }
 
-static irqid_t vplic_next_pending(struct vcpu* vcpu, int vcntxt)
+/**
+ * Whether the interrupt id takes precedence over other, 0 standing for no interrupt. As the PLIC,
+ * interrupts with priority 0 never do and ties go to the lowest id.
+ */
+static bool vplic_prio_higher(struct vplic* vplic, irqid_t id, irqid_t other)
+{
+    uint32_t prio = vplic->prio[id];
+    uint32_t other_prio = (other != 0) ? vplic->prio[other] : 0;
+    return (prio > other_prio) || (other != 0 && prio == other_prio && id < other);
+}
+
+static void vplic_best_rescan(struct vplic* vplic, int vcntxt)
 {
-    uint32_t max_prio = 0;
-    irqid_t int_id = 0;
-
-    for (size_t i = 0; i < PLIC_MAX_INTERRUPTS; i++) {
-        if (vplic_get_pend(vcpu, i) && !vplic_get_act(vcpu, i) && vplic_get_enbl(vcpu, vcntxt, i)) {
-            uint32_t prio = vplic_get_prio(vcpu, i);
-            if (prio > max_prio) {
-                max_prio = prio;
-                int_id = i;
+    irqid_t best = 0;
+
+    for (size_t i = 0; i < BITMAP_SIZE(PLIC_MAX_INTERRUPTS); i++) {
+        bitmap_granule_t granule = vplic->ready[vcntxt][i];
+        while (granule != 0) {
+            size_t bit = (size_t)bit32_ffs(granule);
+            irqid_t id = (irqid_t)((i * BITMAP_GRANULE_LEN) + bit);
+            if (vplic_prio_higher(vplic, id, best)) {
+                best = id;
             }
+            granule = bit32_clear(granule, bit);
         }
     }
 
-    if (max_prio > vplic_get_threshold(vcpu, vcntxt)) {
+    vplic->best[vcntxt] = best;
+}
+
+/**
+ * Re-evaluates whether the interrupt is ready to be claimed by the context after a change to its
+ * pending, active or enable state. Must be called with the vplic lock held.
+ */
+static void vplic_ready_update(struct vplic* vplic, int vcntxt, irqid_t id)
+{
+    bool ready = bitmap_get(vplic->pend, id) && !bitmap_get(vplic->act, id) &&
+        bitmap_get(vplic->enbl[vcntxt], id);
+
+    if (ready) {
+        bitmap_set(vplic->ready[vcntxt], id);
+        if (vplic_prio_higher(vplic, id, vplic->best[vcntxt])) {
+            vplic->best[vcntxt] = id;
+        }
+    } else {
+        bitmap_clear(vplic->ready[vcntxt], id);
+        if (vplic->best[vcntxt] == id) {
+            vplic_best_rescan(vplic, vcntxt);
+        }
+    }
+}
+
+static void vplic_ready_update_all(struct vplic* vplic, irqid_t id)
+{
+    if (id == 0 || id >= PLIC_MAX_INTERRUPTS) {
+        return;
+    }
+
+    for (size_t i = 0; i < vplic->cntxt_num; i++) {
+        vplic_ready_update(vplic, (int)i, id);
+    }
+}
+
+/* Same as vplic_ready_update, but after a change to the interrupt's priority. */
+static void vplic_ready_prio_update(struct vplic* vplic, int vcntxt, irqid_t id)
+{
+    if (!bitmap_get(vplic->ready[vcntxt], id)) {
+        return;
+    }
+
+    if (vplic->best[vcntxt] == id) {
+        vplic_best_rescan(vplic, vcntxt);
+    } else if (vplic_prio_higher(vplic, id, vplic->best[vcntxt])) {
+        vplic->best[vcntxt] = id;
+    }
+}
+
+static irqid_t vplic_next_pending(struct vcpu* vcpu, int vcntxt)
+{
+    irqid_t int_id = vcpu->vm->arch.vplic.best[vcntxt];
+
+    if (int_id != 0 && vplic_get_prio(vcpu, int_id) > vplic_get_threshold(vcpu, vcntxt)) {
         return int_id;
     } else {
         return 0;
@@ -169,6 +225,7 @@ static void vplic_set_enbl(struct vcpu* vcpu, int vcntxt, irqid_t id, bool set)
         } else {
             bitmap_clear(vplic->enbl[vcntxt], id);
         }
+        vplic_ready_update(vplic, vcntxt, id);
 
         if (vplic_get_hw(vcpu, id)) {
             int pcntxt_id = vplic_vcntxt_to_pcntxt(vcpu, vcntxt);
@@ -186,6 +243,9 @@ static void vplic_set_prio(struct vcpu* vcpu, irqid_t id, uint32_t prio)
     spin_lock(&vplic->lock);
     if (id < PLIC_MAX_INTERRUPTS && vplic_get_prio(vcpu, id) != prio) {
         vplic->prio[id] = prio;
+        for (size_t i = 0; i < vplic->cntxt_num; i++) {
+            vplic_ready_prio_update(vplic, (int)i, id);
+        }
         if (vplic_get_hw(vcpu, id)) {
             plic_set_prio(id, prio);
         } else {
@@ -204,11 +264,15 @@ static void vplic_set_prio(struct vcpu* vcpu, irqid_t id, uint32_t prio)
 
 static irqid_t vplic_claim(struct vcpu* vcpu, int vcntxt)
 {
-    spin_lock(&vcpu->vm->arch.vplic.lock);
+    struct vplic* vplic = &vcpu->vm->arch.vplic;
+    spin_lock(&vplic->lock);
     irqid_t int_id = vplic_next_pending(vcpu, vcntxt);
-    bitmap_clear(vcpu->vm->arch.vplic.pend, int_id);
-    bitmap_set(vcpu->vm->arch.vplic.act, int_id);
-    spin_unlock(&vcpu->vm->arch.vplic.lock);
+    if (int_id != 0) {
+        bitmap_clear(vplic->pend, int_id);
+        bitmap_set(vplic->act, int_id);
+        vplic_ready_update_all(vplic, int_id);
+    }
+    spin_unlock(&vplic->lock);
 
     vplic_update_hart_line(vcpu, vcntxt);
     return int_id;
@@ -216,13 +280,18 @@ static irqid_t vplic_claim(struct vcpu* vcpu, int vcntxt)
 
 static void vplic_complete(struct vcpu* vcpu, int vcntxt, irqid_t int_id)
 {
+    struct vplic* vplic = &vcpu->vm->arch.vplic;
+
     if (vplic_get_hw(vcpu, int_id)) {
         plic_hart[cpu()->arch.plic_cntxt].complete = int_id;
     }
 
-    spin_lock(&vcpu->vm->arch.vplic.lock);
-    bitmap_clear(vcpu->vm->arch.vplic.act, int_id);
-    spin_unlock(&vcpu->vm->arch.vplic.lock);
+    if (int_id < PLIC_MAX_INTERRUPTS) {
+        spin_lock(&vplic->lock);
+        bitmap_clear(vplic->act, int_id);
+        vplic_ready_update_all(vplic, int_id);
+        spin_unlock(&vplic->lock);
+    }
 
     vplic_update_hart_line(vcpu, vcntxt);
 }
@@ -233,6 +302,7 @@ void vplic_inject(struct vcpu* vcpu, irqid_t id)
     spin_lock(&vplic->lock);
     if (id > 0 && id < PLIC_MAX_INTERRUPTS && !vplic_get_pend(vcpu, id)) {
         bitmap_set(vplic->pend, id);
+        vplic_ready_update_all(vplic, id);
 
         if (vplic_get_hw(vcpu, id)) {
             struct plic_cntxt vcntxt = { vcpu->id, PRIV_S };
@@ -243,8 +313,7 @@ void vplic_inject(struct vcpu* vcpu, irqid_t id)
                 if (plic_plat_id_to_cntxt(i).mode != PRIV_S) {
                     continue;
                 }
-                if (vplic_get_enbl(vcpu, i, id) &&
-                    vplic_get_prio(vcpu, id) > vplic_get_threshold(vcpu, i)) {
+                if (vplic->best[i] == id) {
                     vplic_update_hart_line(vcpu, i);
                 }
             }
@@ -82,6 +82,10 @@ size_t guest_page_fault_handler()
 {
     vaddr_t addr = CSRR(CSR_HTVAL) << 2;
 
+    if (vm_mem_fault_recover(cpu()->vcpu->vm, addr)) {
+        return 0;
+    }
+
     emul_handler_t handler = vm_emul_get_mem(cpu()->vcpu->vm, addr);
     if (handler != NULL) {
         unsigned long ins = CSRR(CSR_HTINST);
@@ -126,8 +130,20 @@ size_t guest_page_fault_handler()
     }
 }
 
+size_t guest_ins_page_fault_handler()
+{
+    vaddr_t addr = CSRR(CSR_HTVAL) << 2;
+
+    if (!vm_mem_fault_recover(cpu()->vcpu->vm, addr)) {
+        ERROR("instruction guest page fault (0x%x at 0x%x)", addr, CSRR(sepc));
+    }
+
+    return 0;
+}
+
 sync_handler_t sync_handler_table[] = {
     [SCAUSE_CODE_ECV] = sbi_vs_handler,
+    [SCAUSE_CODE_IGPF] = guest_ins_page_fault_handler,
     [SCAUSE_CODE_LGPF] = guest_page_fault_handler,
     [SCAUSE_CODE_SGPF] = guest_page_fault_handler,
 };
@@ -37,6 +37,12 @@ void vcpu_arch_reset(struct vcpu* vcpu, vaddr_t entry)
     CSRW(sscratch, &vcpu->regs);
 
     vcpu->regs.hstatus = HSTATUS_SPV | HSTATUS_VSXL_64;
+#if (IRQC == AIA)
+    /* Back the VS-level interrupt file with the guest file the VM's IMSIC pages map to */
+    if (vcpu->vm->config->platform.arch.irqc.aia.imsic.base != 0) {
+        vcpu->regs.hstatus |= (IMSIC_VM_GUEST_FILE << HSTATUS_VGEIN_OFF) & HSTATUS_VGEIN_MSK;
+    }
+#endif
     vcpu->regs.sstatus = SSTATUS_SPP_BIT | SSTATUS_FS_DIRTY | SSTATUS_XS_DIRTY;
     vcpu->regs.sepc = entry;
     vcpu->regs.a0 = vcpu->arch.hart_id = vcpu->id;
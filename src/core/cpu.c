@@ -9,6 +9,7 @@
 #include <objpool.h>
 #include <vm.h>
 #include <fences.h>
+#include <vsched.h>
 
 struct cpu_msg_node {
     node_t node;
@@ -76,20 +77,30 @@ bool cpu_get_msg(struct cpu_msg* msg)
     return false;
 }
 
+void cpu_msg_dispatch(struct cpu_msg* msg)
+{
+    if (msg->handler < ipi_cpumsg_handler_num && ipi_cpumsg_handlers[msg->handler]) {
+        ipi_cpumsg_handlers[msg->handler](msg->event, msg->data);
+    }
+}
+
 void cpu_msg_handler()
 {
     cpu()->handling_msgs = true;
     struct cpu_msg msg;
     while (cpu_get_msg(&msg)) {
-        if (msg.handler < ipi_cpumsg_handler_num && ipi_cpumsg_handlers[msg.handler]) {
-            ipi_cpumsg_handlers[msg.handler](msg.event, msg.data);
-        }
+        cpu_msg_dispatch(&msg);
     }
     cpu()->handling_msgs = false;
 }
 
 void cpu_idle()
 {
+#ifdef VCPU_SCHED
+    /* Only returns if there is no other vcpu to run on this cpu */
+    vsched_idle();
+#endif
+
     cpu_arch_idle();
 
     /**
@@ -101,6 +112,11 @@ void cpu_idle()
 
 void cpu_idle_wakeup()
 {
+#ifdef VCPU_SCHED
+    /* Only returns if there is a vcpu to run */
+    vsched_idle_wakeup();
+#endif
+
     if (interrupts_check(IPI_CPU_MSG)) {
         interrupts_clear(IPI_CPU_MSG);
         cpu_msg_handler();
@@ -0,0 +1,47 @@
+/**
+ * SPDX-License-Identifier: Apache-2.0
+ * Copyright (c) Bao Project and Contributors. All rights reserved.
+ */
+
+#include <dram.h>
+#include <platform.h>
+
+struct dram dram_dscr;
+
+size_t BANK_NUM = 1;
+
+void dram_init()
+{
+    for (size_t i = 0; i < platform.dram.bank_bit_num && i < DRAM_MAX_BANK_BITS; i++) {
+        paddr_t bank_bits = platform.dram.bank_bits[i];
+
+        /**
+         * Banks can only be colored at page granularity, so bank functions depending on address
+         * bits inside a page (e.g. channel interleaving on cache lines) are left out.
+         */
+        if ((bank_bits == 0) || (bank_bits & (PAGE_SIZE - 1))) {
+            WARNING("ignoring dram bank bit %d which does not select whole pages", i);
+            continue;
+        }
+
+        if ((1UL << (dram_dscr.bank_bit_num + 1)) > COLORMAP_BANK_OFF) {
+            WARNING("ignoring dram bank bit %d which does not fit in the colormap", i);
+            continue;
+        }
+
+        dram_dscr.bank_bits[dram_dscr.bank_bit_num++] = bank_bits;
+    }
+
+    BANK_NUM = 1UL << dram_dscr.bank_bit_num;
+
+    /**
+     * With bank coloring, the cache colors only have the lower half of the colormap. Merging pairs
+     * of consecutive cache colors keeps the partitioning, only coarser.
+     */
+    if (BANK_NUM > 1) {
+        while (COLOR_NUM > COLORMAP_BANK_OFF) {
+            COLOR_NUM /= 2;
+            COLOR_SIZE *= 2;
+        }
+    }
+}
@@ -10,6 +10,9 @@
 #include "scheds/inc/sched.h"
 #include <ipi.h>
 #include <generic_timer.h>
+#include <vmm.h>
+#include <vsched.h>
+#include <io.h>
 
 volatile unsigned long low_prio_counter = 0;
 long int hypercall(unsigned long id)
@@ -81,6 +84,23 @@ long int hypercall(unsigned long id)
         ret = update_memory_access(arg0);
         low_prio_counter += 1;
         break;
+    case HC_SET_VM_COLORS:
+        // arg0 is the target vm id, arg1 its new colors
+        ret = vmm_set_colors_hypercall(arg0, arg1);
+        break;
+    case HC_VM_COLORS_STATE:
+        // arg0 is the vm id whose last color change is queried
+        ret = vmm_colors_state_hypercall(arg0);
+        break;
+#ifdef VCPU_SCHED
+    case HC_SCHED_REMAINING:
+        ret = vsched_remaining_hypercall();
+        break;
+#endif
+    case HC_IO_FAULTS:
+        // arg0 is the page to copy the iommu faults to
+        ret = io_faults_hypercall(arg0, arg1, arg2);
+        break;
     default:
         WARNING("Unknown hypercall id %d", id);
     }
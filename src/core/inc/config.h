@@ -10,6 +10,7 @@
 #include <platform.h>
 #include <vm.h>
 #include <config_defs.h>
+#include <vsched.h>
 
 #ifndef GENERATING_DEFS
 // clang-format wont correctly recognize the syntax of assembly strings interleaved with
@@ -70,6 +71,13 @@ struct vm_config {
         bool separately_loaded;
         /* Dont copy the image */
         bool inplace;
+        /**
+         * Only meaningful for inplace images of colored VMs. Instead of recoloring the whole
+         * image at boot, the image pages not in the VM's colors are left unmapped and each is
+         * copied to a colored frame on the guest's first access to it. Until then, these pages
+         * are not accessible by the VM's devices through the IOMMU either.
+         */
+        bool lazy_reclr;
     } image;
 
     /* Entry point address in VM's address space */
@@ -83,10 +91,30 @@ struct vm_config {
 
     /**
      * A bitmap for the assigned colors of the VM. This value is truncated depending on the number
-     * of available colors calculated at runtime
+     * of available colors calculated at runtime. If the platform describes its DRAM banks, the VM
+     * can also be restricted to a set of banks by or'ing in BANK_COLORS(banks).
      */
     colormap_t colors;
 
+    /**
+     * Allows the VM to change the colors of any VM, itself included, at runtime through the
+     * HC_SET_VM_COLORS hypercall.
+     */
+    bool color_manager;
+
+    /**
+     * Allows the VM to read the iommu fault counters and last faults of all devices through the
+     * HC_IO_FAULTS hypercall.
+     */
+    bool io_fault_manager;
+
+    /**
+     * Only meaningful if the hypervisor is built with VCPU_SCHED=y. Each physical cpu then takes a
+     * vcpu of every VM whose cpu_affinity includes it, and schedules them according to these
+     * parameters. Defaults to the highest priority with no budget.
+     */
+    struct vsched_config sched;
+
     /**
      * A description of the virtual platform available to the guest, i.e., the virtual machine
      * itself.
@@ -114,6 +142,14 @@ extern struct config {
     size_t shmemlist_size;
     struct shmem* shmemlist;
 
+    /**
+     * Only meaningful if the hypervisor is built with VCPU_SCHED=y. Cyclic schedules indexed by
+     * physical cpu id. A cpu with a non-empty table only runs a VM's vcpu within the VM's windows,
+     * regardless of the VMs' priorities and budgets. The others use the priority scheduler.
+     */
+    size_t sched_tables_size;
+    struct vsched_table* sched_tables;
+
     /* The number of VMs specified by this configuration */
     size_t vmlist_size;
 
@@ -0,0 +1,40 @@
+/**
+ * SPDX-License-Identifier: Apache-2.0
+ * Copyright (c) Bao Project and Contributors. All rights reserved.
+ */
+
+#ifndef __DRAM_H__
+#define __DRAM_H__
+
+#include <bao.h>
+#include <bit.h>
+
+#define DRAM_MAX_BANK_BITS (5)
+
+/**
+ * Description of how the memory controller maps physical addresses to DRAM banks (and channels,
+ * ranks, etc., which are treated just as more bank bits). Each bit of the bank index is the xor of
+ * the physical address bits set in the respective mask.
+ */
+struct dram {
+    size_t bank_bit_num;
+    paddr_t bank_bits[DRAM_MAX_BANK_BITS];
+};
+
+extern size_t BANK_NUM;
+extern struct dram dram_dscr;
+
+void dram_init();
+
+static inline size_t dram_bank(paddr_t pa)
+{
+    size_t bank = 0;
+
+    for (size_t i = 0; i < dram_dscr.bank_bit_num; i++) {
+        bank |= (bit_count(pa & dram_dscr.bank_bits[i]) & 1) << i;
+    }
+
+    return bank;
+}
+
+#endif /* __DRAM_H__ */
@@ -22,7 +22,11 @@ enum
     HC_DISPLAY_RESULTS = 8,
     HC_MEASURE_IPI = 9,
     HC_REVOKE_MEM_ACCESS_TIMER = 10,
-    HC_UPDATE_MEM_ACCESS = 11
+    HC_UPDATE_MEM_ACCESS = 11,
+    HC_SET_VM_COLORS = 12,
+    HC_SCHED_REMAINING = 13,
+    HC_IO_FAULTS = 14,
+    HC_VM_COLORS_STATE = 15
 };
 
 enum
@@ -12,11 +12,47 @@
 
 struct vm_config;
 struct vm;
+struct addr_space;
 
 struct vm_io {
     struct io_prot prot;
 };
 
+/* Devices whose faults are counted individually, and last faults kept for management VMs */
+#define IO_FAULT_DEV_NUM  (32)
+#define IO_FAULT_RING_NUM (16)
+
+struct io_fault {
+    uint64_t dev_id;
+    /* The iommu's own fault cause or syndrome */
+    uint64_t cause;
+    uint64_t addr;
+};
+
+struct io_fault_dev {
+    uint64_t dev_id;
+    uint64_t count;
+    /* Cause and address of the device's last fault */
+    uint64_t cause;
+    uint64_t addr;
+};
+
+/**
+ * Fault state copied to management VMs by the HC_IO_FAULTS hypercall. Devices are listed in the
+ * order of their first fault, the faults of devices beyond IO_FAULT_DEV_NUM are only counted as
+ * untracked. The ring holds the last faults, the one of index total - 1 in ring[(total - 1) %
+ * IO_FAULT_RING_NUM].
+ */
+struct io_faults {
+    uint64_t total;
+    uint64_t untracked;
+    /* Faults the iommu itself dropped as it had no room to report them */
+    uint64_t lost;
+    uint64_t dev_num;
+    struct io_fault_dev devs[IO_FAULT_DEV_NUM];
+    struct io_fault ring[IO_FAULT_RING_NUM];
+};
+
 /* Mainly for HW initialization. */
 void io_init();
 
@@ -24,4 +60,16 @@ void io_init();
 bool io_vm_init(struct vm* vm, const struct vm_config* config);
 bool io_vm_add_device(struct vm* vm, deviceid_t dev_id);
 
+/* Invalidates the iommu's cached translations of a range unmapped from an address space. */
+void io_inv_range(struct addr_space* as, vaddr_t va, size_t size);
+
+/**
+ * Records a device's fault, from the iommu's fault interrupt. Faults are only counted there and
+ * reported to the console later on, at most once for each power of two of a device's faults.
+ */
+void io_fault_record(deviceid_t dev_id, unsigned long cause, uint64_t addr);
+void io_fault_lost(size_t num);
+
+long int io_faults_hypercall(unsigned long ipa, unsigned long arg1, unsigned long arg2);
+
 #endif /* IO_H_ */
@@ -11,6 +11,7 @@
 #include <list.h>
 #include <spinlock.h>
 #include <cache.h>
+#include <dram.h>
 #include <bitmap.h>
 
 #ifndef __ASSEMBLER__
@@ -54,11 +55,38 @@ static inline struct ppages mem_ppages_get(paddr_t base, size_t num_pages)
     return (struct ppages){ .colors = 0, .base = base, .num_pages = num_pages };
 }
 
+/**
+ * If the platform describes its DRAM bank mapping, the upper half of a colormap selects the DRAM
+ * banks and the lower half the cache colors. A page belongs to a colormap if both its cache color
+ * and bank are selected. An empty half selects all cache colors or banks.
+ */
+#define COLORMAP_BANK_OFF  (sizeof(colormap_t) * 8 / 2)
+#define BANK_COLORS(banks) (((colormap_t)(banks)) << COLORMAP_BANK_OFF)
+
+static inline colormap_t clrs_llc(colormap_t clrs)
+{
+    return clrs & BIT_MASK(0, COLOR_NUM);
+}
+
+static inline colormap_t clrs_banks(colormap_t clrs)
+{
+    return (BANK_NUM > 1) ? ((clrs >> COLORMAP_BANK_OFF) & BIT_MASK(0, BANK_NUM)) : 0;
+}
+
 static inline bool all_clrs(colormap_t clrs)
 {
-    colormap_t mask = (((colormap_t)1) << COLOR_NUM) - 1;
-    colormap_t masked_colors = clrs & mask;
-    return (masked_colors == 0) || (masked_colors == mask);
+    colormap_t llc = clrs_llc(clrs);
+    colormap_t banks = clrs_banks(clrs);
+    return ((llc == 0) || (llc == BIT_MASK(0, COLOR_NUM))) &&
+        ((banks == 0) || (banks == BIT_MASK(0, BANK_NUM)));
+}
+
+static inline bool pa_in_clrs(paddr_t pa, colormap_t clrs)
+{
+    colormap_t llc = clrs_llc(clrs);
+    colormap_t banks = clrs_banks(clrs);
+    return ((llc == 0) || bit_get(llc, (pa / PAGE_SIZE / COLOR_SIZE) % COLOR_NUM)) &&
+        ((banks == 0) || bit_get(banks, dram_bank(pa)));
 }
 
 void mem_init(paddr_t load_addr);
@@ -71,6 +99,11 @@ vaddr_t mem_alloc_map_dev(struct addr_space* as, enum AS_SEC section, vaddr_t at
 void mem_unmap(struct addr_space* as, vaddr_t at, size_t num_pages, bool free_ppages);
 bool mem_map_reclr(struct addr_space* as, vaddr_t va, struct ppages* ppages, size_t num_pages,
     mem_flags_t flags);
+size_t mem_map_reclr_lazy(struct addr_space* as, vaddr_t va, struct ppages* ppages,
+    size_t num_pages, mem_flags_t flags, bitmap_t* pending);
+bool mem_reclr_page(struct addr_space* as, vaddr_t va, paddr_t pa, mem_flags_t flags);
+bool mem_reclr_mapped_page(struct addr_space* as, vaddr_t va, mem_flags_t flags);
+bool mem_is_mapped(struct addr_space* as, vaddr_t va);
 vaddr_t mem_map_cpy(struct addr_space* ass, struct addr_space* asd, vaddr_t vas, vaddr_t vad,
     size_t num_pages);
 bool pp_alloc(struct page_pool* pool, size_t num_pages, bool aligned, struct ppages* ppages);
@@ -81,6 +114,7 @@ size_t mem_cpu_boot_alloc_size();
 /* Functions implemented in architecture dependent files */
 
 void as_arch_init(struct addr_space* as);
+void as_arch_pt_attach(struct addr_space* as);
 bool mem_translate(struct addr_space* as, vaddr_t va, paddr_t* pa);
 
 extern struct list page_pool_list;
@@ -11,6 +11,7 @@
 #include <plat/platform.h>
 #include <mem.h>
 #include <cache.h>
+#include <dram.h>
 #include <platform_defs.h>
 
 struct platform {
@@ -27,6 +28,11 @@ struct platform {
 
     struct cache cache;
 
+    /**
+     * Optional. If set, allows colormaps to also select DRAM banks, see BANK_COLORS.
+     */
+    struct dram dram;
+
     struct arch_platform arch;
 };
 
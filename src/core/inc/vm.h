@@ -58,6 +58,9 @@ struct vm_platform {
     struct arch_vm_platform arch;
 };
 
+/* Progress of a change of a vm's colors, as reported to the color manager */
+enum vm_reclr_state { VM_RECLR_DONE = 0, VM_RECLR_PENDING = 1, VM_RECLR_FAILED = 2 };
+
 struct vm {
     vmid_t id;
 
@@ -73,11 +76,40 @@ struct vm {
 
     struct addr_space as;
 
+    struct {
+        vaddr_t base;
+        paddr_t load_addr;
+        size_t num_pages;
+        size_t pending_num;
+        bitmap_t* pending;
+    } lazy_img;
+
+    /**
+     * Serializes the recoloring of the vm's pages, either lazily on a fault or when its colors
+     * are changed at runtime.
+     */
+    struct {
+        spinlock_t lock;
+        bool busy;
+        /* The next page to move, while the vm's colors are being changed */
+        size_t region;
+        size_t page;
+    } reclr;
+
     struct vm_arch arch;
 
     struct list emul_mem_list;
     struct list emul_reg_list;
 
+    /**
+     * The emulated memory regions sorted by base address, built from emul_mem_list at the end of
+     * the vm's initialization.
+     */
+    struct {
+        struct emul_mem** regions;
+        size_t num;
+    } emul_mem_index;
+
     struct vm_io io;
 
     BITMAP_ALLOC(interrupt_bitmap, MAX_INTERRUPTS);
@@ -97,6 +129,9 @@ struct vcpu {
     bool active;
 
     struct vm* vm;
+
+    /* The emulated memory region of this vcpu's last trapped access */
+    struct emul_mem* emul_mem_last;
 };
 
 struct vm_allocation {
@@ -115,6 +150,10 @@ void vm_emul_add_mem(struct vm* vm, struct emul_mem* emu);
 void vm_emul_add_reg(struct vm* vm, struct emul_reg* emu);
 emul_handler_t vm_emul_get_mem(struct vm* vm, vaddr_t addr);
 emul_handler_t vm_emul_get_reg(struct vm* vm, vaddr_t addr);
+struct vm_mem_region* vm_find_mem_region(struct vm* vm, vaddr_t addr);
+bool vm_mem_fault_recover(struct vm* vm, vaddr_t addr);
+bool vm_set_colors(struct vm* vm, colormap_t colors);
+enum vm_reclr_state vm_set_colors_step(struct vm* vm, size_t num_pages);
 void vcpu_init(struct vcpu* vcpu, struct vm* vm, vaddr_t entry);
 void vm_msg_broadcast(struct vm* vm, struct cpu_msg* msg);
 cpumap_t vm_translate_to_pcpu_mask(struct vm* vm, cpumap_t mask, size_t len);
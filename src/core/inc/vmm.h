@@ -16,6 +16,9 @@ void vmm_arch_init();
 
 void vmm_io_init();
 
+long int vmm_set_colors_hypercall(unsigned long vm_id, unsigned long colors);
+long int vmm_colors_state_hypercall(unsigned long vm_id);
+
 struct vm_install_info vmm_get_vm_install_info(struct vm_allocation* vm_alloc);
 void vmm_vm_install(struct vm_install_info* install_info);
 
@@ -9,6 +9,7 @@
 #include <vm.h>
 #include <bitmap.h>
 #include <string.h>
+#include <vsched.h>
 
 BITMAP_ALLOC(hyp_interrupt_bitmap, MAX_INTERRUPTS);
 BITMAP_ALLOC(global_interrupt_bitmap, MAX_INTERRUPTS);
@@ -69,7 +70,11 @@ static inline bool interrupt_assigned(irqid_t int_id)
 
 enum irq_res interrupts_handle(irqid_t int_id)
 {
-    if (vm_has_interrupt(cpu()->vcpu->vm, int_id)) {
+    if (vsched_irq_defer(int_id)) {
+        /* Left active until injected into the vcpu of its VM, when it is switched in */
+        return FORWARD_TO_VM;
+
+    } else if ((cpu()->vcpu != NULL) && vm_has_interrupt(cpu()->vcpu->vm, int_id)) {
         vcpu_inject_hw_irq(cpu()->vcpu, int_id);
 
         return FORWARD_TO_VM;
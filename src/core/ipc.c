@@ -9,13 +9,17 @@
 #include <vmm.h>
 #include <hypercall.h>
 #include <config.h>
+#include <vsched.h>
 
-enum { IPC_NOTIFY };
+enum { IPC_NOTIFY, IPC_NOTIFY_VM };
+extern volatile const size_t IPC_CPUMSG_ID;
 
 union ipc_msg_data {
     struct {
         uint8_t shmem_id;
         uint8_t event_id;
+        /* The notifying VM, or the notified one for IPC_NOTIFY_VM */
+        uint16_t vm_id;
     };
     uint64_t raw;
 };
@@ -55,11 +59,51 @@ static void ipc_notify(size_t shmem_id, size_t event_id)
     }
 }
 
+#ifdef VCPU_SCHED
+static bool ipc_config_has_shmem(const struct vm_config* vm_config, size_t shmem_id)
+{
+    for (size_t i = 0; i < vm_config->platform.ipc_num; i++) {
+        if (vm_config->platform.ipcs[i].shmem_id == shmem_id) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * The cpu may be the master of several VMs sharing the memory, and only the structures of the one
+ * running are accessible. The others are notified once their vcpu is switched in.
+ */
+static void ipc_notify_hosted(union ipc_msg_data* ipc_data)
+{
+    for (vmid_t vm_id = 0; vm_id < config.vmlist_size; vm_id++) {
+        if ((vm_id == ipc_data->vm_id) || !vsched_vm_master(vm_id) ||
+            !ipc_config_has_shmem(&config.vmlist[vm_id], ipc_data->shmem_id)) {
+            continue;
+        }
+
+        union ipc_msg_data vm_data = *ipc_data;
+        vm_data.vm_id = (uint16_t)vm_id;
+        struct cpu_msg msg = { (uint32_t)IPC_CPUMSG_ID, IPC_NOTIFY_VM, vm_data.raw };
+        if (!vsched_msg_defer(vm_id, &msg)) {
+            ipc_notify(ipc_data->shmem_id, ipc_data->event_id);
+        }
+    }
+}
+#endif
+
 static void ipc_handler(uint32_t event, uint64_t data)
 {
     union ipc_msg_data ipc_data = { .raw = data };
     switch (event) {
         case IPC_NOTIFY:
+#ifdef VCPU_SCHED
+            ipc_notify_hosted(&ipc_data);
+#else
+            ipc_notify(ipc_data.shmem_id, ipc_data.event_id);
+#endif
+            break;
+        case IPC_NOTIFY_VM:
             ipc_notify(ipc_data.shmem_id, ipc_data.event_id);
             break;
     }
@@ -79,10 +123,15 @@ unsigned long ipc_hypercall(unsigned long ipc_id, unsigned long ipc_event, unsig
 
     if (valid_ipc_obj && valid_shmem) {
         cpumap_t ipc_cpu_masters = shmem->cpu_masters & ~cpu()->vcpu->vm->cpus;
+#ifdef VCPU_SCHED
+        /* The VM's own cpus may host the master vcpus of the other VMs */
+        ipc_cpu_masters = shmem->cpu_masters;
+#endif
 
         union ipc_msg_data data = {
             .shmem_id = cpu()->vcpu->vm->ipcs[ipc_id].shmem_id,
             .event_id = ipc_event,
+            .vm_id = (uint16_t)cpu()->vcpu->vm->id,
         };
         struct cpu_msg msg = { IPC_CPUMSG_ID, IPC_NOTIFY, data.raw };
 
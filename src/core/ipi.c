@@ -1,12 +1,23 @@
 #include <ipi.h>
 #include <vm.h>
+#include <vsched.h>
 
 #define CPU_MSG(handler, event, data) (&(struct cpu_msg){handler, event, data})
 
+extern volatile const size_t INTER_VM_IRQ;
+
 void ipi_send_handler(uint32_t event, uint64_t data)
 {
     ipi_data_t ipi_data = {.raw = data};
 
+    // The interrupt goes to whichever vcpu runs on this cpu, if any
+    if (cpu()->vcpu == NULL) {
+        return;
+    }
+    if (vsched_msg_defer(cpu()->vcpu->vm->id, CPU_MSG(INTER_VM_IRQ, event, data))) {
+        return;
+    }
+
     switch (event)
     {
     case FPSCHED_EVENT:
@@ -383,6 +383,29 @@ __attribute__((weak)) bool mem_map_reclr(struct addr_space* as, vaddr_t va, stru
     ERROR("Trying to recolor section but there is no coloring implementation");
 }
 
+__attribute__((weak)) size_t mem_map_reclr_lazy(struct addr_space* as, vaddr_t va,
+    struct ppages* ppages, size_t num_pages, mem_flags_t flags, bitmap_t* pending)
+{
+    ERROR("Trying to recolor section but there is no coloring implementation");
+}
+
+__attribute__((weak)) bool mem_reclr_page(struct addr_space* as, vaddr_t va, paddr_t pa,
+    mem_flags_t flags)
+{
+    ERROR("Trying to recolor page but there is no coloring implementation");
+}
+
+__attribute__((weak)) bool mem_reclr_mapped_page(struct addr_space* as, vaddr_t va,
+    mem_flags_t flags)
+{
+    ERROR("Trying to recolor page but there is no coloring implementation");
+}
+
+__attribute__((weak)) bool mem_is_mapped(struct addr_space* as, vaddr_t va)
+{
+    return false;
+}
+
 __attribute__((weak)) bool pp_alloc_clr(struct page_pool* pool, size_t num_pages, colormap_t colors,
     struct ppages* ppages)
 {
@@ -413,6 +436,7 @@ void mem_init(paddr_t load_addr)
 
     if (cpu_is_master()) {
         cache_enumerate();
+        dram_init();
 
         if (!mem_setup_root_pool(load_addr, &root_mem_region)) {
             ERROR("couldn't not initialize root pool");
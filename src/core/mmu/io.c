@@ -5,11 +5,31 @@
 
 #include <io.h>
 #include <vm.h>
+#include <mem.h>
+#include <cpu.h>
+#include <config.h>
+#include <hypercall.h>
+#include <string.h>
 
 struct iommu_device {
     deviceid_t id;
 };
 
+/* Devices reported by each console report, the others are left to a following one */
+#define IO_FAULT_REPORT_MAX (8)
+
+static struct {
+    spinlock_t lock;
+    struct io_faults faults;
+    /* Faults already reported to the console, of each device and of the untracked or lost ones */
+    uint64_t reported[IO_FAULT_DEV_NUM];
+    uint64_t reported_untracked;
+    uint64_t reported_lost;
+    bool report_pending;
+} io_fault_state = { .lock = SPINLOCK_INITVAL };
+
+extern volatile const size_t IO_FAULT_CPUMSG_ID;
+
 /* Mainly for HW initialization. */
 void io_init()
 {
@@ -38,3 +58,175 @@ bool io_vm_add_device(struct vm* vm, deviceid_t dev_id)
 
     return res;
 }
+
+/*
+ * The iommu shares the VMs' page tables, so the devices of a VM may still be using translations
+ * removed from its address space. All of a range's translations are invalidated at once, which
+ * lets the iommu batch them and wait for their completion a single time.
+ */
+void io_inv_range(struct addr_space* as, vaddr_t va, size_t size)
+{
+    if (as->type == AS_VM) {
+        iommu_arch_inv_range(as->id, va, size);
+    }
+}
+
+/* A count is reported again once it has at least doubled since it last was */
+static inline bool io_fault_report_due(uint64_t count, uint64_t reported)
+{
+    return (count > reported) && (count >= (2 * reported));
+}
+
+/* Must be called with the fault state lock held. */
+static void io_fault_report_schedule(void)
+{
+    if (!io_fault_state.report_pending) {
+        struct cpu_msg msg = { (uint32_t)IO_FAULT_CPUMSG_ID, 0, 0 };
+        io_fault_state.report_pending = true;
+        cpu_send_msg(cpu()->id, &msg);
+    }
+}
+
+/*
+ * Faults are printed outside of the iommu's interrupt handler, which a misbehaving device could
+ * otherwise keep busy printing to the console. A burst of faults is reported by a single message.
+ */
+static void io_fault_report_handler(uint32_t event, uint64_t data)
+{
+    struct io_fault_dev devs[IO_FAULT_REPORT_MAX];
+    size_t dev_num = 0;
+    uint64_t untracked = 0;
+    uint64_t lost = 0;
+
+    spin_lock(&io_fault_state.lock);
+    io_fault_state.report_pending = false;
+
+    struct io_faults* faults = &io_fault_state.faults;
+    for (size_t i = 0; i < faults->dev_num; i++) {
+        if (!io_fault_report_due(faults->devs[i].count, io_fault_state.reported[i])) {
+            continue;
+        }
+        if (dev_num == IO_FAULT_REPORT_MAX) {
+            io_fault_report_schedule();
+            break;
+        }
+        devs[dev_num++] = faults->devs[i];
+        io_fault_state.reported[i] = faults->devs[i].count;
+    }
+
+    if (io_fault_report_due(faults->untracked, io_fault_state.reported_untracked)) {
+        untracked = faults->untracked;
+        io_fault_state.reported_untracked = untracked;
+    }
+
+    if (io_fault_report_due(faults->lost, io_fault_state.reported_lost)) {
+        lost = faults->lost;
+        io_fault_state.reported_lost = lost;
+    }
+    spin_unlock(&io_fault_state.lock);
+
+    for (size_t i = 0; i < dev_num; i++) {
+        WARNING("iommu: device %llu faulted %llu times, last cause 0x%llx at 0x%llx",
+            devs[i].dev_id, devs[i].count, devs[i].cause, devs[i].addr);
+    }
+
+    if (untracked != 0) {
+        WARNING("iommu: %llu faults of untracked devices", untracked);
+    }
+
+    if (lost != 0) {
+        WARNING("iommu: %llu faults lost by the iommu", lost);
+    }
+}
+CPU_MSG_HANDLER(io_fault_report_handler, IO_FAULT_CPUMSG_ID);
+
+void io_fault_record(deviceid_t dev_id, unsigned long cause, uint64_t addr)
+{
+    struct io_faults* faults = &io_fault_state.faults;
+    struct io_fault_dev* dev = NULL;
+
+    spin_lock(&io_fault_state.lock);
+    for (size_t i = 0; i < faults->dev_num; i++) {
+        if (faults->devs[i].dev_id == dev_id) {
+            dev = &faults->devs[i];
+            break;
+        }
+    }
+
+    if ((dev == NULL) && (faults->dev_num < IO_FAULT_DEV_NUM)) {
+        dev = &faults->devs[faults->dev_num++];
+        dev->dev_id = dev_id;
+    }
+
+    if (dev != NULL) {
+        dev->count++;
+        dev->cause = cause;
+        dev->addr = addr;
+    } else {
+        faults->untracked++;
+    }
+
+    struct io_fault* fault = &faults->ring[faults->total % IO_FAULT_RING_NUM];
+    fault->dev_id = dev_id;
+    fault->cause = cause;
+    fault->addr = addr;
+    faults->total++;
+
+    io_fault_report_schedule();
+    spin_unlock(&io_fault_state.lock);
+}
+
+void io_fault_lost(size_t num)
+{
+    spin_lock(&io_fault_state.lock);
+    io_fault_state.faults.lost += num;
+    io_fault_report_schedule();
+    spin_unlock(&io_fault_state.lock);
+}
+
+/*
+ * Copies the fault state to the page at ipa of the calling VM, which must be allowed to manage
+ * the iommu faults.
+ */
+long int io_faults_hypercall(unsigned long ipa, unsigned long arg1, unsigned long arg2)
+{
+    struct vm* vm = cpu()->vcpu->vm;
+
+    if (!vm->config->io_fault_manager) {
+        return -HC_E_FAILURE;
+    }
+
+    if ((ipa % PAGE_SIZE) != 0) {
+        return -HC_E_INVAL_ARGS;
+    }
+
+    /**
+     * Only write to the vm's own memory allocated by the hypervisor, never to memory it shares
+     * with other vms, devices or a region placed at a fixed physical address. The recoloring lock
+     * keeps the page from being moved while it is written.
+     */
+    struct vm_mem_region* reg = vm_find_mem_region(vm, ipa);
+    if ((reg == NULL) || reg->place_phys ||
+        !range_in_range(ipa, sizeof(struct io_faults), reg->base, reg->size)) {
+        return -HC_E_INVAL_ARGS;
+    }
+
+    long int ret = HC_E_SUCCESS;
+    spin_lock(&vm->reclr.lock);
+    vaddr_t va = INVALID_VA;
+    if (mem_is_mapped(&vm->as, ipa)) {
+        va = mem_map_cpy(&vm->as, &cpu()->as, ipa, INVALID_VA, 1);
+    }
+    if (va != INVALID_VA) {
+        spin_lock(&io_fault_state.lock);
+        memcpy((void*)va, &io_fault_state.faults, sizeof(struct io_faults));
+        spin_unlock(&io_fault_state.lock);
+
+        mem_unmap(&cpu()->as, va, 1, false);
+    } else {
+        ret = -HC_E_FAILURE;
+    }
+    spin_unlock(&vm->reclr.lock);
+
+    return ret;
+}
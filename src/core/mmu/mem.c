@@ -15,6 +15,7 @@
 #include <fences.h>
 #include <tlb.h>
 #include <config.h>
+#include <io.h>
 
 extern uint8_t _image_start, _image_load_end, _image_end, _dmem_phys_beg, _dmem_beg,
     _cpu_private_beg, _cpu_private_end, _vm_beg, _vm_end, _vm_image_start, _vm_image_end;
@@ -53,6 +54,8 @@ struct {
     [AS_VM] = { vm_secs, sizeof(vm_secs) / sizeof(struct section) },
 };
 
+__attribute__((weak)) void as_arch_pt_attach(struct addr_space* as) { }
+
 size_t mem_cpu_boot_alloc_size()
 {
     size_t size = ALIGN(sizeof(struct cpu), PAGE_SIZE);
@@ -62,12 +65,16 @@ size_t mem_cpu_boot_alloc_size()
     return size;
 }
 
-static inline size_t pp_next_clr(paddr_t base, size_t from, colormap_t colors)
+/**
+ * Returns the index of the first page from base + from that belongs to colors, or top if there is
+ * none before it. A combination of cache colors and banks might not exist at all, so searches must
+ * always be bounded.
+ */
+static inline size_t pp_next_clr(paddr_t base, size_t from, size_t top, colormap_t colors)
 {
-    size_t clr_offset = (base / PAGE_SIZE) % (COLOR_NUM * COLOR_SIZE);
     size_t index = from;
 
-    while (!((colors >> ((index + clr_offset) / COLOR_SIZE % COLOR_NUM)) & 1)) {
+    while ((index < top) && !pa_in_clrs(base + (index * PAGE_SIZE), colors)) {
         index++;
     }
 
@@ -82,7 +89,7 @@ static void mem_free_ppages(struct ppages* ppages)
             size_t index = (ppages->base - pool->base) / PAGE_SIZE;
             if (!all_clrs(ppages->colors)) {
                 for (size_t i = 0; i < ppages->num_pages; i++) {
-                    index = pp_next_clr(pool->base, index, ppages->colors);
+                    index = pp_next_clr(pool->base, index, pool->size, ppages->colors);
                     bitmap_clear(pool->bitmap, index++);
                 }
             } else {
@@ -109,8 +116,8 @@ bool pp_alloc_clr(struct page_pool* pool, size_t n, colormap_t colors, struct pp
      * Lets start the search at the first available color after the last known free position to the
      * top of the pool.
      */
-    size_t index = pp_next_clr(pool->base, pool->last, colors);
     size_t top = pool->size;
+    size_t index = pp_next_clr(pool->base, pool->last, top, colors);
 
     /**
      * Two iterations. One starting from the last known free page, other starting from the
@@ -122,7 +129,7 @@ bool pp_alloc_clr(struct page_pool* pool, size_t n, colormap_t colors, struct pp
 
             /* Find first free page on the target colors */
             while ((index < top) && bitmap_get(pool->bitmap, index)) {
-                index = pp_next_clr(pool->base, ++index, colors);
+                index = pp_next_clr(pool->base, ++index, top, colors);
             }
             first_index = index;
 
@@ -132,7 +139,7 @@ bool pp_alloc_clr(struct page_pool* pool, size_t n, colormap_t colors, struct pp
              */
             while ((index < top) && (bitmap_get(pool->bitmap, index) == 0) && (allocated < n)) {
                 allocated++;
-                index = pp_next_clr(pool->base, ++index, colors);
+                index = pp_next_clr(pool->base, ++index, top, colors);
             }
 
             index++;
@@ -146,7 +153,7 @@ bool pp_alloc_clr(struct page_pool* pool, size_t n, colormap_t colors, struct pp
             ppages->num_pages = n;
             ppages->base = pool->base + (first_index * PAGE_SIZE);
             for (size_t i = 0; i < n; i++) {
-                first_index = pp_next_clr(pool->base, first_index, colors);
+                first_index = pp_next_clr(pool->base, first_index, top, colors);
                 bitmap_set(pool->bitmap, first_index++);
             }
             pool->free -= n;
@@ -248,9 +255,10 @@ static void mem_expand_pte(struct addr_space* as, vaddr_t va, size_t lvl)
              * Invalidate the old TLB entries with superpage entries. This means that from now on
              * to the end of the function, the original spaced mapped by the entry will be unmaped.
              * Therefore this function cannot be call on the entry mapping hypervisor code or data
-             * used in it (including stack).
+             * used in it (including stack). The copy of the hypervisor address space built while
+             * coloring it may share its tables with the live one, so invalidate the latter.
              */
-            tlb_inv_va(&cpu()->as, va);
+            tlb_inv_va((as->type == AS_VM) ? as : &cpu()->as, va);
 
             /**
              *  Now traverse the new next level page table to replicate the original mapping.
@@ -328,6 +336,7 @@ vaddr_t mem_alloc_vpage(struct addr_space* as, enum AS_SEC section, vaddr_t at,
     }
 
     spin_lock(&as->lock);
+    as_arch_pt_attach(as);
     if (sec->shared) {
         spin_lock(&sec->lock);
     }
@@ -411,13 +420,57 @@ vaddr_t mem_alloc_vpage(struct addr_space* as, enum AS_SEC section, vaddr_t at,
     return vpage;
 }
 
+#define MEM_UNMAP_FREE_NUM (8)
+
+/**
+ * Physical pages unmapped by mem_unmap but not yet freed. Devices may still access them through
+ * the iommu until its translations of the unmapped range are invalidated, so they are only freed
+ * afterwards. Physically contiguous pages are merged into a single entry.
+ */
+struct mem_unmap_free {
+    vaddr_t inv_base;
+    size_t num;
+    struct ppages ppages[MEM_UNMAP_FREE_NUM];
+};
+
+static void mem_unmap_free_flush(struct addr_space* as, struct mem_unmap_free* pending,
+    vaddr_t top)
+{
+    io_inv_range(as, pending->inv_base, top - pending->inv_base);
+    for (size_t i = 0; i < pending->num; i++) {
+        mem_free_ppages(&pending->ppages[i]);
+    }
+    pending->inv_base = top;
+    pending->num = 0;
+}
+
+static void mem_unmap_free_add(struct addr_space* as, struct mem_unmap_free* pending,
+    vaddr_t vaddr, paddr_t paddr, size_t num_pages)
+{
+    if (pending->num > 0) {
+        struct ppages* last = &pending->ppages[pending->num - 1];
+        if ((last->base + (last->num_pages * PAGE_SIZE)) == paddr) {
+            last->num_pages += num_pages;
+            return;
+        }
+    }
+
+    if (pending->num == MEM_UNMAP_FREE_NUM) {
+        mem_unmap_free_flush(as, pending, vaddr);
+    }
+
+    pending->ppages[pending->num++] = mem_ppages_get(paddr, num_pages);
+}
+
 void mem_unmap(struct addr_space* as, vaddr_t at, size_t num_pages, bool free_ppages)
 {
     vaddr_t vaddr = at;
     vaddr_t top = at + (num_pages * PAGE_SIZE);
     size_t lvl = 0;
+    struct mem_unmap_free pending = { .inv_base = at, .num = 0 };
 
     spin_lock(&as->lock);
+    as_arch_pt_attach(as);
 
     struct section* sec = mem_find_sec(as, at);
     if (sec->shared) {
@@ -449,13 +502,11 @@ void mem_unmap(struct addr_space* as, vaddr_t at, size_t num_pages, bool free_pp
                     }
 
                     if (free_ppages) {
-                        paddr_t paddr = pte_addr(pte);
-                        struct ppages ppages = mem_ppages_get(paddr, lvlsz / PAGE_SIZE);
-                        mem_free_ppages(&ppages);
+                        mem_unmap_free_add(as, &pending, vaddr, pte_addr(pte), lvlsz / PAGE_SIZE);
                     }
 
                     *pte = 0;
-                    tlb_inv_va(&cpu()->as, vaddr);
+                    tlb_inv_va(as, vaddr);
 
                 } else {
                     break;
@@ -475,6 +526,8 @@ void mem_unmap(struct addr_space* as, vaddr_t at, size_t num_pages, bool free_pp
         }
     }
 
+    mem_unmap_free_flush(as, &pending, top);
+
     if (sec->shared) {
         spin_unlock(&sec->lock);
     }
@@ -496,6 +549,7 @@ bool mem_map(struct addr_space* as, vaddr_t va, struct ppages* ppages, size_t nu
     }
 
     spin_lock(&as->lock);
+    as_arch_pt_attach(as);
     if (sec->shared) {
         spin_lock(&sec->lock);
     }
@@ -518,7 +572,7 @@ bool mem_map(struct addr_space* as, vaddr_t va, struct ppages* ppages, size_t nu
         mem_inflate_pt(as, vaddr, num_pages * PAGE_SIZE);
         for (size_t i = 0; i < ppages->num_pages; i++) {
             pte = pt_get_pte(&as->pt, as->pt.dscr->lvls - 1, vaddr);
-            index = pp_next_clr(ppages->base, index, ppages->colors);
+            index = pp_next_clr(ppages->base, index, SIZE_MAX, ppages->colors);
             paddr_t paddr = ppages->base + (index * PAGE_SIZE);
             pte_set(pte, paddr, PTE_PAGE, flags);
             vaddr += PAGE_SIZE;
@@ -596,11 +650,9 @@ bool mem_map_reclr(struct addr_space* as, vaddr_t va, struct ppages* ppages, siz
      * Count how many pages are not colored in original images. Allocate the necessary colored
      * pages. Mapped onto hypervisor address space.
      */
-    size_t reclrd_num = num_pages / (COLOR_NUM * COLOR_SIZE) * COLOR_SIZE *
-        bit_count(~(as->colors & BIT_MASK(0, COLOR_NUM)));
-    size_t clr_offset = (ppages->base / PAGE_SIZE) % (COLOR_NUM * COLOR_SIZE);
-    for (size_t i = 0; i < (num_pages % (COLOR_NUM * COLOR_SIZE)); i++) {
-        if (!bit_get(as->colors, (i + clr_offset) / COLOR_SIZE % COLOR_NUM)) {
+    size_t reclrd_num = 0;
+    for (size_t i = 0; i < num_pages; i++) {
+        if (!pa_in_clrs(ppages->base + (i * PAGE_SIZE), as->colors)) {
             reclrd_num++;
         }
     }
@@ -634,6 +686,7 @@ bool mem_map_reclr(struct addr_space* as, vaddr_t va, struct ppages* ppages, siz
      * Inflate reserved page tables to the last level. This assumes coloring always needs the
      * finest grained mapping possible.
      */
+    as_arch_pt_attach(as);
     mem_inflate_pt(as, vaddr, num_pages * PAGE_SIZE);
 
     for (size_t i = 0; i < num_pages; i++) {
@@ -643,11 +696,11 @@ bool mem_map_reclr(struct addr_space* as, vaddr_t va, struct ppages* ppages, siz
          * If image page is already color, just map it. Otherwise first copy it to the previously
          * allocated pages.
          */
-        if (bit_get(as->colors, ((i + clr_offset) / COLOR_SIZE % COLOR_NUM))) {
+        if (pa_in_clrs(paddr, as->colors)) {
             pte_set(pte, paddr, PTE_PAGE, flags);
         } else {
             memcpy((void*)clrd_vaddr, (void*)phys_va, PAGE_SIZE);
-            index = pp_next_clr(reclrd_ppages.base, index, as->colors);
+            index = pp_next_clr(reclrd_ppages.base, index, SIZE_MAX, as->colors);
             paddr_t clrd_paddr = reclrd_ppages.base + (index * PAGE_SIZE);
             pte_set(pte, clrd_paddr, PTE_PAGE, flags);
 
@@ -668,10 +721,12 @@ bool mem_map_reclr(struct addr_space* as, vaddr_t va, struct ppages* ppages, siz
     /**
      * Free the uncolored pages of the original image.
      */
-    struct ppages unused_pages = { .base = ppages->base,
-        .num_pages = reclrd_num,
-        .colors = ~as->colors };
-    mem_free_ppages(&unused_pages);
+    for (size_t i = 0; i < num_pages; i++) {
+        struct ppages unused_page = mem_ppages_get(ppages->base + (i * PAGE_SIZE), 1);
+        if (!pa_in_clrs(unused_page.base, as->colors)) {
+            mem_free_ppages(&unused_page);
+        }
+    }
 
     mem_unmap(&cpu()->as, reclrd_va_base, reclrd_num, false);
     mem_unmap(&cpu()->as, phys_va_base, num_pages, false);
@@ -679,6 +734,157 @@ bool mem_map_reclr(struct addr_space* as, vaddr_t va, struct ppages* ppages, siz
     return true;
 }
 
+/**
+ * Lazy counterpart of mem_map_reclr. Pages of the original image already in the address space's
+ * colors are mapped in place. The others are left unmapped and their indexes marked in the pending
+ * bitmap, to be recolored one at a time by mem_reclr_page when first accessed. Only meant for vm
+ * address spaces. Returns the number of pages left pending.
+ */
+size_t mem_map_reclr_lazy(struct addr_space* as, vaddr_t va, struct ppages* ppages,
+    size_t num_pages, mem_flags_t flags, bitmap_t* pending)
+{
+    size_t pending_num = 0;
+    vaddr_t vaddr = va & ~(PAGE_SIZE - 1);
+    size_t i = 0;
+
+    /**
+     * Reserve the whole range so that pages waiting to be recolored are not taken by any other
+     * mapping.
+     */
+    if (mem_alloc_vpage(as, SEC_VM_ANY, vaddr, num_pages) != vaddr) {
+        ERROR("failed to reserve lazily recolored region at 0x%lx", vaddr);
+    }
+
+    while (i < num_pages) {
+        /**
+         * Pages come in runs of the same color, so map or mark each run as a whole.
+         */
+        bool in_clr = pa_in_clrs(ppages->base + (i * PAGE_SIZE), as->colors);
+        size_t run = 1;
+        while (((i + run) < num_pages) &&
+            (pa_in_clrs(ppages->base + ((i + run) * PAGE_SIZE), as->colors) == in_clr)) {
+            run++;
+        }
+
+        if (in_clr) {
+            struct ppages run_ppages = mem_ppages_get(ppages->base + (i * PAGE_SIZE), run);
+            mem_map(as, vaddr + (i * PAGE_SIZE), &run_ppages, run, flags);
+        } else {
+            bitmap_set_consecutive(pending, i, run);
+            pending_num += run;
+        }
+
+        i += run;
+    }
+
+    return pending_num;
+}
+
+/**
+ * Copy the page at pa to a newly allocated page in the address space's colors, map it at va and
+ * release the original page.
+ */
+bool mem_reclr_page(struct addr_space* as, vaddr_t va, paddr_t pa, mem_flags_t flags)
+{
+    struct ppages src_ppages = mem_ppages_get(pa, 1);
+    struct ppages clrd_ppages = mem_alloc_ppages(as->colors, 1, false);
+    if (clrd_ppages.num_pages < 1) {
+        return false;
+    }
+
+    vaddr_t src_va =
+        mem_alloc_map(&cpu()->as, SEC_HYP_VM, &src_ppages, INVALID_VA, 1, PTE_HYP_FLAGS);
+    vaddr_t clrd_va =
+        mem_alloc_map(&cpu()->as, SEC_HYP_VM, &clrd_ppages, INVALID_VA, 1, PTE_HYP_FLAGS);
+    memcpy((void*)clrd_va, (void*)src_va, PAGE_SIZE);
+    cache_flush_range(clrd_va, PAGE_SIZE);
+    /**
+     * Also evict the source page, so that its lines stop occupying the colors it was in.
+     */
+    cache_flush_range(src_va, PAGE_SIZE);
+    mem_unmap(&cpu()->as, src_va, 1, false);
+    mem_unmap(&cpu()->as, clrd_va, 1, false);
+
+    /**
+     * The target entry is invalid at this point and its TLB entries, if any, were already
+     * invalidated when it was unmapped.
+     */
+    mem_map(as, va & ~(PAGE_SIZE - 1), &clrd_ppages, 1, flags);
+
+    mem_free_ppages(&src_ppages);
+
+    return true;
+}
+
+static pte_t* mem_find_leaf_pte(struct addr_space* as, vaddr_t va, size_t* lvl)
+{
+    /* Must have lock on as to call */
+
+    for (size_t i = 0; i < as->pt.dscr->lvls; i++) {
+        pte_t* pte = pt_get_pte(&as->pt, i, va);
+        if ((pte == NULL) || !pte_valid(pte)) {
+            break;
+        } else if (!pte_table(&as->pt, pte, i)) {
+            *lvl = i;
+            return pte;
+        }
+    }
+
+    return NULL;
+}
+
+static bool mem_get_mapping(struct addr_space* as, vaddr_t va, paddr_t* pa)
+{
+    size_t lvl = 0;
+    bool mapped = false;
+
+    spin_lock(&as->lock);
+    as_arch_pt_attach(as);
+    pte_t* pte = mem_find_leaf_pte(as, va, &lvl);
+    if (pte != NULL) {
+        *pa = pte_addr(pte) + (va & (pt_lvlsize(&as->pt, lvl) - 1));
+        mapped = true;
+    }
+    spin_unlock(&as->lock);
+
+    return mapped;
+}
+
+bool mem_is_mapped(struct addr_space* as, vaddr_t va)
+{
+    paddr_t pa;
+    return mem_get_mapping(as, va, &pa);
+}
+
+/**
+ * If the page mapped at va is not in the address space's colors, move it to a newly allocated page
+ * that is. The page is unmapped while being copied, so any concurrent access to it by the address
+ * space's owner faults and must be retried once the page is mapped again. Returns false only if
+ * the page could not be moved, in which case it is left mapped at its original location.
+ */
+bool mem_reclr_mapped_page(struct addr_space* as, vaddr_t va, mem_flags_t flags)
+{
+    vaddr_t vaddr = va & ~(PAGE_SIZE - 1);
+    paddr_t paddr = 0;
+
+    if (!mem_get_mapping(as, vaddr, &paddr) || pa_in_clrs(paddr, as->colors)) {
+        return true;
+    }
+
+    /**
+     * Unmapping first (and expanding any superpage covering the page) invalidates the TLB entries
+     * for the old page before it is copied, so no write to it can be lost.
+     */
+    mem_unmap(as, vaddr, 1, false);
+    if (!mem_reclr_page(as, vaddr, paddr, flags)) {
+        struct ppages ppages = mem_ppages_get(paddr, 1);
+        mem_map(as, vaddr, &ppages, 1, flags);
+        return false;
+    }
+
+    return true;
+}
+
 vaddr_t mem_map_cpy(struct addr_space* ass, struct addr_space* asd, vaddr_t vas, vaddr_t vad,
     size_t num_pages)
 {
@@ -687,6 +893,7 @@ vaddr_t mem_map_cpy(struct addr_space* ass, struct addr_space* asd, vaddr_t vas,
     size_t count = 0;
     size_t to_map = num_pages * PAGE_SIZE;
 
+    as_arch_pt_attach(ass);
     while (count < num_pages) {
         size_t lvl = 0;
         pte_t* pte = pt_get_pte(&ass->pt, lvl, vas);
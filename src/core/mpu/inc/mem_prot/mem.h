@@ -29,6 +29,18 @@ struct addr_space {
         enum { MPE_S_FREE, MPE_S_INVALID, MPE_S_VALID } state;
         struct mp_region region;
     } vmpu[VMPU_NUM_ENTRIES];
+    /* Entries not in the free state */
+    BITMAP_ALLOC(vmpu_bitmap, VMPU_NUM_ENTRIES);
+    /**
+     * The valid entries sorted by base address. As they never overlap, they are also sorted by
+     * limit, which allows looking up an address with a binary search.
+     */
+    struct {
+        mpid_t mpid[VMPU_NUM_ENTRIES];
+        size_t num;
+    } vmpu_order;
+    /* The entry last looked up by address, checked first as faults tend to hit the same region */
+    mpid_t vmpu_last;
     spinlock_t lock;
 };
 
@@ -5,6 +5,7 @@
 
 #include <io.h>
 #include <vm.h>
+#include <hypercall.h>
 
 void io_init()
 {
@@ -20,3 +21,23 @@ bool io_vm_add_device(struct vm* vm, deviceid_t dev_id)
 {
     return true;
 }
+
+void io_inv_range(struct addr_space* as, vaddr_t va, size_t size)
+{
+    return;
+}
+
+void io_fault_record(deviceid_t dev_id, unsigned long cause, uint64_t addr)
+{
+    return;
+}
+
+void io_fault_lost(size_t num)
+{
+    return;
+}
+
+long int io_faults_hypercall(unsigned long ipa, unsigned long arg1, unsigned long arg2)
+{
+    return -HC_E_FAILURE;
+}
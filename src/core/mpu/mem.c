@@ -9,27 +9,57 @@
 #include <bao.h>
 #include <fences.h>
 #include <platform_defs.h>
-#include <objpool.h>
 #include <config.h>
 
 struct shared_region {
     enum AS_TYPE as_type;
     asid_t asid;
     struct mp_region region;
-    cpumap_t sharing_cpus;
+    uint32_t op;
+    /* The change's slot is reused once all of its cpus have applied it */
+    uint64_t gen;
+    cpumap_t pending_cpus;
 };
 
-void mem_handle_broadcast_region(uint32_t event, uint64_t data);
 bool mem_map(struct addr_space* as, struct mp_region* mpr, bool broadcast);
 bool mem_unmap_range(struct addr_space* as, vaddr_t vaddr, size_t size, bool broadcast);
+static bool mem_vmpu_map(struct addr_space* as, struct mp_region* mpr, bool broadcast);
+static bool mem_vmpu_unmap_range(struct addr_space* as, vaddr_t vaddr, size_t size, bool broadcast);
+static void mem_shared_regions_sync(void);
 
 enum { MEM_INSERT_REGION, MEM_REMOVE_REGION };
 
-#define SHARED_REGION_POOL_SIZE_DEFAULT (128)
-#ifndef SHARED_REGION_POOL_SIZE
-#define SHARED_REGION_POOL_SIZE SHARED_REGION_POOL_SIZE_DEFAULT
+#define SHARED_REGION_TABLE_SIZE_DEFAULT (128)
+#ifndef SHARED_REGION_TABLE_SIZE
+#define SHARED_REGION_TABLE_SIZE SHARED_REGION_TABLE_SIZE_DEFAULT
 #endif
-OBJPOOL_ALLOC(shared_region_pool, struct shared_region, SHARED_REGION_POOL_SIZE);
+
+/* Unmapping a range removes each region it overlaps and may add back a region at each end */
+#define SHARED_REGION_UNMAP_MAX (VMPU_NUM_ENTRIES + 2)
+#if (SHARED_REGION_TABLE_SIZE < SHARED_REGION_UNMAP_MAX)
+#error "SHARED_REGION_TABLE_SIZE must fit the changes of unmapping any range"
+#endif
+
+/**
+ * Changes to the regions of shared sections, numbered by generation. Each cpu applies the changes
+ * sent to it in generation order. Cpus are only signaled if they have not been since they last
+ * applied their changes, so a burst of changes costs a single message to each of them.
+ *
+ * A cpu applies the changes sent to it while handling its messages, which it does not do while
+ * spinning on a lock, so nobody may wait for a free slot with an address space locked. Before
+ * locking an address space to change it, a cpu reserves the slots the change may use.
+ */
+static struct {
+    spinlock_t lock;
+    uint64_t gen;
+    struct shared_region changes[SHARED_REGION_TABLE_SIZE];
+    /* The slots following the current generation, known to be free, which cpus reserved */
+    size_t reserved;
+    size_t cpu_reserved[PLAT_CPU_NUM];
+    /* The next generation each cpu has to look at */
+    uint64_t cpu_gen[PLAT_CPU_NUM];
+    bool cpu_signaled[PLAT_CPU_NUM];
+} shared_regions = { .lock = SPINLOCK_INITVAL };
 
 static inline struct mpe* mem_vmpu_get_entry(struct addr_space* as, mpid_t mpid)
 {
@@ -39,21 +69,78 @@ static inline struct mpe* mem_vmpu_get_entry(struct addr_space* as, mpid_t mpid)
     return NULL;
 }
 
+/* Position in the vmpu order of the first valid entry whose limit is above addr */
+static size_t mem_vmpu_order_search(struct addr_space* as, vaddr_t addr)
+{
+    size_t low = 0;
+    size_t high = as->vmpu_order.num;
+
+    while (low < high) {
+        size_t mid = low + ((high - low) / 2);
+        struct mp_region* reg = &as->vmpu[as->vmpu_order.mpid[mid]].region;
+        if ((reg->base + reg->size) <= addr) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+
+    return low;
+}
+
+static void mem_vmpu_order_insert(struct addr_space* as, mpid_t mpid)
+{
+    size_t pos = mem_vmpu_order_search(as, as->vmpu[mpid].region.base);
+
+    for (size_t i = as->vmpu_order.num; i > pos; i--) {
+        as->vmpu_order.mpid[i] = as->vmpu_order.mpid[i - 1];
+    }
+    as->vmpu_order.mpid[pos] = mpid;
+    as->vmpu_order.num++;
+}
+
+static void mem_vmpu_order_remove(struct addr_space* as, mpid_t mpid)
+{
+    size_t pos = mem_vmpu_order_search(as, as->vmpu[mpid].region.base);
+
+    if ((pos < as->vmpu_order.num) && (as->vmpu_order.mpid[pos] == mpid)) {
+        as->vmpu_order.num--;
+        for (size_t i = pos; i < as->vmpu_order.num; i++) {
+            as->vmpu_order.mpid[i] = as->vmpu_order.mpid[i + 1];
+        }
+    }
+
+    if (as->vmpu_last == mpid) {
+        as->vmpu_last = INVALID_MPID;
+    }
+}
+
 void mem_vmpu_set_entry(struct addr_space* as, mpid_t mpid, struct mp_region* mpr)
 {
     struct mpe* mpe = mem_vmpu_get_entry(as, mpid);
 
+    if (mpe->state == MPE_S_VALID) {
+        mem_vmpu_order_remove(as, mpid);
+    }
+
     mpe->region.base = mpr->base;
     mpe->region.size = mpr->size;
     mpe->region.mem_flags = mpr->mem_flags;
     mpe->region.as_sec = mpr->as_sec;
     mpe->state = MPE_S_VALID;
+
+    bitmap_set(as->vmpu_bitmap, mpid);
+    mem_vmpu_order_insert(as, mpid);
 }
 
 void mem_vmpu_clear_entry(struct addr_space* as, mpid_t mpid)
 {
     struct mpe* mpe = mem_vmpu_get_entry(as, mpid);
 
+    if (mpe->state == MPE_S_VALID) {
+        mem_vmpu_order_remove(as, mpid);
+    }
+
     mpe->region.base = 0;
     mpe->region.size = 0;
     mpe->region.mem_flags = PTE_INVALID;
@@ -66,19 +153,16 @@ void mem_vmpu_free_entry(struct addr_space* as, mpid_t mpid)
     mem_vmpu_clear_entry(as, mpid);
     struct mpe* mpe = mem_vmpu_get_entry(as, mpid);
     mpe->state = MPE_S_FREE;
+    bitmap_clear(as->vmpu_bitmap, mpid);
 }
 
 mpid_t mem_vmpu_allocate_entry(struct addr_space* as)
 {
-    mpid_t mpid = INVALID_MPID;
+    mpid_t mpid = bitmap_find_nth(as->vmpu_bitmap, VMPU_NUM_ENTRIES, 1, 0, false);
 
-    for (mpid_t i = 0; i < VMPU_NUM_ENTRIES; i++) {
-        struct mpe* mpe = mem_vmpu_get_entry(as, i);
-        if (mpe->state == MPE_S_FREE) {
-            mpid = i;
-            mpe->state = MPE_S_INVALID;
-            break;
-        }
+    if (mpid != INVALID_MPID) {
+        bitmap_set(as->vmpu_bitmap, mpid);
+        mem_vmpu_get_entry(as, mpid)->state = MPE_S_INVALID;
     }
 
     return mpid;
@@ -86,20 +170,20 @@ mpid_t mem_vmpu_allocate_entry(struct addr_space* as)
 
 mpid_t mem_vmpu_get_entry_by_addr(struct addr_space* as, vaddr_t addr)
 {
-    mpid_t mpid = INVALID_MPID;
+    mpid_t mpid = as->vmpu_last;
 
-    for (mpid_t i = 0; i < VMPU_NUM_ENTRIES; i++) {
-        struct mpe* mpe = mem_vmpu_get_entry(as, i);
-
-        if (mpe->state != MPE_S_VALID) {
-            continue;
+    if (mpid != INVALID_MPID) {
+        struct mp_region* reg = &as->vmpu[mpid].region;
+        if ((addr >= reg->base) && (addr < (reg->base + reg->size))) {
+            return mpid;
         }
+    }
 
-        vaddr_t limit_addr = mpe->region.base + mpe->region.size;
-        if ((addr >= mpe->region.base) && (addr < limit_addr)) {
-            mpid = i;
-            break;
-        }
+    mpid = INVALID_MPID;
+    size_t pos = mem_vmpu_order_search(as, addr);
+    if ((pos < as->vmpu_order.num) && (as->vmpu[as->vmpu_order.mpid[pos]].region.base <= addr)) {
+        mpid = as->vmpu_order.mpid[pos];
+        as->vmpu_last = mpid;
     }
 
     return mpid;
@@ -193,9 +277,12 @@ void as_init(struct addr_space* as, enum AS_TYPE type, asid_t id, colormap_t col
     as->type = type;
     as->colors = 0;
     as->id = id;
+    as->vmpu_order.num = 0;
+    as->vmpu_last = INVALID_MPID;
     as_arch_init(as);
 
     for (size_t i = 0; i < VMPU_NUM_ENTRIES; i++) {
+        as->vmpu[i].state = MPE_S_INVALID;
         mem_vmpu_free_entry(as, i);
     }
 }
@@ -214,7 +301,7 @@ static void mem_free_ppages(struct ppages* ppages)
 
 void mem_msg_handler(uint32_t event, uint64_t data)
 {
-    mem_handle_broadcast_region(event, data);
+    mem_shared_regions_sync();
 }
 CPU_MSG_HANDLER(mem_msg_handler, MEM_PROT_SYNC);
 
@@ -241,28 +328,83 @@ static cpumap_t mem_section_shared_cpus(struct addr_space* as, as_sec_t section)
     return cpus;
 }
 
+/**
+ * Reserves num slots for the changes about to be broadcast by this cpu. Fails if the slots
+ * following the ones already reserved are not all free yet.
+ */
+static bool mem_shared_regions_reserve(size_t num)
+{
+    bool reserved = true;
+
+    spin_lock(&shared_regions.lock);
+    if ((shared_regions.reserved + num) > SHARED_REGION_TABLE_SIZE) {
+        reserved = false;
+    }
+    for (size_t i = shared_regions.reserved; (i < shared_regions.reserved + num) && reserved; i++) {
+        uint64_t gen = shared_regions.gen + i;
+        reserved = (shared_regions.changes[gen % SHARED_REGION_TABLE_SIZE].pending_cpus == 0);
+    }
+    if (reserved) {
+        shared_regions.reserved += num;
+        shared_regions.cpu_reserved[cpu()->id] += num;
+    }
+    spin_unlock(&shared_regions.lock);
+
+    return reserved;
+}
+
+/* Gives back the slots reserved by this cpu which were left unused */
+static void mem_shared_regions_release(void)
+{
+    spin_lock(&shared_regions.lock);
+    shared_regions.reserved -= shared_regions.cpu_reserved[cpu()->id];
+    shared_regions.cpu_reserved[cpu()->id] = 0;
+    spin_unlock(&shared_regions.lock);
+}
+
+/* Must be called with slots reserved, so that it never waits for the table to drain. */
 void mem_region_broadcast(struct addr_space* as, struct mp_region* mpr, uint32_t op)
 {
-    cpumap_t shared_cpus = mem_section_shared_cpus(as, mpr->as_sec);
+    cpumap_t shared_cpus = bit_clear(mem_section_shared_cpus(as, mpr->as_sec), cpu()->id);
+    cpumap_t signal_cpus = 0;
 
     if (shared_cpus == 0) {
         return;
     }
 
-    struct shared_region shared_region = {
+    spin_lock(&shared_regions.lock);
+
+    if (shared_regions.cpu_reserved[cpu()->id] == 0) {
+        ERROR("shared region broadcast without a reserved slot");
+    }
+    shared_regions.cpu_reserved[cpu()->id]--;
+    shared_regions.reserved--;
+
+    struct shared_region* change =
+        &shared_regions.changes[shared_regions.gen % SHARED_REGION_TABLE_SIZE];
+
+    *change = (struct shared_region){
         .as_type = as->type,
         .asid = as->id,
         .region = *mpr,
+        .op = op,
+        .gen = shared_regions.gen,
+        .pending_cpus = shared_cpus,
     };
+    shared_regions.gen++;
 
     for (cpuid_t cpuid = 0; cpuid < PLAT_CPU_NUM; cpuid++) {
-        if ((cpu()->id != cpuid) && bit_get(shared_cpus, cpuid)) {
-            struct shared_region* node = objpool_alloc(&shared_region_pool);
-            if (node == NULL) {
-                ERROR("Failed allocating shared region node");
-            }
-            *node = shared_region;
-            struct cpu_msg msg = { MEM_PROT_SYNC, op, (uintptr_t)node };
+        if (bit_get(shared_cpus, cpuid) && !shared_regions.cpu_signaled[cpuid]) {
+            shared_regions.cpu_signaled[cpuid] = true;
+            signal_cpus = bit_set(signal_cpus, cpuid);
+        }
+    }
+
+    spin_unlock(&shared_regions.lock);
+
+    for (cpuid_t cpuid = 0; cpuid < PLAT_CPU_NUM; cpuid++) {
+        if (bit_get(signal_cpus, cpuid)) {
+            struct cpu_msg msg = { MEM_PROT_SYNC, 0, 0 };
             cpu_send_msg(cpuid, &msg);
         }
     }
@@ -293,11 +435,12 @@ bool mem_vmpu_remove_region(struct addr_space* as, mpid_t mpid, bool broadcast)
     struct mpe* mpe = mem_vmpu_get_entry(as, mpid);
 
     if ((mpe != NULL) && (mpe->state == MPE_S_VALID)) {
+        struct mp_region region = mpe->region;
+        mpu_unmap(as_priv(as), &region);
+        mem_vmpu_free_entry(as, mpid);
         if (broadcast) {
-            mem_region_broadcast(as, &mpe->region, MEM_REMOVE_REGION);
+            mem_region_broadcast(as, &region, MEM_REMOVE_REGION);
         }
-        mpu_unmap(as_priv(as), &mpe->region);
-        mem_vmpu_free_entry(as, mpid);
         removed = true;
     }
 
@@ -307,7 +450,7 @@ bool mem_vmpu_remove_region(struct addr_space* as, mpid_t mpid, bool broadcast)
 void mem_handle_broadcast_insert(struct addr_space* as, struct mp_region* mpr)
 {
     if (as->type == AS_HYP) {
-        mem_map(&cpu()->as, mpr, false);
+        mem_map(as, mpr, false);
     } else {
         mpu_map(as_priv(as), mpr);
     }
@@ -316,64 +459,91 @@ void mem_handle_broadcast_insert(struct addr_space* as, struct mp_region* mpr)
 void mem_handle_broadcast_remove(struct addr_space* as, struct mp_region* mpr)
 {
     if (as->type == AS_HYP) {
-        mem_unmap_range(&cpu()->as, mpr->base, mpr->size, false);
+        mem_unmap_range(as, mpr->base, mpr->size, false);
     } else {
         mpu_unmap(as_priv(as), mpr);
     }
 }
 
-void mem_handle_broadcast_region(uint32_t event, uint64_t data)
+void mem_handle_broadcast_region(struct shared_region* sh_reg)
 {
-    struct shared_region* sh_reg = (struct shared_region*)(uintptr_t)data;
-
-    if (sh_reg != NULL) {
-        struct addr_space* as;
-        if (sh_reg->as_type == AS_HYP) {
-            as = &cpu()->as;
-        } else {
-            struct addr_space* vm_as = &cpu()->vcpu->vm->as;
-            if (vm_as->id != sh_reg->asid) {
-                ERROR("Received shared region for unkown vm address space.");
-            }
-            as = vm_as;
-        }
-
-        switch (event) {
-            case MEM_INSERT_REGION:
-                mem_handle_broadcast_insert(as, &sh_reg->region);
-                break;
-            case MEM_REMOVE_REGION:
-                mem_handle_broadcast_remove(as, &sh_reg->region);
-                break;
-            default:
-                ERROR("unknown mem broadcast msg");
+    struct addr_space* as;
+    if (sh_reg->as_type == AS_HYP) {
+        as = &cpu()->as;
+    } else {
+        struct addr_space* vm_as = &cpu()->vcpu->vm->as;
+        if (vm_as->id != sh_reg->asid) {
+            ERROR("Received shared region for unkown vm address space.");
         }
+        as = vm_as;
+    }
 
-        objpool_free(&shared_region_pool, sh_reg);
+    switch (sh_reg->op) {
+        case MEM_INSERT_REGION:
+            mem_handle_broadcast_insert(as, &sh_reg->region);
+            break;
+        case MEM_REMOVE_REGION:
+            mem_handle_broadcast_remove(as, &sh_reg->region);
+            break;
+        default:
+            ERROR("unknown mem broadcast msg");
     }
 }
 
-mpid_t mem_vmpu_find_overlapping_region(struct addr_space* as, struct mp_region* region)
+/**
+ * Applies the shared region changes sent to this cpu, in order. Must not be called with an address
+ * space locked, as applying a change to the hypervisor's address space locks it.
+ */
+static void mem_shared_regions_sync(void)
 {
-    mpid_t mpid = INVALID_MPID;
+    cpuid_t cpuid = cpu()->id;
+
+    spin_lock(&shared_regions.lock);
 
-    for (mpid_t i = 0; i < VMPU_NUM_ENTRIES; i++) {
-        struct mpe* mpe = mem_vmpu_get_entry(as, i);
+    shared_regions.cpu_signaled[cpuid] = false;
 
-        if (mpe->state != MPE_S_VALID) {
+    /* The slots of older generations were all reused, so none of them was sent to this cpu */
+    if ((shared_regions.gen - shared_regions.cpu_gen[cpuid]) > SHARED_REGION_TABLE_SIZE) {
+        shared_regions.cpu_gen[cpuid] = shared_regions.gen - SHARED_REGION_TABLE_SIZE;
+    }
+
+    while (shared_regions.cpu_gen[cpuid] != shared_regions.gen) {
+        uint64_t gen = shared_regions.cpu_gen[cpuid]++;
+        struct shared_region* change = &shared_regions.changes[gen % SHARED_REGION_TABLE_SIZE];
+
+        if ((change->gen != gen) || !bit_get(change->pending_cpus, cpuid)) {
             continue;
         }
 
-        if (mem_regions_overlap(region, &mpe->region)) {
-            mpid = i;
-            break;
+        struct shared_region sh_reg = *change;
+        spin_unlock(&shared_regions.lock);
+
+        mem_handle_broadcast_region(&sh_reg);
+
+        spin_lock(&shared_regions.lock);
+        change->pending_cpus = bit_clear(change->pending_cpus, cpuid);
+    }
+
+    spin_unlock(&shared_regions.lock);
+}
+
+mpid_t mem_vmpu_find_overlapping_region(struct addr_space* as, struct mp_region* region)
+{
+    mpid_t mpid = INVALID_MPID;
+    size_t pos = mem_vmpu_order_search(as, region->base);
+
+    if (pos < as->vmpu_order.num) {
+        mpid_t next = as->vmpu_order.mpid[pos];
+        if (as->vmpu[next].region.base < (region->base + region->size)) {
+            mpid = next;
         }
     }
 
     return mpid;
 }
 
-bool mem_map(struct addr_space* as, struct mp_region* mpr, bool broadcast)
+/* Must be called with the address space's lock held. */
+static bool mem_vmpu_map(struct addr_space* as, struct mp_region* mpr, bool broadcast)
 {
     bool mapped = false;
 
@@ -386,8 +556,6 @@ bool mem_map(struct addr_space* as, struct mp_region* mpr, bool broadcast)
               "granularity");
     }
 
-    spin_lock(&as->lock);
-
     if (mem_vmpu_find_overlapping_region(as, mpr) == INVALID_MPID) {
         // TODO: check if it possible to merge with another region
         mpid_t mpid = mem_vmpu_allocate_entry(as);
@@ -396,15 +564,32 @@ bool mem_map(struct addr_space* as, struct mp_region* mpr, bool broadcast)
         }
     }
 
-    spin_unlock(&as->lock);
-
     return mapped;
 }
 
-bool mem_unmap_range(struct addr_space* as, vaddr_t vaddr, size_t size, bool broadcast)
+bool mem_map(struct addr_space* as, struct mp_region* mpr, bool broadcast)
 {
     spin_lock(&as->lock);
+    while (broadcast && !mem_shared_regions_reserve(1)) {
+        /* Apply the changes the table waits for, possibly to this very address space */
+        spin_unlock(&as->lock);
+        mem_shared_regions_sync();
+        spin_lock(&as->lock);
+    }
+
+    bool mapped = mem_vmpu_map(as, mpr, broadcast);
+
+    if (broadcast) {
+        mem_shared_regions_release();
+    }
+    spin_unlock(&as->lock);
+
+    return mapped;
+}
 
+/* Must be called with the address space's lock held. */
+static bool mem_vmpu_unmap_range(struct addr_space* as, vaddr_t vaddr, size_t size, bool broadcast)
+{
     size_t size_left = size;
 
     while (size_left > 0) {
@@ -431,30 +616,62 @@ bool mem_unmap_range(struct addr_space* as, vaddr_t vaddr, size_t size, bool bro
         size_t top_size = limit >= r_limit ? 0 : r_limit - limit;
         size_t bottom_size = vaddr <= r_base ? 0 : vaddr - r_base;
 
-        mem_vmpu_remove_region(as, mpid, true);
+        mem_vmpu_remove_region(as, mpid, broadcast);
 
         if (top_size > 0) {
             struct mp_region top = reg;
             top.base = limit;
             top.size = top_size;
             mpid_t top_mpid = mem_vmpu_allocate_entry(as);
-            mem_vmpu_insert_region(as, top_mpid, &top, true);
+            mem_vmpu_insert_region(as, top_mpid, &top, broadcast);
         }
 
         if (bottom_size > 0) {
             struct mp_region bottom = reg;
             bottom.size = bottom_size;
             mpid_t bottom_mpid = mem_vmpu_allocate_entry(as);
-            mem_vmpu_insert_region(as, bottom_mpid, &bottom, true);
+            mem_vmpu_insert_region(as, bottom_mpid, &bottom, broadcast);
         }
 
         size_t overlap_size = reg.size - top_size - bottom_size;
         size_left -= overlap_size;
     }
 
+    return size_left == 0;
+}
+
+/* Must be called with the address space's lock held. */
+static size_t mem_vmpu_unmap_changes(struct addr_space* as, vaddr_t vaddr, size_t size)
+{
+    size_t num = 2;
+
+    for (size_t pos = mem_vmpu_order_search(as, vaddr);
+         (pos < as->vmpu_order.num) &&
+         (as->vmpu[as->vmpu_order.mpid[pos]].region.base < (vaddr + size));
+         pos++) {
+        num++;
+    }
+
+    return num;
+}
+
+bool mem_unmap_range(struct addr_space* as, vaddr_t vaddr, size_t size, bool broadcast)
+{
+    spin_lock(&as->lock);
+    while (broadcast && !mem_shared_regions_reserve(mem_vmpu_unmap_changes(as, vaddr, size))) {
+        spin_unlock(&as->lock);
+        mem_shared_regions_sync();
+        spin_lock(&as->lock);
+    }
+
+    bool unmapped = mem_vmpu_unmap_range(as, vaddr, size, broadcast);
+
+    if (broadcast) {
+        mem_shared_regions_release();
+    }
     spin_unlock(&as->lock);
 
-    return size_left == 0;
+    return unmapped;
 }
 
 void mem_unmap(struct addr_space* as, vaddr_t at, size_t num_pages, bool free_ppages)
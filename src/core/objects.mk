@@ -5,6 +5,7 @@
 core-objs-y+=init.o
 core-objs-y+=mem.o
 core-objs-y+=cache.o
+core-objs-y+=dram.o
 core-objs-y+=interrupts.o
 core-objs-y+=cpu.o
 core-objs-y+=vmm.o
@@ -0,0 +1,208 @@
+/**
+ * SPDX-License-Identifier: Apache-2.0
+ * Copyright (c) Bao Project and Contributors. All rights reserved.
+ */
+
+#ifndef __VSCHED_H__
+#define __VSCHED_H__
+
+#include <bao.h>
+#include <list.h>
+#include <bitmap.h>
+#include <vm.h>
+#include <mem_prot/vmm.h>
+#include <config_defs.h>
+
+/**
+ * Scheduling parameters of a VM's vcpus. These are only meaningful when the hypervisor is built
+ * with VCPU_SCHED=y, in which case the vcpus of several VMs may share the same physical cpu.
+ */
+struct vsched_config {
+    /**
+     * Lower values mean higher priorities. The runnable vcpu with the highest priority on a cpu
+     * always runs, vcpus with the same priority take turns every VSCHED_QUANTUM_US.
+     */
+    size_t priority;
+    /**
+     * The vcpus of the VM may only run for budget_us microseconds in every period_us. A zero
+     * budget leaves them unbounded.
+     */
+    unsigned long budget_us;
+    unsigned long period_us;
+    /**
+     * If not zero, the statistics page of the physical cpu running each of the VM's vcpus is
+     * mapped read-only at this address plus the vcpu's id times the page size.
+     */
+    vaddr_t stats_base;
+};
+
+/* A time window of a cyclic schedule, relative to the start of the major frame */
+struct vsched_window {
+    vmid_t vm_id;
+    unsigned long offset_us;
+    unsigned long duration_us;
+};
+
+/**
+ * A cyclic (ARINC 653-like) schedule of a physical cpu. Its windows are sorted by offset, may not
+ * overlap and all fit in the major frame, which is repeated indefinitely. The cpu idles in the
+ * time not covered by any window.
+ */
+struct vsched_table {
+    unsigned long major_frame_us;
+    size_t window_num;
+    struct vsched_window* windows;
+};
+
+struct vcpu;
+struct cpu_msg;
+
+#ifdef VCPU_SCHED
+
+#include <arch/vsched.h>
+
+#ifndef VSCHED_QUANTUM_US
+#define VSCHED_QUANTUM_US (1000)
+#endif
+
+/* Window switches later than this after the window boundary are counted as overruns */
+#ifndef VSCHED_JITTER_BOUND_US
+#define VSCHED_JITTER_BOUND_US (50)
+#endif
+
+/**
+ * Contents of the per cpu statistics page, which VMs may map read-only. All times are in ticks of
+ * a timer running at freq Hz.
+ */
+struct vsched_stats {
+    uint64_t freq;
+    /* Number of vcpu switches and the time spent saving and restoring vcpu state */
+    uint64_t switches;
+    uint64_t latency_max;
+    uint64_t latency_sum;
+    /* Vcpus resumed after idling, with their state still loaded */
+    uint64_t resumes;
+    /* Trapped first FP/SIMD uses, and those that had to switch the registers' contents */
+    uint64_t fpu_traps;
+    uint64_t fpu_switches;
+    /* Cyclic schedules only. Delay from a window boundary to the start of the window's vcpu */
+    uint64_t frames;
+    uint64_t windows;
+    uint64_t jitter_max;
+    uint64_t jitter_sum;
+    /* Window switches delayed beyond VSCHED_JITTER_BOUND_US, and windows skipped altogether */
+    uint64_t overruns;
+    uint64_t missed;
+};
+
+struct vsched_vcpu {
+    struct vcpu* vcpu;
+    vmid_t vm_id;
+    bool vm_master;
+    bool shareable;
+    struct vm_install_info install_info;
+
+    size_t priority;
+    /* In timer ticks, as are all times below */
+    uint64_t budget;
+    uint64_t period;
+    uint64_t remaining;
+    uint64_t replenish;
+
+    /* Set while the vcpu waits for an interrupt, until the wakeup deadline if it is not zero */
+    bool blocked;
+    uint64_t wakeup;
+
+    /* Messages sent to the vcpu's VM while it was not running, handled when it is switched in */
+    struct list msgs;
+
+    /**
+     * Copy of the VM's interrupt bitmap, as the VM's structures are only accessible while its vcpu
+     * is the cpu's current one. Its interrupts taken in the meantime are injected when it is
+     * switched in.
+     */
+    BITMAP_ALLOC(interrupts, MAX_INTERRUPTS);
+    BITMAP_ALLOC(pend_irqs, MAX_INTERRUPTS);
+    bool irqs_pending;
+
+    size_t switches;
+
+    struct vsched_vcpu_arch arch;
+};
+
+struct vsched {
+    size_t num;
+    struct vsched_vcpu vcpus[CONFIG_VM_NUM];
+    /**
+     * The vcpu whose VM is installed and whose state is loaded on the cpu, which it keeps while
+     * the cpu idles, i.e., running is not set, until another vcpu is switched in.
+     */
+    struct vsched_vcpu* current;
+    bool running;
+    bool resched;
+    /* Time at which the current vcpu was last charged for */
+    uint64_t last;
+    uint64_t quantum_end;
+
+    /* The cpu's cyclic schedule, if any, which replaces the priority based one */
+    const struct vsched_table* table;
+    uint64_t major_frame;
+    uint64_t frame_start;
+    size_t window;
+    bool in_window;
+    /* The next start or end of a window, and the last one crossed if not yet accounted for */
+    uint64_t boundary;
+    uint64_t crossed;
+    bool crossed_pending;
+    struct vsched_vcpu* owner;
+
+    struct vsched_stats* stats;
+    paddr_t stats_pa;
+};
+
+void vsched_init(void);
+void vsched_vm_enter(vmid_t vm_id);
+void vsched_vcpu_add(struct vm_install_info* install_info);
+void vsched_start(void);
+void vsched_exit(void);
+void vsched_idle(void);
+void vsched_idle_wakeup(void);
+void vsched_block(uint64_t wakeup);
+void vsched_resched(void);
+bool vsched_shared(void);
+bool vsched_vm_master(vmid_t vm_id);
+bool vsched_msg_defer(vmid_t vm_id, struct cpu_msg* msg);
+bool vsched_irq_defer(irqid_t int_id);
+long vsched_remaining_hypercall(void);
+struct vsched_vcpu* vsched_current(void);
+struct vsched_stats* vsched_stats(void);
+
+/* Implemented by each supported architecture */
+
+void vsched_arch_init(void);
+uint64_t vsched_arch_time(void);
+uint64_t vsched_arch_freq(void);
+void vsched_arch_timer_set(uint64_t deadline);
+void vsched_arch_wfi_trap(bool trap);
+bool vsched_arch_vcpu_shareable(struct vcpu* vcpu);
+void vsched_arch_vcpu_save(struct vsched_vcpu* vsv);
+void vsched_arch_vcpu_restore(struct vsched_vcpu* vsv);
+void vsched_arch_vm_install(struct vm_install_info* install_info);
+void vsched_arch_handle_irqs(void);
+void vsched_arch_wfi(struct vcpu* vcpu);
+
+#else
+
+static inline bool vsched_msg_defer(vmid_t vm_id, struct cpu_msg* msg)
+{
+    return false;
+}
+
+static inline bool vsched_irq_defer(irqid_t int_id)
+{
+    return false;
+}
+
+#endif /* VCPU_SCHED */
+
+#endif /* __VSCHED_H__ */
@@ -2,4 +2,8 @@ ifeq ($(MEMORY_REQUEST_WAIT),y)
     core-objs-y+=scheds/dp_wcet.o
 else
     core-objs-y+=scheds/fp_classic.o
-endif
\ No newline at end of file
+endif
+
+ifeq ($(VCPU_SCHED),y)
+    core-objs-y+=scheds/vsched.o
+endif
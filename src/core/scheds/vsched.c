@@ -0,0 +1,578 @@
+/**
+ * SPDX-License-Identifier: Apache-2.0
+ * Copyright (c) Bao Project and Contributors. All rights reserved.
+ */
+
+#include <vsched.h>
+
+#include <cpu.h>
+#include <vm.h>
+#include <config.h>
+#include <objpool.h>
+#include <string.h>
+#include <hypercall.h>
+
+/**
+ * Each cpu hosts a vcpu of every VM it was assigned to and runs the one of the highest priority
+ * among those with budget left that are not waiting for an interrupt. The structures of a VM are
+ * only mapped on the cpu while it holds its current vcpu, so the messages and interrupts for the
+ * others are kept aside and handled once they are switched in. A cpu given a cyclic schedule
+ * instead runs each vcpu within its VM's windows only.
+ */
+
+struct vsched_msg {
+    node_t node;
+    struct cpu_msg msg;
+};
+
+#ifndef VSCHED_MSG_POOL_SIZE
+#define VSCHED_MSG_POOL_SIZE (128)
+#endif
+
+OBJPOOL_ALLOC(vsched_msg_pool, struct vsched_msg, VSCHED_MSG_POOL_SIZE);
+
+static struct vsched vsched_cpus[PLAT_CPU_NUM];
+
+static inline struct vsched* vsched_cpu(void)
+{
+    return &vsched_cpus[cpu()->id];
+}
+
+static inline uint64_t vsched_us_to_ticks(uint64_t us)
+{
+    return (us * vsched_arch_freq()) / 1000000;
+}
+
+static struct vsched_vcpu* vsched_get(struct vsched* vs, vmid_t vm_id)
+{
+    for (size_t i = 0; i < vs->num; i++) {
+        if (vs->vcpus[i].vm_id == vm_id) {
+            return &vs->vcpus[i];
+        }
+    }
+    return NULL;
+}
+
+static inline bool vsched_runnable(struct vsched_vcpu* vsv)
+{
+    return !vsv->blocked && ((vsv->budget == 0) || (vsv->remaining > 0));
+}
+
+static inline void vsched_wake(struct vsched* vs, struct vsched_vcpu* vsv)
+{
+    vsv->blocked = false;
+    vs->resched = true;
+}
+
+void vsched_init(void)
+{
+    struct vsched* vs = vsched_cpu();
+
+    memset(vs, 0, sizeof(*vs));
+
+    vs->stats = mem_alloc_page(1, SEC_HYP_GLOBAL, false);
+    if (vs->stats == NULL || !mem_translate(&cpu()->as, (vaddr_t)vs->stats, &vs->stats_pa)) {
+        ERROR("cant allocate vsched stats page");
+    }
+    memset(vs->stats, 0, PAGE_SIZE);
+    vs->stats->freq = vsched_arch_freq();
+
+    vsched_arch_init();
+}
+
+/* The cpu may have to switch vcpus, or to idle between the windows of its single vcpu */
+bool vsched_shared(void)
+{
+    struct vsched* vs = vsched_cpu();
+    return (vs->num > 1) || (vs->table != NULL);
+}
+
+struct vsched_vcpu* vsched_current(void)
+{
+    return vsched_cpu()->current;
+}
+
+struct vsched_stats* vsched_stats(void)
+{
+    return vsched_cpu()->stats;
+}
+
+void vsched_resched(void)
+{
+    vsched_cpu()->resched = true;
+}
+
+/**
+ * Called before initializing the cpu's vcpu of vm_id. The state of the vcpu initialized before is
+ * loaded on the cpu, it is saved and its VM unmapped so that the new VM is allocated or mapped in
+ * its place.
+ */
+void vsched_vm_enter(vmid_t vm_id)
+{
+    struct vsched* vs = vsched_cpu();
+
+    if (vs->num >= CONFIG_VM_NUM) {
+        ERROR("too many vcpus on cpu %d", cpu()->id);
+    }
+
+    if (vs->current != NULL) {
+        vsched_arch_vcpu_save(vs->current);
+        vsched_arch_vm_install(NULL);
+    }
+
+    struct vsched_vcpu* vsv = &vs->vcpus[vs->num++];
+    vsv->vm_id = vm_id;
+    list_init(&vsv->msgs);
+
+    vs->current = vsv;
+    vs->running = true;
+    cpu()->vcpu = NULL;
+}
+
+void vsched_vcpu_add(struct vm_install_info* install_info)
+{
+    struct vsched* vs = vsched_cpu();
+    struct vsched_vcpu* vsv = vs->current;
+    struct vcpu* vcpu = cpu()->vcpu;
+    const struct vsched_config* sched = &vcpu->vm->config->sched;
+
+    vsv->vcpu = vcpu;
+    vsv->vm_master = (vcpu->vm->master == cpu()->id);
+    vsv->shareable = vsched_arch_vcpu_shareable(vcpu);
+    vsv->install_info = *install_info;
+    memcpy(vsv->interrupts, vcpu->vm->interrupt_bitmap, sizeof(vsv->interrupts));
+
+    vsv->priority = sched->priority;
+    if (sched->budget_us != 0) {
+        if (sched->budget_us > sched->period_us) {
+            ERROR("vm %d budget is larger than its period", vcpu->vm->id);
+        }
+        vsv->budget = vsched_us_to_ticks(sched->budget_us);
+        vsv->period = vsched_us_to_ticks(sched->period_us);
+        vsv->remaining = vsv->budget;
+    }
+
+    if (sched->stats_base != 0) {
+        struct ppages ppages = mem_ppages_get(vs->stats_pa, 1);
+        vaddr_t va = sched->stats_base + (vcpu->id * PAGE_SIZE);
+        if (mem_alloc_map(&vcpu->vm->as, SEC_VM_ANY, &ppages, va, 1, PTE_VM_RO_FLAGS) != va) {
+            ERROR("cant map vsched stats page in vm %d", vcpu->vm->id);
+        }
+    }
+}
+
+bool vsched_vm_master(vmid_t vm_id)
+{
+    struct vsched_vcpu* vsv = vsched_get(vsched_cpu(), vm_id);
+    return (vsv != NULL) && vsv->vm_master;
+}
+
+/**
+ * Returns true if the message was kept to be handled when the vcpu of vm_id is switched in.
+ * Either way, it is a reason for the vcpu to stop waiting.
+ */
+bool vsched_msg_defer(vmid_t vm_id, struct cpu_msg* msg)
+{
+    struct vsched* vs = vsched_cpu();
+    struct vsched_vcpu* vsv = vsched_get(vs, vm_id);
+
+    if (vsv == NULL) {
+        return false;
+    }
+
+    vsched_wake(vs, vsv);
+    if ((vsv == vs->current) && vs->running) {
+        return false;
+    }
+
+    struct vsched_msg* node = objpool_alloc(&vsched_msg_pool);
+    if (node == NULL) {
+        ERROR("cant allocate vsched msg node");
+    }
+    node->msg = *msg;
+    list_push(&vsv->msgs, (node_t*)node);
+
+    return true;
+}
+
+bool vsched_irq_defer(irqid_t int_id)
+{
+    struct vsched* vs = vsched_cpu();
+    struct vsched_vcpu* vsv = NULL;
+
+    /* Private interrupts may belong to several VMs, the running one is the one they fired for */
+    if ((vs->current != NULL) && bitmap_get(vs->current->interrupts, int_id)) {
+        vsv = vs->current;
+    } else {
+        for (size_t i = 0; i < vs->num && vsv == NULL; i++) {
+            if (bitmap_get(vs->vcpus[i].interrupts, int_id)) {
+                vsv = &vs->vcpus[i];
+            }
+        }
+    }
+
+    if (vsv == NULL) {
+        return false;
+    }
+
+    vsched_wake(vs, vsv);
+    if ((vsv == vs->current) && vs->running) {
+        return false;
+    }
+
+    bitmap_set(vsv->pend_irqs, int_id);
+    vsv->irqs_pending = true;
+
+    return true;
+}
+
+void vsched_block(uint64_t wakeup)
+{
+    struct vsched* vs = vsched_cpu();
+
+    vs->current->blocked = true;
+    vs->current->wakeup = wakeup;
+    vs->resched = true;
+}
+
+static void vsched_account(struct vsched* vs, uint64_t now)
+{
+    struct vsched_vcpu* curr = vs->current;
+
+    if (vs->running && (curr != NULL) && (curr->budget != 0)) {
+        uint64_t elapsed = now - vs->last;
+        curr->remaining = (elapsed < curr->remaining) ? (curr->remaining - elapsed) : 0;
+    }
+    vs->last = now;
+}
+
+static void vsched_update(struct vsched* vs, uint64_t now)
+{
+    for (size_t i = 0; i < vs->num; i++) {
+        struct vsched_vcpu* vsv = &vs->vcpus[i];
+        if ((vsv->budget != 0) && (now >= vsv->replenish)) {
+            vsv->remaining = vsv->budget;
+            vsv->replenish += vsv->period * (((now - vsv->replenish) / vsv->period) + 1);
+        }
+        if (vsv->blocked && (vsv->wakeup != 0) && (now >= vsv->wakeup)) {
+            vsv->blocked = false;
+        }
+    }
+}
+
+static void vsched_table_init(struct vsched* vs, uint64_t now)
+{
+    if ((config.sched_tables == NULL) || (cpu()->id >= config.sched_tables_size) ||
+        (config.sched_tables[cpu()->id].window_num == 0)) {
+        return;
+    }
+
+    const struct vsched_table* table = &config.sched_tables[cpu()->id];
+    unsigned long end = 0;
+    for (size_t i = 0; i < table->window_num; i++) {
+        const struct vsched_window* window = &table->windows[i];
+        if ((window->offset_us < end) || (window->duration_us == 0)) {
+            ERROR("cpu %d schedule windows are not sorted or overlap", cpu()->id);
+        }
+        if (vsched_get(vs, window->vm_id) == NULL) {
+            ERROR("cpu %d schedule has a window for vm %d which does not run on it", cpu()->id,
+                window->vm_id);
+        }
+        end = window->offset_us + window->duration_us;
+    }
+    if ((end > table->major_frame_us) || (table->major_frame_us == 0)) {
+        ERROR("cpu %d schedule windows do not fit in its major frame", cpu()->id);
+    }
+
+    /**
+     * Major frames start at multiples of their length since the counter started, so that cpus
+     * with the same major frame stay in phase.
+     */
+    vs->table = table;
+    vs->major_frame = vsched_us_to_ticks(table->major_frame_us);
+    vs->frame_start = ((now / vs->major_frame) + 1) * vs->major_frame;
+    vs->window = 0;
+    vs->in_window = false;
+    vs->boundary = vs->frame_start + vsched_us_to_ticks(table->windows[0].offset_us);
+    vs->owner = NULL;
+}
+
+/**
+ * Moves on to the window, or the gap between windows, that now falls in. Windows whose end is
+ * also past were missed, e.g., because the hypervisor was held up with interrupts disabled.
+ */
+static void vsched_table_update(struct vsched* vs, uint64_t now)
+{
+    const struct vsched_table* table = vs->table;
+
+    if (now < vs->boundary) {
+        return;
+    }
+
+    vs->crossed = vs->boundary;
+    vs->crossed_pending = true;
+
+    while (now >= vs->boundary) {
+        const struct vsched_window* window = &table->windows[vs->window];
+        if (!vs->in_window) {
+            vs->in_window = true;
+            vs->boundary = vs->frame_start + vsched_us_to_ticks(window->offset_us +
+                window->duration_us);
+            vs->stats->windows++;
+            if (now >= vs->boundary) {
+                vs->stats->missed++;
+            }
+        } else {
+            vs->in_window = false;
+            if (++vs->window == table->window_num) {
+                vs->window = 0;
+                vs->frame_start += vs->major_frame;
+                vs->stats->frames++;
+            }
+            vs->boundary =
+                vs->frame_start + vsched_us_to_ticks(table->windows[vs->window].offset_us);
+        }
+    }
+
+    vs->owner = vs->in_window ? vsched_get(vs, table->windows[vs->window].vm_id) : NULL;
+}
+
+/* Delay from the last window boundary to the moment the cpu runs what comes after it */
+static void vsched_table_account(struct vsched* vs)
+{
+    if (!vs->crossed_pending) {
+        return;
+    }
+    vs->crossed_pending = false;
+
+    uint64_t jitter = vsched_arch_time() - vs->crossed;
+    vs->stats->jitter_sum += jitter;
+    if (jitter > vs->stats->jitter_max) {
+        vs->stats->jitter_max = jitter;
+    }
+    if (jitter > vsched_us_to_ticks(VSCHED_JITTER_BOUND_US)) {
+        vs->stats->overruns++;
+    }
+}
+
+/**
+ * The runnable vcpu of the highest priority. Among those of the same priority, the current one
+ * keeps the cpu until the end of its quantum, after which the next one in order gets it.
+ */
+static struct vsched_vcpu* vsched_pick(struct vsched* vs, uint64_t now)
+{
+    struct vsched_vcpu* curr = vs->current;
+    struct vsched_vcpu* next = NULL;
+    size_t first = (curr != NULL) ? (size_t)(curr - vs->vcpus) + 1 : 0;
+
+    /* Within a window, its owner runs unless it waits for an interrupt, even without budget */
+    if (vs->table != NULL) {
+        return ((vs->owner != NULL) && !vs->owner->blocked) ? vs->owner : NULL;
+    }
+
+    for (size_t i = 0; i < vs->num; i++) {
+        struct vsched_vcpu* vsv = &vs->vcpus[(first + i) % vs->num];
+        if (vsched_runnable(vsv) && ((next == NULL) || (vsv->priority < next->priority))) {
+            next = vsv;
+        }
+    }
+
+    if ((next != NULL) && (next != curr) && vs->running && vsched_runnable(curr) &&
+        (curr->priority == next->priority) && (now < vs->quantum_end)) {
+        next = curr;
+    }
+
+    return next;
+}
+
+static void vsched_timer_program(struct vsched* vs, uint64_t now)
+{
+    uint64_t deadline = UINT64_MAX;
+    struct vsched_vcpu* curr = vs->current;
+
+    if (vs->table != NULL) {
+        deadline = vs->boundary;
+        if ((vs->owner != NULL) && vs->owner->blocked && (vs->owner->wakeup != 0) &&
+            (vs->owner->wakeup < deadline)) {
+            deadline = vs->owner->wakeup;
+        }
+        vsched_arch_timer_set(deadline);
+        return;
+    }
+
+    if (vs->running && (curr != NULL)) {
+        if (vs->num > 1) {
+            deadline = vs->quantum_end;
+        }
+        if ((curr->budget != 0) && ((now + curr->remaining) < deadline)) {
+            deadline = now + curr->remaining;
+        }
+    }
+
+    for (size_t i = 0; i < vs->num; i++) {
+        struct vsched_vcpu* vsv = &vs->vcpus[i];
+        if ((vsv->budget != 0) && (vsv->remaining < vsv->budget) && (vsv->replenish < deadline)) {
+            deadline = vsv->replenish;
+        }
+        if (vsv->blocked && (vsv->wakeup != 0) && (vsv->wakeup < deadline)) {
+            deadline = vsv->wakeup;
+        }
+    }
+
+    vsched_arch_timer_set(deadline);
+}
+
+static void vsched_switch(struct vsched* vs, struct vsched_vcpu* next, uint64_t now)
+{
+    struct vsched_vcpu* curr = vs->current;
+    uint64_t start = vsched_arch_time();
+
+    if (next != curr) {
+        vsched_arch_vcpu_save(curr);
+        vsched_arch_vm_install(&next->install_info);
+        vs->current = next;
+        cpu()->vcpu = next->vcpu;
+        vsched_arch_vcpu_restore(next);
+        next->switches++;
+
+        uint64_t latency = vsched_arch_time() - start;
+        vs->stats->switches++;
+        vs->stats->latency_sum += latency;
+        if (latency > vs->stats->latency_max) {
+            vs->stats->latency_max = latency;
+        }
+    } else {
+        vs->stats->resumes++;
+    }
+    vs->running = true;
+
+    if (next->irqs_pending) {
+        next->irqs_pending = false;
+        for (irqid_t id = 0; id < MAX_INTERRUPTS; id++) {
+            if (bitmap_get(next->pend_irqs, id)) {
+                bitmap_clear(next->pend_irqs, id);
+                vcpu_inject_hw_irq(next->vcpu, id);
+            }
+        }
+    }
+
+    struct vsched_msg* node = NULL;
+    while ((node = (struct vsched_msg*)list_pop(&next->msgs)) != NULL) {
+        struct cpu_msg msg = node->msg;
+        objpool_free(&vsched_msg_pool, node);
+        cpu_msg_dispatch(&msg);
+    }
+}
+
+/**
+ * Called on every return to a guest. Unless something changed since the last decision, i.e., an
+ * interrupt or message woke a vcpu, the current one blocked or the scheduling timer fired, the
+ * current vcpu just keeps running. If no vcpu is runnable the cpu idles until one is.
+ */
+void vsched_exit(void)
+{
+    struct vsched* vs = vsched_cpu();
+
+    if (!vs->resched) {
+        return;
+    }
+    vs->resched = false;
+
+    uint64_t now = vsched_arch_time();
+    vsched_account(vs, now);
+    vsched_update(vs, now);
+    if (vs->table != NULL) {
+        vsched_table_update(vs, now);
+    }
+
+    struct vsched_vcpu* next = vsched_pick(vs, now);
+    if (next == NULL) {
+        /* The current vcpu's state stays loaded, it is often the next one to run anyway */
+        if (vsched_shared()) {
+            vs->running = false;
+        }
+        vsched_table_account(vs);
+        vsched_timer_program(vs, now);
+        /* Wakes up in cpu_idle_wakeup */
+        cpu_arch_idle();
+    }
+
+    if ((next != vs->current) || !vs->running) {
+        vsched_switch(vs, next, now);
+        vs->quantum_end = now + vsched_us_to_ticks(VSCHED_QUANTUM_US);
+    } else if (now >= vs->quantum_end) {
+        vs->quantum_end = now + vsched_us_to_ticks(VSCHED_QUANTUM_US);
+    }
+    vsched_table_account(vs);
+    vsched_timer_program(vs, now);
+}
+
+/* The current vcpu has nothing to run until it is woken up, e.g., it is powered off */
+void vsched_idle(void)
+{
+    struct vsched* vs = vsched_cpu();
+
+    if (vs->current == NULL) {
+        return;
+    }
+
+    vsched_block(0);
+    vsched_exit();
+    vcpu_run(cpu()->vcpu);
+}
+
+void vsched_idle_wakeup(void)
+{
+    vsched_arch_handle_irqs();
+    vsched_resched();
+    vsched_exit();
+}
+
+void vsched_start(void)
+{
+    struct vsched* vs = vsched_cpu();
+    uint64_t now = vsched_arch_time();
+
+    vsched_table_init(vs, now);
+
+    for (size_t i = 0; i < vs->num; i++) {
+        struct vsched_vcpu* vsv = &vs->vcpus[i];
+        if (vsched_shared() && !vsv->shareable) {
+            ERROR("vm %d can not share cpu %d with other VMs", vsv->vm_id, cpu()->id);
+        }
+        vsv->replenish = now + vsv->period;
+    }
+
+    /* Otherwise, wfi is only trapped if the VM's configuration asks for it */
+    if (vsched_shared()) {
+        vsched_arch_wfi_trap(true);
+    }
+
+    vs->last = now;
+    vs->resched = true;
+    vsched_exit();
+    vcpu_run(cpu()->vcpu);
+}
+
+/**
+ * Time, in timer ticks, the calling vcpu may still run before the schedule preempts it: until the
+ * end of its window on cpus with a cyclic schedule, or its remaining budget otherwise. Fails if
+ * it is not bounded.
+ */
+long vsched_remaining_hypercall(void)
+{
+    struct vsched* vs = vsched_cpu();
+    struct vsched_vcpu* curr = vs->current;
+    uint64_t now = vsched_arch_time();
+
+    if (vs->table != NULL) {
+        return (vs->in_window && (now < vs->boundary)) ? (long)(vs->boundary - now) : 0;
+    }
+
+    if (curr->budget == 0) {
+        return -HC_E_FAILURE;
+    }
+
+    uint64_t elapsed = now - vs->last;
+    return (elapsed < curr->remaining) ? (long)(curr->remaining - elapsed) : 0;
+}
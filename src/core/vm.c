@@ -18,6 +18,8 @@ static void vm_master_init(struct vm* vm, const struct vm_config* config, vmid_t
 
     cpu_sync_init(&vm->sync, vm->cpu_num);
 
+    vm->reclr.lock = SPINLOCK_INITVAL;
+
     vm_mem_prot_init(vm, config);
 }
 
@@ -47,6 +49,7 @@ void vm_vcpu_init(struct vm* vm, const struct vm_config* config)
     vcpu->id = vcpu_id;
     vcpu->phys_id = cpu()->id;
     vcpu->vm = vm;
+    vcpu->emul_mem_last = NULL;
     cpu()->vcpu = vcpu;
 
     vcpu_arch_init(vcpu, vm);
@@ -73,6 +76,174 @@ void vm_map_mem_region(struct vm* vm, struct vm_mem_region* reg)
     }
 }
 
+static void vm_map_img_lazy_reclr(struct vm* vm, const struct vm_config* config,
+    struct ppages* pa_img, size_t n_img)
+{
+    vaddr_t img_base = config->image.base_addr;
+    size_t bitmap_size = BITMAP_SIZE(n_img) * sizeof(bitmap_granule_t);
+
+    vm->lazy_img.pending = mem_alloc_page(NUM_PAGES(bitmap_size), SEC_HYP_VM, false);
+    if (vm->lazy_img.pending == NULL) {
+        ERROR("failed to allocate vm image pending pages bitmap");
+    }
+    memset((void*)vm->lazy_img.pending, 0, bitmap_size);
+
+    vm->lazy_img.base = img_base;
+    vm->lazy_img.load_addr = pa_img->base;
+    vm->lazy_img.num_pages = n_img;
+    vm->lazy_img.pending_num =
+        mem_map_reclr_lazy(&vm->as, img_base, pa_img, n_img, PTE_VM_FLAGS, vm->lazy_img.pending);
+}
+
+/**
+ * Recolor the lazily mapped image page containing addr, if any. Returns true if addr falls in the
+ * lazily recolored image, in which case the faulting access must simply be retried.
+ */
+static bool vm_img_lazy_reclr(struct vm* vm, vaddr_t addr)
+{
+    if ((vm->lazy_img.pending == NULL) ||
+        !in_range(addr, vm->lazy_img.base, vm->lazy_img.num_pages * PAGE_SIZE)) {
+        return false;
+    }
+
+    size_t index = (addr - vm->lazy_img.base) / PAGE_SIZE;
+
+    spin_lock(&vm->reclr.lock);
+    /**
+     * If the page is no longer pending, another vcpu recolored it while we were waiting for the
+     * lock.
+     */
+    if (bitmap_get(vm->lazy_img.pending, index)) {
+        vaddr_t va = vm->lazy_img.base + (index * PAGE_SIZE);
+        paddr_t pa = vm->lazy_img.load_addr + (index * PAGE_SIZE);
+        if (!mem_reclr_page(&vm->as, va, pa, PTE_VM_FLAGS)) {
+            ERROR("failed to recolor vm image page at 0x%lx", va);
+        }
+        bitmap_clear(vm->lazy_img.pending, index);
+        vm->lazy_img.pending_num--;
+    }
+    spin_unlock(&vm->reclr.lock);
+
+    return true;
+}
+
+/**
+ * Returns the vm's configured memory region containing addr, or NULL if there is none. Shared
+ * memory and devices are not among these regions.
+ */
+struct vm_mem_region* vm_find_mem_region(struct vm* vm, vaddr_t addr)
+{
+    for (size_t i = 0; i < vm->config->platform.region_num; i++) {
+        struct vm_mem_region* reg = &vm->config->platform.regions[i];
+        if (in_range(addr, reg->base, reg->size)) {
+            return reg;
+        }
+    }
+
+    return NULL;
+}
+
+/**
+ * Handle a translation fault on addr caused by the hypervisor itself having left the page
+ * unmapped. Returns true if it was the case, and the faulting access must simply be retried.
+ */
+bool vm_mem_fault_recover(struct vm* vm, vaddr_t addr)
+{
+    if (vm_img_lazy_reclr(vm, addr)) {
+        return true;
+    }
+
+    /**
+     * A page of a hypervisor allocated region might be unmapped while vm_set_colors moves it. If
+     * so, it is mapped again by the time we get the lock.
+     */
+    struct vm_mem_region* reg = vm_find_mem_region(vm, addr);
+    if ((reg == NULL) || reg->place_phys) {
+        return false;
+    }
+
+    spin_lock(&vm->reclr.lock);
+    bool mapped = mem_is_mapped(&vm->as, addr);
+    spin_unlock(&vm->reclr.lock);
+
+    return mapped;
+}
+
+/**
+ * Change the colors of the vm at runtime. Pages of the memory regions allocated by the hypervisor
+ * which are not in the new colors are then moved by vm_set_colors_step, a few at a time, to pages
+ * that are, while the vm keeps running. Regions placed at a fixed physical address, shared memory
+ * and devices are left as is. Returns false if colors is empty or a change for this vm is already
+ * in progress.
+ */
+bool vm_set_colors(struct vm* vm, colormap_t colors)
+{
+    bool ret = true;
+
+    colors = clrs_llc(colors) | BANK_COLORS(clrs_banks(colors));
+    if (colors == 0) {
+        return false;
+    }
+
+    spin_lock(&vm->reclr.lock);
+    if (vm->reclr.busy) {
+        ret = false;
+    } else {
+        vm->reclr.busy = true;
+        vm->reclr.region = 0;
+        vm->reclr.page = 0;
+        vm->as.colors = colors;
+    }
+    spin_unlock(&vm->reclr.lock);
+
+    return ret;
+}
+
+/**
+ * Moves up to num_pages pages of the change started by vm_set_colors. The lock is only held while
+ * moving each page, so that the vm's vcpus faulting on it do not wait for the whole regions to be
+ * moved. Returns VM_RECLR_PENDING until all the pages are in the new colors.
+ */
+enum vm_reclr_state vm_set_colors_step(struct vm* vm, size_t num_pages)
+{
+    enum vm_reclr_state state = VM_RECLR_PENDING;
+    size_t moved = 0;
+
+    while ((state == VM_RECLR_PENDING) && (moved < num_pages)) {
+        if (vm->reclr.region >= vm->config->platform.region_num) {
+            state = VM_RECLR_DONE;
+            break;
+        }
+
+        struct vm_mem_region* reg = &vm->config->platform.regions[vm->reclr.region];
+        if (reg->place_phys || (vm->reclr.page >= NUM_PAGES(reg->size))) {
+            vm->reclr.region++;
+            vm->reclr.page = 0;
+            continue;
+        }
+
+        spin_lock(&vm->reclr.lock);
+        bool ok = mem_reclr_mapped_page(&vm->as, reg->base + (vm->reclr.page * PAGE_SIZE),
+            PTE_VM_FLAGS);
+        spin_unlock(&vm->reclr.lock);
+
+        if (!ok) {
+            WARNING("failed to move vm %d pages to its new colors", vm->id);
+            state = VM_RECLR_FAILED;
+        }
+        vm->reclr.page++;
+        moved++;
+    }
+
+    if (state != VM_RECLR_PENDING) {
+        spin_lock(&vm->reclr.lock);
+        vm->reclr.busy = false;
+        spin_unlock(&vm->reclr.lock);
+    }
+
+    return state;
+}
+
 static void vm_map_img_rgn_inplace(struct vm* vm, const struct vm_config* config,
     struct vm_mem_region* reg)
 {
@@ -93,6 +264,9 @@ static void vm_map_img_rgn_inplace(struct vm* vm, const struct vm_config* config
         /* map img in place */
         mem_alloc_map(&vm->as, SEC_VM_ANY, &pa_img, img_base, n_img, PTE_VM_FLAGS);
         /* we are mapping in place, config is already reserved */
+    } else if (config->image.lazy_reclr) {
+        /* recolour img pages on first access */
+        vm_map_img_lazy_reclr(vm, config, &pa_img, n_img);
     } else {
         /* recolour img */
         mem_map_reclr(&vm->as, img_base, &pa_img, n_img, PTE_VM_FLAGS);
@@ -229,6 +403,48 @@ static struct vm* vm_allocation_init(struct vm_allocation* vm_alloc)
     return vm;
 }
 
+/**
+ * Emulated regions are only registered while the vm is initialized. Once they all are, they are
+ * sorted by base address into an array so that the handler of a trapped access is binary searched
+ * instead of walking the whole list on every trap.
+ */
+static void vm_emul_index_init(struct vm* vm)
+{
+    size_t num = 0;
+    list_foreach (vm->emul_mem_list, struct emul_mem, emu) {
+        num++;
+    }
+
+    if (num == 0) {
+        return;
+    }
+
+    struct emul_mem** regions = mem_alloc_page(NUM_PAGES(num * sizeof(*regions)), SEC_HYP_VM, false);
+    if (regions == NULL) {
+        ERROR("failed to allocate vm emulated regions index");
+    }
+
+    size_t n = 0;
+    list_foreach (vm->emul_mem_list, struct emul_mem, emu) {
+        size_t i = n++;
+        while (i > 0 && regions[i - 1]->va_base > emu->va_base) {
+            regions[i] = regions[i - 1];
+            i--;
+        }
+        regions[i] = emu;
+    }
+
+    for (size_t i = 1; i < num; i++) {
+        if (regions[i]->va_base - regions[i - 1]->va_base < regions[i - 1]->size) {
+            ERROR("vm emulated regions at 0x%lx and 0x%lx overlap", regions[i - 1]->va_base,
+                regions[i]->va_base);
+        }
+    }
+
+    vm->emul_mem_index.num = num;
+    vm->emul_mem_index.regions = regions;
+}
+
 struct vm* vm_init(struct vm_allocation* vm_alloc, const struct vm_config* config, bool master,
     vmid_t vm_id)
 {
@@ -268,6 +484,7 @@ struct vm* vm_init(struct vm_allocation* vm_alloc, const struct vm_config* confi
         vm_init_mem_regions(vm, config);
         vm_init_dev(vm, config);
         vm_init_ipc(vm, config);
+        vm_emul_index_init(vm);
     }
 
     cpu_sync_and_clear_msgs(&vm->sync);
@@ -277,6 +494,10 @@ struct vm* vm_init(struct vm_allocation* vm_alloc, const struct vm_config* confi
 
 void vm_emul_add_mem(struct vm* vm, struct emul_mem* emu)
 {
+    if (vm->emul_mem_index.regions != NULL) {
+        ERROR("emulated memory region added after vm initialization");
+    }
+
     list_push(&vm->emul_mem_list, &emu->node);
 }
 
@@ -285,17 +506,49 @@ void vm_emul_add_reg(struct vm* vm, struct emul_reg* emu)
     list_push(&vm->emul_reg_list, &emu->node);
 }
 
+static inline bool vm_emul_mem_contains(struct emul_mem* emu, vaddr_t addr)
+{
+    return (addr >= emu->va_base) && ((addr - emu->va_base) < emu->size);
+}
+
 emul_handler_t vm_emul_get_mem(struct vm* vm, vaddr_t addr)
 {
-    emul_handler_t handler = NULL;
-    list_foreach (vm->emul_mem_list, struct emul_mem, emu) {
-        if (addr >= emu->va_base && (addr < (emu->va_base + emu->size))) {
-            handler = emu->handler;
-            break;
+    struct vcpu* vcpu = cpu()->vcpu;
+    struct emul_mem* emu = NULL;
+
+    /**
+     * A vcpu usually keeps trapping on the same device (e.g. its interrupt controller), so the
+     * last region it hit is checked before searching the index.
+     */
+    if (vcpu != NULL && vcpu->vm == vm && vcpu->emul_mem_last != NULL &&
+        vm_emul_mem_contains(vcpu->emul_mem_last, addr)) {
+        return vcpu->emul_mem_last->handler;
+    }
+
+    size_t low = 0;
+    size_t high = vm->emul_mem_index.num;
+    while (low < high) {
+        size_t mid = low + ((high - low) / 2);
+        if (addr < vm->emul_mem_index.regions[mid]->va_base) {
+            high = mid;
+        } else {
+            low = mid + 1;
         }
     }
 
-    return handler;
+    if (low > 0 && vm_emul_mem_contains(vm->emul_mem_index.regions[low - 1], addr)) {
+        emu = vm->emul_mem_index.regions[low - 1];
+    }
+
+    if (emu == NULL) {
+        return NULL;
+    }
+
+    if (vcpu != NULL && vcpu->vm == vm) {
+        vcpu->emul_mem_last = emu;
+    }
+
+    return emu->handler;
 }
 
 emul_handler_t vm_emul_get_reg(struct vm* vm, vaddr_t addr)
@@ -11,6 +11,8 @@
 #include <fences.h>
 #include <string.h>
 #include <ipc.h>
+#include <hypercall.h>
+#include <vsched.h>
 
 static struct vm_assignment {
     spinlock_t lock;
@@ -20,8 +22,42 @@ static struct vm_assignment {
     struct vm_allocation vm_alloc;
     struct vm_install_info vm_install_info;
     volatile bool install_info_ready;
+    /* Last colors requested by the color manager, and the state of their change */
+    colormap_t colors;
+    volatile enum vm_reclr_state colors_state;
 } vm_assign[CONFIG_VM_NUM];
 
+extern volatile const size_t VMM_CPUMSG_ID;
+
+/* Assign a vcpu of the first VM that still has vcpus to assign, regardless of affinity. */
+static bool vmm_assign_vcpu_any(bool* master, vmid_t* vm_id)
+{
+    bool assigned = false;
+    *master = false;
+    for (size_t i = 0; i < config.vmlist_size && !assigned; i++) {
+        spin_lock(&vm_assign[i].lock);
+        if (vm_assign[i].ncpus < config.vmlist[i].platform.cpu_num) {
+            if (!vm_assign[i].master) {
+                vm_assign[i].master = true;
+                vm_assign[i].ncpus++;
+                *master = true;
+                assigned = true;
+                vm_assign[i].cpus |= (1UL << cpu()->id);
+                *vm_id = i;
+            } else {
+                assigned = true;
+                vm_assign[i].ncpus++;
+                vm_assign[i].cpus |= (1UL << cpu()->id);
+                *vm_id = i;
+            }
+        }
+        spin_unlock(&vm_assign[i].lock);
+    }
+
+    return assigned;
+}
+
+#ifndef VCPU_SCHED
 static bool vmm_assign_vcpu(bool* master, vmid_t* vm_id)
 {
     bool assigned = false;
@@ -51,29 +87,46 @@ static bool vmm_assign_vcpu(bool* master, vmid_t* vm_id)
 
     /* Assign remaining cpus not assigned by affinity. */
     if (assigned == false) {
-        for (size_t i = 0; i < config.vmlist_size && !assigned; i++) {
+        assigned = vmm_assign_vcpu_any(master, vm_id);
+    }
+
+    return assigned;
+}
+#else
+/**
+ * With vcpu multiplexing, a cpu takes a vcpu of every VM it has affinity to that still has vcpus
+ * to assign, instead of only the first. The ids are returned in ascending order, in which all cpus
+ * initialize their VMs so that the VMs' barriers do not deadlock. Cpus left without any take a
+ * vcpu of the first VM still missing some, as without multiplexing.
+ */
+static size_t vmm_assign_vcpus(bool* master, vmid_t* vm_ids)
+{
+    size_t num = 0;
+
+    for (size_t i = 0; i < config.vmlist_size; i++) {
+        if (config.vmlist[i].cpu_affinity & (1UL << cpu()->id)) {
             spin_lock(&vm_assign[i].lock);
             if (vm_assign[i].ncpus < config.vmlist[i].platform.cpu_num) {
-                if (!vm_assign[i].master) {
-                    vm_assign[i].master = true;
-                    vm_assign[i].ncpus++;
-                    *master = true;
-                    assigned = true;
-                    vm_assign[i].cpus |= (1UL << cpu()->id);
-                    *vm_id = i;
-                } else {
-                    assigned = true;
-                    vm_assign[i].ncpus++;
-                    vm_assign[i].cpus |= (1UL << cpu()->id);
-                    *vm_id = i;
-                }
+                master[num] = !vm_assign[i].master;
+                vm_assign[i].master = true;
+                vm_assign[i].ncpus++;
+                vm_assign[i].cpus |= (1UL << cpu()->id);
+                vm_ids[num++] = i;
             }
             spin_unlock(&vm_assign[i].lock);
         }
     }
 
-    return assigned;
+    cpu_sync_barrier(&cpu_glb_sync);
+
+    /* Assign remaining cpus not assigned by affinity. */
+    if ((num == 0) && vmm_assign_vcpu_any(&master[num], &vm_ids[num])) {
+        num++;
+    }
+
+    return num;
 }
+#endif
 
 static bool vmm_alloc_vm(struct vm_allocation* vm_alloc, struct vm_config* config)
 {
@@ -123,14 +176,138 @@ static struct vm_allocation* vmm_alloc_install_vm(vmid_t vm_id, bool master)
     return vm_alloc;
 }
 
+/* Pages moved to their new colors by each message, so the target cpu is never held for long */
+#define VMM_RECLR_STEP_PAGES (64)
+
+enum { VMM_SET_COLORS, VMM_SET_COLORS_STEP };
+
+/**
+ * The target vm's struct vm lives in its own SEC_HYP_VM section, which is only mapped on the cpus
+ * running it. The recolor is therefore always carried out by one of the target's cpus, which
+ * moves a bounded number of pages per message and sends itself another one until it is done.
+ */
+static void vmm_set_colors_handler(uint32_t event, uint64_t data)
+{
+    vmid_t vm_id = (vmid_t)data;
+    struct cpu_msg msg = { (uint32_t)VMM_CPUMSG_ID, event, data };
+    if (vsched_msg_defer(vm_id, &msg)) {
+        return;
+    }
+
+    struct vm* vm = cpu()->vcpu->vm;
+    enum vm_reclr_state state = VM_RECLR_FAILED;
+    if (vm->id == vm_id) {
+        switch (event) {
+            case VMM_SET_COLORS:
+                if (vm_set_colors(vm, vm_assign[vm_id].colors)) {
+                    state = VM_RECLR_PENDING;
+                }
+                break;
+            case VMM_SET_COLORS_STEP:
+                state = vm_set_colors_step(vm, VMM_RECLR_STEP_PAGES);
+                break;
+        }
+    }
+
+    if (state == VM_RECLR_PENDING) {
+        msg.event = VMM_SET_COLORS_STEP;
+        cpu_send_msg(cpu()->id, &msg);
+    } else {
+        vm_assign[vm_id].colors_state = state;
+    }
+}
+CPU_MSG_HANDLER(vmm_set_colors_handler, VMM_CPUMSG_ID);
+
+static bool vmm_colors_valid(colormap_t colors)
+{
+    colormap_t llc = colors & BIT_MASK(0, COLORMAP_BANK_OFF);
+    return (colors != 0) && ((llc & ~BIT_MASK(0, COLOR_NUM)) == 0);
+}
+
+/**
+ * Starts changing the colors of a vm. The change completes asynchronously, its outcome is read
+ * with vmm_colors_state_hypercall. Fails if a change of the vm's colors is still in progress.
+ */
+long int vmm_set_colors_hypercall(unsigned long vm_id, unsigned long colors)
+{
+    if (!cpu()->vcpu->vm->config->color_manager) {
+        return -HC_E_FAILURE;
+    }
+
+    /* A vm with no cpus assigned is never allocated */
+    if ((vm_id >= config.vmlist_size) || !vm_assign[vm_id].install_info_ready ||
+        !vmm_colors_valid((colormap_t)colors)) {
+        return -HC_E_INVAL_ARGS;
+    }
+
+    cpuid_t target = INVALID_CPUID;
+    for (cpuid_t i = 0; i < PLAT_CPU_NUM && target == INVALID_CPUID; i++) {
+        if (vm_assign[vm_id].cpus & (1UL << i)) {
+            target = i;
+        }
+    }
+    if (target == INVALID_CPUID) {
+        return -HC_E_INVAL_ARGS;
+    }
+
+    long int ret = HC_E_SUCCESS;
+    spin_lock(&vm_assign[vm_id].lock);
+    if (vm_assign[vm_id].colors_state == VM_RECLR_PENDING) {
+        ret = -HC_E_FAILURE;
+    } else {
+        vm_assign[vm_id].colors = (colormap_t)colors;
+        vm_assign[vm_id].colors_state = VM_RECLR_PENDING;
+    }
+    spin_unlock(&vm_assign[vm_id].lock);
+
+    if (ret == HC_E_SUCCESS) {
+        struct cpu_msg msg = { (uint32_t)VMM_CPUMSG_ID, VMM_SET_COLORS, (uint64_t)vm_id };
+        cpu_send_msg(target, &msg);
+    }
+
+    return ret;
+}
+
+/* Returns the state of the last change of a vm's colors, one of enum vm_reclr_state. */
+long int vmm_colors_state_hypercall(unsigned long vm_id)
+{
+    if (!cpu()->vcpu->vm->config->color_manager) {
+        return -HC_E_FAILURE;
+    }
+
+    if ((vm_id >= config.vmlist_size) || !vm_assign[vm_id].install_info_ready) {
+        return -HC_E_INVAL_ARGS;
+    }
+
+    return (long int)vm_assign[vm_id].colors_state;
+}
+
 void vmm_init()
 {
     vmm_arch_init();
     vmm_io_init();
     ipc_init();
 
+#ifdef VCPU_SCHED
+    vsched_init();
+#endif
+
     cpu_sync_barrier(&cpu_glb_sync);
 
+#ifdef VCPU_SCHED
+    bool masters[CONFIG_VM_NUM];
+    vmid_t vm_ids[CONFIG_VM_NUM];
+    size_t vm_num = vmm_assign_vcpus(masters, vm_ids);
+    for (size_t i = 0; i < vm_num; i++) {
+        vsched_vm_enter(vm_ids[i]);
+        struct vm_allocation* vm_alloc = vmm_alloc_install_vm(vm_ids[i], masters[i]);
+        struct vm* vm = vm_init(vm_alloc, &config.vmlist[vm_ids[i]], masters[i], vm_ids[i]);
+        cpu_sync_barrier(&vm->sync);
+        struct vm_install_info install_info = vmm_get_vm_install_info(vm_alloc);
+        vsched_vcpu_add(&install_info);
+    }
+    vsched_start();
+#else
     bool master = false;
     vmid_t vm_id = -1;
     if (vmm_assign_vcpu(&master, &vm_id)) {
@@ -142,4 +319,5 @@ void vmm_init()
     } else {
         cpu_idle();
     }
+#endif
 }
@@ -13,8 +13,14 @@ ssize_t bitmap_find_nth(bitmap_t* map, size_t size, size_t nth, size_t start, bo
 
     size_t count = 0;
     unsigned bit = set ? 1 : 0;
+    bitmap_granule_t skip = set ? 0 : ~((bitmap_granule_t)0);
 
     for (ssize_t i = start; i < size; i++) {
+        /* Granules holding none of the searched bits are skipped whole */
+        if (((i % BITMAP_GRANULE_LEN) == 0) && (map[i / BITMAP_GRANULE_LEN] == skip)) {
+            i += BITMAP_GRANULE_LEN - 1;
+            continue;
+        }
         if (bitmap_get(map, i) == bit) {
             if (++count == nth) {
                 return i;
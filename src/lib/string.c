@@ -5,7 +5,11 @@
 
 #include <string.h>
 
-void* memcpy(void* dst, const void* src, size_t count)
+/**
+ * memcpy and memset are weak so that architectures may provide optimized versions.
+ */
+
+__attribute__((weak)) void* memcpy(void* dst, const void* src, size_t count)
 {
     size_t i;
     uint8_t* dst_tmp = dst;
@@ -36,10 +40,24 @@ void* memcpy(void* dst, const void* src, size_t count)
     return dst;
 }
 
-void* memset(void* dest, int c, size_t count)
+__attribute__((weak)) void* memset(void* dest, int c, size_t count)
 {
     uint8_t* d;
     d = (uint8_t*)dest;
+    static const size_t WORD_SIZE = sizeof(unsigned long);
+    unsigned long pattern = (uint8_t)c * (~0UL / 0xff);
+
+    while (((uintptr_t)d & (WORD_SIZE - 1)) && count > 0) {
+        *d = c;
+        d++;
+        count--;
+    }
+
+    while (count >= WORD_SIZE) {
+        *(unsigned long*)d = pattern;
+        d += WORD_SIZE;
+        count -= WORD_SIZE;
+    }
 
     while (count--) {
         *d = c;
@@ -16,3 +16,10 @@ platform-cppflags =
 platform-cflags = -mtune=$(CPU)
 platform-asflags =
 platform-ldflags =
+
+# Describe the SMMUv3 QEMU adds with -machine virt,iommu=smmuv3. QEMU's SMMUv3 only implements
+# stage 1 by default, and the driver needs stage 2, so also pass -global arm-smmuv3.stage=2.
+ifeq ($(QEMU_SMMUV3),y)
+SMMU_VERSION:=SMMUV3
+platform-cppflags+=-DQEMU_SMMUV3
+endif
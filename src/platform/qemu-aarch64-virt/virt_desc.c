@@ -29,6 +29,13 @@ struct platform platform = {
             .gicr_addr = 0x080A0000,
             .maintenance_id = 25,
         },
+
+#ifdef QEMU_SMMUV3
+        .smmu = {
+            .base = 0x09050000,
+            .interrupt_id = 106,
+        },
+#endif
     },
 
 };
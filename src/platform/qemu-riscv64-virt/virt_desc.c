@@ -23,6 +23,11 @@ struct platform platform = {
         .irqc.plic.base = 0xc000000,
 #elif (IRQC == APLIC)
         .irqc.aia.aplic.base = 0xd000000,
+#elif (IRQC == AIA)
+        /* qemu with aia=aplic-imsic,aia-guests=1 */
+        .irqc.aia.aplic.base = 0xd000000,
+        .irqc.aia.imsic.base = 0x28000000,
+        .irqc.aia.imsic.guest_index_bits = 1,
 #else
 #error "unknown IRQC type " IRQC
 #endif